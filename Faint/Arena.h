@@ -0,0 +1,112 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Блочный распределитель памяти сцены.
+// Память берётся у системы блоками и раздаётся подряд; выделенное никогда
+// не перемещается и не освобождается по отдельности — только всё сразу
+// (Reset). Блоки растут вдвое от kArenaFirstBlock до kArenaBlock, так что
+// маленькие сцены (срезы для тайлов) не платят за мегабайт. Запрос больше
+// kArenaBlock получает собственный блок.
+// Годится для тривиально копируемых данных (точки штрихов). Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+const size_t kArenaFirstBlock = (size_t)16 << 10;
+const size_t kArenaBlock = (size_t)1 << 20;
+
+class Arena {
+public:
+    Arena() {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    // Перенос забирает блоки целиком, выделенное остаётся на месте
+    Arena(Arena&& o) { *this = std::move(o); }
+    Arena& operator=(Arena&& o) {
+        if (this != &o) {
+            blocks = std::move(o.blocks);
+            nextSize = o.nextSize;
+            cur = o.cur;
+            end = o.end;
+            used = o.used;
+            o.blocks.clear();
+            o.nextSize = kArenaFirstBlock;
+            o.cur = o.end = nullptr;
+            o.used = 0;
+        }
+        return *this;
+    }
+
+    void* Allocate(size_t bytes, size_t align) {
+        char* p = Align(cur, align);
+        if (cur == nullptr || p + bytes > end) {
+            size_t need = bytes + align;
+            if (need > kArenaBlock) {
+                // Крупный запрос — отдельный блок, текущий продолжает заполняться
+                blocks.push_back(Block(need));
+                used += bytes;
+                return Align(blocks.back().data.get(), align);
+            }
+            NextBlock((std::max)(nextSize, need));
+            p = Align(cur, align);
+        }
+        cur = p + bytes;
+        used += bytes;
+        return p;
+    }
+
+    template <class T>
+    T* Allocate(size_t n) { return static_cast<T*>(Allocate(n * sizeof(T), alignof(T))); }
+
+    // Освобождает всё разом; самый крупный обычный блок остаётся для повторного
+    // заполнения, чтобы очистка и новый рисунок не гоняли память через систему
+    void Reset() {
+        Block keep(nullptr, 0);
+        for (auto& b : blocks)
+            if (b.size <= kArenaBlock && b.size > keep.size) keep = std::move(b);
+        blocks.clear();
+        cur = end = nullptr;
+        used = 0;
+        if (keep.size) {
+            blocks.push_back(std::move(keep));
+            cur = blocks.back().data.get();
+            end = cur + blocks.back().size;
+        }
+    }
+
+    size_t BytesUsed() const { return used; }
+    size_t BytesReserved() const {
+        size_t s = 0;
+        for (auto& b : blocks) s += b.size;
+        return s;
+    }
+    size_t Blocks() const { return blocks.size(); }
+
+private:
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+        explicit Block(size_t n) : data(new char[n]), size(n) {}
+        Block(char* d, size_t n) : data(d), size(n) {}
+    };
+
+    std::vector<Block> blocks;
+    size_t nextSize = kArenaFirstBlock;
+    char* cur = nullptr;
+    char* end = nullptr;
+    size_t used = 0;
+
+    void NextBlock(size_t size) {
+        blocks.push_back(Block(size));
+        cur = blocks.back().data.get();
+        end = cur + size;
+        nextSize = (std::min)(nextSize * 2, kArenaBlock);
+    }
+    static char* Align(char* p, size_t align) {
+        return (char*)(((uintptr_t)p + (align - 1)) & ~(uintptr_t)(align - 1));
+    }
+};
@@ -0,0 +1,517 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Собственный формат рисунка (*.faint).
+// Файл — заголовок и блоки (тег, версия блока, длина), каждый с начала,
+// кратного 8 байтам; неизвестные блоки при чтении пропускаются. Числа —
+// little-endian, записи блоков — массивы структур фиксированной раскладки:
+//   VIEW  масштаб и сдвиг вида
+//   ORDR  порядок отрисовки: тип и номер в таблице своего типа
+//   BNDS  габариты фигур — индекс строится без чтения точек
+//   STRK  штрихи: первая точка и число точек в PNTS, цвет, толщина
+//   PNTS  точки всех штрихов подряд
+//   LINE  отрезки
+//   BOXS  прямоугольник, эллипс, треугольник, звезда, картинка
+//   FUNC  графики: диапазон, начало координат, флаги, текст выражения
+//   IMGS  картинки: путь (UTF-8) и содержимое файла, если оно было доступно
+// При чтении файл отображается в память (MappedFile), точки штрихов не
+// копируются: SceneStore указывает прямо в отображение, и страницы
+// читаются с диска, только когда штрих рисуется. Стёртые фигуры не
+// сохраняются, id в файле идут подряд (кроме снимков журнала: там стёртые
+// остаются в ORDR пустыми местами, чтобы id совпадали с живой сценой).
+// -------------------------------------------------------------------------
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "SceneStore.h"
+
+#ifdef _WIN32
+typedef wchar_t PathChar;
+#else
+typedef char PathChar;
+#endif
+
+namespace faintdoc {
+
+const char kMagic[8] = { 'F', 'A', 'I', 'N', 'T', 'D', 'O', 'C' };
+const uint32_t kVersion = 1;
+
+inline uint32_t Tag(const char (&s)[5]) {
+    return (uint32_t)(uint8_t)s[0] | (uint32_t)(uint8_t)s[1] << 8 | (uint32_t)(uint8_t)s[2] << 16 | (uint32_t)(uint8_t)s[3] << 24;
+}
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t chunks;
+};
+struct ChunkHeader {
+    uint32_t tag;
+    uint32_t version;
+    uint64_t size;   // байт полезной нагрузки без выравнивания
+};
+struct ViewRecord { float zoom, offsetX, offsetY, reserved; };
+struct OrderRecord { uint8_t kind, reserved[3]; uint32_t slot; };
+struct StrokeRecord { uint64_t first; uint32_t count, color; float width; uint32_t reserved; };
+struct LineRecord { float x0, y0, x1, y1, width; uint32_t color; };
+struct BoxRecord { uint32_t kind; float x, y, w, h, width; uint32_t color, image; };
+struct FunctionRecord { double start, end; float originX, originY, width; uint32_t color, flags, exprBytes; };
+struct ImageRecord { uint32_t pathBytes, reserved; uint64_t dataBytes; };
+
+static_assert(sizeof(FileHeader) == 16 && sizeof(ChunkHeader) == 16, "заголовки");
+static_assert(sizeof(OrderRecord) == 8 && sizeof(StrokeRecord) == 24 && sizeof(LineRecord) == 24 &&
+    sizeof(BoxRecord) == 32 && sizeof(FunctionRecord) == 40 && sizeof(ImageRecord) == 16, "записи блоков");
+
+const uint32_t kFuncAxes = 1, kFuncClip = 2;
+const uint32_t kNoImage = UINT32_MAX;
+
+inline uint64_t Pad8(uint64_t n) { return (n + 7) & ~(uint64_t)7; }
+
+} // namespace faintdoc
+
+struct DocumentView {
+    float zoom = 1, offsetX = 0, offsetY = 0;
+};
+
+// Картинка документа. При записи data — содержимое файла картинки (или
+// nullptr, тогда сохраняется только путь), при чтении — место в отображении.
+struct DocumentImage {
+    std::string path; // UTF-8
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+// Файл, отображённый в память только для чтения
+class MappedFile {
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { Close(); }
+
+    bool Open(const PathChar* path) {
+        Close();
+#ifdef _WIN32
+        // FILE_SHARE_DELETE — чтобы поверх открытого документа можно было сохранить новый
+        HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER len;
+        if (GetFileSizeEx(file, &len) && len.QuadPart > 0) {
+            HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (mapping) {
+                view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                CloseHandle(mapping);
+                if (view) size = (size_t)len.QuadPart;
+            }
+        }
+        CloseHandle(file);
+#else
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                view = p;
+                size = (size_t)st.st_size;
+            }
+        }
+        close(fd);
+#endif
+        return view != nullptr;
+    }
+
+    void Close() {
+        if (!view) return;
+#ifdef _WIN32
+        UnmapViewOfFile(view);
+#else
+        munmap(view, size);
+#endif
+        view = nullptr;
+        size = 0;
+    }
+
+    const uint8_t* Data() const { return static_cast<const uint8_t*>(view); }
+    size_t Size() const { return size; }
+
+private:
+    void* view = nullptr;
+    size_t size = 0;
+};
+
+inline FILE* OpenForWrite(const PathChar* path) {
+#ifdef _WIN32
+    return _wfopen(path, L"wb");
+#else
+    return fopen(path, "wb");
+#endif
+}
+
+// Пишет сцену целиком. image(id) даёт DocumentImage для id картинки сцены.
+// keepErased — стёртые фигуры остаются пустыми местами и id не сдвигаются.
+// false — ошибка записи (error — описание).
+template <class ImageSource>
+bool SaveDocument(const PathChar* path, const SceneStore& scene, const DocumentView& view,
+    const ImageSource& image, std::string& error, bool keepErased = false) {
+    using namespace faintdoc;
+
+    // Фигуры получают номера подряд, каждая — номер в таблице своего типа
+    std::vector<OrderRecord> order;
+    std::vector<BoundsF> bounds;
+    std::vector<StrokeRecord> strokes;
+    std::vector<LineRecord> lines;
+    std::vector<BoxRecord> boxes;
+    std::vector<const FunctionPlot*> functions;
+    std::vector<DocumentImage> images;
+    std::unordered_map<uint32_t, uint32_t> imageIndex; // id в сцене -> номер в IMGS
+    uint64_t points = 0;
+
+    for (uint32_t id = 0; id < (uint32_t)scene.Size(); id++) {
+        const SceneStore::Ref& r = scene.order[id];
+        size_t i = r.slot;
+        uint32_t slot;
+        switch (r.kind) {
+        case ShapeKind::Erased:
+            if (!keepErased) continue;
+            slot = 0;
+            break;
+        case ShapeKind::Pen: {
+            const StrokeArray& a = scene.strokes;
+            slot = (uint32_t)strokes.size();
+            strokes.push_back(StrokeRecord{ points, a.count[i], a.color[i], a.stroke[i], 0 });
+            points += a.count[i];
+            break;
+        }
+        case ShapeKind::Line: {
+            const LineArray& a = scene.lines;
+            slot = (uint32_t)lines.size();
+            lines.push_back(LineRecord{ a.x0[i], a.y0[i], a.x1[i], a.y1[i], a.stroke[i], a.color[i] });
+            break;
+        }
+        case ShapeKind::Function:
+            slot = (uint32_t)functions.size();
+            functions.push_back(scene.functions[i].get());
+            break;
+        default: {
+            const BoxArray& a = scene.Boxes(r.kind);
+            uint32_t img = kNoImage;
+            if (r.kind == ShapeKind::Image) {
+                uint32_t sceneImage = scene.imageIds[i];
+                auto it = imageIndex.find(sceneImage);
+                if (it == imageIndex.end()) {
+                    it = imageIndex.emplace(sceneImage, (uint32_t)images.size()).first;
+                    images.push_back(image(sceneImage));
+                }
+                img = it->second;
+            }
+            slot = (uint32_t)boxes.size();
+            boxes.push_back(BoxRecord{ (uint32_t)r.kind, a.x[i], a.y[i], a.w[i], a.h[i], a.stroke[i], a.color[i], img });
+            break;
+        }
+        }
+        order.push_back(OrderRecord{ (uint8_t)r.kind, { 0, 0, 0 }, slot });
+        bounds.push_back(scene.Bounds(id));
+    }
+
+    uint64_t funcBytes = 8, imageBytes = 8;
+    for (auto* f : functions) funcBytes += sizeof(FunctionRecord) + Pad8(f->expression.size());
+    for (auto& im : images) imageBytes += sizeof(ImageRecord) + Pad8(im.path.size()) + Pad8(im.size);
+
+    FILE* out = OpenForWrite(path);
+    if (!out) {
+        error = "не удалось создать файл";
+        return false;
+    }
+    bool ok = true;
+    auto put = [&](const void* p, size_t n) {
+        if (ok && n && fwrite(p, 1, n, out) != n) ok = false;
+    };
+    auto pad = [&](uint64_t n) {
+        static const char zeros[8] = { 0 };
+        put(zeros, (size_t)(Pad8(n) - n));
+    };
+    auto chunk = [&](const char (&tag)[5], uint64_t size) {
+        ChunkHeader h{ Tag(tag), 1, size };
+        put(&h, sizeof(h));
+    };
+    // Таблица фиксированных записей: число записей, затем записи
+    auto table = [&](const char (&tag)[5], const void* data, uint64_t count, size_t recordSize) {
+        chunk(tag, 8 + count * recordSize);
+        put(&count, 8);
+        put(data, (size_t)(count * recordSize));
+        pad(count * recordSize);
+    };
+
+    FileHeader fh;
+    memcpy(fh.magic, kMagic, 8);
+    fh.version = kVersion;
+    fh.chunks = 9;
+    put(&fh, sizeof(fh));
+
+    ViewRecord vr{ view.zoom, view.offsetX, view.offsetY, 0 };
+    chunk("VIEW", sizeof(vr));
+    put(&vr, sizeof(vr));
+
+    table("ORDR", order.data(), order.size(), sizeof(OrderRecord));
+    table("BNDS", bounds.data(), bounds.size(), sizeof(BoundsF));
+    table("STRK", strokes.data(), strokes.size(), sizeof(StrokeRecord));
+
+    chunk("PNTS", 8 + points * sizeof(ScenePoint));
+    put(&points, 8);
+    for (uint32_t id = 0; id < (uint32_t)scene.Size(); id++) {
+        const SceneStore::Ref& r = scene.order[id];
+        if (r.kind == ShapeKind::Pen) put(scene.strokes.Points(r.slot), scene.strokes.count[r.slot] * sizeof(ScenePoint));
+    }
+    pad(points * sizeof(ScenePoint));
+
+    table("LINE", lines.data(), lines.size(), sizeof(LineRecord));
+    table("BOXS", boxes.data(), boxes.size(), sizeof(BoxRecord));
+
+    chunk("FUNC", funcBytes);
+    uint64_t n = functions.size();
+    put(&n, 8);
+    for (auto* f : functions) {
+        FunctionRecord fr{ f->rangeStart, f->rangeEnd, f->originX, f->originY, f->width, f->color,
+            (f->drawAxes ? kFuncAxes : 0) | (f->clipToRange ? kFuncClip : 0), (uint32_t)f->expression.size() };
+        put(&fr, sizeof(fr));
+        put(f->expression.data(), f->expression.size());
+        pad(f->expression.size());
+    }
+
+    chunk("IMGS", imageBytes);
+    n = images.size();
+    put(&n, 8);
+    for (auto& im : images) {
+        ImageRecord ir{ (uint32_t)im.path.size(), 0, im.data ? (uint64_t)im.size : 0 };
+        put(&ir, sizeof(ir));
+        put(im.path.data(), im.path.size());
+        pad(im.path.size());
+        if (im.data) {
+            put(im.data, im.size);
+            pad(im.size);
+        }
+    }
+
+    if (fclose(out) != 0) ok = false;
+    if (!ok) error = "ошибка записи на диск";
+    return ok;
+}
+
+// Читает документ в пустую сцену. Точки штрихов остаются в отображении файла,
+// которым владеет сцена. bounds[id] — габариты фигур (для индекса).
+// addImage(DocumentImage) регистрирует картинку и возвращает её id для сцены.
+template <class AddImage>
+bool LoadDocument(const PathChar* path, SceneStore& scene, std::vector<BoundsF>& bounds, DocumentView& view,
+    const AddImage& addImage, std::string& error) {
+    using namespace faintdoc;
+
+    auto file = std::make_shared<MappedFile>();
+    if (!file->Open(path)) {
+        error = "не удалось открыть файл";
+        return false;
+    }
+    const uint8_t* base = file->Data();
+    const uint64_t size = file->Size();
+
+    FileHeader fh;
+    if (size < sizeof(fh)) {
+        error = "файл повреждён";
+        return false;
+    }
+    memcpy(&fh, base, sizeof(fh));
+    if (memcmp(fh.magic, kMagic, 8) != 0) {
+        error = "это не рисунок Faint";
+        return false;
+    }
+    if (fh.version > kVersion) {
+        error = "рисунок сохранён более новой версией программы";
+        return false;
+    }
+
+    // Блок: начало нагрузки и её длина
+    struct Span { const uint8_t* data = nullptr; uint64_t size = 0; };
+    std::unordered_map<uint32_t, Span> chunks;
+    uint64_t at = sizeof(fh);
+    for (uint32_t c = 0; c < fh.chunks; c++) {
+        ChunkHeader h;
+        if (size - at < sizeof(h)) {
+            error = "файл обрезан";
+            return false;
+        }
+        memcpy(&h, base + at, sizeof(h));
+        at += sizeof(h);
+        if (h.size > size - at) {
+            error = "файл обрезан";
+            return false;
+        }
+        chunks[h.tag] = Span{ base + at, h.size };
+        at = (std::min)(size, at + Pad8(h.size));
+    }
+
+    // Таблица фиксированных записей; false — длина не сходится
+    auto table = [&](const char (&tag)[5], size_t recordSize, const uint8_t*& data, uint64_t& count) {
+        auto it = chunks.find(Tag(tag));
+        data = nullptr;
+        count = 0;
+        if (it == chunks.end()) return true;
+        const Span& s = it->second;
+        if (s.size < 8) return false;
+        memcpy(&count, s.data, 8);
+        data = s.data + 8;
+        return count <= (s.size - 8) / recordSize;
+    };
+
+    const uint8_t *orderData, *boundsData, *strokeData, *pointData, *lineData, *boxData;
+    uint64_t orderCount, boundsCount, strokeCount, pointCount, lineCount, boxCount;
+    if (!table("ORDR", sizeof(OrderRecord), orderData, orderCount) ||
+        !table("BNDS", sizeof(BoundsF), boundsData, boundsCount) ||
+        !table("STRK", sizeof(StrokeRecord), strokeData, strokeCount) ||
+        !table("PNTS", sizeof(ScenePoint), pointData, pointCount) ||
+        !table("LINE", sizeof(LineRecord), lineData, lineCount) ||
+        !table("BOXS", sizeof(BoxRecord), boxData, boxCount)) {
+        error = "файл повреждён";
+        return false;
+    }
+    if (((uintptr_t)pointData & (alignof(ScenePoint) - 1)) != 0) {
+        error = "файл повреждён";
+        return false;
+    }
+    const ScenePoint* points = reinterpret_cast<const ScenePoint*>(pointData);
+
+    // Графики и картинки — записи переменной длины
+    std::vector<std::shared_ptr<FunctionPlot>> functions;
+    std::vector<uint32_t> images;
+    // read(p, end, next) разбирает одну запись с p и ставит next на следующую
+    auto variable = [&](const char (&tag)[5], size_t recordSize, const auto& read) {
+        auto it = chunks.find(Tag(tag));
+        if (it == chunks.end()) return true;
+        const uint8_t* p = it->second.data;
+        const uint8_t* end = p + it->second.size;
+        uint64_t count;
+        if (end - p < 8) return false;
+        memcpy(&count, p, 8);
+        p += 8;
+        for (uint64_t k = 0; k < count; k++) {
+            if ((uint64_t)(end - p) < recordSize || !read(p, end, p)) return false;
+        }
+        return true;
+    };
+    bool ok = variable("FUNC", sizeof(FunctionRecord), [&](const uint8_t* p, const uint8_t* end, const uint8_t*& next) {
+        FunctionRecord fr;
+        memcpy(&fr, p, sizeof(fr));
+        p += sizeof(fr);
+        if ((uint64_t)(end - p) < fr.exprBytes) return false;
+        std::string expr((const char*)p, fr.exprBytes);
+        functions.push_back(std::make_shared<FunctionPlot>(expr, fr.start, fr.end, fr.originX, fr.originY,
+            fr.color, fr.width, (fr.flags & kFuncAxes) != 0, (fr.flags & kFuncClip) != 0));
+        next = p + (std::min)((uint64_t)(end - p), Pad8(fr.exprBytes));
+        return true;
+    }) && variable("IMGS", sizeof(ImageRecord), [&](const uint8_t* p, const uint8_t* end, const uint8_t*& next) {
+        ImageRecord ir;
+        memcpy(&ir, p, sizeof(ir));
+        p += sizeof(ir);
+        if ((uint64_t)(end - p) < ir.pathBytes) return false;
+        DocumentImage im;
+        im.path.assign((const char*)p, ir.pathBytes);
+        p += (std::min)((uint64_t)(end - p), Pad8(ir.pathBytes));
+        if ((uint64_t)(end - p) < ir.dataBytes) return false;
+        if (ir.dataBytes) {
+            im.data = p;
+            im.size = (size_t)ir.dataBytes;
+        }
+        p += (std::min)((uint64_t)(end - p), Pad8(ir.dataBytes));
+        images.push_back(addImage(im));
+        next = p;
+        return true;
+    });
+    if (!ok) {
+        error = "файл повреждён";
+        return false;
+    }
+
+    scene.Clear();
+    scene.Borrow(file, base, (size_t)size);
+    scene.order.reserve((size_t)orderCount);
+    for (uint64_t k = 0; k < orderCount; k++) {
+        OrderRecord o;
+        memcpy(&o, orderData + k * sizeof(o), sizeof(o));
+        ShapeKind kind = (ShapeKind)o.kind;
+        bool valid = true;
+        switch (kind) {
+        case ShapeKind::Pen: {
+            StrokeRecord sr;
+            if (!(valid = o.slot < strokeCount)) break;
+            memcpy(&sr, strokeData + o.slot * sizeof(sr), sizeof(sr));
+            if (!(valid = sr.first <= pointCount && sr.count <= pointCount - sr.first)) break;
+            scene.AddStrokeView(points + sr.first, sr.count, sr.color, sr.width);
+            break;
+        }
+        case ShapeKind::Line: {
+            LineRecord lr;
+            if (!(valid = o.slot < lineCount)) break;
+            memcpy(&lr, lineData + o.slot * sizeof(lr), sizeof(lr));
+            scene.AddLine(lr.x0, lr.y0, lr.x1, lr.y1, lr.color, lr.width);
+            break;
+        }
+        case ShapeKind::Function:
+            if (!(valid = o.slot < functions.size())) break;
+            scene.AddFunction(functions[o.slot]);
+            break;
+        case ShapeKind::Erased:
+            scene.AddErased();
+            break;
+        case ShapeKind::Rect:
+        case ShapeKind::Ellipse:
+        case ShapeKind::Triangle:
+        case ShapeKind::Star:
+        case ShapeKind::Image: {
+            BoxRecord br;
+            if (!(valid = o.slot < boxCount)) break;
+            memcpy(&br, boxData + o.slot * sizeof(br), sizeof(br));
+            if (!(valid = br.kind == o.kind)) break;
+            if (kind == ShapeKind::Image) {
+                if (!(valid = br.image < images.size())) break;
+                scene.AddImage(br.x, br.y, br.w, br.h, images[br.image]);
+            }
+            else {
+                scene.AddBox(kind, br.x, br.y, br.w, br.h, br.color, br.width);
+            }
+            break;
+        }
+        default:
+            valid = false;
+            break;
+        }
+        if (!valid) {
+            scene.Clear();
+            error = "файл повреждён";
+            return false;
+        }
+    }
+
+    bounds.resize(scene.Size());
+    if (boundsCount == scene.Size() && boundsCount > 0) memcpy(bounds.data(), boundsData, bounds.size() * sizeof(BoundsF));
+    else scene.AllBounds(bounds);
+
+    auto vit = chunks.find(Tag("VIEW"));
+    if (vit != chunks.end() && vit->second.size >= sizeof(ViewRecord)) {
+        ViewRecord vr;
+        memcpy(&vr, vit->second.data, sizeof(vr));
+        if (vr.zoom > 0 && std::isfinite(vr.zoom)) view = DocumentView{ vr.zoom, vr.offsetX, vr.offsetY };
+    }
+    return true;
+}
@@ -0,0 +1,244 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Геометрия ластика.
+// Ластик — круг радиуса r, протянутый вдоль пути курсора: каждое движение
+// мыши даёт «капсулу» (отрезок ab, раздутый на r). Штрихи режутся по
+// капсуле на уцелевшие куски; контурные фигуры удаляются, только когда
+// весь контур оказался под путём ластика за одно нажатие.
+// Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "SceneStore.h"
+#include "StrokeSimplifier.h"
+
+// Часть [t0, t1] отрезка pq (t от 0 до 1), лежащая в капсуле ab радиуса r.
+// Капсула выпукла, поэтому часть одна — объединение частей в кругах у a, b
+// и в полосе между ними.
+inline bool CapsuleInterval(const ScenePoint& p, const ScenePoint& q, const ScenePoint& a, const ScenePoint& b,
+    double r, double& t0, double& t1) {
+    double dx = (double)q.X - p.X, dy = (double)q.Y - p.Y;
+    double lo = 2, hi = -1;
+    auto take = [&](double s0, double s1) {
+        s0 = (std::max)(s0, 0.0);
+        s1 = (std::min)(s1, 1.0);
+        if (s0 > s1) return;
+        lo = (std::min)(lo, s0);
+        hi = (std::max)(hi, s1);
+    };
+    // |p + t d - c| <= r
+    auto disc = [&](const ScenePoint& c) {
+        double fx = (double)p.X - c.X, fy = (double)p.Y - c.Y;
+        double A = dx * dx + dy * dy, B = 2 * (fx * dx + fy * dy), C = fx * fx + fy * fy - r * r;
+        if (A == 0) {
+            if (C <= 0) take(0, 1);
+            return;
+        }
+        double D = B * B - 4 * A * C;
+        if (D < 0) return;
+        double sq = std::sqrt(D);
+        take((-B - sq) / (2 * A), (-B + sq) / (2 * A));
+    };
+    disc(a);
+    disc(b);
+
+    // Полоса: проекция на ab в [0, len²], расстояние до прямой ab <= r.
+    // Обе величины линейны по t: v(t) = v0 + t * dv.
+    double ux = (double)b.X - a.X, uy = (double)b.Y - a.Y;
+    double len2 = ux * ux + uy * uy;
+    if (len2 > 0) {
+        double len = std::sqrt(len2);
+        double px = (double)p.X - a.X, py = (double)p.Y - a.Y;
+        double s0 = 0, s1 = 1;
+        auto clip = [&](double v0, double dv, double vmin, double vmax) {
+            if (dv == 0) {
+                if (v0 < vmin || v0 > vmax) s0 = 2;
+                return;
+            }
+            double ta = (vmin - v0) / dv, tb = (vmax - v0) / dv;
+            if (ta > tb) std::swap(ta, tb);
+            s0 = (std::max)(s0, ta);
+            s1 = (std::min)(s1, tb);
+        };
+        clip(px * ux + py * uy, dx * ux + dy * uy, 0, len2);
+        clip((px * uy - py * ux) / len, (dx * uy - dy * ux) / len, -r, r);
+        take(s0, s1);
+    }
+
+    if (lo > hi) return false;
+    t0 = lo;
+    t1 = hi;
+    return true;
+}
+
+// Режет ломаную pts (куски через IsStrokeBreak) капсулой ab радиуса r.
+// Уцелевшие куски пишутся в out через разрывы; куски короче двух точек
+// пропадают. false — капсула ничего не задела (out не трогается).
+inline bool ErasePolyline(const ScenePoint* pts, size_t n, const ScenePoint& a, const ScenePoint& b, double r,
+    std::vector<ScenePoint>& out) {
+    std::vector<ScenePoint> result;
+    std::vector<ScenePoint> piece;
+    bool changed = false;
+
+    auto flush = [&]() {
+        if (piece.size() >= 2) {
+            if (!result.empty()) result.push_back(ScenePoint{ NAN, NAN });
+            result.insert(result.end(), piece.begin(), piece.end());
+        }
+        piece.clear();
+    };
+    auto at = [](const ScenePoint& p, const ScenePoint& q, double t) {
+        return ScenePoint{ (float)(p.X + (q.X - p.X) * t), (float)(p.Y + (q.Y - p.Y) * t) };
+    };
+
+    ForEachStrokePiece(pts, n, [&](const ScenePoint* p, size_t m) {
+        double t0, t1;
+        if (m == 1) {
+            if (CapsuleInterval(p[0], p[0], a, b, r, t0, t1)) changed = true;
+            return; // одиночная точка не рисуется, оставлять её незачем
+        }
+        for (size_t k = 0; k + 1 < m; k++) {
+            bool hit = CapsuleInterval(p[k], p[k + 1], a, b, r, t0, t1);
+            bool startsOutside = !hit || t0 > 0;
+            if (startsOutside && piece.empty()) piece.push_back(p[k]);
+            if (!hit) {
+                piece.push_back(p[k + 1]);
+                continue;
+            }
+            changed = true;
+            if (t0 > 0) piece.push_back(at(p[k], p[k + 1], t0));
+            flush();
+            if (t1 < 1) {
+                piece.push_back(at(p[k], p[k + 1], t1));
+                piece.push_back(p[k + 1]);
+            }
+        }
+        flush();
+    });
+
+    if (changed) out.swap(result);
+    return changed;
+}
+
+// Контур прямоугольной фигуры ломаной (замкнутой): прямоугольник,
+// эллипс (64 хорды), треугольник и звезда — как их рисует SceneRenderer
+inline void BoxOutline(ShapeKind kind, float x, float y, float w, float h, std::vector<ScenePoint>& out) {
+    out.clear();
+    const double pi = 3.14159265358979323846;
+    switch (kind) {
+    case ShapeKind::Ellipse: {
+        const int segments = 64;
+        for (int k = 0; k <= segments; k++) {
+            double a = 2 * pi * k / segments;
+            out.push_back(ScenePoint{ x + w / 2 + (float)(std::cos(a) * w / 2), y + h / 2 + (float)(std::sin(a) * h / 2) });
+        }
+        break;
+    }
+    case ShapeKind::Triangle:
+        out.push_back(ScenePoint{ x + w / 2, y });
+        out.push_back(ScenePoint{ x, y + h });
+        out.push_back(ScenePoint{ x + w, y + h });
+        out.push_back(out.front());
+        break;
+    case ShapeKind::Star: {
+        float cx = x + w / 2, cy = y + h / 2;
+        float R = (std::min)(w, h) / 2, rr = R * 0.4f;
+        double angle = -pi / 2;
+        for (int k = 0; k < 10; k++) {
+            float cr = (k % 2 == 0) ? R : rr;
+            out.push_back(ScenePoint{ cx + (float)(std::cos(angle) * cr), cy + (float)(std::sin(angle) * cr) });
+            angle += pi / 5;
+        }
+        out.push_back(out.front());
+        break;
+    }
+    default:
+        out.push_back(ScenePoint{ x, y });
+        out.push_back(ScenePoint{ x + w, y });
+        out.push_back(ScenePoint{ x + w, y + h });
+        out.push_back(ScenePoint{ x, y + h });
+        out.push_back(out.front());
+        break;
+    }
+}
+
+// Путь ластика за одно нажатие кнопки
+class EraserPath {
+public:
+    void Begin(const ScenePoint& p, float r) {
+        radius = r;
+        pts.assign(1, p);
+    }
+    void Add(const ScenePoint& p) { pts.push_back(p); }
+
+    float Radius() const { return radius; }
+    const ScenePoint& Last() const { return pts.back(); }
+
+    // Лежит ли весь контур (с шагом проверки radius/4) под путём
+    bool Covers(const std::vector<ScenePoint>& outline) {
+        BoundsF b = BoundsF::Empty();
+        for (auto& p : outline) b.Include(p.X, p.Y);
+        if (!Near(b)) return false;
+        double step = radius / 4;
+        for (size_t k = 0; k + 1 < outline.size(); k++) {
+            const ScenePoint& p = outline[k];
+            const ScenePoint& q = outline[k + 1];
+            double len = std::hypot((double)q.X - p.X, (double)q.Y - p.Y);
+            int n = (std::max)(1, (int)std::ceil(len / step));
+            for (int i = 0; i < n; i++) {
+                double t = (double)i / n;
+                if (!Covered(p.X + (q.X - p.X) * t, p.Y + (q.Y - p.Y) * t)) return false;
+            }
+        }
+        return outline.empty() || Covered(outline.back().X, outline.back().Y);
+    }
+
+    // Лежит ли под путём весь прямоугольник (картинка); сетка с шагом
+    // radius/2, слишком большие для проверки области не стираются
+    bool CoversArea(const BoundsF& b) {
+        if (!Near(b)) return false;
+        double step = radius / 2;
+        double nx = std::ceil((b.maxX - b.minX) / step) + 1, ny = std::ceil((b.maxY - b.minY) / step) + 1;
+        if (!(nx * ny <= 65536)) return false;
+        for (int iy = 0; iy < (int)ny; iy++)
+            for (int ix = 0; ix < (int)nx; ix++) {
+                double x = (std::min)((double)b.maxX, b.minX + ix * step);
+                double y = (std::min)((double)b.maxY, b.minY + iy * step);
+                if (!Covered(x, y)) return false;
+            }
+        return true;
+    }
+
+private:
+    std::vector<ScenePoint> pts;
+    float radius = 0;
+    std::vector<size_t> near; // отрезки пути рядом с проверяемой фигурой
+
+    // Отбирает отрезки пути, которые могут накрыть b
+    bool Near(const BoundsF& b) {
+        near.clear();
+        for (size_t k = 0; k < pts.size(); k++) {
+            const ScenePoint& p = pts[k];
+            const ScenePoint& q = pts[k + 1 < pts.size() ? k + 1 : k];
+            BoundsF s = BoundsF::Empty();
+            s.Include(p.X, p.Y);
+            s.Include(q.X, q.Y);
+            s.Inflate(radius);
+            if (s.Intersects(b)) near.push_back(k);
+        }
+        return !near.empty();
+    }
+
+    bool Covered(double x, double y) const {
+        ScenePoint c{ (float)x, (float)y };
+        for (size_t k : near) {
+            const ScenePoint& p = pts[k];
+            const ScenePoint& q = pts[k + 1 < pts.size() ? k + 1 : k];
+            if (SegmentDistance(c, p, q) <= radius) return true;
+        }
+        return false;
+    }
+};
@@ -2,12 +2,35 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include <windows.h>
 #include <commdlg.h>
+#include <shlwapi.h>
+#include <wincodec.h>
 #include <gdiplus.h>
 #include <vector>
 #include <string>
 #include <cmath>
 #include <algorithm>
 #include <sstream>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "MathParser.h"
+#include "FunctionSampler.h"
+#include "SpatialIndex.h"
+#include "TileCache.h"
+#include "StrokeSimplifier.h"
+#include "SceneStore.h"
+#include "Eraser.h"
+#include "Document.h"
+#include "Journal.h"
+#include "History.h"
+#include "RenderBackend.h"
+#include "PngStream.h"
+#include "ImageCache.h"
+#include "TiledImage.h"
+#include "LabelAtlas.h"
+#include "FrameStats.h"
 
 // Подключение библиотек
 #pragma comment(lib, "gdiplus.lib")
@@ -15,6 +38,9 @@
 #pragma comment(lib, "gdi32.lib")
 #pragma comment(lib, "advapi32.lib")
 #pragma comment(lib, "comdlg32.lib")
+#pragma comment(lib, "shlwapi.lib")
+#pragma comment(lib, "windowscodecs.lib")
+#pragma comment(lib, "ole32.lib")
 
 using namespace Gdiplus;
 using namespace std;
@@ -37,6 +63,17 @@ using namespace std;
 #define ID_ACTION_OPEN    1103 
 #define ID_ACTION_COLOR   1104
 #define ID_ACTION_AUTORUN 1105
+#define ID_ACTION_UNDO    1106
+#define ID_ACTION_REDO    1107
+#define ID_ACTION_IMAGES  1108
+#define ID_ACTION_FRAME_STATS 1109
+#define ID_ACTION_FRAME_TRACE 1110
+
+// Экспорт всего рисунка в PNG
+#define ID_EXPORT_96      1111
+#define ID_EXPORT_150     1112
+#define ID_EXPORT_300     1113
+#define ID_EXPORT_600     1114
 
 // Размеры ластика
 #define ID_ERASER_XS      1201
@@ -45,6 +82,12 @@ using namespace std;
 #define ID_ERASER_L       1204
 #define ID_ERASER_XL      1205
 
+// Фоновые потоки закончили тайлы (см. TileRenderer)
+#define WM_APP_TILES_READY (WM_APP + 1)
+#define WM_APP_IMAGES_READY (WM_APP + 2)
+#define ID_TIMER_JOURNAL   3001 // проверка, не пора ли свернуть журнал в снимок
+#define ID_TIMER_FRAME_HUD 3002 // обновление оверлея замеров кадров
+
 #define ID_BTN_OK         2001
 #define ID_BTN_CANCEL     2002
 #define ID_CHK_AXIS       2003
@@ -53,293 +96,731 @@ using namespace std;
 const wchar_t* MUTEX_NAME = L"Global\\MyGDIPlusPaintMutex_MegaV6";
 const wchar_t* REG_PATH = L"Software\\Microsoft\\Windows\\CurrentVersion\\Run";
 const wchar_t* APP_NAME = L"MyGDIPlusPaint";
+const wchar_t* SETTINGS_PATH = L"Software\\MyGDIPlusPaint";
 
 // -------------------------------------------------------------------------
 // 2. Математический парсер
 // -------------------------------------------------------------------------
-class MathParser {
-public:
-    static double Evaluate(string expr, double x) {
-        expr.erase(remove(expr.begin(), expr.end(), ' '), expr.end());
-        size_t pos = 0;
-        return ParseExpression(expr, pos, x);
-    }
-private:
-    static double ParseExpression(const string& expr, size_t& pos, double x) {
-        double left = ParseTerm(expr, pos, x);
-        while (pos < expr.length()) {
-            char op = expr[pos];
-            if (op != '+' && op != '-') break;
-            pos++;
-            double right = ParseTerm(expr, pos, x);
-            if (op == '+') left += right; else left -= right;
-        }
-        return left;
-    }
-    static double ParseTerm(const string& expr, size_t& pos, double x) {
-        double left = ParsePower(expr, pos, x);
-        while (pos < expr.length()) {
-            char op = expr[pos];
-            if (op != '*' && op != '/') break;
-            pos++;
-            double right = ParsePower(expr, pos, x);
-            if (op == '*') left *= right; else if (right != 0) left /= right;
-        }
-        return left;
-    }
-    static double ParsePower(const string& expr, size_t& pos, double x) {
-        double left = ParseFactor(expr, pos, x);
-        while (pos < expr.length()) {
-            if (expr[pos] == '^') {
-                pos++;
-                double right = ParseFactor(expr, pos, x);
-                left = pow(left, right);
-            }
-            else {
-                break;
-            }
+// Сам парсер и компилятор выражений вынесены в MathParser.h (без зависимостей от Win32)
+
+// -------------------------------------------------------------------------
+// 3. Отрисовка фигур
+// -------------------------------------------------------------------------
+// Сами фигуры хранятся массивами по типам (SceneStore.h), как они выглядят —
+// в RenderBackend.h; здесь — вывод через GDI+.
+static_assert(sizeof(ScenePoint) == sizeof(PointF), "ScenePoint должен совпадать с PointF по раскладке");
+
+string ToUtf8(const wstring& w);
+
+// Пирамида картинки из содержимого файла: уровень 0 — копия в PARGB (её GDI+
+// выводит быстрее всего, и поток файла не нужно держать), дальше — вдвое
+// меньше предыдущего
+bool BuildPyramid(const std::vector<uint8_t>& bytes, std::vector<ImageCache<Bitmap>::Level>& levels) {
+    if (bytes.empty()) return false;
+    IStream* stream = SHCreateMemStream(bytes.data(), (UINT)bytes.size());
+    if (!stream) return false;
+    {
+        std::unique_ptr<Bitmap> decoded(Bitmap::FromStream(stream));
+        int w = 0, h = 0;
+        if (decoded && decoded->GetLastStatus() == Ok) {
+            w = (int)decoded->GetWidth();
+            h = (int)decoded->GetHeight();
         }
-        return left;
-    }
-    static double ParseFactor(const string& expr, size_t& pos, double x) {
-        if (pos >= expr.length()) return 0;
-        if (expr[pos] == '-') { pos++; return -ParseFactor(expr, pos, x); }
-        if (expr[pos] == '(') {
-            pos++;
-            double val = ParseExpression(expr, pos, x);
-            if (pos < expr.length() && expr[pos] == ')') pos++;
-            return val;
-        }
-        if (isalpha(expr[pos])) {
-            string func;
-            while (pos < expr.length() && isalpha(expr[pos])) func += expr[pos++];
-            if (func == "x") return x;
-            if (func == "pi") return M_PI;
-            if (func == "e") return M_E;
-            if (pos < expr.length() && expr[pos] == '(') {
-                pos++;
-                double val = ParseExpression(expr, pos, x);
-                if (pos < expr.length() && expr[pos] == ')') pos++;
-                if (func == "sin") return sin(val);
-                if (func == "cos") return cos(val);
-                if (func == "tan") return tan(val);
-                if (func == "sqrt") return sqrt(abs(val));
-                if (func == "abs") return abs(val);
-                if (func == "log") return log(val);
-                if (func == "ln") return log(val);
-            }
+        if (w > 0 && h > 0) {
+            levels.emplace_back();
+            levels.back().image.reset(new Bitmap(w, h, PixelFormat32bppPARGB));
+            levels.back().width = w;
+            levels.back().height = h;
+            Graphics g(levels.back().image.get());
+            g.DrawImage(decoded.get(), 0, 0, w, h);
         }
-        if (isdigit(expr[pos]) || expr[pos] == '.') {
-            string numStr;
-            while (pos < expr.length() && (isdigit(expr[pos]) || expr[pos] == '.')) numStr += expr[pos++];
-            return stod(numStr);
+    }
+    stream->Release();
+    if (levels.empty()) return false;
+
+    // Края не смешиваются с прозрачным фоном
+    ImageAttributes attr;
+    attr.SetWrapMode(WrapModeTileFlipXY);
+    while (max(levels.back().width, levels.back().height) / 2 >= kMipMinSide) {
+        int w = max(1, (levels.back().width + 1) / 2), h = max(1, (levels.back().height + 1) / 2);
+        std::unique_ptr<Bitmap> half(new Bitmap(w, h, PixelFormat32bppPARGB));
+        {
+            Graphics g(half.get());
+            g.SetInterpolationMode(InterpolationModeHighQualityBilinear);
+            g.SetPixelOffsetMode(PixelOffsetModeHalf);
+            Bitmap* src = levels.back().image.get();
+            g.DrawImage(src, RectF(0, 0, (REAL)w, (REAL)h), 0, 0,
+                (REAL)levels.back().width, (REAL)levels.back().height, UnitPixel, &attr);
         }
-        return 0;
+        levels.emplace_back();
+        levels.back().image = std::move(half);
+        levels.back().width = w;
+        levels.back().height = h;
     }
-};
+    return true;
+}
 
-// -------------------------------------------------------------------------
-// 3. Классы фигур
-// -------------------------------------------------------------------------
-class Shape {
-public:
-    Color color;
-    float width;
-    Shape(Color c, float w) : color(c), width(w) {}
-    virtual ~Shape() {}
-    virtual void Draw(Graphics& g) = 0;
-};
+// Картинки не меньше этого числа пикселей (8192 x 8192) хранятся тайлами
+// на диске (TiledImage.h) и в память целиком не раскодируются
+const uint64_t kTiledImagePixels = (uint64_t)64 << 20;
+const UINT kTiledImportRows = 64; // строк за одно чтение при импорте
 
-class PenShape : public Shape {
-public:
-    std::vector<PointF> points;
-    PenShape(Color c, float w) : Shape(c, w) {}
-    void AddPoint(PointF p) { points.push_back(p); }
-    void Draw(Graphics& g) override {
-        if (points.size() < 2) return;
-        Pen pen(color, width);
-        pen.SetStartCap(LineCapRound);
-        pen.SetEndCap(LineCapRound);
-        pen.SetLineJoin(LineJoinRound);
-        g.DrawCurve(&pen, points.data(), (INT)points.size());
+wstring JournalDirectory();
+
+// COM для WIC в текущем потоке (уже инициализированный поток тоже подходит)
+struct ComScope {
+    HRESULT hr;
+    ComScope() : hr(CoInitializeEx(NULL, COINIT_MULTITHREADED)) {}
+    ~ComScope() {
+        if (SUCCEEDED(hr)) CoUninitialize();
     }
 };
 
-class LineShape : public Shape {
+// Картинка через WIC: в отличие от GDI+ отдаёт пиксели полосами, не
+// раскодируя всё целиком. Пиксели PBGRA — в памяти то же, что PARGB GDI+.
+class WicSource {
 public:
-    PointF start, end;
-    LineShape(PointF s, PointF e, Color c, float w) : Shape(c, w), start(s), end(e) {}
-    void Draw(Graphics& g) override {
-        Pen pen(color, width);
-        g.DrawLine(&pen, start, end);
+    WicSource() {}
+    WicSource(const WicSource&) = delete;
+    WicSource& operator=(const WicSource&) = delete;
+    ~WicSource() {
+        if (converter) converter->Release();
+        if (frame) frame->Release();
+        if (decoder) decoder->Release();
+        if (stream) stream->Release();
+        if (factory) factory->Release();
     }
-};
 
-class RectShape : public Shape {
-public:
-    RectF rect;
-    RectShape(RectF r, Color c, float w) : Shape(c, w), rect(r) {}
-    void Draw(Graphics& g) override {
-        Pen pen(color, width);
-        g.DrawRectangle(&pen, rect);
+    // Файл path или, если data != nullptr, содержимое файла в памяти
+    bool Open(const wchar_t* path, const uint8_t* data, size_t size) {
+        if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory)))) return false;
+        HRESULT hr;
+        if (data) {
+            hr = factory->CreateStream(&stream);
+            if (SUCCEEDED(hr)) hr = stream->InitializeFromMemory(const_cast<BYTE*>(data), (DWORD)size);
+            if (SUCCEEDED(hr)) hr = factory->CreateDecoderFromStream(stream, NULL, WICDecodeMetadataCacheOnDemand, &decoder);
+        }
+        else hr = factory->CreateDecoderFromFilename(path, NULL, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder);
+        if (SUCCEEDED(hr)) hr = decoder->GetFrame(0, &frame);
+        if (SUCCEEDED(hr)) hr = frame->GetSize(&width, &height);
+        return SUCCEEDED(hr) && width > 0 && height > 0;
     }
-};
 
-class EllipseShape : public Shape {
-public:
-    RectF rect;
-    EllipseShape(RectF r, Color c, float w) : Shape(c, w), rect(r) {}
-    void Draw(Graphics& g) override {
-        Pen pen(color, width);
-        g.DrawEllipse(&pen, rect);
+    UINT Width() const { return width; }
+    UINT Height() const { return height; }
+
+    // Строки [y, y + n) в out (width * n пикселей)
+    bool Rows(UINT y, UINT n, uint32_t* out) {
+        if (!converter) {
+            if (FAILED(factory->CreateFormatConverter(&converter)) ||
+                FAILED(converter->Initialize(frame, GUID_WICPixelFormat32bppPBGRA, WICBitmapDitherTypeNone, NULL, 0, WICBitmapPaletteTypeCustom))) return false;
+        }
+        WICRect r = { 0, (INT)y, (INT)width, (INT)n };
+        return SUCCEEDED(converter->CopyPixels(&r, width * 4, width * 4 * n, (BYTE*)out));
     }
+
+private:
+    IWICImagingFactory* factory = nullptr;
+    IWICStream* stream = nullptr;
+    IWICBitmapDecoder* decoder = nullptr;
+    IWICBitmapFrameDecode* frame = nullptr;
+    IWICFormatConverter* converter = nullptr;
+    UINT width = 0, height = 0;
 };
 
-class TriangleShape : public Shape {
+// Картинки сцены; сцена ссылается на них по номеру. Номер — вставка,
+// а содержимое и пирамида — запись общего кэша (ImageCache.h): одна и та
+// же картинка, вставленная много раз, раскодируется один раз.
+// Поток интерфейса не раскодирует: на месте неготовой картинки рисуется
+// заглушка, картинка раскодируется в общем пуле, и окну приходит
+// WM_APP_IMAGES_READY — перерисовать места заглушек (TakeDecoded).
+// Огромные картинки (kTiledImagePixels) при вставке один раз переписываются
+// в хранилище тайлов в каталоге приложения; выводятся только видимые тайлы
+// подходящего уровня, в памяти — недавние тайлы в пределах бюджета.
+// Такие картинки в документ не встраиваются, сохраняется только путь.
+class ImageTable {
 public:
-    RectF rect;
-    TriangleShape(RectF r, Color c, float w) : Shape(c, w), rect(r) {}
-    void Draw(Graphics& g) override {
-        Pen pen(color, width);
-        PointF p1(rect.X + rect.Width / 2, rect.Y);
-        PointF p2(rect.X, rect.Y + rect.Height);
-        PointF p3(rect.X + rect.Width, rect.Y + rect.Height);
+    // Место на холсте, где была заглушка; stale — заглушка могла попасть в тайлы холста
+    struct Area {
+        BoundsF bounds;
+        bool stale;
+    };
 
-        PointF points[] = { p1, p2, p3 };
-        g.DrawPolygon(&pen, points, 3);
+    void Init(HWND hWnd) {
+        notify = hWnd;
+        cache.SetOnDecoded([this](uint32_t entry) { OnDecoded(Source{ Kind::Cached, entry }); });
     }
-};
 
-class StarShape : public Shape {
-public:
-    RectF rect;
-    StarShape(RectF r, Color c, float w) : Shape(c, w), rect(r) {}
-    void Draw(Graphics& g) override {
-        Pen pen(color, width);
-        float cx = rect.X + rect.Width / 2;
-        float cy = rect.Y + rect.Height / 2;
-        float R = min(rect.Width, rect.Height) / 2;
-        float r = R * 0.4f;
-
-        PointF pnts[10];
-        double angle = -M_PI / 2;
-        double step = M_PI / 5;
-
-        for (int i = 0; i < 10; i++) {
-            float currR = (i % 2 == 0) ? R : r;
-            pnts[i] = PointF(cx + (float)(cos(angle) * currR), cy + (float)(sin(angle) * currR));
-            angle += step;
-        }
-        g.DrawPolygon(&pen, pnts, 10);
+    // Картинка из файла. Здесь читается только заголовок (огромная картинка
+    // импортируется тайлами); сам файл читается целиком в фоне, той же
+    // задачей, что потом раскодирует его, а до тех пор на месте картинки
+    // заглушка. Не прочитался — вставка без содержимого, на её месте ничего
+    // не рисуется.
+    uint32_t Load(const wchar_t* path) {
+        if (IsHuge(path, nullptr, 0)) return AddTiled(path, nullptr, 0);
+        std::shared_ptr<Reading> r = std::make_shared<Reading>();
+        uint32_t id;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            items.push_back(Item{ 0, false, path, r });
+            id = (uint32_t)(items.size() - 1);
+        }
+        ThreadPool::Shared().Submit([this, id, r] {
+            if (!ReadFile(id, r)) return;
+            // Пирамида нужна сразу: картинку только что поставили на экран
+            Source src;
+            std::shared_ptr<Tiled> tiled;
+            if (Find(id, src, tiled) && src.kind == Kind::Cached)
+                cache.Request(src.id, [](std::function<void()> job) { job(); }, BuildPyramid);
+            OnDecoded(Source{ Kind::Loading, id });
+        });
+        return id;
     }
-};
 
-class ImageShape : public Shape {
-public:
-    RectF rect;
-    Bitmap* image;
+    // Картинка, сохранённая внутри документа: байты копируются, path — откуда она была взята
+    uint32_t Load(const uint8_t* data, size_t size, const wchar_t* path) {
+        if (IsHuge(path, data, size)) return AddTiled(path, data, size);
+        return Add(path, std::vector<uint8_t>(data, data + size));
+    }
 
-    ImageShape(const WCHAR* filename, RectF r) : Shape(Color(0, 0, 0), 0), rect(r) {
-        image = Bitmap::FromFile(filename);
+    wstring Path(uint32_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return id < items.size() ? items[id].path : wstring();
     }
 
-    ~ImageShape() {
-        if (image) delete image;
+    // Путь и содержимое файла картинки для записи в документ (файл, который
+    // ещё читается в фоне, дожидается); false — файл не удалось прочитать
+    // или картинка хранится тайлами (в документ попадёт только путь)
+    bool Contents(uint32_t id, wstring& path, std::vector<uint8_t>& bytes) {
+        bytes.clear();
+        AwaitFile(id);
+        uint32_t entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (id >= items.size()) return false;
+            path = items[id].path;
+            if (items[id].tiled || items[id].reading) return false;
+            entry = items[id].entry;
+        }
+        bytes = cache.Bytes(entry);
+        return !bytes.empty();
     }
 
-    void Draw(Graphics& g) override {
-        if (image && image->GetLastStatus() == Ok) {
-            g.DrawImage(image, rect);
+    // pixelsPerUnit — масштаб вывода: по нему выбирается уровень пирамиды.
+    // Неготовая картинка раскодируется здесь же (фоновые потоки, экспорт).
+    void Draw(Graphics& g, uint32_t id, const RectF& rect, float pixelsPerUnit) {
+        AwaitFile(id);
+        Source src;
+        std::shared_ptr<Tiled> tiled;
+        if (!Find(id, src, tiled) || src.kind == Kind::Loading) return;
+        if (tiled) {
+            DrawTiled(g, src.id, *tiled, rect, pixelsPerUnit);
+            return;
         }
+        cache.Draw(src.id, fabsf(rect.Width * pixelsPerUnit), fabsf(rect.Height * pixelsPerUnit), BuildPyramid, [&](Bitmap& im) {
+            Blit(g, im, rect);
+        });
     }
-};
 
-class FunctionShape : public Shape {
-public:
-    string expression;
-    double rangeStart, rangeEnd;
-    PointF origin;
-    bool drawAxes;
-    bool clipToRange;
-
-    FunctionShape(string expr, double start, double end, PointF org, Color c, float w, bool axes, bool clip)
-        : Shape(c, w), expression(expr), rangeStart(start), rangeEnd(end), origin(org), drawAxes(axes), clipToRange(clip) {
-    }
-
-    void Draw(Graphics& g) override {
-        Pen pen(color, width);
-
-        if (drawAxes) {
-            Pen axisPen(Color(200, 0, 0, 0), 1);
-            Font font(L"Arial", 8);
-            SolidBrush brush(Color(200, 0, 0, 0));
-
-            g.DrawLine(&axisPen, PointF(origin.X - 100000, origin.Y), PointF(origin.X + 100000, origin.Y));
-            g.DrawLine(&axisPen, PointF(origin.X, origin.Y - 100000), PointF(origin.X, origin.Y + 100000));
-
-            double step = 50.0;
-            for (double x = -3000; x <= 3000; x += step) {
-                if (x == 0) continue;
-                float screenX = origin.X + (float)x;
-                g.DrawLine(&axisPen, PointF(screenX, origin.Y - 3), PointF(screenX, origin.Y + 3));
-                wstring s = to_wstring((int)x);
-                g.DrawString(s.c_str(), -1, &font, PointF(screenX - 10, origin.Y + 5), &brush);
+    // То же без ожидания (поток интерфейса): неготовая картинка заказывается,
+    // на её месте — заглушка того же размера. rect — в координатах сцены.
+    void DrawOrRequest(Graphics& g, uint32_t id, const RectF& rect, float pixelsPerUnit) {
+        Source src;
+        std::shared_ptr<Tiled> tiled;
+        if (!Find(id, src, tiled)) return;
+        if (src.kind == Kind::Loading) {
+            Placeholder(g, src, rect);
+            // Файл мог дочитаться раньше, чем заглушку запомнили
+            if (Find(id, src, tiled) && src.kind != Kind::Loading) OnDecoded(Source{ Kind::Loading, id });
+            return;
+        }
+        if (tiled) {
+            DrawTiled(g, src.id, *tiled, rect, pixelsPerUnit);
+            return;
+        }
+        ImageStatus st = cache.TryDraw(src.id, fabsf(rect.Width * pixelsPerUnit), fabsf(rect.Height * pixelsPerUnit), [&](Bitmap& im) {
+            Blit(g, im, rect);
+        });
+        if (st != ImageStatus::Pending) return;
+        Placeholder(g, src, rect);
+        cache.Request(src.id, [](std::function<void()> job) { ThreadPool::Shared().Submit(std::move(job)); }, BuildPyramid);
+    }
+
+    // Фигура с картинкой id убрана со сцены: её ещё не начатое раскодирование
+    // не нужно (если картинка снова понадобится, её закажут заново)
+    void Cancel(uint32_t id) {
+        Source src;
+        std::shared_ptr<Tiled> tiled;
+        if (Find(id, src, tiled) && src.kind == Kind::Cached) cache.Cancel(src.id);
+    }
+
+    // Места заглушек, чьи картинки с прошлого вызова раскодированы или
+    // импортированы (или не читаются)
+    std::vector<Area> TakeDecoded() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Area> out;
+        size_t keep = 0;
+        for (const Waiting& w : waiting) {
+            if (std::find(decoded.begin(), decoded.end(), w.source) != decoded.end()) out.push_back(Area{ w.bounds, w.source.kind == Kind::Tiled });
+            else waiting[keep++] = w;
+        }
+        waiting.resize(keep);
+        decoded.clear();
+        return out;
+    }
+
+    void SetBudget(size_t bytes) { cache.SetBudget(bytes); }
+    void SetTileBudget(size_t bytes) { tiles.SetBudget(bytes); }
+    ImageCache<Bitmap>::Stats Stats() { return cache.GetStats(); }
+    TiledTileCache<Bitmap>::Stats TileStats() { return tiles.GetStats(); }
+    size_t TiledCount() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tiledImages.size();
+    }
+
+    // Вызывать, когда фоновые потоки остановлены (TileRenderer::Quiesce).
+    // Ещё не начатые чтения файлов и раскодирования отменяются, идущие
+    // дожидаются; импорт в хранилище тайлов прерывается.
+    void Clear() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (const Item& it : items) {
+                if (it.reading) it.reading->state = Reading::Done; // прочитанное отдаст запись сам
+                else if (!it.tiled) cache.Release(it.entry);
             }
-            for (double y = -3000; y <= 3000; y += step) {
-                if (y == 0) continue;
-                float screenY = origin.Y - (float)y;
-                g.DrawLine(&axisPen, PointF(origin.X - 3, screenY), PointF(origin.X + 3, screenY));
-                wstring s = to_wstring((int)y);
-                g.DrawString(s.c_str(), -1, &font, PointF(origin.X + 5, screenY - 6), &brush);
+            fileRead.wait(lock, [this] { return reading == 0; });
+            for (uint32_t t = 0; t < (uint32_t)tiledImages.size(); t++) {
+                tiledImages[t]->cancelled = true;
+                tiles.Forget(t);
             }
+            items.clear();
+            tiledImages.clear();
+            waiting.clear();
+            decoded.clear();
         }
+        cache.WaitForJobs();
+    }
 
-        double start, end;
-        if (clipToRange) {
-            start = min(rangeStart, rangeEnd);
-            end = max(rangeStart, rangeEnd);
-            RectF clipRect((float)(origin.X + start), (float)(origin.Y - 100000), (float)(end - start), 200000.0f);
-            g.SetClip(clipRect, CombineModeIntersect);
+private:
+    // Файл вставки, который ещё не прочитан: Queued -> Running -> Done
+    // (Done и без чтения — вставку убрали)
+    struct Reading {
+        enum { Queued, Running, Done };
+        int state = Queued; // под mutex
+    };
+    struct Item {
+        uint32_t entry; // запись cache или номер в tiledImages
+        bool tiled;
+        wstring path;
+        std::shared_ptr<Reading> reading; // не пусто, пока файл читается; entry ещё нет
+    };
+    struct Tiled {
+        enum { Importing, Ready, Failed };
+        std::atomic<int> state{ Importing };
+        std::atomic<bool> cancelled{ false };
+        TiledImage image; // открыт в Ready
+    };
+    // Чего ждёт заглушка: записи cache, хранилища тайлов или чтения файла
+    // вставки (id — номер вставки)
+    enum class Kind : uint8_t { Cached, Tiled, Loading };
+    struct Source {
+        Kind kind;
+        uint32_t id;
+        bool operator==(const Source& o) const { return kind == o.kind && id == o.id; }
+    };
+    struct Waiting {
+        Source source;
+        BoundsF bounds; // заглушка в координатах сцены
+    };
+    std::mutex mutex;
+    std::vector<Item> items;
+    std::vector<std::shared_ptr<Tiled>> tiledImages; // задача импорта держит свою ссылку
+    std::vector<Waiting> waiting;
+    std::vector<Source> decoded; // готовые после последнего TakeDecoded
+    std::condition_variable fileRead; // под mutex: чтение файла закончено
+    size_t reading = 0;               // файлов читается сейчас
+    ImageCache<Bitmap> cache;
+    TiledTileCache<Bitmap> tiles;
+    HWND notify = NULL;
+
+    bool Find(uint32_t id, Source& src, std::shared_ptr<Tiled>& tiled) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (id >= items.size()) return false;
+        const Item& it = items[id];
+        if (it.reading) src = Source{ Kind::Loading, id };
+        else src = Source{ it.tiled ? Kind::Tiled : Kind::Cached, it.entry };
+        if (src.kind == Kind::Tiled) tiled = tiledImages[src.id];
+        return true;
+    }
+
+    // Чтение файла вставки id этим потоком, если его ещё никто не начал.
+    // true — прочитан, и у вставки есть запись cache; false — файл читает
+    // или прочитал другой поток, или вставку убрали.
+    bool ReadFile(uint32_t id, const std::shared_ptr<Reading>& r) {
+        wstring path;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (r->state != Reading::Queued) return false;
+            r->state = Reading::Running;
+            path = items[id].path;
+            reading++;
         }
-        else {
-            start = -50000.0; end = 50000.0;
+        std::vector<uint8_t> bytes;
+        FILE* f = _wfopen(path.c_str(), L"rb");
+        if (f) {
+            uint8_t buf[65536];
+            size_t n;
+            while ((n = fread(buf, 1, sizeof(buf), f)) > 0) bytes.insert(bytes.end(), buf, buf + n);
+            if (ferror(f)) bytes.clear();
+            fclose(f);
+        }
+        uint32_t entry = cache.Acquire(ToUtf8(path), std::move(bytes));
+        bool kept;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            kept = r->state == Reading::Running;
+            if (kept) {
+                items[id].entry = entry;
+                items[id].reading.reset();
+                r->state = Reading::Done;
+            }
+            else cache.Release(entry);
+            reading--;
         }
+        fileRead.notify_all();
+        return kept;
+    }
 
-        double step = 0.05;
+    // Ждущие пути (фоновые потоки, экспорт, запись документа): файл,
+    // чтение которого ещё не начато, читается здесь же, начатое — дожидается
+    void AwaitFile(uint32_t id) {
+        std::shared_ptr<Reading> r;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (id >= items.size() || !items[id].reading) return;
+            r = items[id].reading;
+        }
+        if (ReadFile(id, r)) {
+            OnDecoded(Source{ Kind::Loading, id });
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        fileRead.wait(lock, [&] { return r->state == Reading::Done; });
+    }
 
-        std::vector<std::vector<PointF>> segments;
-        std::vector<PointF> currentSegment;
+    static void Blit(Graphics& g, Bitmap& im, const RectF& rect) {
+        ImageAttributes attr;
+        attr.SetWrapMode(WrapModeTileFlipXY);
+        g.DrawImage(&im, rect, 0, 0, (REAL)im.GetWidth(), (REAL)im.GetHeight(), UnitPixel, &attr);
+    }
 
-        for (double xPix = start; xPix <= end; xPix += step) {
-            double yVal = MathParser::Evaluate(expression, xPix);
+    // Заглушка; место запоминается, чтобы перерисовать его, когда картинка будет готова
+    void Placeholder(Graphics& g, const Source& src, const RectF& rect) {
+        SolidBrush fill(Color(255, 236, 236, 236));
+        Pen frame(Color(255, 180, 180, 180), 0); // 0 — один пиксель при любом масштабе
+        g.FillRectangle(&fill, rect);
+        g.DrawRectangle(&frame, rect);
+        BoundsF b = { min(rect.X, rect.GetRight()), min(rect.Y, rect.GetBottom()), max(rect.X, rect.GetRight()), max(rect.Y, rect.GetBottom()) };
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const Waiting& w : waiting)
+            if (w.source == src && w.bounds.minX == b.minX && w.bounds.minY == b.minY && w.bounds.maxX == b.maxX && w.bounds.maxY == b.maxY) return;
+        waiting.push_back(Waiting{ src, b });
+    }
 
-            if (isnan(yVal) || isinf(yVal)) {
-                if (!currentSegment.empty()) { segments.push_back(currentSegment); currentSegment.clear(); }
-                continue;
-            }
+    // Поток, построивший пирамиду или хранилище: окно узнаёт об этом, если картинку ждёт заглушка
+    void OnDecoded(const Source& src) {
+        bool post = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            bool wanted = false;
+            for (const Waiting& w : waiting) wanted = wanted || w.source == src;
+            if (!wanted) return;
+            post = decoded.empty();
+            decoded.push_back(src);
+        }
+        if (post && notify) PostMessage(notify, WM_APP_IMAGES_READY, 0, 0);
+    }
 
-            float screenX = origin.X + (float)xPix;
-            float screenY = origin.Y - (float)yVal;
+    uint32_t Add(const wchar_t* path, std::vector<uint8_t>&& bytes) {
+        uint32_t entry = cache.Acquire(ToUtf8(path), std::move(bytes));
+        std::lock_guard<std::mutex> lock(mutex);
+        items.push_back(Item{ entry, false, path });
+        return (uint32_t)(items.size() - 1);
+    }
 
-            if (!currentSegment.empty()) {
-                float lastY = currentSegment.back().Y;
-                if (abs(screenY - lastY) > 2000.0f) {
-                    segments.push_back(currentSegment);
-                    currentSegment.clear();
-                }
+    // Размер читается из заголовка, картинка не раскодируется
+    static bool IsHuge(const wchar_t* path, const uint8_t* data, size_t size) {
+        ComScope com;
+        WicSource src;
+        return src.Open(path, data, size) && (uint64_t)src.Width() * src.Height() >= kTiledImagePixels;
+    }
+
+    // Хранилище тайлов картинки: имя — хэш файла (путь, размер, время записи)
+    // или содержимого, так что повторная вставка того же файла его находит
+    static wstring StorePath(const wchar_t* path, const uint8_t* data, size_t size) {
+        uint64_t key;
+        if (data) key = ContentHash(data, size);
+        else {
+            wstring id = path;
+            WIN32_FILE_ATTRIBUTE_DATA fa;
+            if (GetFileAttributesExW(path, GetFileExInfoStandard, &fa)) {
+                wchar_t stamp[64];
+                swprintf(stamp, 64, L"|%lu|%lu|%lu|%lu", fa.nFileSizeHigh, fa.nFileSizeLow, fa.ftLastWriteTime.dwHighDateTime, fa.ftLastWriteTime.dwLowDateTime);
+                id += stamp;
             }
-            currentSegment.push_back(PointF(screenX, screenY));
+            key = ContentHash((const uint8_t*)id.data(), id.size() * sizeof(wchar_t));
         }
-        if (!currentSegment.empty()) segments.push_back(currentSegment);
+        wstring dir = JournalDirectory() + L"\\Tiles";
+        CreateDirectory(dir.c_str(), NULL);
+        wchar_t name[32];
+        swprintf(name, 32, L"\\%016llx.ftiles", (unsigned long long)key);
+        return dir + name;
+    }
 
-        for (const auto& seg : segments) {
-            if (seg.size() > 1) {
-                g.DrawLines(&pen, seg.data(), (INT)seg.size());
+    uint32_t AddTiled(const wchar_t* path, const uint8_t* data, size_t size) {
+        std::shared_ptr<Tiled> t = std::make_shared<Tiled>();
+        wstring store = StorePath(path, data, size);
+        uint32_t index, id;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            index = (uint32_t)tiledImages.size();
+            tiledImages.push_back(t);
+            items.push_back(Item{ index, true, path });
+            id = (uint32_t)(items.size() - 1);
+        }
+        if (t->image.Open(store.c_str())) {
+            t->state = Tiled::Ready;
+            return id;
+        }
+        // Импорт в фоне; картинка из документа копируется (отображение документа закроется)
+        std::shared_ptr<std::vector<uint8_t>> bytes;
+        if (data) bytes = std::make_shared<std::vector<uint8_t>>(data, data + size);
+        wstring file = path;
+        ThreadPool::Shared().Submit([this, t, index, store, file, bytes] {
+            bool ok = Import(*t, store, file, bytes.get());
+            t->state = ok ? Tiled::Ready : Tiled::Failed;
+            if (!t->cancelled) OnDecoded(Source{ Kind::Tiled, index });
+        });
+        return id;
+    }
+
+    // Фоновый поток: картинка полосами в хранилище
+    static bool Import(Tiled& t, const wstring& store, const wstring& file, const std::vector<uint8_t>* bytes) {
+        ComScope com;
+        WicSource src;
+        if (!src.Open(file.c_str(), bytes ? bytes->data() : nullptr, bytes ? bytes->size() : 0)) return false;
+        TiledImageWriter writer;
+        if (!writer.Begin(store.c_str(), src.Width(), src.Height())) return false;
+        std::vector<uint32_t> rows((size_t)src.Width() * kTiledImportRows);
+        for (UINT y = 0; y < src.Height(); y += kTiledImportRows) {
+            if (t.cancelled) return false; // writer удалит недописанный файл
+            UINT n = min(kTiledImportRows, src.Height() - y);
+            if (!src.Rows(y, n, rows.data()) || !writer.Rows(rows.data(), src.Width(), n)) return false;
+        }
+        return writer.Finish() && t.image.Open(store.c_str());
+    }
+
+    // Видимые тайлы уровня, подходящего к масштабу; пока идёт импорт — заглушка
+    void DrawTiled(Graphics& g, uint32_t index, Tiled& t, const RectF& rect, float pixelsPerUnit) {
+        int state = t.state;
+        if (state == Tiled::Failed) return;
+        if (state == Tiled::Importing) {
+            Placeholder(g, Source{ Kind::Tiled, index }, rect);
+            return;
+        }
+        if (rect.Width <= 0 || rect.Height <= 0) return;
+        const TiledImage& im = t.image;
+        int level = im.PickLevel(rect.Width * pixelsPerUnit, rect.Height * pixelsPerUnit);
+        const tiledimg::Level& lv = im.Level(level);
+        double sx = lv.width / rect.Width, sy = lv.height / rect.Height; // пикселей уровня на единицу сцены
+
+        RectF vis;
+        g.GetVisibleClipBounds(&vis);
+        double u0 = (max(vis.X, rect.X) - rect.X) * sx, u1 = (min(vis.GetRight(), rect.GetRight()) - rect.X) * sx;
+        double v0 = (max(vis.Y, rect.Y) - rect.Y) * sy, v1 = (min(vis.GetBottom(), rect.GetBottom()) - rect.Y) * sy;
+        if (u1 <= u0 || v1 <= v0) return;
+        uint32_t tx0 = (uint32_t)(u0 / kImageTileSize), tx1 = min(lv.tilesX - 1, (uint32_t)(u1 / kImageTileSize));
+        uint32_t ty0 = (uint32_t)(v0 / kImageTileSize), ty1 = min(lv.tilesY - 1, (uint32_t)(v1 / kImageTileSize));
+
+        ImageAttributes attr;
+        attr.SetWrapMode(WrapModeTileFlipXY);
+        for (uint32_t ty = ty0; ty <= ty1; ty++)
+            for (uint32_t tx = tx0; tx <= tx1; tx++) {
+                uint32_t w = min((uint32_t)kImageTileSize, lv.width - tx * kImageTileSize);
+                uint32_t h = min((uint32_t)kImageTileSize, lv.height - ty * kImageTileSize);
+                RectF dest((REAL)(rect.X + tx * kImageTileSize / sx), (REAL)(rect.Y + ty * kImageTileSize / sy), (REAL)(w / sx), (REAL)(h / sy));
+                tiles.Draw(TiledTileKey{ index, level, tx, ty },
+                    [&] {
+                        // Копия из отображения: страницы файла остаются кэшем ОС, а не памятью процесса
+                        std::unique_ptr<Bitmap> bmp(new Bitmap(kImageTileSize, kImageTileSize, PixelFormat32bppPARGB));
+                        Rect all(0, 0, kImageTileSize, kImageTileSize);
+                        BitmapData data;
+                        if (bmp->LockBits(&all, ImageLockModeWrite, PixelFormat32bppPARGB, &data) != Ok) return std::unique_ptr<Bitmap>();
+                        const uint32_t* src = im.Tile(level, tx, ty);
+                        for (int y = 0; y < kImageTileSize; y++)
+                            memcpy((uint8_t*)data.Scan0 + (size_t)y * data.Stride, src + (size_t)y * kImageTileSize, kImageTileSize * 4);
+                        bmp->UnlockBits(&data);
+                        return bmp;
+                    },
+                    [&](Bitmap& bmp) { g.DrawImage(&bmp, dest, 0, 0, (REAL)w, (REAL)h, UnitPixel, &attr); });
             }
+    }
+};
+
+// Рисуемый штрих кисти (фигуры сцены выводит GdiplusBackend)
+void DrawStroke(Graphics& g, Pen& pen, const PointF* pts, size_t n) {
+    ForEachStrokePiece(pts, n, [&](const PointF* p, size_t m) {
+        if (m >= 2) g.DrawCurve(&pen, p, (INT)m);
+    });
+}
+
+void SetupStrokePen(Pen& pen) {
+    pen.SetStartCap(LineCapRound);
+    pen.SetEndCap(LineCapRound);
+    pen.SetLineJoin(LineJoinRound);
+}
+
+// Растры подписей осей графиков, общие для всех GdiplusBackend
+LabelAtlas<Bitmap> g_Labels;
+
+// Подпись шрифтом Arial 8 пт в растр по её размеру (DrawString разово,
+// дальше растр берётся из g_Labels)
+std::unique_ptr<Bitmap> RasterizeLabel(const char* text, uint32_t argb) {
+    wstring s(text, text + strlen(text));
+    Font font(L"Arial", 8);
+    Bitmap probe(1, 1, PixelFormat32bppPARGB);
+    RectF box;
+    Graphics(&probe).MeasureString(s.c_str(), -1, &font, PointF(0, 0), &box);
+    int w = (std::max)(1, (int)ceilf(box.Width)), h = (std::max)(1, (int)ceilf(box.Height));
+    std::unique_ptr<Bitmap> bmp(new Bitmap(w, h, PixelFormat32bppPARGB));
+    Graphics g(bmp.get());
+    g.Clear(Color(0, 0, 0, 0));
+    g.SetTextRenderingHint(TextRenderingHintAntiAliasGridFit);
+    SolidBrush brush{ Color(argb) };
+    if (g.DrawString(s.c_str(), -1, &font, PointF(0, 0), &brush) != Ok) return std::unique_ptr<Bitmap>();
+    return bmp;
+}
+
+// Вывод фигур (RenderBackend.h) через GDI+. Преобразование и отсечение
+// задаёт вызывающий у Graphics. Перья переиспользуются между соседними
+// фигурами: у подряд идущих штрихов обычно одинаковые цвет и толщина.
+class GdiplusBackend : public RenderBackend {
+public:
+    // waitImages == false — поток интерфейса: неготовые картинки не
+    // раскодируются на месте, а заказываются (ImageTable::DrawOrRequest)
+    GdiplusBackend(Graphics& graphics, ImageTable& table, bool waitImages = true)
+        : g(graphics), images(table), waitImages(waitImages), outline(Color(255, 0, 0, 0), 1.0f), round(Color(255, 0, 0, 0), 1.0f) {
+        SetupStrokePen(round);
+    }
+
+    float PixelsPerUnit() const override {
+        Matrix m;
+        g.GetTransform(&m);
+        REAL el[6];
+        m.GetElements(el);
+        return el[0];
+    }
+
+    BoundsF VisibleBounds() const override {
+        RectF vis;
+        g.GetVisibleClipBounds(&vis);
+        return BoundsF{ vis.X, vis.Y, vis.GetRight(), vis.GetBottom() };
+    }
+
+    void Curve(const ScenePoint* pts, size_t n, uint32_t argb, float width) override {
+        g.DrawCurve(&Use(round, roundStyle, argb, width), (const PointF*)pts, (INT)n);
+    }
+
+    void Lines(const ScenePoint* pts, size_t n, uint32_t argb, float width) override {
+        Pen& pen = Use(outline, outlineStyle, argb, width);
+        if (n == 2) g.DrawLine(&pen, pts[0].X, pts[0].Y, pts[1].X, pts[1].Y);
+        else g.DrawLines(&pen, (const PointF*)pts, (INT)n);
+    }
+
+    void Polygon(const ScenePoint* pts, size_t n, uint32_t argb, float width) override {
+        g.DrawPolygon(&Use(outline, outlineStyle, argb, width), (const PointF*)pts, (INT)n);
+    }
+
+    void Ellipse(float x, float y, float w, float h, uint32_t argb, float width) override {
+        g.DrawEllipse(&Use(outline, outlineStyle, argb, width), x, y, w, h);
+    }
+
+    void Image(uint32_t image, float x, float y, float w, float h) override {
+        if (waitImages) images.Draw(g, image, RectF(x, y, w, h), PixelsPerUnit());
+        else images.DrawOrRequest(g, image, RectF(x, y, w, h), PixelsPerUnit());
+    }
+
+    // Подпись из атласа g_Labels: растр копируется без масштаба в пиксели
+    // устройства, ближайшие к мировой точке (x, y)
+    void Label(const char* text, float x, float y, uint32_t argb) override {
+        Matrix m;
+        g.GetTransform(&m);
+        PointF p(x, y);
+        m.TransformPoints(&p);
+        g_Labels.Draw(text, argb, [&] { return RasterizeLabel(text, argb); }, [&](Bitmap& bmp) {
+            g.ResetTransform();
+            g.DrawImage(&bmp, (INT)floorf(p.X + 0.5f), (INT)floorf(p.Y + 0.5f));
+            g.SetTransform(&m);
+        });
+    }
+
+    // Отсечение вызывающего (например, область перерисовки) восстанавливается в PopClip
+    void PushClip(const BoundsF& b) override {
+        saved.emplace_back(new Region());
+        g.GetClip(saved.back().get());
+        g.SetClip(RectF(b.minX, b.minY, b.maxX - b.minX, b.maxY - b.minY), CombineModeIntersect);
+    }
+
+    void PopClip() override {
+        if (saved.empty()) return;
+        g.SetClip(saved.back().get());
+        saved.pop_back();
+    }
+
+private:
+    struct Style { uint32_t color = 0xFF000000; float width = 1.0f; };
+
+    Graphics& g;
+    ImageTable& images;
+    bool waitImages;
+    Pen outline, round;
+    Style outlineStyle, roundStyle;
+    std::vector<std::unique_ptr<Region>> saved;
+
+    static Pen& Use(Pen& pen, Style& st, uint32_t color, float width) {
+        if (st.color != color) { pen.SetColor(Color(color)); st.color = color; }
+        if (st.width != width) { pen.SetWidth(width); st.width = width; }
+        return pen;
+    }
+};
+
+// Рисует фигуры сцены по id через GDI+. times != nullptr — время и число
+// фигур складываются по типам (замеры кадров, FrameStats.h)
+class SceneRenderer {
+public:
+    SceneRenderer(Graphics& graphics, ImageTable& table, bool waitImages = true, ShapeTimes* times = nullptr)
+        : out(graphics, table, waitImages), times(times) {}
+
+    void Draw(const SceneStore& s, uint32_t id) {
+        if (!times) {
+            DrawShape(out, s, id);
+            return;
         }
+        double t0 = FrameClock();
+        DrawShape(out, s, id);
+        times->Add(s.order[id].kind, FrameClock() - t0);
+    }
 
-        if (clipToRange) g.ResetClip();
+    void DrawAll(const SceneStore& s) {
+        if (!times) DrawScene(out, s);
+        else for (uint32_t id = 0; id < (uint32_t)s.Size(); id++) Draw(s, id);
     }
+
+    void DrawFunction(FunctionPlot& f) { ::DrawFunction(out, f); }
+
+private:
+    GdiplusBackend out;
+    ShapeTimes* times;
 };
 
 // -------------------------------------------------------------------------
@@ -353,7 +834,18 @@ struct AppState {
     float currentWidth = 2.0f;
     float eraserSize = 20.0f;
     int eraserMenuID = ID_ERASER_M;
-    std::vector<Shape*> shapes;
+    SceneStore scene;                 // все зафиксированные фигуры
+    SpatialIndex shapeIndex;          // габариты фигур scene, id — позиция в порядке отрисовки
+    std::mutex sceneMutex;            // scene и shapeIndex читают потоки тайлов
+
+    // Штрих кисти, который ещё рисуется
+    bool strokeActive = false;
+    std::vector<PointF> strokePoints;
+    Color strokeColor;
+    float strokeWidth = 0;
+    StrokeSimplifier strokeFilter;    // прореживает strokePoints на лету
+    EraserPath eraser;                // путь ластика за текущее нажатие
+    RECT previewRect = { 0, 0, 0, 0 }; // где на экране был предпросмотр инструмента
     bool isDrawing = false;
     bool isPanning = false;
 
@@ -365,12 +857,18 @@ struct AppState {
     double funcStart = -300, funcEnd = 300;
     bool funcShowAxes = true;
     bool funcClip = true;
+    std::unique_ptr<FunctionPlot> funcPreview; // график под курсором до размещения (T_FUNC_PLACE)
 
     wstring imagePath;
 
     float zoom = 1.0f;
     float offsetX = 0.0f;
     float offsetY = 0.0f;
+
+    DWORD plotCacheMB = 64;  // бюджет кэша графиков функций (PlotCacheMB в реестре)
+    DWORD tileCacheMB = 128; // бюджет кэша тайлов холста (TileCacheMB в реестре)
+    DWORD imageCacheMB = 256; // бюджет пирамид картинок (ImageCacheMB в реестре)
+    DWORD imageTilesMB = 128; // бюджет тайлов огромных картинок (ImageTilesMB в реестре)
 } appState;
 
 struct FuncParams {
@@ -382,6 +880,273 @@ struct FuncParams {
     BOOL resultOK;
 } g_FuncParams;
 
+ImageTable g_Images;
+FrameStats g_FrameStats; // замеры кадров окна, включаются из меню (F3)
+SceneJournal g_Journal; // журнал изменений сцены для восстановления после сбоя
+SceneHistory g_History; // отмена и повтор
+
+// -------------------------------------------------------------------------
+// 4.1. Тайловый рендер
+// -------------------------------------------------------------------------
+// Зафиксированные фигуры растеризуются фоновыми потоками в тайлы по уровням
+// масштаба (TileCache.h). Поток интерфейса только собирает кадр из готовых
+// тайлов; недостающие временно заменяются масштабированными тайлами
+// соседних уровней. Фигуры, добавленные после рендера тайла, дорисовываются
+// поверх векторно, а сам тайл заказывается заново.
+// Потоки под sceneMutex копируют нужные фигуры в свой SceneStore; графики
+// и картинки разделяются, поэтому удалять их можно только после Quiesce().
+class TileRenderer {
+public:
+    void Init(HWND hWnd, size_t budgetBytes) {
+        notify = hWnd;
+        cache.SetBudget(budgetBytes);
+    }
+
+    // Собирает видимые тайлы текущего уровня в g (координаты устройства)
+    void Compose(Graphics& g, const BoundsF& view) {
+        TileRange r = TileRange::Covering(TileLevelFor(appState.zoom), view);
+        {
+            std::lock_guard<std::mutex> lock(viewMutex);
+            wanted = r;
+        }
+        for (int32_t ty = r.ty0; ty <= r.ty1; ty++)
+            for (int32_t tx = r.tx0; tx <= r.tx1; tx++) ComposeTile(g, TileKey{ r.level, tx, ty });
+    }
+
+    // Один тайл: готовый растр, иначе замена с соседних уровней; затем
+    // фигуры новее тайла. Отсутствующий или устаревший тайл заказывается.
+    void ComposeTile(Graphics& g, const TileKey& k) {
+        BoundsF wb = TileWorldBounds(k);
+        RectF dest = DeviceRect(wb);
+        g.SetClip(dest);
+
+        size_t have = 0; // фигуры [0, have) уже на картинке
+        bool drawn = false;
+        if (const TileCache<Bitmap>::Entry* e = cache.Find(k)) {
+            DrawTile(g, *e->image, dest);
+            have = e->count;
+            drawn = true;
+        }
+        else {
+            SolidBrush white(Color(255, 255, 255, 255));
+            g.FillRectangle(&white, dest);
+            drawn = DrawFallback(g, k.level, wb, have);
+            Request(k);
+        }
+
+        if (drawn && have < appState.scene.Size()) {
+            {
+                std::lock_guard<std::mutex> lock(appState.sceneMutex);
+                appState.shapeIndex.Query(wb, ids);
+            }
+            Matrix matrix;
+            matrix.Translate(appState.offsetX, appState.offsetY);
+            matrix.Scale(appState.zoom, appState.zoom);
+            g.SetTransform(&matrix);
+            SceneRenderer renderer(g, g_Images, false, g_FrameStats.Shapes());
+            bool newer = false;
+            for (auto id : ids) {
+                if (id < have) continue;
+                renderer.Draw(appState.scene, id);
+                newer = true;
+            }
+            g.ResetTransform();
+            if (newer) Request(k);
+        }
+        g.ResetClip();
+    }
+
+    // Видимый тайл, задетый новой фигурой, перерендеривается сразу
+    void OnShapeAdded(const BoundsF& b) {
+        TileRange r;
+        {
+            std::lock_guard<std::mutex> lock(viewMutex);
+            r = wanted;
+        }
+        std::vector<TileKey> hit;
+        cache.ForEachIntersecting(b, [&](const TileKey& k, const TileCache<Bitmap>::Entry&) {
+            if (r.Contains(k)) hit.push_back(k);
+        });
+        for (auto& k : hit) Request(k);
+    }
+
+    // Фигуры в b изменены или стёрты: задетые тайлы всех уровней выбрасываются,
+    // видимые заказываются заново
+    void OnShapesChanged(const BoundsF& b) {
+        cache.Invalidate(b);
+        TileRange r;
+        {
+            std::lock_guard<std::mutex> lock(viewMutex);
+            r = wanted;
+        }
+        TileRange hit = TileRange::Covering(r.level, b);
+        for (int32_t ty = max(r.ty0, hit.ty0); ty <= min(r.ty1, hit.ty1); ty++)
+            for (int32_t tx = max(r.tx0, hit.tx0); tx <= min(r.tx1, hit.tx1); tx++) Request(TileKey{ r.level, tx, ty });
+    }
+
+    // Забирает готовые тайлы в кэш; возвращает те, что видны сейчас
+    std::vector<TileKey> TakeReady() {
+        std::vector<Result> done;
+        {
+            std::lock_guard<std::mutex> lock(readyMutex);
+            done.swap(ready);
+        }
+        std::vector<TileKey> visible;
+        for (auto& r : done) {
+            if (r.generation != generation) continue;
+            bool stale = cache.IsStale(r.key);
+            cache.SetPending(r.key, false);
+            if (!r.image) continue;
+            if (stale) {
+                if (wanted.Contains(r.key)) Request(r.key);
+                continue;
+            }
+            cache.Store(r.key, r.image, (size_t)kTileSize * kTileSize * 4, r.count);
+            if (wanted.Contains(r.key)) visible.push_back(r.key);
+        }
+        return visible;
+    }
+
+    // Экранный прямоугольник тайла при текущем виде
+    RectF DeviceRect(const BoundsF& wb) const {
+        return RectF(wb.minX * appState.zoom + appState.offsetX, wb.minY * appState.zoom + appState.offsetY,
+            (wb.maxX - wb.minX) * appState.zoom, (wb.maxY - wb.minY) * appState.zoom);
+    }
+
+    // Дождаться потоков, которые ещё держат указатели на фигуры
+    void Quiesce() {
+        generation++;
+        std::unique_lock<std::mutex> lock(flightMutex);
+        idle.wait(lock, [this] { return inFlight == 0; });
+    }
+
+    // Сцена очищена: все тайлы недействительны
+    void Clear() {
+        Quiesce();
+        cache.Clear();
+        cache.ClearPending();
+        std::lock_guard<std::mutex> lock(readyMutex);
+        ready.clear();
+    }
+
+private:
+    struct Result {
+        TileKey key;
+        uint64_t generation;
+        std::shared_ptr<Bitmap> image; // nullptr — заказ отменён
+        size_t count;
+    };
+
+    TileCache<Bitmap> cache;           // только поток интерфейса
+    std::vector<SpatialIndex::Id> ids;
+    HWND notify = NULL;
+    std::atomic<uint64_t> generation{ 0 };
+
+    std::mutex viewMutex;
+    TileRange wanted = { 0, 0, 0, -1, -1 };
+
+    std::mutex readyMutex;
+    std::vector<Result> ready;
+
+    std::mutex flightMutex;
+    std::condition_variable idle;
+    size_t inFlight = 0;
+
+    void Request(const TileKey& k) {
+        if (cache.IsPending(k)) return;
+        cache.SetPending(k, true);
+        {
+            std::lock_guard<std::mutex> lock(flightMutex);
+            inFlight++;
+        }
+        uint64_t gen = generation;
+        ThreadPool::Shared().Submit([this, k, gen] { Render(k, gen); });
+    }
+
+    // Фоновый поток
+    void Render(TileKey k, uint64_t gen) {
+        Result r{ k, gen, nullptr, 0 };
+        bool stillWanted;
+        {
+            std::lock_guard<std::mutex> lock(viewMutex);
+            stillWanted = wanted.Contains(k);
+        }
+        if (gen == generation && stillWanted) {
+            BoundsF wb = TileWorldBounds(k);
+            double scale = TileLevelScale(k.level);
+            BoundsF area = wb;
+            area.Inflate((float)(2 / scale));
+
+            // Копия нужной части сцены: массивы могут перевыделиться при добавлении
+            SceneStore slice;
+            ShapeTimes times;
+            {
+                std::lock_guard<std::mutex> lock(appState.sceneMutex);
+                std::vector<SpatialIndex::Id> found;
+                appState.shapeIndex.Query(area, found);
+                slice.AppendFrom(appState.scene, found);
+                r.count = appState.scene.Size();
+                times.culled = (uint32_t)(appState.scene.Size() - appState.scene.Erased() - found.size());
+            }
+            bool stats = g_FrameStats.Enabled();
+
+            std::shared_ptr<Bitmap> bmp = std::make_shared<Bitmap>(kTileSize, kTileSize, PixelFormat32bppPARGB);
+            {
+                Graphics g(bmp.get());
+                g.SetSmoothingMode(SmoothingModeAntiAlias);
+                g.Clear(Color(255, 255, 255, 255));
+                Matrix matrix;
+                matrix.Translate((REAL)(-(double)k.tx * kTileSize), (REAL)(-(double)k.ty * kTileSize));
+                matrix.Scale((REAL)scale, (REAL)scale);
+                g.SetTransform(&matrix);
+                SceneRenderer(g, g_Images, true, stats ? &times : nullptr).DrawAll(slice);
+            }
+            r.image = bmp;
+            if (stats) g_FrameStats.AddTile(times);
+        }
+
+        bool first;
+        {
+            std::lock_guard<std::mutex> lock(readyMutex);
+            first = ready.empty();
+            ready.push_back(r);
+        }
+        if (first) PostMessage(notify, WM_APP_TILES_READY, 0, 0);
+
+        std::lock_guard<std::mutex> lock(flightMutex);
+        if (--inFlight == 0) idle.notify_all();
+    }
+
+    void DrawTile(Graphics& g, Bitmap& image, const RectF& dest) {
+        // Края тайла не смешиваются с прозрачным фоном при масштабировании
+        ImageAttributes attr;
+        attr.SetWrapMode(WrapModeTileFlipXY);
+        g.DrawImage(&image, dest, 0, 0, (REAL)kTileSize, (REAL)kTileSize, UnitPixel, &attr);
+    }
+
+    // Тайлы соседних уровней (до октавы в обе стороны), ближние рисуются
+    // последними. have — наименьшее число фигур среди нарисованных.
+    bool DrawFallback(Graphics& g, int level, const BoundsF& wb, size_t& have) {
+        bool drawn = false;
+        have = appState.scene.Size();
+        for (int d = 4; d >= 1; d--) {
+            for (int sign = -1; sign <= 1; sign += 2) {
+                TileRange r = TileRange::Covering(level + sign * d, wb);
+                for (int32_t ty = r.ty0; ty <= r.ty1; ty++)
+                    for (int32_t tx = r.tx0; tx <= r.tx1; tx++) {
+                        TileKey k{ r.level, tx, ty };
+                        const TileCache<Bitmap>::Entry* e = cache.Find(k);
+                        if (!e) continue;
+                        DrawTile(g, *e->image, DeviceRect(TileWorldBounds(k)));
+                        have = min(have, e->count);
+                        drawn = true;
+                    }
+            }
+        }
+        return drawn;
+    }
+} g_Tiles;
+
 // -------------------------------------------------------------------------
 // 5. Вспомогательные функции
 // -------------------------------------------------------------------------
@@ -407,6 +1172,147 @@ PointF ScreenToWorld(int sx, int sy) {
     return PointF((sx - appState.offsetX) / appState.zoom, (sy - appState.offsetY) / appState.zoom);
 }
 
+// Видимая мировая область окна w x h с запасом в пару пикселей на сглаживание
+BoundsF VisibleWorldRect(int w, int h) {
+    PointF a = ScreenToWorld(0, 0), b = ScreenToWorld(w, h);
+    BoundsF r{ a.X, a.Y, b.X, b.Y };
+    r.Inflate(2.0f / appState.zoom);
+    return r;
+}
+
+// Пути в документе и журнале хранятся в UTF-8
+string ToUtf8(const wstring& w) {
+    int n = WideCharToMultiByte(CP_UTF8, 0, w.c_str(), (int)w.size(), NULL, 0, NULL, NULL);
+    string s(n, '\0');
+    if (n > 0) WideCharToMultiByte(CP_UTF8, 0, w.c_str(), (int)w.size(), &s[0], n, NULL, NULL);
+    return s;
+}
+
+wstring FromCodePage(UINT codePage, const string& s) {
+    int n = MultiByteToWideChar(codePage, 0, s.c_str(), (int)s.size(), NULL, 0);
+    wstring w(n, L'\0');
+    if (n > 0) MultiByteToWideChar(codePage, 0, s.c_str(), (int)s.size(), &w[0], n);
+    return w;
+}
+
+// Путь картинки сцены для журнала
+string ImagePathUtf8(uint32_t image) {
+    return ToUtf8(g_Images.Path(image));
+}
+
+// Все изменения сцены идут через эти функции, чтобы индекс и тайлы не отставали.
+// add(scene) добавляет одну фигуру и возвращает её id.
+template <class F>
+uint32_t AddToScene(F add) {
+    uint32_t id;
+    BoundsF b;
+    {
+        std::lock_guard<std::mutex> lock(appState.sceneMutex);
+        id = add(appState.scene);
+        b = appState.scene.Bounds(id);
+        appState.shapeIndex.Insert(id, b);
+        g_Journal.Added(appState.scene, id, ImagePathUtf8);
+        g_History.Begin();
+        g_History.Added(id);
+        g_History.Commit();
+    }
+    g_Tiles.OnShapeAdded(b);
+    return id;
+}
+
+// Сцена заменяется целиком (открытие документа): история и картинки забываются
+void ClearScene() {
+    g_Tiles.Clear(); // потоки тайлов больше не обращаются к фигурам
+    std::lock_guard<std::mutex> lock(appState.sceneMutex);
+    appState.scene.Clear();
+    appState.shapeIndex.Clear();
+    g_History.Reset();
+    g_Journal.Reset(); // до картинок: начатый снимок журнала ещё читает их
+    g_Images.Clear();
+}
+
+// Мировой прямоугольник -> экранный, с запасом на сглаживание и перо предпросмотра
+RECT WorldToDeviceRect(const BoundsF& b) {
+    const float lim = (float)(1 << 24);
+    auto dev = [lim](float v, float scale, float offset) { return max(-lim, min(lim, v * scale + offset)); };
+    RECT r;
+    r.left = (LONG)floor(dev(b.minX, appState.zoom, appState.offsetX)) - 2;
+    r.top = (LONG)floor(dev(b.minY, appState.zoom, appState.offsetY)) - 2;
+    r.right = (LONG)ceil(dev(b.maxX, appState.zoom, appState.offsetX)) + 3;
+    r.bottom = (LONG)ceil(dev(b.maxY, appState.zoom, appState.offsetY)) + 3;
+    return r;
+}
+
+// Пометить область окна как повреждённую; WM_PAINT перерисует только объединение таких областей
+void InvalidateDevice(HWND hWnd, const RECT& r) {
+    if (r.right > r.left && r.bottom > r.top) InvalidateRect(hWnd, &r, FALSE);
+}
+
+void InvalidateWorld(HWND hWnd, const BoundsF& b) {
+    if (b.minX <= b.maxX && b.minY <= b.maxY) InvalidateDevice(hWnd, WorldToDeviceRect(b));
+}
+
+// Предварительный график пересоздаётся только при смене выражения, диапазона
+// или отсечения: его кэш точек переживает движение мыши и перерисовки
+void PrepareFuncPreview() {
+    const FunctionPlot* f = appState.funcPreview.get();
+    if (!f || f->expression != appState.funcExpr || f->rangeStart != appState.funcStart ||
+        f->rangeEnd != appState.funcEnd || f->clipToRange != appState.funcClip) {
+        appState.funcPreview.reset(new FunctionPlot(appState.funcExpr, appState.funcStart, appState.funcEnd,
+            0, 0, Color(100, 0, 0, 200).GetValue(), 1.0f, false, appState.funcClip));
+    }
+    appState.funcPreview->originX = appState.currentPoint.X;
+    appState.funcPreview->originY = appState.currentPoint.Y;
+}
+
+// Экранная область предпросмотра текущего инструмента (круг ластика, рамка фигуры,
+// график перед размещением). Рисуемый штрих сюда не входит.
+RECT PreviewDeviceRect(HWND hWnd) {
+    RECT r = { 0, 0, 0, 0 };
+    const PointF& p = appState.currentPoint;
+    if (appState.currentTool == T_FUNC_PLACE) {
+        // Пунктирные оси ±1000 пикселей и видимая часть кривой: точки те же,
+        // что возьмёт из кэша WM_PAINT
+        float axLen = 1000.0f / appState.zoom;
+        BoundsF b{ p.X - axLen, p.Y - axLen, p.X + axLen, p.Y + axLen };
+        RECT client;
+        GetClientRect(hWnd, &client);
+        BoundsF curve = FunctionCurveBounds(*appState.funcPreview, appState.zoom, VisibleWorldRect(client.right, client.bottom));
+        if (curve.minX <= curve.maxX) b.Include(curve);
+        return WorldToDeviceRect(b);
+    }
+    if (appState.currentTool == T_ERASER) {
+        float half = appState.eraserSize / appState.zoom / 2;
+        return WorldToDeviceRect(BoundsF{ p.X - half, p.Y - half, p.X + half, p.Y + half });
+    }
+    if (appState.isDrawing && appState.currentTool != T_PEN) {
+        BoundsF b = BoundsF::Empty();
+        b.Include(appState.startPoint.X, appState.startPoint.Y);
+        b.Include(p.X, p.Y);
+        return WorldToDeviceRect(b);
+    }
+    return r;
+}
+
+// Стирает предпросмотр на старом месте и рисует на новом
+void UpdatePreview(HWND hWnd) {
+    RECT now = PreviewDeviceRect(hWnd);
+    InvalidateDevice(hWnd, appState.previewRect);
+    InvalidateDevice(hWnd, now);
+    appState.previewRect = now;
+}
+
+// Числовая настройка из HKCU\Software\MyGDIPlusPaint (если не задана — значение по умолчанию)
+DWORD ReadSettingDword(const wchar_t* name, DWORD defValue) {
+    HKEY hKey;
+    DWORD value = defValue, size = sizeof(value), type = 0;
+    if (RegOpenKeyEx(HKEY_CURRENT_USER, SETTINGS_PATH, 0, KEY_READ, &hKey) == ERROR_SUCCESS) {
+        if (RegQueryValueEx(hKey, name, NULL, &type, (BYTE*)&value, &size) != ERROR_SUCCESS || type != REG_DWORD) value = defValue;
+        RegCloseKey(hKey);
+    }
+    return value;
+}
+
 // Проверка, включен ли автозапуск
 bool IsAutorunEnabled() {
     HKEY hKey;
@@ -450,6 +1356,644 @@ void SelectColor(HWND hWnd) {
     }
 }
 
+// -------------------------------------------------------------------------
+// 5.1. Слой зафиксированных фигур
+// -------------------------------------------------------------------------
+// Растр всех фигур appState.scene при текущем виде. При смене вида
+// (панорамирование, масштаб), очистке или изменении размера окна слой
+// собирается из тайлов g_Tiles; новые фигуры дорисовываются поверх векторно.
+struct SceneLayer {
+    HDC hdc = NULL;
+    HBITMAP hbm = NULL, hbmOld = NULL;
+    int width = 0, height = 0;
+    bool valid = false;
+    size_t committed = 0; // сколько фигур уже нарисовано на слое
+    float zoom = 0, offsetX = 0, offsetY = 0;
+
+    void Resize(HDC ref, int w, int h) {
+        Release();
+        width = w;
+        height = h;
+        hdc = CreateCompatibleDC(ref);
+        hbm = CreateCompatibleBitmap(ref, w, h);
+        hbmOld = (HBITMAP)SelectObject(hdc, hbm);
+        valid = false;
+    }
+
+    void Release() {
+        if (hdc) {
+            SelectObject(hdc, hbmOld);
+            DeleteObject(hbm);
+            DeleteDC(hdc);
+        }
+        hdc = NULL;
+        hbm = hbmOld = NULL;
+        valid = false;
+    }
+
+    void Invalidate() { valid = false; }
+
+    // Доводит слой до текущего состояния сцены
+    void Update() {
+        if (!hdc) return;
+        bool viewChanged = zoom != appState.zoom || offsetX != appState.offsetX || offsetY != appState.offsetY;
+        if (valid && !viewChanged && committed == appState.scene.Size()) return;
+
+        Graphics g(hdc);
+        BoundsF view = VisibleWorldRect(width, height);
+        if (!valid || viewChanged || committed > appState.scene.Size()) {
+            g.Clear(Color(255, 255, 255, 255));
+            PrepareForTiles(g);
+            g_Tiles.Compose(g, view);
+        }
+        else {
+            // Рисуются только новые фигуры, задевающие окно
+            g.SetSmoothingMode(SmoothingModeAntiAlias);
+            Matrix matrix;
+            matrix.Translate(appState.offsetX, appState.offsetY);
+            matrix.Scale(appState.zoom, appState.zoom);
+            g.SetTransform(&matrix);
+            ShapeTimes* times = g_FrameStats.Shapes();
+            SceneRenderer renderer(g, g_Images, false, times);
+            for (size_t i = committed; i < appState.scene.Size(); i++) {
+                if (appState.shapeIndex.Bounds((SpatialIndex::Id)i).Intersects(view)) renderer.Draw(appState.scene, (uint32_t)i);
+                else if (times) times->culled++;
+            }
+        }
+
+        committed = appState.scene.Size();
+        zoom = appState.zoom;
+        offsetX = appState.offsetX;
+        offsetY = appState.offsetY;
+        valid = true;
+    }
+
+    // Фигуры в b изменены или стёрты: участок слоя перерисовывается векторно,
+    // пока тайлы не пришли заново
+    void Redraw(const BoundsF& b) {
+        if (!hdc) return;
+        Update();
+        RECT rc = WorldToDeviceRect(b);
+        rc.left = max(rc.left, 0L);
+        rc.top = max(rc.top, 0L);
+        rc.right = min(rc.right, (LONG)width);
+        rc.bottom = min(rc.bottom, (LONG)height);
+        if (rc.right <= rc.left || rc.bottom <= rc.top) return;
+
+        std::vector<SpatialIndex::Id> ids;
+        {
+            std::lock_guard<std::mutex> lock(appState.sceneMutex);
+            appState.shapeIndex.Query(b, ids);
+        }
+        Graphics g(hdc);
+        Rect dev(rc.left, rc.top, rc.right - rc.left, rc.bottom - rc.top);
+        g.SetClip(dev);
+        SolidBrush white(Color(255, 255, 255, 255));
+        g.FillRectangle(&white, dev);
+        g.SetSmoothingMode(SmoothingModeAntiAlias);
+        Matrix matrix;
+        matrix.Translate(appState.offsetX, appState.offsetY);
+        matrix.Scale(appState.zoom, appState.zoom);
+        g.SetTransform(&matrix);
+        SceneRenderer renderer(g, g_Images, false, g_FrameStats.Shapes());
+        for (auto id : ids) renderer.Draw(appState.scene, id);
+    }
+
+    // Пришли тайлы от фоновых потоков: пересобрать только их место
+    void ComposeTiles(HWND hWnd, const std::vector<TileKey>& keys) {
+        if (!hdc || keys.empty()) return;
+        Update();
+        Graphics g(hdc);
+        PrepareForTiles(g);
+        for (auto& k : keys) {
+            g_Tiles.ComposeTile(g, k);
+            RectF r = g_Tiles.DeviceRect(TileWorldBounds(k));
+            RECT rc = { (LONG)floor(r.X) - 1, (LONG)floor(r.Y) - 1, (LONG)ceil(r.GetRight()) + 1, (LONG)ceil(r.GetBottom()) + 1 };
+            InvalidateDevice(hWnd, rc);
+        }
+    }
+
+private:
+    static void PrepareForTiles(Graphics& g) {
+        g.SetSmoothingMode(SmoothingModeAntiAlias);
+        g.SetInterpolationMode(InterpolationModeHighQualityBilinear);
+        g.SetPixelOffsetMode(PixelOffsetModeHalf);
+    }
+} g_SceneLayer;
+
+// -------------------------------------------------------------------------
+// 5.2. Ластик
+// -------------------------------------------------------------------------
+// Ластик прошёл от a до b (Eraser.h): штрихи и отрезки режутся на уцелевшие
+// куски, контурные фигуры и картинки, целиком попавшие под путь ластика,
+// стираются. Сцена от этого только уменьшается.
+void EraseAlong(HWND hWnd, const ScenePoint& a, const ScenePoint& b) {
+    EraserPath& path = appState.eraser;
+    float r = path.Radius();
+    BoundsF area = BoundsF::Empty();
+    area.Include(a.X, a.Y);
+    area.Include(b.X, b.Y);
+    area.Inflate(r);
+
+    std::vector<SpatialIndex::Id> ids;
+    {
+        std::lock_guard<std::mutex> lock(appState.sceneMutex);
+        appState.shapeIndex.Query(area, ids);
+    }
+
+    // Сцену меняет только этот поток, поэтому читать её можно без замка
+    SceneStore& scene = appState.scene;
+    std::vector<ScenePoint> cut, outline;
+    BoundsF damage = BoundsF::Empty();
+    for (auto id : ids) {
+        SceneStore::Ref ref = scene.order[id];
+        size_t i = ref.slot;
+        bool erase = false, replace = false;
+        switch (ref.kind) {
+        case ShapeKind::Pen: {
+            // Стирается всё, чего коснулся круг, с учётом толщины пера
+            const StrokeArray& s = scene.strokes;
+            if (ErasePolyline(s.Points(i), s.count[i], a, b, r + s.stroke[i] / 2, cut)) replace = true;
+            break;
+        }
+        case ShapeKind::Line: {
+            const LineArray& l = scene.lines;
+            ScenePoint seg[2] = { { l.x0[i], l.y0[i] }, { l.x1[i], l.y1[i] } };
+            if (ErasePolyline(seg, 2, a, b, r + l.stroke[i] / 2, cut)) replace = true;
+            break;
+        }
+        case ShapeKind::Image:
+            erase = path.CoversArea(scene.images.Bounds(i, 0));
+            break;
+        case ShapeKind::Function:
+        case ShapeKind::Erased:
+            break;
+        default: {
+            const BoxArray& box = scene.Boxes(ref.kind);
+            BoxOutline(ref.kind, box.x[i], box.y[i], box.w[i], box.h[i], outline);
+            erase = path.Covers(outline);
+            break;
+        }
+        }
+        if (replace && cut.empty()) erase = true;
+        if (!erase && !replace) continue;
+
+        damage.Include(appState.shapeIndex.Bounds(id));
+        std::lock_guard<std::mutex> lock(appState.sceneMutex);
+        g_History.Changing(scene, id);
+        if (erase) {
+            if (ref.kind == ShapeKind::Image) g_Images.Cancel(scene.imageIds[i]);
+            scene.Erase(id);
+            appState.shapeIndex.Remove(id);
+            g_Journal.Erased(id);
+        }
+        else {
+            scene.ReplaceStroke(id, cut.data(), cut.size());
+            appState.shapeIndex.Insert(id, scene.Bounds(id));
+            g_Journal.Replaced(scene, id);
+        }
+    }
+    if (damage.minX > damage.maxX) return;
+
+    g_Tiles.OnShapesChanged(damage);
+    g_SceneLayer.Redraw(damage);
+    InvalidateWorld(hWnd, damage);
+}
+
+// -------------------------------------------------------------------------
+// 5.3. Документ (*.faint)
+// -------------------------------------------------------------------------
+bool HasExtension(const wchar_t* path, const wchar_t* ext) {
+    const wchar_t* dot = wcsrchr(path, L'.');
+    return dot && _wcsicmp(dot, ext) == 0;
+}
+
+DocumentView CurrentView() {
+    return DocumentView{ appState.zoom, appState.offsetX, appState.offsetY };
+}
+
+// Картинка сцены для записи документа; files держит содержимое до конца записи
+DocumentImage ExportImage(uint32_t id, std::vector<std::vector<uint8_t>>& files) {
+    DocumentImage im;
+    wstring file;
+    files.emplace_back();
+    if (!g_Images.Contents(id, file, files.back())) files.back().clear();
+    im.path = ToUtf8(file);
+    im.data = files.back().empty() ? nullptr : files.back().data();
+    im.size = files.back().size();
+    return im;
+}
+
+// Картинка из документа: из его копии, если она есть, иначе по пути
+uint32_t ImportImage(const DocumentImage& im) {
+    wstring file = FromCodePage(CP_UTF8, im.path);
+    return im.data ? g_Images.Load(im.data, im.size, file.c_str()) : g_Images.Load(file.c_str());
+}
+
+// Картинки для основы эпохи журнала: поток записи журнала читает их сам,
+// содержимое файлов живёт, пока пишется снимок
+std::function<DocumentImage(uint32_t)> JournalImages() {
+    auto files = std::make_shared<std::vector<std::vector<uint8_t>>>();
+    return [files](uint32_t id) { return ExportImage(id, *files); };
+}
+
+// Сворачивает журнал в снимок текущей сцены. Здесь — только копии сцены и
+// отложенных сцен истории, снимок пишет поток записи журнала. При ошибке
+// журнал остаётся прежним.
+void SnapshotJournal() {
+    g_Journal.Snapshot(appState.scene, g_History.Stashes(), CurrentView(), JournalImages());
+}
+
+// Документ пишется во временный файл рядом и подменяет старый только целиком.
+// Если старый — тот, что сейчас открыт, его держит отображение в памяти:
+// тогда точки штрихов копируются из отображения и замена повторяется.
+bool SaveScene(const wchar_t* path, string& error) {
+    wstring temp = wstring(path) + L".tmp";
+    std::vector<std::vector<uint8_t>> files;
+    // Сцену меняет только этот поток, поэтому читать её можно без замка
+    bool ok = SaveDocument(temp.c_str(), appState.scene, CurrentView(), [&](uint32_t id) { return ExportImage(id, files); }, error);
+    if (!ok) {
+        DeleteFile(temp.c_str());
+        return false;
+    }
+    if (!MoveFileEx(temp.c_str(), path, MOVEFILE_REPLACE_EXISTING)) {
+        g_Tiles.Quiesce(); // копии сцены у потоков тайлов тоже держат отображение
+        g_Journal.Quiesce(); // и у снимка журнала
+        {
+            std::lock_guard<std::mutex> lock(appState.sceneMutex);
+            appState.scene.Materialize();
+            g_History.Materialize();
+        }
+        if (!MoveFileEx(temp.c_str(), path, MOVEFILE_REPLACE_EXISTING)) {
+            DeleteFile(temp.c_str());
+            error = "не удалось заменить файл";
+            return false;
+        }
+    }
+    g_Journal.Rebase(path, appState.scene, false, g_History.Stashes(), JournalImages()); // сохранённый рисунок — новая основа журнала
+    return true;
+}
+
+// Открывает документ вместо текущей сцены. Индекс строится по сохранённым
+// габаритам, точки штрихов читаются с диска, только когда их рисуют.
+bool OpenScene(HWND hWnd, const wchar_t* path, string& error) {
+    ClearScene();
+    std::vector<BoundsF> bounds;
+    DocumentView view;
+    bool ok;
+    {
+        std::lock_guard<std::mutex> lock(appState.sceneMutex);
+        ok = LoadDocument(path, appState.scene, bounds, view, ImportImage, error);
+        for (uint32_t id = 0; ok && id < (uint32_t)bounds.size(); id++)
+            if (appState.scene.order[id].kind != ShapeKind::Erased) appState.shapeIndex.Insert(id, bounds[id]);
+    }
+    if (ok) {
+        appState.zoom = max(0.1f, min(50.0f, view.zoom)); // пределы колеса мыши
+        appState.offsetX = view.offsetX;
+        appState.offsetY = view.offsetY;
+        g_Journal.Rebase(path, appState.scene, true, g_History.Stashes(), JournalImages()); // журнал ссылается на файл, рисунок не копируется
+    }
+    else {
+        ClearScene(); // картинки, загруженные до ошибки
+    }
+    g_SceneLayer.Invalidate();
+    InvalidateRect(hWnd, NULL, FALSE);
+    return ok;
+}
+
+// Каталог журнала: %LOCALAPPDATA%\MyGDIPlusPaint\ (без LOCALAPPDATA — во временном каталоге)
+wstring JournalDirectory() {
+    wchar_t buf[MAX_PATH];
+    DWORD n = GetEnvironmentVariable(L"LOCALAPPDATA", buf, MAX_PATH);
+    wstring dir;
+    if (n > 0 && n < MAX_PATH) dir = wstring(buf) + L"\\" + APP_NAME;
+    else if (GetTempPath(MAX_PATH, buf) > 0) dir = wstring(buf) + APP_NAME;
+    else return wstring();
+    CreateDirectory(dir.c_str(), NULL);
+    return dir + L"\\";
+}
+
+// При запуске: если прошлый сеанс оборвался, предлагает восстановить рисунок
+// из журнала, затем начинает новый журнал с текущей сцены
+void StartJournal(HWND hWnd) {
+    wstring dir = JournalDirectory();
+    if (dir.empty()) return;
+    string error;
+    if (SceneJournal::Exists(dir) && MessageBox(hWnd, L"Прошлый сеанс завершился аварийно. Восстановить рисунок?",
+        L"Восстановление", MB_YESNO | MB_ICONQUESTION) == IDYES) {
+        bool ok;
+        {
+            std::lock_guard<std::mutex> lock(appState.sceneMutex);
+            ok = SceneJournal::Recover(dir, appState.scene, ImportImage, error);
+            std::vector<BoundsF> bounds;
+            appState.scene.AllBounds(bounds);
+            for (uint32_t id = 0; id < (uint32_t)bounds.size(); id++)
+                if (appState.scene.order[id].kind != ShapeKind::Erased) appState.shapeIndex.Insert(id, bounds[id]);
+        }
+        if (!ok) MessageBox(hWnd, FromCodePage(CP_ACP, error).c_str(), L"Ошибка", MB_OK | MB_ICONERROR);
+        g_SceneLayer.Invalidate();
+        InvalidateRect(hWnd, NULL, FALSE);
+    }
+    std::vector<std::vector<uint8_t>> files;
+    if (!g_Journal.Start(dir, appState.scene, CurrentView(), [&](uint32_t id) { return ExportImage(id, files); }, error)) {
+        wstring text = L"Автосохранение отключено: " + FromCodePage(CP_ACP, error);
+        MessageBox(hWnd, text.c_str(), L"Ошибка", MB_OK | MB_ICONWARNING);
+        return;
+    }
+    SetTimer(hWnd, ID_TIMER_JOURNAL, kJournalFlushMs, NULL);
+}
+
+// -------------------------------------------------------------------------
+// 5.4. Отмена и повтор
+// -------------------------------------------------------------------------
+// Очистка как шаг истории: сцена откладывается целиком, картинки остаются
+void ClearSceneStep(HWND hWnd) {
+    {
+        std::lock_guard<std::mutex> lock(appState.sceneMutex);
+        uint32_t stash = g_History.Clear(appState.scene, appState.shapeIndex);
+        g_Journal.Cleared(stash);
+    }
+    g_Tiles.Clear();
+    g_SceneLayer.Invalidate();
+    InvalidateRect(hWnd, NULL, FALSE);
+}
+
+void UndoRedo(HWND hWnd, bool redo) {
+    if (appState.isDrawing) return; // шаг ластика ещё не закрыт
+    SceneHistory::Effect fx;
+    {
+        std::lock_guard<std::mutex> lock(appState.sceneMutex);
+        SceneStore& scene = appState.scene;
+        if (!(redo ? g_History.Redo(scene, appState.shapeIndex, fx) : g_History.Undo(scene, appState.shapeIndex, fx))) return;
+        if (fx.swapped) g_Journal.Cleared(fx.stash);
+        for (uint32_t id : fx.ids) {
+            if (scene.order[id].kind == ShapeKind::Erased) g_Journal.Erased(id);
+            else g_Journal.Placed(scene, id, ImagePathUtf8);
+        }
+        for (uint32_t image : fx.images) g_Images.Cancel(image);
+    }
+    if (fx.swapped) {
+        g_Tiles.Clear();
+        g_SceneLayer.Invalidate();
+        InvalidateRect(hWnd, NULL, FALSE);
+        return;
+    }
+    g_Tiles.OnShapesChanged(fx.damage);
+    g_SceneLayer.Redraw(fx.damage);
+    InvalidateWorld(hWnd, fx.damage);
+}
+
+// -------------------------------------------------------------------------
+// 5.5. Экспорт всего рисунка
+// -------------------------------------------------------------------------
+const int kExportBandPixels = 1 << 20; // пикселей в полосе: чем шире рисунок, тем меньше строк
+const int kExportMaxSide = 1 << 20;
+const float kExportMargin = 2;         // поле вокруг рисунка, пикселей
+
+// Весь рисунок в PNG при dpi точек на дюйм (единица мира — пиксель при 96).
+// Полосы рисует GDI+ в потоках пула, каждую по копии своей части сцены,
+// и сразу сжимает; в памяти несколько полос, а не всё изображение.
+bool ExportDrawing(const wchar_t* path, double dpi, int& width, int& height, string& error) {
+    BoundsF b = DrawingExtent(appState.scene); // сцену меняет только этот поток
+    if (!(b.minX <= b.maxX)) {
+        error = "рисунок пуст";
+        return false;
+    }
+    float scale = (float)(dpi / 96);
+    double w = ceil((b.maxX - b.minX) * (double)scale + 2 * kExportMargin);
+    double h = ceil((b.maxY - b.minY) * (double)scale + 2 * kExportMargin);
+    if (w > kExportMaxSide || h > kExportMaxSide) {
+        error = "слишком большое изображение, уменьшите разрешение";
+        return false;
+    }
+    width = (int)w;
+    height = (int)h;
+    float ox = kExportMargin - b.minX * scale, oy = kExportMargin - b.minY * scale;
+    int rows = max(16, min(1024, kExportBandPixels / width));
+
+    FILE* f = _wfopen(path, L"wb");
+    if (!f) {
+        error = "не удалось создать файл";
+        return false;
+    }
+    ThreadPool& pool = ThreadPool::Shared();
+    PngStream png;
+    bool ok = png.Begin(f, (uint32_t)width, (uint32_t)height, dpi);
+    size_t bands = (size_t)((height + rows - 1) / rows);
+    ok = ok && StreamBands(&pool, png, bands, 2 * (pool.WorkerCount() + 1), [&](size_t k, PngBand& band) {
+        int top = (int)k * rows, n = min(rows, height - top);
+        BoundsF area{ -ox / scale, (top - oy) / scale, (width - ox) / scale, (top + n - oy) / scale };
+        area.Inflate(2 / scale);
+        SceneStore slice;
+        {
+            std::lock_guard<std::mutex> lock(appState.sceneMutex);
+            std::vector<SpatialIndex::Id> found;
+            appState.shapeIndex.Query(area, found);
+            slice.AppendFrom(appState.scene, found);
+        }
+        // Полоса до 1 << 20 пикселей в ширину, их в работе несколько: памяти может не хватить
+        Bitmap bmp(width, n, PixelFormat32bppARGB);
+        if (bmp.GetLastStatus() != Ok) {
+            band.failed = true;
+            return;
+        }
+        {
+            Graphics g(&bmp);
+            g.SetSmoothingMode(SmoothingModeAntiAlias);
+            g.Clear(Color(255, 255, 255, 255));
+            Matrix matrix;
+            matrix.Translate(ox, oy - (REAL)top);
+            matrix.Scale(scale, scale);
+            g.SetTransform(&matrix);
+            SceneRenderer(g, g_Images).DrawAll(slice);
+        }
+        BitmapData data;
+        Rect all(0, 0, width, n);
+        if (bmp.LockBits(&all, ImageLockModeRead, PixelFormat32bppARGB, &data) != Ok) {
+            band.failed = true;
+            return;
+        }
+        EncodePngBand(static_cast<const uint32_t*>(data.Scan0), (size_t)data.Stride / 4, width, n, band);
+        bmp.UnlockBits(&data);
+    });
+    ok = png.End() && ok;
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        _wremove(path);
+        error = "не удалось записать файл";
+    }
+    return ok;
+}
+
+void ExportDrawingAs(HWND hWnd, double dpi) {
+    OPENFILENAME ofn;
+    WCHAR szFile[260] = { 0 };
+    ZeroMemory(&ofn, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hWnd;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = sizeof(szFile) / sizeof(szFile[0]);
+    ofn.lpstrFilter = L"PNG Image\0*.png\0";
+    ofn.nFilterIndex = 1;
+    ofn.lpstrDefExt = L"png";
+    if (GetSaveFileName(&ofn) != TRUE) return;
+
+    HCURSOR old = SetCursor(LoadCursor(NULL, IDC_WAIT));
+    int width = 0, height = 0;
+    string error;
+    bool ok = ExportDrawing(szFile, dpi, width, height, error);
+    SetCursor(old);
+    if (ok) {
+        wstring msg = L"Изображение " + std::to_wstring(width) + L"x" + std::to_wstring(height) + L" сохранено.";
+        MessageBox(hWnd, msg.c_str(), L"Успех", MB_OK);
+    }
+    else {
+        MessageBox(hWnd, FromCodePage(CP_ACP, error).c_str(), L"Ошибка", MB_OK | MB_ICONERROR);
+    }
+}
+
+// Сколько памяти занимают картинки
+void ShowImageStats(HWND hWnd) {
+    ImageCache<Bitmap>::Stats st = g_Images.Stats();
+    std::wostringstream msg;
+    msg.precision(1);
+    msg << std::fixed
+        << L"Картинок: " << st.entries << L" (вставок: " << st.references << L")\n"
+        << L"Файлы картинок: " << st.encodedBytes / 1048576.0 << L" МБ\n"
+        << L"Раскодированные пирамиды: " << st.decodedBytes / 1048576.0 << L" МБ из " << st.budget / 1048576.0 << L" МБ\n"
+        << L"Раскодировано пирамид: " << st.decodes;
+    size_t tiled = g_Images.TiledCount();
+    if (tiled > 0) {
+        TiledTileCache<Bitmap>::Stats ts = g_Images.TileStats();
+        msg << L"\n\nОгромных картинок (тайлами на диске): " << tiled << L"\n"
+            << L"Тайлов в памяти: " << ts.tiles << L", " << ts.bytes / 1048576.0 << L" МБ из " << ts.budget / 1048576.0 << L" МБ\n"
+            << L"Прочитано тайлов: " << ts.loads;
+    }
+    MessageBox(hWnd, msg.str().c_str(), L"Память картинок", MB_OK | MB_ICONINFORMATION);
+}
+
+// -------------------------------------------------------------------------
+// 5.6. Замеры кадров
+// -------------------------------------------------------------------------
+// Оверлей с замерами в левом верхнем углу окна, пиксели устройства. Текст
+// размечается в свой растр по таймеру, kFrameHudRefreshMs; кадр только
+// копирует растр в окно после замера и в hdcMem его не кладёт, так что
+// оверлей не входит во время кадра и не перерисовывается каждый кадр.
+const RECT kFrameHudRect = { 8, 8, 378, 256 };
+const UINT kFrameHudRefreshMs = 250;
+
+struct FrameHud {
+    HDC hdc = NULL;
+    HBITMAP hbm = NULL, hbmOld = NULL;
+
+    void Release() {
+        if (hdc) {
+            SelectObject(hdc, hbmOld);
+            DeleteObject(hbm);
+            DeleteDC(hdc);
+        }
+        hdc = NULL;
+        hbm = hbmOld = NULL;
+    }
+} g_FrameHud;
+
+// p50 / p95 / p99 по последним кадрам в растр оверлея
+void RefreshFrameHud(HWND hWnd) {
+    static const wchar_t* const kinds[kShapeKinds] = {
+        L"кисть", L"линия", L"прямоугольник", L"эллипс", L"треугольник", L"звезда", L"картинка", L"график" };
+    std::wostringstream text;
+    text << std::fixed;
+    auto line = [&](const wstring& name, const FrameStats::Percentiles& p, int precision, const wchar_t* unit) {
+        text.precision(precision);
+        text << name << L": " << p.p50 << L" / " << p.p95 << L" / " << p.p99 << unit << L"\n";
+    };
+    FrameStats::Percentiles total = g_FrameStats.Metric(FrameMetric::Total);
+    text << L"Кадров " << total.frames << L", p50 / p95 / p99\n";
+    line(L"Кадр", total, 2, L" мс");
+    line(L"  слой сцены", g_FrameStats.Metric(FrameMetric::Layer), 2, L" мс");
+    line(L"  копирование", g_FrameStats.Metric(FrameMetric::Blit), 2, L" мс");
+    line(L"Фигур нарисовано", g_FrameStats.Metric(FrameMetric::Drawn), 0, L"");
+    line(L"  отсечено", g_FrameStats.Metric(FrameMetric::Culled), 0, L"");
+    line(L"Фигуры в тайлах", g_FrameStats.Metric(FrameMetric::TileMs), 2, L" мс");
+    text << L"По типам (окно и тайлы):\n";
+    for (int k = 0; k < kShapeKinds; k++) {
+        FrameStats::Percentiles p = g_FrameStats.Shape(k);
+        if (p.frames) line(wstring(L"  ") + kinds[k], p, 2, L" мс");
+    }
+    text << L"F3 — скрыть";
+
+    const RECT& r = kFrameHudRect;
+    int w = r.right - r.left, h = r.bottom - r.top;
+    if (!g_FrameHud.hdc) {
+        HDC ref = GetDC(hWnd);
+        g_FrameHud.hdc = CreateCompatibleDC(ref);
+        g_FrameHud.hbm = CreateCompatibleBitmap(ref, w, h);
+        g_FrameHud.hbmOld = (HBITMAP)SelectObject(g_FrameHud.hdc, g_FrameHud.hbm);
+        ReleaseDC(hWnd, ref);
+    }
+    {
+        Graphics g(g_FrameHud.hdc);
+        g.Clear(Color(255, 245, 245, 245));
+        Font font(L"Consolas", 9);
+        SolidBrush ink(Color(255, 0, 0, 0));
+        g.DrawString(text.str().c_str(), -1, &font, PointF(6, 4), &ink);
+    }
+    InvalidateRect(hWnd, &r, FALSE);
+}
+
+// Поверх кадра в окне; hdc отсечён повреждённой областью WM_PAINT
+void DrawFrameHud(HDC hdc) {
+    const RECT& r = kFrameHudRect;
+    if (g_FrameHud.hdc) BitBlt(hdc, r.left, r.top, r.right - r.left, r.bottom - r.top, g_FrameHud.hdc, 0, 0, SRCCOPY);
+}
+
+void ToggleFrameStats(HWND hWnd) {
+    bool on = !g_FrameStats.Enabled();
+    g_FrameStats.Enable(on); // трасса остаётся до следующего включения
+    CheckMenuItem(GetMenu(hWnd), ID_ACTION_FRAME_STATS, on ? MF_CHECKED : MF_UNCHECKED);
+    if (on) {
+        RefreshFrameHud(hWnd);
+        SetTimer(hWnd, ID_TIMER_FRAME_HUD, kFrameHudRefreshMs, NULL);
+    }
+    else {
+        KillTimer(hWnd, ID_TIMER_FRAME_HUD);
+        g_FrameHud.Release();
+        InvalidateRect(hWnd, &kFrameHudRect, FALSE);
+    }
+}
+
+// Трасса кадров в CSV или JSON (по расширению)
+void SaveFrameTrace(HWND hWnd) {
+    if (g_FrameStats.TraceFrames() == 0) {
+        MessageBox(hWnd, L"Замеров нет: включите их (F3) и поработайте с рисунком.", L"Замеры кадров", MB_OK | MB_ICONINFORMATION);
+        return;
+    }
+    OPENFILENAME ofn;
+    WCHAR szFile[260] = L"frames.csv";
+    ZeroMemory(&ofn, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = hWnd;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = sizeof(szFile) / sizeof(szFile[0]);
+    ofn.lpstrFilter = L"CSV\0*.csv\0JSON\0*.json\0";
+    ofn.nFilterIndex = 1;
+    ofn.lpstrDefExt = L"csv";
+    ofn.Flags = OFN_OVERWRITEPROMPT;
+    if (GetSaveFileName(&ofn) != TRUE) return;
+
+    FILE* f = _wfopen(szFile, L"wb");
+    bool ok = f && (HasExtension(szFile, L".json") ? g_FrameStats.WriteJson(f) : g_FrameStats.WriteCsv(f));
+    if (f) ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        MessageBox(hWnd, L"Не удалось записать файл.", L"Ошибка", MB_OK | MB_ICONERROR);
+        return;
+    }
+    std::wostringstream msg;
+    msg << L"Сохранено кадров: " << g_FrameStats.TraceFrames();
+    if (g_FrameStats.Dropped()) msg << L"\nТрасса заполнена, не попали последние " << g_FrameStats.Dropped();
+    MessageBox(hWnd, msg.str().c_str(), L"Замеры кадров", MB_OK | MB_ICONINFORMATION);
+}
+
 // -------------------------------------------------------------------------
 // 6. Диалог (Кнопка ОТМЕНА исправлена)
 // -------------------------------------------------------------------------
@@ -550,11 +2094,31 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
     case WM_CREATE: {
         GdiplusStartup(&gdiToken, &gdiInput, NULL);
 
+        appState.plotCacheMB = ReadSettingDword(L"PlotCacheMB", appState.plotCacheMB);
+        PlotCache::SetBudget((size_t)appState.plotCacheMB << 20);
+        appState.tileCacheMB = ReadSettingDword(L"TileCacheMB", appState.tileCacheMB);
+        g_Tiles.Init(hWnd, (size_t)appState.tileCacheMB << 20);
+        g_Images.Init(hWnd);
+        appState.imageCacheMB = ReadSettingDword(L"ImageCacheMB", appState.imageCacheMB);
+        g_Images.SetBudget((size_t)appState.imageCacheMB << 20);
+        appState.imageTilesMB = ReadSettingDword(L"ImageTilesMB", appState.imageTilesMB);
+        g_Images.SetTileBudget((size_t)appState.imageTilesMB << 20);
+
         HMENU hMenu = CreateMenu();
         HMENU hFile = CreatePopupMenu();
-        AppendMenu(hFile, MF_STRING, ID_ACTION_OPEN, L"Открыть изображение... (Ctrl+O)");
+        AppendMenu(hFile, MF_STRING, ID_ACTION_OPEN, L"Открыть изображение или рисунок... (Ctrl+O)");
         AppendMenu(hFile, MF_STRING, ID_ACTION_SAVE, L"Сохранить как... (Ctrl+S)");
 
+        HMENU hExport = CreatePopupMenu();
+        AppendMenu(hExport, MF_STRING, ID_EXPORT_96, L"96 dpi (как на экране)");
+        AppendMenu(hExport, MF_STRING, ID_EXPORT_150, L"150 dpi");
+        AppendMenu(hExport, MF_STRING, ID_EXPORT_300, L"300 dpi");
+        AppendMenu(hExport, MF_STRING, ID_EXPORT_600, L"600 dpi");
+        AppendMenu(hFile, MF_POPUP, (UINT_PTR)hExport, L"Экспорт всего рисунка в PNG");
+        AppendMenu(hFile, MF_STRING, ID_ACTION_IMAGES, L"Память картинок...");
+        AppendMenu(hFile, MF_STRING, ID_ACTION_FRAME_STATS, L"Замеры кадров (F3)");
+        AppendMenu(hFile, MF_STRING, ID_ACTION_FRAME_TRACE, L"Сохранить замеры кадров...");
+
         // Логика чекбокса автозапуска при создании
         bool autoRunEnabled = IsAutorunEnabled();
         UINT flags = autoRunEnabled ? (MF_STRING | MF_CHECKED) : MF_STRING;
@@ -564,6 +2128,11 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
         AppendMenu(hFile, MF_STRING, ID_ACTION_CLEAR, L"Очистить (Ctrl+N)");
         AppendMenu(hMenu, MF_POPUP, (UINT_PTR)hFile, L"Файл");
 
+        HMENU hEdit = CreatePopupMenu();
+        AppendMenu(hEdit, MF_STRING, ID_ACTION_UNDO, L"Отменить (Ctrl+Z)");
+        AppendMenu(hEdit, MF_STRING, ID_ACTION_REDO, L"Повторить (Ctrl+Y)");
+        AppendMenu(hMenu, MF_POPUP, (UINT_PTR)hEdit, L"Правка");
+
         HMENU hTools = CreatePopupMenu();
         AppendMenu(hTools, MF_STRING, ID_TOOL_PEN, L"Кисть (Ctrl+P)");
         AppendMenu(hTools, MF_STRING, ID_TOOL_LINE, L"Линия (Ctrl+L)");
@@ -603,6 +2172,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
         hdcMem = CreateCompatibleDC(hdc);
         hbmMem = CreateCompatibleBitmap(hdc, cxClient, cyClient);
         hbmOld = (HBITMAP)SelectObject(hdcMem, hbmMem);
+        g_SceneLayer.Resize(hdc, cxClient, cyClient);
         ReleaseDC(hWnd, hdc);
         break;
     }
@@ -677,15 +2247,22 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
                 appState.funcShowAxes = (g_FuncParams.showAxes == BST_CHECKED);
                 appState.funcClip = (g_FuncParams.clipRange == BST_CHECKED);
                 appState.currentTool = T_FUNC_PLACE;
+                PrepareFuncPreview();
             }
             break;
         }
         case ID_ACTION_COLOR: SelectColor(hWnd); break;
-        case ID_ACTION_CLEAR:
-            for (auto s : appState.shapes) delete s;
-            appState.shapes.clear();
-            InvalidateRect(hWnd, NULL, FALSE);
-            break;
+        case ID_ACTION_CLEAR: ClearSceneStep(hWnd); break;
+        case ID_ACTION_UNDO: UndoRedo(hWnd, false); break;
+        case ID_ACTION_REDO: UndoRedo(hWnd, true); break;
+
+        case ID_ACTION_IMAGES: ShowImageStats(hWnd); break;
+        case ID_ACTION_FRAME_STATS: ToggleFrameStats(hWnd); break;
+        case ID_ACTION_FRAME_TRACE: SaveFrameTrace(hWnd); break;
+        case ID_EXPORT_96: ExportDrawingAs(hWnd, 96); break;
+        case ID_EXPORT_150: ExportDrawingAs(hWnd, 150); break;
+        case ID_EXPORT_300: ExportDrawingAs(hWnd, 300); break;
+        case ID_EXPORT_600: ExportDrawingAs(hWnd, 600); break;
 
         case ID_ACTION_OPEN: {
             OPENFILENAME ofn;
@@ -694,12 +2271,19 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             ofn.lStructSize = sizeof(ofn);
             ofn.hwndOwner = hWnd;
             ofn.lpstrFile = szFile;
-            ofn.nMaxFile = sizeof(szFile);
-            ofn.lpstrFilter = L"Images\0*.png;*.jpg;*.jpeg;*.bmp\0All\0*.*\0";
+            ofn.nMaxFile = sizeof(szFile) / sizeof(szFile[0]);
+            ofn.lpstrFilter = L"Images\0*.png;*.jpg;*.jpeg;*.bmp\0Рисунок Faint\0*.faint\0All\0*.*\0";
             ofn.nFilterIndex = 1;
             if (GetOpenFileName(&ofn) == TRUE) {
-                appState.imagePath = szFile;
-                appState.currentTool = T_IMAGE_PLACE;
+                if (HasExtension(szFile, L".faint")) {
+                    string error;
+                    if (!OpenScene(hWnd, szFile, error))
+                        MessageBox(hWnd, FromCodePage(CP_ACP, error).c_str(), L"Ошибка", MB_OK | MB_ICONERROR);
+                }
+                else {
+                    appState.imagePath = szFile;
+                    appState.currentTool = T_IMAGE_PLACE;
+                }
             }
             break;
         }
@@ -711,11 +2295,17 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             ofn.lStructSize = sizeof(ofn);
             ofn.hwndOwner = hWnd;
             ofn.lpstrFile = szFile;
-            ofn.nMaxFile = sizeof(szFile);
-            ofn.lpstrFilter = L"PNG Image\0*.png\0JPEG Image\0*.jpg\0Bitmap\0*.bmp\0All\0*.*\0";
+            ofn.nMaxFile = sizeof(szFile) / sizeof(szFile[0]);
+            ofn.lpstrFilter = L"PNG Image\0*.png\0JPEG Image\0*.jpg\0Bitmap\0*.bmp\0Рисунок Faint\0*.faint\0All\0*.*\0";
             ofn.nFilterIndex = 1;
             ofn.lpstrDefExt = L"png";
             if (GetSaveFileName(&ofn) == TRUE) {
+                if (HasExtension(szFile, L".faint")) {
+                    string error;
+                    if (SaveScene(szFile, error)) MessageBox(hWnd, L"Рисунок сохранён.", L"Успех", MB_OK);
+                    else MessageBox(hWnd, FromCodePage(CP_ACP, error).c_str(), L"Ошибка", MB_OK | MB_ICONERROR);
+                    break;
+                }
                 CLSID clsid;
                 if (wcsstr(szFile, L".jpg") || wcsstr(szFile, L".jpeg")) GetEncoderClsid(L"image/jpeg", &clsid);
                 else if (wcsstr(szFile, L".bmp")) GetEncoderClsid(L"image/bmp", &clsid);
@@ -735,6 +2325,7 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             break;
         }
         }
+        UpdatePreview(hWnd); // инструмент мог смениться
         break;
     }
 
@@ -745,24 +2336,32 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
         appState.currentPoint = worldPos;
         SetCapture(hWnd);
 
-        if (appState.currentTool == T_PEN || appState.currentTool == T_ERASER) {
-            Color c = (appState.currentTool == T_ERASER) ? Color(255, 255, 255, 255) : appState.currentColor;
-            float w = (appState.currentTool == T_ERASER) ? appState.eraserSize : appState.currentWidth;
-            PenShape* p = new PenShape(c, w / appState.zoom);
-            p->AddPoint(worldPos);
-            appState.shapes.push_back(p);
+        if (appState.currentTool == T_PEN) {
+            appState.strokeActive = true;
+            appState.strokeColor = appState.currentColor;
+            appState.strokeWidth = appState.currentWidth / appState.zoom;
+            // Допуск — доля пикселя при текущем масштабе
+            appState.strokeFilter.Begin(appState.strokePoints, worldPos, kStrokeTolerancePx / appState.zoom);
+        }
+        else if (appState.currentTool == T_ERASER) {
+            ScenePoint p{ worldPos.X, worldPos.Y };
+            appState.eraser.Begin(p, appState.eraserSize / appState.zoom / 2);
+            g_History.Begin(); // весь проход ластика — один шаг
+            EraseAlong(hWnd, p, p);
         }
         else if (appState.currentTool == T_FUNC_PLACE) {
-            appState.shapes.push_back(new FunctionShape(
+            auto f = std::make_shared<FunctionPlot>(
                 appState.funcExpr, appState.funcStart, appState.funcEnd,
-                worldPos, appState.currentColor, 2.0f / appState.zoom,
+                worldPos.X, worldPos.Y, appState.currentColor.GetValue(), 2.0f / appState.zoom,
                 appState.funcShowAxes, appState.funcClip
-            ));
+            );
+            AddToScene([&](SceneStore& s) { return s.AddFunction(f); });
             appState.currentTool = T_PEN;
             appState.isDrawing = false;
             ReleaseCapture();
-            InvalidateRect(hWnd, NULL, FALSE);
+            InvalidateWorld(hWnd, f->Bounds());
         }
+        UpdatePreview(hWnd);
         break;
     }
 
@@ -783,21 +2382,30 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 
         PointF worldPos = ScreenToWorld(mx, my);
         appState.currentPoint = worldPos;
-
-        if (appState.currentTool == T_ERASER && !appState.isDrawing) {
-            InvalidateRect(hWnd, NULL, FALSE);
+        if (appState.currentTool == T_FUNC_PLACE) {
+            // Кэш точек хранится относительно начала координат графика
+            appState.funcPreview->originX = worldPos.X;
+            appState.funcPreview->originY = worldPos.Y;
         }
 
-        if (appState.isDrawing) {
-            if (appState.currentTool == T_PEN || appState.currentTool == T_ERASER) {
-                Shape* s = appState.shapes.back();
-                ((PenShape*)s)->AddPoint(worldPos);
-            }
-            InvalidateRect(hWnd, NULL, FALSE);
+        if (appState.isDrawing && appState.strokeActive) {
+            // Фильтр сдвигает последний узел или добавляет новый; это меняет
+            // касательную в предыдущем, поэтому перерисовывается хвост кривой
+            // до и после
+            std::vector<PointF>& pts = appState.strokePoints;
+            float w = appState.strokeWidth;
+            size_t n = pts.size();
+            BoundsF tail = StrokeSpanBounds(pts.data(), n, n > 3 ? n - 3 : 0, n, w);
+            appState.strokeFilter.Add(pts, worldPos);
+            tail.Include(StrokeSpanBounds(pts.data(), pts.size(), n > 3 ? n - 3 : 0, pts.size(), w));
+            InvalidateWorld(hWnd, tail);
         }
-        else if (appState.currentTool == T_FUNC_PLACE || appState.currentTool == T_IMAGE_PLACE) {
-            InvalidateRect(hWnd, NULL, FALSE);
+        else if (appState.isDrawing && appState.currentTool == T_ERASER) {
+            ScenePoint from = appState.eraser.Last(), to{ worldPos.X, worldPos.Y };
+            appState.eraser.Add(to);
+            EraseAlong(hWnd, from, to);
         }
+        UpdatePreview(hWnd);
         break;
     }
 
@@ -816,108 +2424,192 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
             RectF r(l, t, rw, rh);
 
             // Обработка фигур
-            if (appState.currentTool == T_LINE) {
-                appState.shapes.push_back(new LineShape(appState.startPoint, appState.currentPoint, c, w));
-            }
-            else if (appState.currentTool == T_RECT) {
-                appState.shapes.push_back(new RectShape(r, c, w));
+            // Прямоугольные фигуры
+            ShapeKind box = ShapeKind::Rect;
+            bool isBox = true;
+            switch (appState.currentTool) {
+            case T_RECT: box = ShapeKind::Rect; break;
+            case T_ELLIPSE: box = ShapeKind::Ellipse; break;
+            case T_TRIANGLE: box = ShapeKind::Triangle; break;
+            case T_STAR: box = ShapeKind::Star; break;
+            default: isBox = false; break;
             }
-            else if (appState.currentTool == T_ELLIPSE) {
-                appState.shapes.push_back(new EllipseShape(r, c, w));
+
+            uint32_t added = UINT32_MAX;
+            if (appState.strokeActive) {
+                // Штрих завершён — окончательно упрощается и переходит в сцену
+                std::vector<PointF>& pts = appState.strokePoints;
+                appState.strokeFilter.Finish(pts);
+                added = AddToScene([&](SceneStore& s) {
+                    return s.AddStroke((const ScenePoint*)pts.data(), pts.size(), appState.strokeColor.GetValue(), appState.strokeWidth);
+                });
+                appState.strokeActive = false;
+                pts.clear();
             }
-            else if (appState.currentTool == T_TRIANGLE) {
-                appState.shapes.push_back(new TriangleShape(r, c, w));
+            else if (appState.currentTool == T_LINE) {
+                PointF a = appState.startPoint, b = appState.currentPoint;
+                added = AddToScene([&](SceneStore& s) { return s.AddLine(a.X, a.Y, b.X, b.Y, c.GetValue(), w); });
             }
-            else if (appState.currentTool == T_STAR) {
-                appState.shapes.push_back(new StarShape(r, c, w));
+            else if (isBox) {
+                added = AddToScene([&](SceneStore& s) { return s.AddBox(box, r.X, r.Y, r.Width, r.Height, c.GetValue(), w); });
             }
             else if (appState.currentTool == T_IMAGE_PLACE) {
                 // Добавляем картинку
-                appState.shapes.push_back(new ImageShape(appState.imagePath.c_str(), r));
+                uint32_t image = g_Images.Load(appState.imagePath.c_str());
+                added = AddToScene([&](SceneStore& s) { return s.AddImage(r.X, r.Y, r.Width, r.Height, image); });
                 appState.currentTool = T_PEN; // Возврат к кисти
             }
 
-            InvalidateRect(hWnd, NULL, FALSE);
+            if (added != UINT32_MAX) InvalidateWorld(hWnd, appState.scene.Bounds(added));
+            g_History.Commit(); // проход ластика (инструмент мог смениться посреди него)
+            if (appState.currentTool == T_ERASER && appState.scene.NeedsCompact()) {
+                // Id не меняются, поэтому индекс и тайлы остаются в силе
+                std::lock_guard<std::mutex> lock(appState.sceneMutex);
+                appState.scene.Compact();
+            }
+            UpdatePreview(hWnd);
         }
         break;
     }
 
     case WM_PAINT: {
+        // Перерисовывается только повреждённая область: всё рисование и копирование
+        // растров отсекается по ней, остальной кадр в hdcMem остаётся прежним
+        bool stats = g_FrameStats.Enabled();
+        double mark = 0;
+        if (stats) g_FrameStats.BeginFrame();
+        HRGN damage = CreateRectRgn(0, 0, 0, 0);
+        GetUpdateRgn(hWnd, damage, FALSE);
         PAINTSTRUCT ps;
         HDC hdc = BeginPaint(hWnd, &ps);
-
-        Graphics g(hdcMem);
-        g.SetSmoothingMode(SmoothingModeAntiAlias);
-        g.Clear(Color(255, 255, 255, 255));
-
-        Matrix matrix;
-        matrix.Translate(appState.offsetX, appState.offsetY);
-        matrix.Scale(appState.zoom, appState.zoom);
-        g.SetTransform(&matrix);
-
-        // Рисуем все фигуры
-        for (auto s : appState.shapes) s->Draw(g);
-
-        Color previewColor = Color(128, 100, 100, 100);
-        Pen previewPen(previewColor, 1.0f / appState.zoom);
-        previewPen.SetDashStyle(DashStyleDot);
-
-        // ПРЕДПРОСМОТР ЛАСТИКА
-        if (appState.currentTool == T_ERASER) {
-            float size = appState.eraserSize / appState.zoom;
-            float x = appState.currentPoint.X - size / 2;
-            float y = appState.currentPoint.Y - size / 2;
-            Pen eraserPen(Color(150, 0, 0, 0), 1.0f / appState.zoom);
-            g.DrawEllipse(&eraserPen, x, y, size, size);
+        RECT rc = ps.rcPaint;
+        int dw = rc.right - rc.left, dh = rc.bottom - rc.top;
+
+        // Зафиксированные фигуры берутся готовым растром, поверх — только то, что меняется
+        if (stats) mark = FrameClock();
+        g_SceneLayer.Update();
+        if (stats) {
+            g_FrameStats.AddLayer(FrameClock() - mark);
+            mark = FrameClock();
         }
+        SelectClipRgn(hdcMem, damage);
+        BitBlt(hdcMem, rc.left, rc.top, dw, dh, g_SceneLayer.hdc, rc.left, rc.top, SRCCOPY);
+        if (stats) g_FrameStats.AddBlit(FrameClock() - mark);
+        {
+            Graphics g(hdcMem);
+            g.SetSmoothingMode(SmoothingModeAntiAlias);
+            Region clip(damage);
+            g.SetClip(&clip);
+
+            Matrix matrix;
+            matrix.Translate(appState.offsetX, appState.offsetY);
+            matrix.Scale(appState.zoom, appState.zoom);
+            g.SetTransform(&matrix);
+
+            if (appState.strokeActive) {
+                if (stats) mark = FrameClock();
+                Pen strokePen(appState.strokeColor, appState.strokeWidth);
+                SetupStrokePen(strokePen);
+                DrawStroke(g, strokePen, appState.strokePoints.data(), appState.strokePoints.size());
+                if (stats) g_FrameStats.Shapes()->Add(ShapeKind::Pen, FrameClock() - mark);
+            }
 
-        if (appState.currentTool == T_FUNC_PLACE) {
-            PointF origin = appState.currentPoint;
-            float axLen = 1000.0f / appState.zoom;
-            g.DrawLine(&previewPen, origin.X - axLen, origin.Y, origin.X + axLen, origin.Y);
-            g.DrawLine(&previewPen, origin.X, origin.Y - axLen, origin.X, origin.Y + axLen);
+            Color previewColor = Color(128, 100, 100, 100);
+            Pen previewPen(previewColor, 1.0f / appState.zoom);
+            previewPen.SetDashStyle(DashStyleDot);
+
+            // ПРЕДПРОСМОТР ЛАСТИКА
+            if (appState.currentTool == T_ERASER) {
+                float size = appState.eraserSize / appState.zoom;
+                float x = appState.currentPoint.X - size / 2;
+                float y = appState.currentPoint.Y - size / 2;
+                Pen eraserPen(Color(150, 0, 0, 0), 1.0f / appState.zoom);
+                g.DrawEllipse(&eraserPen, x, y, size, size);
+            }
 
-            FunctionShape tmp(appState.funcExpr, appState.funcStart, appState.funcEnd, origin, Color(100, 0, 0, 200), 1.0f / appState.zoom, false, appState.funcClip);
-            tmp.Draw(g);
-        }
-        else if (appState.isDrawing && appState.currentTool != T_PEN && appState.currentTool != T_ERASER) {
-            if (appState.currentTool == T_LINE) {
-                g.DrawLine(&previewPen, appState.startPoint, appState.currentPoint);
+            if (appState.currentTool == T_FUNC_PLACE) {
+                PointF origin = appState.currentPoint;
+                float axLen = 1000.0f / appState.zoom;
+                g.DrawLine(&previewPen, origin.X - axLen, origin.Y, origin.X + axLen, origin.Y);
+                g.DrawLine(&previewPen, origin.X, origin.Y - axLen, origin.X, origin.Y + axLen);
+
+                FunctionPlot& preview = *appState.funcPreview;
+                preview.width = 1.0f / appState.zoom;
+                SceneRenderer(g, g_Images).DrawFunction(preview);
             }
-            else {
-                float l = min(appState.startPoint.X, appState.currentPoint.X);
-                float t = min(appState.startPoint.Y, appState.currentPoint.Y);
-                float w = abs(appState.currentPoint.X - appState.startPoint.X);
-                float h = abs(appState.currentPoint.Y - appState.startPoint.Y);
-                if (appState.currentTool == T_TRIANGLE || appState.currentTool == T_STAR) {
-                    g.DrawRectangle(&previewPen, l, t, w, h); // Рамка для сложных фигур
-                }
-                else if (appState.currentTool == T_IMAGE_PLACE) {
-                    g.DrawRectangle(&previewPen, l, t, w, h);
-                    // Можно добавить текст "Image"
-                }
-                else if (appState.currentTool == T_RECT) {
-                    g.DrawRectangle(&previewPen, l, t, w, h);
+            else if (appState.isDrawing && appState.currentTool != T_PEN && appState.currentTool != T_ERASER) {
+                if (appState.currentTool == T_LINE) {
+                    g.DrawLine(&previewPen, appState.startPoint, appState.currentPoint);
                 }
-                else if (appState.currentTool == T_ELLIPSE) {
-                    g.DrawEllipse(&previewPen, l, t, w, h);
+                else {
+                    float l = min(appState.startPoint.X, appState.currentPoint.X);
+                    float t = min(appState.startPoint.Y, appState.currentPoint.Y);
+                    float w = abs(appState.currentPoint.X - appState.startPoint.X);
+                    float h = abs(appState.currentPoint.Y - appState.startPoint.Y);
+                    if (appState.currentTool == T_TRIANGLE || appState.currentTool == T_STAR) {
+                        g.DrawRectangle(&previewPen, l, t, w, h); // Рамка для сложных фигур
+                    }
+                    else if (appState.currentTool == T_IMAGE_PLACE) {
+                        g.DrawRectangle(&previewPen, l, t, w, h);
+                        // Можно добавить текст "Image"
+                    }
+                    else if (appState.currentTool == T_RECT) {
+                        g.DrawRectangle(&previewPen, l, t, w, h);
+                    }
+                    else if (appState.currentTool == T_ELLIPSE) {
+                        g.DrawEllipse(&previewPen, l, t, w, h);
+                    }
                 }
             }
         }
-
-        BitBlt(hdc, 0, 0, cxClient, cyClient, hdcMem, 0, 0, SRCCOPY);
+        SelectClipRgn(hdcMem, NULL);
+
+        if (stats) mark = FrameClock();
+        BitBlt(hdc, rc.left, rc.top, dw, dh, hdcMem, rc.left, rc.top, SRCCOPY);
+        if (stats) {
+            g_FrameStats.AddBlit(FrameClock() - mark);
+            g_FrameStats.EndFrame();
+            DrawFrameHud(hdc); // вне замера
+        }
         EndPaint(hWnd, &ps);
+        DeleteObject(damage);
         break;
     }
 
+    case WM_APP_TILES_READY:
+        g_SceneLayer.ComposeTiles(hWnd, g_Tiles.TakeReady());
+        break;
+
+    case WM_APP_IMAGES_READY:
+        // Заглушки на слое заменяются картинками. Тайлы холста ждут
+        // раскодирования сами, но не импорта огромной картинки.
+        for (const ImageTable::Area& a : g_Images.TakeDecoded()) {
+            if (a.stale) g_Tiles.OnShapesChanged(a.bounds);
+            g_SceneLayer.Redraw(a.bounds);
+            InvalidateWorld(hWnd, a.bounds);
+        }
+        break;
+
     case WM_ERASEBKGND: return 1;
 
+    case WM_TIMER:
+        // Снимок пишется между действиями пользователя, не посреди штриха
+        if (wParam == ID_TIMER_JOURNAL && !appState.isDrawing && g_Journal.NeedsSnapshot()) SnapshotJournal();
+        if (wParam == ID_TIMER_FRAME_HUD) RefreshFrameHud(hWnd);
+        break;
+
     case WM_DESTROY:
+        KillTimer(hWnd, ID_TIMER_JOURNAL);
+        KillTimer(hWnd, ID_TIMER_FRAME_HUD);
+        g_Journal.Discard(); // нормальное завершение — восстанавливать нечего
         SelectObject(hdcMem, hbmOld);
         DeleteObject(hbmMem);
         DeleteDC(hdcMem);
+        ClearScene();
+        g_SceneLayer.Release();
+        g_FrameHud.Release();
+        g_Labels.Clear();
         GdiplusShutdown(gdiToken);
-        for (auto s : appState.shapes) delete s;
         PostQuitMessage(0);
         break;
 
@@ -955,11 +2647,14 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrev, LPSTR lpCmdLine, int nC
 
     ShowWindow(hWnd, nCmdShow);
     UpdateWindow(hWnd);
+    StartJournal(hWnd);
 
     ACCEL accels[] = {
         { FCONTROL | FVIRTKEY, 'N', ID_ACTION_CLEAR },
         { FCONTROL | FVIRTKEY, 'S', ID_ACTION_SAVE },
         { FCONTROL | FVIRTKEY, 'O', ID_ACTION_OPEN }, // Ctrl+O
+        { FCONTROL | FVIRTKEY, 'Z', ID_ACTION_UNDO },
+        { FCONTROL | FVIRTKEY, 'Y', ID_ACTION_REDO },
         { FCONTROL | FVIRTKEY, 'P', ID_TOOL_PEN },
         { FCONTROL | FVIRTKEY, 'L', ID_TOOL_LINE },
         { FCONTROL | FVIRTKEY, 'R', ID_TOOL_RECT },
@@ -967,9 +2662,10 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrev, LPSTR lpCmdLine, int nC
         { FCONTROL | FVIRTKEY, 'T', ID_TOOL_TRIANGLE },
         { FCONTROL | FSHIFT | FVIRTKEY, 'S', ID_TOOL_STAR }, // Ctrl+Shift+S
         { FCONTROL | FVIRTKEY, 'D', ID_TOOL_ERASER },
-        { FCONTROL | FVIRTKEY, 'F', ID_TOOL_FUNC }
+        { FCONTROL | FVIRTKEY, 'F', ID_TOOL_FUNC },
+        { FVIRTKEY, VK_F3, ID_ACTION_FRAME_STATS }
     };
-    HACCEL hAccel = CreateAcceleratorTable(accels, 11);
+    HACCEL hAccel = CreateAcceleratorTable(accels, 14);
 
     MSG msg;
     while (GetMessage(&msg, NULL, 0, 0)) {
@@ -0,0 +1,250 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Замеры кадров окна: WM_PAINT целиком, сборка слоя сцены, копирование
+// растров (blit), время и число фигур по типам, отсечённые фигуры.
+// Последние kFrameWindow кадров держатся в скользящих окнах, по ним
+// считаются p50/p95/p99 для оверлея; записи кадров копятся в трассу (не
+// больше kFrameTraceMax) для выгрузки в CSV или JSON.
+// Выключенные замеры стоят проверки флага на кадр и на фигуру: Shapes()
+// даёт nullptr, и рисующий код не трогает часы.
+// Кадр ведёт поток интерфейса; фигуры, нарисованные между кадрами (вне
+// WM_PAINT), относятся к ближайшему. Тайлы фоновых потоков складываются
+// под замком (AddTile) и тоже попадают в ближайший кадр. Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+
+#include "SceneStore.h"
+
+const int kShapeKinds = (int)ShapeKind::Erased; // стёртые не рисуются
+const size_t kFrameWindow = 512;                // кадров в окне процентилей
+const size_t kFrameTraceMax = 100000;           // кадров в трассе
+
+// Секунды монотонных часов высокого разрешения
+inline double FrameClock() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+inline const char* ShapeKindName(int kind) {
+    static const char* const names[kShapeKinds] = { "pen", "line", "rect", "ellipse", "triangle", "star", "image", "function" };
+    return kind >= 0 && kind < kShapeKinds ? names[kind] : "erased";
+}
+
+// Время и число нарисованных фигур по типам; culled — отброшенные
+// проверкой видимости (окна или тайла)
+struct ShapeTimes {
+    double seconds[kShapeKinds] = {};
+    uint32_t drawn[kShapeKinds] = {};
+    uint32_t culled = 0;
+
+    void Add(ShapeKind kind, double s) {
+        if (kind == ShapeKind::Erased) return;
+        seconds[(int)kind] += s;
+        drawn[(int)kind]++;
+    }
+
+    void Merge(const ShapeTimes& o) {
+        for (int k = 0; k < kShapeKinds; k++) {
+            seconds[k] += o.seconds[k];
+            drawn[k] += o.drawn[k];
+        }
+        culled += o.culled;
+    }
+
+    uint32_t Drawn() const {
+        uint32_t n = 0;
+        for (int k = 0; k < kShapeKinds; k++) n += drawn[k];
+        return n;
+    }
+};
+
+// Скользящее окно последних kFrameWindow значений
+class RollingWindow {
+public:
+    void Push(float v) {
+        if (values.size() < kFrameWindow) values.push_back(v);
+        else values[next] = v;
+        next = (next + 1) % kFrameWindow;
+    }
+
+    // p в [0, 1]; пустое окно — 0
+    float Percentile(double p) const {
+        if (values.empty()) return 0;
+        scratch = values;
+        size_t i = (std::min)(scratch.size() - 1, (size_t)(p * scratch.size()));
+        std::nth_element(scratch.begin(), scratch.begin() + i, scratch.end());
+        return scratch[i];
+    }
+
+    size_t Size() const { return values.size(); }
+    void Clear() { values.clear(); next = 0; }
+
+private:
+    std::vector<float> values;
+    size_t next = 0;
+    mutable std::vector<float> scratch;
+};
+
+struct FrameRecord {
+    double start = 0; // с от включения замеров
+    float totalMs = 0, layerMs = 0, blitMs = 0;
+    ShapeTimes shapes;      // поток интерфейса
+    ShapeTimes tiles;       // фоновые потоки: тайлы, готовые к кадру
+    uint32_t tileCount = 0;
+};
+
+enum class FrameMetric { Total, Layer, Blit, Drawn, Culled, TileMs, Count };
+
+class FrameStats {
+public:
+    struct Percentiles {
+        float p50 = 0, p95 = 0, p99 = 0;
+        size_t frames = 0;
+    };
+
+    bool Enabled() const { return enabled; }
+
+    // Включение начинает замеры и трассу заново
+    void Enable(bool on) {
+        if (on && !enabled) {
+            for (RollingWindow& w : metrics) w.Clear();
+            for (RollingWindow& w : kinds) w.Clear();
+            trace.clear();
+            dropped = 0;
+            current = FrameRecord();
+            origin = FrameClock();
+            std::lock_guard<std::mutex> lock(tileMutex);
+            pendingTiles = ShapeTimes();
+            pendingTileCount = 0;
+        }
+        enabled = on;
+    }
+
+    // Накопитель фигур потока интерфейса; nullptr — замеры выключены
+    ShapeTimes* Shapes() { return enabled ? &current.shapes : nullptr; }
+
+    // Фоновый поток нарисовал тайл
+    void AddTile(const ShapeTimes& t) {
+        if (!enabled) return;
+        std::lock_guard<std::mutex> lock(tileMutex);
+        pendingTiles.Merge(t);
+        pendingTileCount++;
+    }
+
+    void BeginFrame() { frameStart = FrameClock(); }
+    void AddLayer(double seconds) { current.layerMs += (float)(seconds * 1000); }
+    void AddBlit(double seconds) { current.blitMs += (float)(seconds * 1000); }
+
+    void EndFrame() {
+        current.start = frameStart - origin;
+        current.totalMs = (float)((FrameClock() - frameStart) * 1000);
+        {
+            std::lock_guard<std::mutex> lock(tileMutex);
+            current.tiles = pendingTiles;
+            current.tileCount = pendingTileCount;
+            pendingTiles = ShapeTimes();
+            pendingTileCount = 0;
+        }
+        float tileMs = 0;
+        for (int k = 0; k < kShapeKinds; k++) tileMs += (float)(current.tiles.seconds[k] * 1000);
+        Window(FrameMetric::Total).Push(current.totalMs);
+        Window(FrameMetric::Layer).Push(current.layerMs);
+        Window(FrameMetric::Blit).Push(current.blitMs);
+        Window(FrameMetric::Drawn).Push((float)current.shapes.Drawn());
+        Window(FrameMetric::Culled).Push((float)current.shapes.culled);
+        Window(FrameMetric::TileMs).Push(tileMs);
+        // По типу — только кадры, где такие фигуры рисовались
+        for (int k = 0; k < kShapeKinds; k++)
+            if (current.shapes.drawn[k] || current.tiles.drawn[k])
+                kinds[k].Push((float)((current.shapes.seconds[k] + current.tiles.seconds[k]) * 1000));
+
+        if (trace.size() < kFrameTraceMax) trace.push_back(current);
+        else dropped++;
+        current = FrameRecord();
+    }
+
+    Percentiles Metric(FrameMetric m) const { return Get(metrics[(int)m]); }
+    // Время фигур типа kind за кадр (поток интерфейса и тайлы), мс
+    Percentiles Shape(int kind) const { return Get(kinds[kind]); }
+
+    size_t TraceFrames() const { return trace.size(); }
+    size_t Dropped() const { return dropped; }
+
+    // Трасса: кадр в строке; по каждому типу фигур время и число в потоке
+    // интерфейса и в тайлах
+    bool WriteCsv(FILE* f) const {
+        fprintf(f, "frame,start_s,total_ms,layer_ms,blit_ms,drawn,culled,tiles,tile_drawn,tile_culled");
+        for (int k = 0; k < kShapeKinds; k++) {
+            const char* n = ShapeKindName(k);
+            fprintf(f, ",%s_ms,%s_n,%s_tile_ms,%s_tile_n", n, n, n, n);
+        }
+        fprintf(f, "\n");
+        for (size_t i = 0; i < trace.size(); i++) {
+            const FrameRecord& r = trace[i];
+            fprintf(f, "%zu,%.6f,%.4f,%.4f,%.4f,%u,%u,%u,%u,%u", i, r.start, r.totalMs, r.layerMs, r.blitMs,
+                r.shapes.Drawn(), r.shapes.culled, r.tileCount, r.tiles.Drawn(), r.tiles.culled);
+            for (int k = 0; k < kShapeKinds; k++)
+                fprintf(f, ",%.4f,%u,%.4f,%u", r.shapes.seconds[k] * 1000, r.shapes.drawn[k], r.tiles.seconds[k] * 1000, r.tiles.drawn[k]);
+            fprintf(f, "\n");
+        }
+        return !ferror(f);
+    }
+
+    bool WriteJson(FILE* f) const {
+        fprintf(f, "{\n  \"dropped\": %zu,\n  \"frames\": [\n", dropped);
+        for (size_t i = 0; i < trace.size(); i++) {
+            const FrameRecord& r = trace[i];
+            fprintf(f, "    { \"start_s\": %.6f, \"total_ms\": %.4f, \"layer_ms\": %.4f, \"blit_ms\": %.4f, \"culled\": %u, "
+                "\"tiles\": %u, \"tile_culled\": %u, \"shapes\": {", r.start, r.totalMs, r.layerMs, r.blitMs,
+                r.shapes.culled, r.tileCount, r.tiles.culled);
+            WriteKinds(f, r.shapes);
+            fprintf(f, " }, \"tile_shapes\": {");
+            WriteKinds(f, r.tiles);
+            fprintf(f, " } }%s\n", i + 1 < trace.size() ? "," : "");
+        }
+        fprintf(f, "  ]\n}\n");
+        return !ferror(f);
+    }
+
+private:
+    std::atomic<bool> enabled{ false };
+    double origin = 0, frameStart = 0;
+    FrameRecord current;
+    RollingWindow metrics[(int)FrameMetric::Count];
+    RollingWindow kinds[kShapeKinds];
+    std::vector<FrameRecord> trace;
+    size_t dropped = 0;
+
+    std::mutex tileMutex;
+    ShapeTimes pendingTiles;
+    uint32_t pendingTileCount = 0;
+
+    RollingWindow& Window(FrameMetric m) { return metrics[(int)m]; }
+
+    static Percentiles Get(const RollingWindow& w) {
+        Percentiles p;
+        p.p50 = w.Percentile(0.50);
+        p.p95 = w.Percentile(0.95);
+        p.p99 = w.Percentile(0.99);
+        p.frames = w.Size();
+        return p;
+    }
+
+    // Только типы, которые рисовались
+    static void WriteKinds(FILE* f, const ShapeTimes& t) {
+        bool first = true;
+        for (int k = 0; k < kShapeKinds; k++) {
+            if (!t.drawn[k]) continue;
+            fprintf(f, "%s \"%s\": { \"ms\": %.4f, \"n\": %u }", first ? "" : ",", ShapeKindName(k), t.seconds[k] * 1000, t.drawn[k]);
+            first = false;
+        }
+    }
+};
@@ -0,0 +1,391 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Адаптивная дискретизация графика функции.
+// Базовая сетка: узел на каждый пиксель устройства (x_i = i / pxPerUnit),
+// затем рекурсивное деление интервалов там, где середина заметно отходит
+// от хорды или значение становится NaN/inf. Расстояние меряется до отрезка
+// хорды в пикселях, поэтому крутые, но гладкие участки не дробятся.
+// Разрывы (полюса tan(x), 1/x) определяются тем же уточнением: интервал,
+// который не выпрямился даже на максимальной глубине и содержит большой
+// скачок, не соединяется.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <mutex>
+
+#include "MathParser.h"
+#include "ThreadPool.h"
+
+// Допустимое отклонение ломаной от кривой, в пикселях устройства
+const double kPlotFlatnessPx = 0.5;
+// Скачок, который на максимальной глубине считается разрывом
+const double kPlotJumpPx = 8.0;
+// Глубина деления интервала сетки (1/1024 пикселя)
+const int kPlotMaxDepth = 10;
+// Предел добавленных точек на один интервал сетки (защита от sin(1000x) и т.п.)
+const int kPlotMaxRefinePerCell = 32;
+// Интервалов сетки на один кусок параллельной дискретизации
+const long long kPlotParallelChunk = 1024;
+
+struct PlotSample {
+    double x, y;      // координаты функции (не экрана)
+    bool breakAfter;  // к следующей точке линия не проводится
+};
+
+class FunctionSampler {
+public:
+    // Индекс узла сетки, ближайший к x снизу/сверху
+    static long long FloorIndex(double x, double pxPerUnit) { return (long long)std::floor(x * pxPerUnit); }
+    static long long CeilIndex(double x, double pxPerUnit) { return (long long)std::ceil(x * pxPerUnit); }
+    static double NodeX(long long i, double pxPerUnit) { return (double)i / pxPerUnit; }
+
+    // Точки для интервалов сетки [i0, i1): узел i0, уточняющие точки внутри
+    // интервалов, узел i1 не включается (его выдаёт следующий диапазон или
+    // includeLast). Результат каждого интервала зависит только от него самого
+    // и соседних узлов, поэтому соседние диапазоны можно просто склеивать.
+    static void SampleRange(const CompiledExpression& f, double pxPerUnit, long long i0, long long i1,
+        bool includeLast, std::vector<PlotSample>& out) {
+        if (i1 < i0) return;
+        long long n = i1 - i0;
+
+        // Узлы i0-1 .. i1+1 (крайние нужны для оценки кривизны)
+        size_t count = (size_t)(n + 3);
+        std::vector<double> gx(count), gy(count);
+        for (size_t k = 0; k < count; k++) gx[k] = NodeX(i0 - 1 + (long long)k, pxPerUnit);
+        f.EvaluateBatch(gx.data(), gy.data(), count);
+
+        std::vector<Span> spans, next;
+        for (long long k = 0; k < n; k++) {
+            size_t a = (size_t)k + 1, b = a + 1;
+            if (NeedsRefinement(gy[a - 1], gy[a], gy[b], gy[b + 1], pxPerUnit)) {
+                spans.push_back({ gx[a], gy[a], gx[b], gy[b], (size_t)k });
+            }
+        }
+
+        // Деление по уровням: середины всех интервалов уровня считаются одним пакетом
+        std::vector<Extra> extra;
+        std::vector<Extra> breaks;
+        std::vector<int> cellCount((size_t)(n > 0 ? n : 0), 0);
+        std::vector<double> mx, my;
+        for (int depth = 1; depth <= kPlotMaxDepth && !spans.empty(); depth++) {
+            mx.resize(spans.size());
+            my.resize(spans.size());
+            for (size_t s = 0; s < spans.size(); s++) mx[s] = 0.5 * (spans[s].xa + spans[s].xb);
+            f.EvaluateBatch(mx.data(), my.data(), spans.size());
+
+            next.clear();
+            for (size_t s = 0; s < spans.size(); s++) {
+                const Span& sp = spans[s];
+                double xm = mx[s], ym = my[s];
+                bool fa = std::isfinite(sp.ya), fb = std::isfinite(sp.yb), fm = std::isfinite(ym);
+
+                if (fa && fb && fm && ChordDistancePx(sp, xm, ym, pxPerUnit) <= kPlotFlatnessPx) continue;
+                // Лимит точек исчерпан: оставляем хорду как есть
+                if (cellCount[sp.cell] >= kPlotMaxRefinePerCell) continue;
+
+                cellCount[sp.cell]++;
+                extra.push_back({ sp.cell, xm, ym });
+                Span left = { sp.xa, sp.ya, xm, ym, sp.cell };
+                Span right = { xm, ym, sp.xb, sp.yb, sp.cell };
+                if (fa && fb) {
+                    // Изгиб или дыра (NaN внутри) — уточняем обе половины
+                    next.push_back(left);
+                    next.push_back(right);
+                }
+                else {
+                    // Граница области определения — только та половина, где она лежит
+                    if (fa != fm) next.push_back(left);
+                    if (fm != fb) next.push_back(right);
+                }
+            }
+            spans.swap(next);
+        }
+        for (const Span& sp : spans) MarkUnresolved(sp, pxPerUnit, breaks);
+
+        // Склейка: узлы сетки + добавленные точки своего интервала по возрастанию x
+        std::sort(extra.begin(), extra.end(), ExtraLess);
+        std::sort(breaks.begin(), breaks.end(), ExtraLess);
+        size_t e = 0, br = 0;
+        for (long long k = 0; k < n; k++) {
+            size_t a = (size_t)k + 1;
+            Emit(out, gx[a], gy[a], (size_t)k, breaks, br);
+            while (e < extra.size() && extra[e].cell == (size_t)k) {
+                Emit(out, extra[e].x, extra[e].y, (size_t)k, breaks, br);
+                e++;
+            }
+        }
+        if (includeLast) out.push_back({ gx[(size_t)n + 1], gy[(size_t)n + 1], false });
+    }
+
+    // То же, что SampleRange, но куски по kPlotParallelChunk интервалов
+    // считаются в пуле. Интервалы независимы, поэтому склейка кусков
+    // побитово совпадает с последовательным вызовом.
+    static void SampleRangeParallel(const CompiledExpression& f, double pxPerUnit, long long i0, long long i1,
+        bool includeLast, std::vector<PlotSample>& out, ThreadPool& pool) {
+        long long n = i1 - i0;
+        if (n < 2 * kPlotParallelChunk || pool.WorkerCount() == 0) {
+            SampleRange(f, pxPerUnit, i0, i1, includeLast, out);
+            return;
+        }
+        size_t chunks = (size_t)((n + kPlotParallelChunk - 1) / kPlotParallelChunk);
+        std::vector<std::vector<PlotSample>> parts(chunks);
+        pool.ParallelFor(chunks, [&](size_t c) {
+            long long c0 = i0 + (long long)c * kPlotParallelChunk;
+            long long c1 = (std::min)(i1, c0 + kPlotParallelChunk);
+            SampleRange(f, pxPerUnit, c0, c1, includeLast && c1 == i1, parts[c]);
+        });
+        size_t total = out.size();
+        for (const auto& part : parts) total += part.size();
+        out.reserve(total);
+        for (const auto& part : parts) out.insert(out.end(), part.begin(), part.end());
+    }
+
+private:
+    struct Span {
+        double xa, ya, xb, yb;
+        size_t cell; // номер интервала сетки внутри диапазона
+    };
+    struct Extra {
+        size_t cell;
+        double x, y;
+    };
+
+    static bool ExtraLess(const Extra& a, const Extra& b) {
+        return a.cell != b.cell ? a.cell < b.cell : a.x < b.x;
+    }
+
+    // Расстояние от середины до отрезка хорды, в пикселях устройства
+    static double ChordDistancePx(const Span& sp, double xm, double ym, double pxPerUnit) {
+        double dx = (sp.xb - sp.xa) * pxPerUnit, dy = (sp.yb - sp.ya) * pxPerUnit;
+        double mx = (xm - sp.xa) * pxPerUnit, my = (ym - sp.ya) * pxPerUnit;
+        double len2 = dx * dx + dy * dy;
+        double t = (len2 > 0) ? (mx * dx + my * dy) / len2 : 0;
+        t = t < 0 ? 0 : (t > 1 ? 1 : t);
+        double ex = mx - t * dx, ey = my - t * dy;
+        double d = std::sqrt(ex * ex + ey * ey);
+        return std::isnan(d) ? HUGE_VAL : d; // переполнение на огромных y — уточняем
+    }
+
+    // Вторая разность в узле оценивает отклонение хорды от кривой (f''h^2/8)
+    static bool Curved(double prev, double mid, double nxt, double pxPerUnit) {
+        if (!std::isfinite(prev) || !std::isfinite(nxt)) return false;
+        return std::fabs(prev - 2 * mid + nxt) * pxPerUnit / 8 > kPlotFlatnessPx;
+    }
+
+    static bool NeedsRefinement(double yPrev, double ya, double yb, double yNext, double pxPerUnit) {
+        bool fa = std::isfinite(ya), fb = std::isfinite(yb);
+        if (fa != fb) return true;
+        if (!fa) return false;
+        if (std::fabs(yb - ya) * pxPerUnit > kPlotJumpPx) return true;
+        return Curved(yPrev, ya, yb, pxPerUnit) || Curved(ya, yb, yNext, pxPerUnit);
+    }
+
+    // Интервал не выпрямился и на максимальной глубине: большой скачок считаем разрывом
+    static void MarkUnresolved(const Span& sp, double pxPerUnit, std::vector<Extra>& breaks) {
+        if (std::isfinite(sp.ya) && std::isfinite(sp.yb) && std::fabs(sp.yb - sp.ya) * pxPerUnit > kPlotJumpPx) {
+            breaks.push_back({ sp.cell, sp.xa, 0 });
+        }
+    }
+
+    static void Emit(std::vector<PlotSample>& out, double x, double y, size_t cell,
+        const std::vector<Extra>& breaks, size_t& br) {
+        bool isBreak = false;
+        while (br < breaks.size() && (breaks[br].cell < cell || (breaks[br].cell == cell && breaks[br].x <= x))) {
+            if (breaks[br].cell == cell && breaks[br].x == x) isBreak = true;
+            br++;
+        }
+        out.push_back({ x, y, isBreak });
+    }
+};
+
+// -------------------------------------------------------------------------
+// Кэш дискретизации одного графика.
+// Масштаб квантуется по четверти октавы (уровень), сетка уровня не реже
+// текущего масштаба. На каждый уровень хранится непрерывный диапазон узлов
+// [lo, hi] с готовыми точками: панорамирование берёт из него подотрезок,
+// новые участки досчитываются только по краям. Общий объём всех кэшей
+// ограничен бюджетом, лишнее вытесняется по давности использования.
+// Потокобезопасен: все кэши разделяют одну блокировку реестра, но держится
+// она только на учёте уровней, не на дискретизации. Точки отдаются копией,
+// так как вытеснение может затронуть чужой уровень.
+// -------------------------------------------------------------------------
+class PlotCache {
+public:
+    PlotCache() {}
+    PlotCache(const PlotCache&) = delete;
+    PlotCache& operator=(const PlotCache&) = delete;
+    ~PlotCache() {
+        std::lock_guard<std::mutex> lock(Registry().mutex);
+        for (auto& lvl : levels) Unregister(lvl.get());
+    }
+
+    static int ZoomBucket(double pxPerUnit) { return (int)std::ceil(std::log2(pxPerUnit) * 4 - 1e-9); }
+    static double BucketScale(int bucket) { return std::pow(2.0, bucket / 4.0); }
+
+    // Точки для видимого [from, to] внутри допустимого [rangeFrom, rangeTo]
+    // (всё в координатах функции). out пуст, если рисовать нечего.
+    void Query(const CompiledExpression& f, double pxPerUnit, double from, double to,
+        double rangeFrom, double rangeTo, std::vector<PlotSample>& out) {
+        out.clear();
+        int bucket = ZoomBucket(pxPerUnit);
+        double ppu = BucketScale(bucket);
+        long long rLo = FunctionSampler::FloorIndex(rangeFrom, ppu), rHi = FunctionSampler::CeilIndex(rangeTo, ppu);
+        long long i0 = (std::max)(rLo, FunctionSampler::FloorIndex(from, ppu));
+        long long i1 = (std::min)(rHi, FunctionSampler::CeilIndex(to, ppu));
+        if (i0 > i1) return;
+
+        // Запас по краям, чтобы мелкое панорамирование не досчитывало каждый кадр
+        long long width = i1 - i0;
+        long long margin = width / 4 + 1;
+        long long wantLo = (std::max)(rLo, i0 - margin), wantHi = (std::min)(rHi, i1 + margin);
+
+        // Что досчитать, решается под блокировкой реестра, сама дискретизация
+        // идёт без неё: графики не ждут друг друга, поток интерфейса не ждёт
+        // потоков тайлов. Уровень, изменённый за это время другим потоком,
+        // досчитывается заново целиком (fresh), так что проходов не больше двух.
+        std::unique_lock<std::mutex> lock(Registry().mutex);
+        bool retry = false;
+        Level* lvl;
+        for (;;) {
+            lvl = Find(bucket);
+            if (lvl && i0 >= lvl->lo && i1 <= lvl->hi) break;
+            // Далеко от закэшированного участка — считаем заново, а не заполняем промежуток
+            bool fresh = retry || !lvl || i1 < lvl->lo - width || i0 > lvl->hi + width;
+            long long oldLo = lvl ? lvl->lo : 0, oldHi = lvl ? lvl->hi : -1;
+            long long newLo = fresh || i0 < oldLo ? wantLo : oldLo;
+            long long newHi = fresh || i1 > oldHi ? wantHi : oldHi;
+            lock.unlock();
+
+            std::vector<PlotSample> head, tail;
+            ThreadPool& pool = ThreadPool::Shared();
+            if (fresh) {
+                FunctionSampler::SampleRangeParallel(f, ppu, newLo, newHi, true, tail, pool);
+            }
+            else {
+                // Досчитываются только новые края; результат совпадает с полным пересчётом
+                if (newHi > oldHi) FunctionSampler::SampleRangeParallel(f, ppu, oldHi, newHi, true, tail, pool);
+                if (newLo < oldLo) FunctionSampler::SampleRangeParallel(f, ppu, newLo, oldLo, false, head, pool);
+            }
+
+            lock.lock();
+            lvl = Find(bucket);
+            if (fresh) {
+                if (lvl && i0 >= lvl->lo && i1 <= lvl->hi) break; // другой поток успел раньше
+                if (!lvl) {
+                    levels.emplace_back(new Level());
+                    lvl = levels.back().get();
+                    lvl->bucket = bucket;
+                    lvl->owner = this;
+                    Register(lvl);
+                }
+                lvl->samples.swap(tail);
+                lvl->lo = newLo;
+                lvl->hi = newHi;
+                break;
+            }
+            // Уровень вытеснен или пересчитан, пока считались края
+            if (!lvl || lvl->lo != oldLo || lvl->hi != oldHi) {
+                retry = true;
+                continue;
+            }
+            if (newHi > oldHi) {
+                lvl->samples.pop_back(); // узел oldHi пришёл заново первым в tail
+                lvl->samples.insert(lvl->samples.end(), tail.begin(), tail.end());
+                lvl->hi = newHi;
+            }
+            if (newLo < oldLo) {
+                lvl->samples.insert(lvl->samples.begin(), head.begin(), head.end());
+                lvl->lo = newLo;
+            }
+            break;
+        }
+        lvl->lastUse = ++Registry().tick;
+        UpdateBytes(*lvl);
+        EvictOverBudget(lvl);
+
+        double x0 = FunctionSampler::NodeX(i0, ppu), x1 = FunctionSampler::NodeX(i1, ppu);
+        auto less = [](const PlotSample& s, double x) { return s.x < x; };
+        auto b = std::lower_bound(lvl->samples.begin(), lvl->samples.end(), x0, less);
+        auto e = std::lower_bound(b, lvl->samples.end(), x1, less);
+        if (e != lvl->samples.end()) ++e; // узел i1 включительно
+        out.assign(b, e);
+    }
+
+    // Общий бюджет памяти всех кэшей графиков, байт
+    static void SetBudget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(Registry().mutex);
+        Registry().budget = bytes;
+        EvictOverBudget(nullptr);
+    }
+    static size_t Budget() {
+        std::lock_guard<std::mutex> lock(Registry().mutex);
+        return Registry().budget;
+    }
+    static size_t MemoryUsed() {
+        std::lock_guard<std::mutex> lock(Registry().mutex);
+        return Registry().used;
+    }
+
+private:
+    struct Level {
+        int bucket = 0;
+        long long lo = 0, hi = -1;          // узлы сетки, hi включительно
+        std::vector<PlotSample> samples;    // последняя точка — узел hi
+        PlotCache* owner = nullptr;
+        uint64_t lastUse = 0;
+        size_t bytes = 0;
+    };
+    struct RegistryData {
+        std::vector<Level*> all;
+        size_t used = 0;
+        size_t budget = (size_t)64 << 20;
+        uint64_t tick = 0;
+        std::mutex mutex;                   // защищает реестр и уровни всех кэшей
+    };
+
+    std::vector<std::unique_ptr<Level>> levels;
+
+    static RegistryData& Registry() {
+        static RegistryData data;
+        return data;
+    }
+    static void Register(Level* lvl) { Registry().all.push_back(lvl); }
+    static void Unregister(Level* lvl) {
+        RegistryData& r = Registry();
+        r.all.erase(std::remove(r.all.begin(), r.all.end(), lvl), r.all.end());
+        r.used -= lvl->bytes;
+    }
+    static void UpdateBytes(Level& lvl) {
+        size_t bytes = lvl.samples.capacity() * sizeof(PlotSample);
+        Registry().used += bytes - lvl.bytes;
+        lvl.bytes = bytes;
+    }
+
+    // Вытесняет давно не использованные уровни всех графиков, кроме keep
+    static void EvictOverBudget(Level* keep) {
+        RegistryData& r = Registry();
+        while (r.used > r.budget) {
+            Level* victim = nullptr;
+            for (Level* lvl : r.all) {
+                if (lvl != keep && (!victim || lvl->lastUse < victim->lastUse)) victim = lvl;
+            }
+            if (!victim) break;
+            victim->owner->Remove(victim);
+        }
+    }
+
+    Level* Find(int bucket) {
+        for (auto& lvl : levels) if (lvl->bucket == bucket) return lvl.get();
+        return nullptr;
+    }
+    void Remove(Level* lvl) {
+        Unregister(lvl);
+        for (size_t i = 0; i < levels.size(); i++) {
+            if (levels[i].get() == lvl) { levels.erase(levels.begin() + i); break; }
+        }
+    }
+};
@@ -0,0 +1,207 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// История правок сцены: отмена и повтор.
+// Шаг истории — одно действие пользователя (фигура, проход ластика,
+// очистка). Для каждой затронутой фигуры шаг хранит её другое состояние —
+// до шага, пока шаг не отменён, и после, когда отменён — в attic, отдельной
+// SceneStore только для истории; «фигуры нет» — kNoShape. Отмена и повтор —
+// один и тот же обмен: фигура сцены уходит в attic, фигура из attic
+// возвращается под тем же id (SceneStore::Place). Память истории — только
+// изменённые фигуры, время отмены — их число, а не размер сцены.
+// Очистка не копирует сцену: сцена и индекс целиком меняются местами с
+// пустыми и лежат в шаге, отмена меняет их обратно.
+// Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <deque>
+#include <memory>
+#include <vector>
+#include <unordered_set>
+#include <utility>
+#include <cstdint>
+
+#include "SceneStore.h"
+
+const size_t kHistorySteps = 1000; // более старые шаги забываются
+
+class SceneHistory {
+public:
+    // Что изменили отмена или повтор
+    struct Effect {
+        std::vector<uint32_t> ids;         // фигуры, сменившие состояние
+        BoundsF damage = BoundsF::Empty(); // где они были и где стали
+        bool swapped = false;              // сцена целиком поменялась местами с отложенной
+        uint32_t stash = 0;                // номер отложенной сцены
+        std::vector<uint32_t> images;      // картинки фигур, убранных шагом со сцены
+    };
+
+    // Шаг открывается перед первым изменением действия, закрывается после последнего
+    void Begin() { open = true; }
+
+    // Фигура id сейчас изменится (стирание, новые точки); её состояние до
+    // шага запоминается один раз, сколько бы раз шаг её ни менял
+    void Changing(const SceneStore& scene, uint32_t id) {
+        if (!open || !touched.insert(id).second) return;
+        current.changes.push_back(Change{ id, Capture(scene, id) });
+    }
+
+    // Добавлена фигура id: до шага её не было
+    void Added(uint32_t id) {
+        if (!open || !touched.insert(id).second) return;
+        current.changes.push_back(Change{ id, kNoShape });
+    }
+
+    // Шаг закрыт; пустой шаг не сохраняется
+    void Commit() {
+        open = false;
+        touched.clear();
+        if (current.changes.empty()) return;
+        Push(std::move(current));
+        current = Step();
+    }
+
+    // Очистка как шаг: scene и index уходят в историю и остаются пустыми.
+    // Возвращает номер отложенной сцены.
+    uint32_t Clear(SceneStore& scene, SpatialIndex& index) {
+        Commit();
+        Step step;
+        step.stash.reset(new Stash());
+        step.stashId = nextStash++;
+        std::swap(scene, step.stash->scene);
+        std::swap(index, step.stash->index);
+        uint32_t stash = step.stashId;
+        Push(std::move(step));
+        return stash;
+    }
+
+    bool CanUndo() const { return !open && done > 0; }
+    bool CanRedo() const { return !open && done < steps.size(); }
+
+    bool Undo(SceneStore& scene, SpatialIndex& index, Effect& fx) {
+        if (!CanUndo()) return false;
+        Apply(steps[--done], scene, index, fx, true);
+        return true;
+    }
+
+    bool Redo(SceneStore& scene, SpatialIndex& index, Effect& fx) {
+        if (!CanRedo()) return false;
+        Apply(steps[done++], scene, index, fx, false);
+        return true;
+    }
+
+    // Забыть всё (сцена заменена целиком)
+    void Reset() {
+        steps.clear();
+        done = 0;
+        current = Step();
+        touched.clear();
+        open = false;
+        attic.Clear();
+    }
+
+    // Копии отложенных сцен живых шагов с их номерами — для основы эпохи журнала
+    std::vector<std::pair<uint32_t, SceneStore>> Stashes() const {
+        std::vector<std::pair<uint32_t, SceneStore>> out;
+        for (const Step& step : steps) {
+            if (!step.stash) continue;
+            out.emplace_back(step.stashId, SceneStore());
+            out.back().second.AppendAll(step.stash->scene);
+        }
+        return out;
+    }
+
+    // Копирует к себе точки из отображённого файла (SceneStore::Materialize)
+    void Materialize() {
+        attic.Materialize();
+        for (auto& step : steps)
+            if (step.stash) step.stash->scene.Materialize();
+    }
+
+private:
+    struct Change {
+        uint32_t id;
+        uint32_t other; // другое состояние: номер в attic или kNoShape
+    };
+    struct Stash {
+        SceneStore scene;
+        SpatialIndex index;
+    };
+    struct Step {
+        std::vector<Change> changes;
+        std::unique_ptr<Stash> stash; // у очистки — отложенная сцена
+        uint32_t stashId = 0;
+    };
+
+    std::deque<Step> steps;
+    size_t done = 0; // steps[0, done) можно отменить, остальные — повторить
+    Step current;
+    std::unordered_set<uint32_t> touched; // id, уже записанные в current
+    bool open = false;
+    SceneStore attic;
+    std::vector<uint32_t> one; // аргумент AppendFrom
+    uint32_t nextStash = 0;
+
+    // Копия фигуры id в attic
+    uint32_t Capture(const SceneStore& scene, uint32_t id) {
+        if (scene.order[id].kind == ShapeKind::Erased) return kNoShape;
+        one.assign(1, id);
+        attic.AppendFrom(scene, one);
+        return (uint32_t)attic.Size() - 1;
+    }
+
+    // Новый шаг отменяет возможность повтора
+    void Push(Step&& step) {
+        while (steps.size() > done) {
+            Forget(steps.back());
+            steps.pop_back();
+        }
+        steps.push_back(std::move(step));
+        if (steps.size() > kHistorySteps) {
+            Forget(steps.front());
+            steps.pop_front();
+        }
+        done = steps.size();
+        if (attic.NeedsCompact()) attic.Compact();
+    }
+
+    void Forget(const Step& step) {
+        for (const Change& c : step.changes)
+            if (c.other != kNoShape) attic.Erase(c.other);
+    }
+
+    void Apply(Step& step, SceneStore& scene, SpatialIndex& index, Effect& fx, bool undo) {
+        fx = Effect();
+        if (step.stash) {
+            std::swap(scene, step.stash->scene);
+            std::swap(index, step.stash->index);
+            fx.swapped = true;
+            fx.stash = step.stashId;
+            return;
+        }
+        // Отмена идёт от последнего изменения к первому
+        size_t n = step.changes.size();
+        for (size_t k = 0; k < n; k++) {
+            Change& c = step.changes[undo ? n - 1 - k : k];
+            if (index.Contains(c.id)) fx.damage.Include(index.Bounds(c.id));
+            uint32_t now = Capture(scene, c.id);
+            const SceneStore::Ref& was = scene.order[c.id];
+            if (c.other == kNoShape && was.kind == ShapeKind::Image) fx.images.push_back(scene.imageIds[was.slot]);
+            scene.Erase(c.id);
+            if (c.other == kNoShape) {
+                index.Remove(c.id);
+            }
+            else {
+                one.assign(1, c.other);
+                scene.AppendFrom(attic, one);
+                scene.Place(c.id);
+                attic.Erase(c.other);
+                BoundsF b = scene.Bounds(c.id);
+                index.Insert(c.id, b);
+                fx.damage.Include(b);
+            }
+            c.other = now;
+            fx.ids.push_back(c.id);
+        }
+        if (attic.NeedsCompact()) attic.Compact();
+    }
+};
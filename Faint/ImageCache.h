@@ -0,0 +1,365 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Общий кэш картинок с пирамидой уменьшенных копий.
+// Запись — содержимое файла картинки, ключ — путь и хэш содержимого: одна и
+// та же картинка, вставленная много раз, читается и раскодируется один раз,
+// записи считают ссылки. Раскодированная картинка хранится пирамидой:
+// уровень 0 — полный размер, каждый следующий вдвое меньше, пока сторона
+// больше kMipMinSide. Вывод берёт наименьший уровень не меньше размера на
+// экране, так что при выводе картинка уменьшается не больше чем вдвое.
+// Пирамида строится при первом выводе; пирамиды всех записей вместе
+// ограничены бюджетом и вытесняются по давности вывода. Содержимое файла
+// остаётся в записи, так что вытесненная пирамида строится заново.
+// Построить пирамиду можно с ожиданием (Draw — фоновые потоки, экспорт)
+// или заказом (Request + TryDraw — поток интерфейса): заказ раскодируется
+// в фоне, пока на месте картинки заглушка; заказ, который ещё не начался,
+// отменяется (Cancel). Одну запись раскодирует только один поток, ждущий
+// Draw забирает себе ещё не начатый заказ.
+// Вид картинки (Bitmap GDI+ в приложении) и её раскодирование —
+// параметры. Потокобезопасен. Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+const int kMipMinSide = 32; // уровни меньше не строятся
+
+// 64-битный хэш содержимого файла (FNV-1a по словам, затем перемешивание)
+inline uint64_t ContentHash(const uint8_t* p, size_t n) {
+    uint64_t h = 0xCBF29CE484222325ull ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x100000001B3ull;
+        h ^= h >> 29;
+    }
+    for (; i < n; i++) h = (h ^ p[i]) * 0x100000001B3ull;
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    return h;
+}
+
+// Итог вывода без ожидания
+enum class ImageStatus { Drawn, Pending, Broken };
+
+template <class Image>
+class ImageCache {
+public:
+    struct Level {
+        std::unique_ptr<Image> image;
+        int width = 0, height = 0;
+    };
+
+    struct Stats {
+        size_t entries = 0;      // разных картинок
+        size_t references = 0;   // вставок всего
+        size_t encodedBytes = 0; // содержимое файлов
+        size_t decodedBytes = 0; // пирамиды, 4 байта на пиксель
+        size_t budget = 0;
+        size_t decodes = 0;      // построено пирамид с начала работы
+    };
+
+    ImageCache() {}
+    ImageCache(const ImageCache&) = delete;
+    ImageCache& operator=(const ImageCache&) = delete;
+
+    // Бюджет пирамид всех записей, байт
+    void SetBudget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        EvictOverBudget(nullptr);
+    }
+
+    // Ссылка на картинку с содержимым bytes, взятую из path. Та же пара
+    // (path, содержимое) — та же запись. Возвращает номер записи.
+    uint32_t Acquire(const std::string& path, std::vector<uint8_t>&& bytes) {
+        Key key{ path, ContentHash(bytes.data(), bytes.size()) };
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(key);
+        if (it != index.end()) {
+            Entry& e = *entries[it->second];
+            if (e.bytes == bytes) {
+                e.refs++;
+                return it->second;
+            }
+        }
+        uint32_t id;
+        if (!freeIds.empty()) {
+            id = freeIds.back();
+            freeIds.pop_back();
+        }
+        else {
+            id = (uint32_t)entries.size();
+            entries.emplace_back();
+        }
+        entries[id].reset(new Entry());
+        Entry& e = *entries[id];
+        e.key = key;
+        e.bytes = std::move(bytes);
+        e.refs = 1;
+        encodedBytes += e.bytes.size();
+        if (it == index.end()) index.emplace(key, id); // коллизия хэша: запись без ключа
+        return id;
+    }
+
+    // Последняя ссылка освобождает запись (и отменяет её заказ). Вызывать,
+    // когда запись никто не выводит; заказ, который уже идёт, держит запись
+    // до своего конца.
+    void Release(uint32_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (id >= entries.size() || !entries[id] || --entries[id]->refs > 0) return;
+        entries[id]->cancelled = true;
+        FreeIfUnused(id);
+    }
+
+    // Вызывается после каждого построения пирамиды (удачного или нет) в
+    // построившем её потоке — например, чтобы перерисовать заглушки
+    void SetOnDecoded(std::function<void(uint32_t)> fn) {
+        std::lock_guard<std::mutex> lock(mutex);
+        onDecoded = std::move(fn);
+    }
+
+    // Заказ пирамиды в фоне: submit(job) ставит задачу в очередь потоков.
+    // Пирамида уже есть или строится — ничего не делает.
+    template <class Submit, class Build>
+    void Request(uint32_t id, const Submit& submit, const Build& build) {
+        Entry* e;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            e = id < entries.size() ? entries[id].get() : nullptr;
+            if (!e) return;
+            e->cancelled = false;
+            if (e->state != State::Empty) return;
+            e->state = State::Queued;
+            e->jobs++;
+            jobs++;
+        }
+        submit([this, id, e, build] {
+            bool run;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                run = e->state == State::Queued && !e->cancelled;
+                if (run) e->state = State::Running;
+                else if (e->state == State::Queued) e->state = State::Empty;
+            }
+            if (run) BuildLevels(id, e, build);
+            // Будится под замком: дождавшийся WaitForJobs может сразу удалить кэш
+            std::lock_guard<std::mutex> lock(mutex);
+            e->jobs--;
+            jobs--;
+            FreeIfUnused(id);
+            built.notify_all();
+        });
+    }
+
+    // Дождаться конца всех заказов (перед выгрузкой библиотеки картинок)
+    void WaitForJobs() {
+        std::unique_lock<std::mutex> lock(mutex);
+        built.wait(lock, [this] { return jobs == 0; });
+    }
+
+    // Отмена заказа, который ещё не начался (фигура с картинкой удалена).
+    // Построение, которое уже идёт, доводится до конца.
+    void Cancel(uint32_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (id < entries.size() && entries[id]) entries[id]->cancelled = true;
+    }
+
+    // Путь и содержимое файла записи; не меняются, пока на запись есть ссылки
+    const std::string& Path(uint32_t id) {
+        return Get(id)->key.path;
+    }
+    const std::vector<uint8_t>& Bytes(uint32_t id) {
+        return Get(id)->bytes;
+    }
+
+    // Вывод уровнем пирамиды для width x height пикселей устройства:
+    // use(image) вызывается под замком записи (Image GDI+ нельзя рисовать из
+    // двух потоков сразу). Пирамиды нет — build(bytes, levels) раскодирует
+    // картинку и заполняет уровни от полного размера вниз; false — картинку
+    // не прочитать (больше не пробуется). Пирамиду строит другой поток —
+    // ждёт её. Возвращает false, если выводить нечего.
+    template <class Build, class Use>
+    bool Draw(uint32_t id, float width, float height, const Build& build, const Use& use) {
+        Entry* e = Get(id);
+        if (!e) return false;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (e->state != State::Ready) {
+                    if (e->state == State::Broken) return false;
+                    if (e->state == State::Running) {
+                        built.wait(lock);
+                        continue;
+                    }
+                    e->state = State::Running; // пустая или заказанная — строим сами
+                    lock.unlock();
+                    BuildLevels(id, e, build);
+                    lock.lock();
+                }
+            }
+            std::lock_guard<std::mutex> draw(e->drawMutex);
+            if (UseLevel(e, width, height, use)) return true;
+            // Вытеснена между проверкой и замком — строится заново
+        }
+    }
+
+    // Вывод без ожидания: пирамиды нет — Pending (её нужно заказать, Request),
+    // картинку не прочитать — Broken
+    template <class Use>
+    ImageStatus TryDraw(uint32_t id, float width, float height, const Use& use) {
+        Entry* e = Get(id);
+        if (!e) return ImageStatus::Broken;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (e->state == State::Broken) return ImageStatus::Broken;
+            if (e->state != State::Ready) return ImageStatus::Pending;
+        }
+        std::lock_guard<std::mutex> draw(e->drawMutex);
+        return UseLevel(e, width, height, use) ? ImageStatus::Drawn : ImageStatus::Pending;
+    }
+
+    // Наименьший уровень не меньше width x height
+    static size_t PickLevel(const std::vector<Level>& levels, float width, float height) {
+        size_t k = 0;
+        while (k + 1 < levels.size() && levels[k + 1].width >= width && levels[k + 1].height >= height) k++;
+        return k;
+    }
+
+    Stats GetStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats s;
+        for (auto& e : entries)
+            if (e) {
+                s.entries++;
+                s.references += e->refs;
+            }
+        s.encodedBytes = encodedBytes;
+        s.decodedBytes = decodedBytes;
+        s.budget = budget;
+        s.decodes = decodes;
+        return s;
+    }
+
+private:
+    struct Key {
+        std::string path;
+        uint64_t hash;
+        bool operator==(const Key& o) const { return hash == o.hash && path == o.path; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const { return (size_t)(k.hash ^ std::hash<std::string>()(k.path)); }
+    };
+    // Пирамида: Empty -> (Queued) -> Running -> Ready | Broken; вытеснение Ready -> Empty
+    enum class State : uint8_t { Empty, Queued, Running, Ready, Broken };
+
+    struct Entry {
+        Key key;
+        std::vector<uint8_t> bytes;
+        size_t refs = 0;
+        size_t jobs = 0;           // задачи заказа в очереди и в работе
+        State state = State::Empty;
+        bool cancelled = false;    // заказ не начинать
+        std::vector<Level> levels; // не пусто только в Ready
+        size_t decoded = 0;        // байт в levels
+        uint64_t lastUse = 0;
+        std::mutex drawMutex;      // вывод и установка пирамиды
+    };
+
+    std::mutex mutex; // реестр, счётчики, состояние, lastUse и decoded записей
+    std::condition_variable built;   // под mutex: пирамида построена или заказ закончен
+    std::function<void(uint32_t)> onDecoded;
+    std::vector<std::unique_ptr<Entry>> entries;
+    std::vector<uint32_t> freeIds;
+    std::unordered_map<Key, uint32_t, KeyHash> index;
+    size_t encodedBytes = 0, decodedBytes = 0, decodes = 0;
+    size_t jobs = 0; // задачи заказов всех записей
+    size_t budget = (size_t)256 << 20;
+    uint64_t tick = 0;
+
+    Entry* Get(uint32_t id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return id < entries.size() ? entries[id].get() : nullptr;
+    }
+
+    // Запись в Running у этого потока: строит пирамиду без замков, ставит
+    // её под замком записи и будит ждущих
+    template <class Build>
+    void BuildLevels(uint32_t id, Entry* e, const Build& build) {
+        std::vector<Level> levels;
+        bool ok = build(e->bytes, levels) && !levels.empty();
+        size_t bytes = 0;
+        for (const Level& l : levels) bytes += (size_t)l.width * l.height * 4;
+        std::function<void(uint32_t)> notify;
+        {
+            std::lock_guard<std::mutex> draw(e->drawMutex);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ok) {
+                e->levels = std::move(levels);
+                e->decoded = bytes;
+                e->lastUse = ++tick;
+                e->state = State::Ready;
+                decodedBytes += bytes;
+                decodes++;
+            }
+            else e->state = State::Broken;
+            notify = onDecoded;
+        }
+        built.notify_all();
+        if (notify) notify(id);
+    }
+
+    // Под замком записи. false — пирамиду успели вытеснить.
+    template <class Use>
+    bool UseLevel(Entry* e, float width, float height, const Use& use) {
+        if (e->levels.empty()) return false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            e->lastUse = ++tick;
+            EvictOverBudget(e);
+        }
+        use(*e->levels[PickLevel(e->levels, width, height)].image);
+        return true;
+    }
+
+    // Под замком реестра. Запись без ссылок и без задач освобождается.
+    void FreeIfUnused(uint32_t id) {
+        Entry& e = *entries[id];
+        if (e.refs > 0 || e.jobs > 0) return;
+        auto it = index.find(e.key);
+        if (it != index.end() && it->second == id) index.erase(it);
+        encodedBytes -= e.bytes.size();
+        decodedBytes -= e.decoded;
+        entries[id].reset();
+        freeIds.push_back(id);
+    }
+
+    // Под замком реестра. Пирамиды давно не выводившихся записей
+    // выбрасываются; keep и записи, которые сейчас выводятся, не трогаются.
+    void EvictOverBudget(Entry* keep) {
+        if (decodedBytes <= budget) return;
+        std::vector<Entry*> old;
+        for (auto& e : entries)
+            if (e && e.get() != keep && e->decoded) old.push_back(e.get());
+        std::sort(old.begin(), old.end(), [](const Entry* a, const Entry* b) { return a->lastUse < b->lastUse; });
+        for (Entry* victim : old) {
+            if (decodedBytes <= budget) return;
+            std::unique_lock<std::mutex> busy(victim->drawMutex, std::try_to_lock);
+            if (!busy.owns_lock()) continue;
+            decodedBytes -= victim->decoded;
+            victim->decoded = 0;
+            victim->levels.clear();
+            victim->state = State::Empty;
+        }
+    }
+};
@@ -0,0 +1,857 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Журнал изменений сцены для восстановления после сбоя.
+// Каждое изменение SceneStore (новая фигура, новые точки стёртого штриха,
+// стирание, очистка, их отмена и повтор) дописывается в конец журнала одной записью — объём
+// записи зависит от изменения, а не от размера сцены. Записи копятся в
+// памяти; фоновый поток раз в kJournalFlushMs (или когда набралось
+// kJournalFlushBytes) пишет их в файл и сбрасывает на диск, так что поток
+// интерфейса диска не ждёт. Когда журнал вырастает, сцена сохраняется
+// снимком (Document.h) и журнал начинается заново — новой эпохой. Поток
+// интерфейса для этого только копирует сцену (SceneStore::AppendAll) и
+// отмечает разрез: записи до него дописываются в журнал старой эпохи,
+// после — в журнал новой. Снимок пишет поток записи.
+//
+// Файлы в каталоге журнала:
+//   journal.fjl              заголовок (эпоха, основа эпохи) и записи
+//   snapshot-<эпоха>.faint   сцена, к которой применяются записи журнала
+// Основой эпохи может быть и документ пользователя, только что открытый
+// или сохранённый (Rebase): тогда снимка нет, заголовок хранит путь,
+// размер, время изменения и контрольную сумму документа, и открытие не
+// копирует рисунок. Изменённый с тех пор документ восстановлению не годится.
+// Снимок новой эпохи пишется до того, как её получит журнал, а записи
+// после разреза ждут в памяти, пока не будет готов её заголовок, поэтому
+// при сбое в любой момент журнал и снимок его эпохи согласованы. Запись с
+// несошедшейся контрольной суммой (оборванный хвост) и всё после неё при
+// восстановлении отбрасываются.
+// Id в записях — id живой сцены: снимок хранит и места стёртых фигур.
+// Очистка (History.h) меняет сцену местами с отложенной сценой своего
+// номера. Отложенные сцены живых шагов истории пишутся вместе с основой
+// эпохи (snapshot-<эпоха>-<номер>.faint), так что восстановление знает все
+// сцены, с которыми меняются местами записи очистки и её отмены.
+// -------------------------------------------------------------------------
+#ifdef _WIN32
+#include <io.h>
+#endif
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include "Document.h"
+
+typedef std::basic_string<PathChar> PathString;
+
+const unsigned kJournalFlushMs = 1000;                     // не реже раза в секунду на диск
+const size_t kJournalFlushBytes = (size_t)1 << 20;         // или раньше, если набрался мегабайт
+const uint64_t kJournalSnapshotBytes = (uint64_t)32 << 20; // журнал меньше этого не сворачивается
+
+namespace faintjnl {
+
+const char kJournalMagic[8] = { 'F', 'A', 'I', 'N', 'T', 'J', 'N', 'L' };
+const uint32_t kJournalVersion = 2;
+const uint32_t kHasSnapshot = 1;
+const uint32_t kBaseDocument = 2; // основа эпохи — документ пользователя
+
+const size_t kBaseSample = (size_t)64 << 10; // контрольная сумма документа — по его началу и концу
+
+struct JournalHeader {
+    char magic[8];
+    uint32_t version, flags;
+    uint64_t epoch;
+    uint64_t baseSize, baseTime; // kBaseDocument: размер и время изменения документа,
+    uint32_t baseChecksum;       // BaseChecksum
+    uint32_t pathBytes;          // за заголовком — путь документа (PathChar),
+    uint32_t gaps;               // затем id стёртых фигур, которых в нём нет,
+    uint32_t stashes;            // затем номера отложенных сцен эпохи
+};
+// Запись: заголовок и данные, дополненные до 8 байт
+struct RecordHeader {
+    uint32_t type, bytes, checksum, reserved;
+};
+struct IdRecord { uint32_t id, count; };
+
+static_assert(sizeof(JournalHeader) == 56, "раскладка JournalHeader");
+static_assert(sizeof(RecordHeader) == 16, "раскладка RecordHeader");
+
+enum RecordType : uint32_t {
+    kAddStroke = 1, // StrokeRecord, точки
+    kAddLine,       // LineRecord
+    kAddBox,        // BoxRecord
+    kAddImage,      // BoxRecord, путь (UTF-8)
+    kAddFunction,   // FunctionRecord, выражение
+    kReplace,       // IdRecord, точки
+    kErase,         // IdRecord
+    kClear,         // IdRecord: номер отложенной сцены
+    kPlace,         // IdRecord: id и тип записи добавления, затем её данные
+};
+
+// FNV-1a, продолжаемая по частям
+inline uint32_t Checksum(const void* data, size_t n, uint32_t h = 2166136261u) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+inline FILE* Open(const PathString& path, const char* mode) {
+#ifdef _WIN32
+    std::wstring m(mode, mode + strlen(mode));
+    return _wfopen(path.c_str(), m.c_str());
+#else
+    return fopen(path.c_str(), mode);
+#endif
+}
+
+inline bool Sync(FILE* f) {
+    if (fflush(f) != 0) return false;
+#ifdef _WIN32
+    return _commit(_fileno(f)) == 0;
+#else
+    return fsync(fileno(f)) == 0;
+#endif
+}
+
+// Заменяет to файлом from целиком
+inline bool Replace(const PathString& from, const PathString& to) {
+#ifdef _WIN32
+    return MoveFileExW(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from.c_str(), to.c_str()) == 0;
+#endif
+}
+
+inline void Remove(const PathString& path) {
+#ifdef _WIN32
+    _wremove(path.c_str());
+#else
+    remove(path.c_str());
+#endif
+}
+
+inline PathString Name(const PathString& dir, const char* name) {
+    PathString s = dir;
+    for (const char* c = name; *c; c++) s.push_back((PathChar)*c);
+    return s;
+}
+
+inline PathString SnapshotName(const PathString& dir, uint64_t epoch) {
+    return Name(dir, ("snapshot-" + std::to_string(epoch) + ".faint").c_str());
+}
+
+inline PathString StashName(const PathString& dir, uint64_t epoch, uint32_t stash) {
+    return Name(dir, ("snapshot-" + std::to_string(epoch) + "-" + std::to_string(stash) + ".faint").c_str());
+}
+
+// Заголовок журнала с переменной частью
+struct Header {
+    JournalHeader fixed = JournalHeader();
+    PathString document;           // kBaseDocument
+    std::vector<uint32_t> gaps;    // по возрастанию
+    std::vector<uint32_t> stashes;
+    uint64_t records = 0;          // смещение первой записи
+};
+
+inline bool ReadHeader(const PathString& dir, Header& h) {
+    FILE* f = Open(Name(dir, "journal.fjl"), "rb");
+    if (!f) return false;
+    JournalHeader& jh = h.fixed;
+    const uint32_t kMaxIds = (uint32_t)1 << 28;
+    bool ok = fread(&jh, sizeof(jh), 1, f) == 1 && memcmp(jh.magic, kJournalMagic, 8) == 0 && jh.version == kJournalVersion &&
+        jh.pathBytes % sizeof(PathChar) == 0 && jh.pathBytes <= ((uint32_t)1 << 16) && jh.gaps <= kMaxIds && jh.stashes <= kMaxIds;
+    // Часть длины n с выравниванием до 8 байт
+    auto read = [&](void* p, uint64_t n) {
+        char pad[8];
+        return (n == 0 || fread(p, (size_t)n, 1, f) == 1) && (faintdoc::Pad8(n) == n || fread(pad, (size_t)(faintdoc::Pad8(n) - n), 1, f) == 1);
+    };
+    if (ok) {
+        h.document.resize(jh.pathBytes / sizeof(PathChar));
+        h.gaps.resize(jh.gaps);
+        h.stashes.resize(jh.stashes);
+        ok = read(&h.document[0], jh.pathBytes) && read(h.gaps.data(), jh.gaps * sizeof(uint32_t)) &&
+            read(h.stashes.data(), jh.stashes * sizeof(uint32_t));
+        h.records = sizeof(jh) + faintdoc::Pad8(jh.pathBytes) + faintdoc::Pad8(jh.gaps * sizeof(uint32_t)) +
+            faintdoc::Pad8(jh.stashes * sizeof(uint32_t));
+    }
+    fclose(f);
+    return ok;
+}
+
+inline bool WriteHeader(FILE* f, const Header& h) {
+    auto write = [&](const void* p, uint64_t n) {
+        static const char zeros[8] = { 0 };
+        return (n == 0 || fwrite(p, (size_t)n, 1, f) == 1) && (faintdoc::Pad8(n) == n || fwrite(zeros, (size_t)(faintdoc::Pad8(n) - n), 1, f) == 1);
+    };
+    return write(&h.fixed, sizeof(h.fixed)) && write(h.document.data(), h.document.size() * sizeof(PathChar)) &&
+        write(h.gaps.data(), h.gaps.size() * sizeof(uint32_t)) && write(h.stashes.data(), h.stashes.size() * sizeof(uint32_t));
+}
+
+// Размер и время изменения файла; false — файла нет
+inline bool Stat(const PathString& path, uint64_t& size, uint64_t& time) {
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA a;
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &a)) return false;
+    size = (uint64_t)a.nFileSizeHigh << 32 | a.nFileSizeLow;
+    time = (uint64_t)a.ftLastWriteTime.dwHighDateTime << 32 | a.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    size = (uint64_t)st.st_size;
+    time = (uint64_t)st.st_mtime;
+#endif
+    return true;
+}
+
+// Контрольная сумма первых и последних kBaseSample байт документа размера
+// size: заголовок, таблицы и хвост (графики, картинки) — весь файл не читается
+inline bool BaseChecksum(const PathString& path, uint64_t size, uint32_t& sum) {
+    FILE* f = Open(path, "rb");
+    if (!f) return false;
+    std::vector<uint8_t> buf((size_t)(std::min)(size, (uint64_t)kBaseSample));
+    bool ok = buf.empty() || fread(buf.data(), buf.size(), 1, f) == 1;
+    sum = Checksum(buf.data(), buf.size());
+    if (ok && size > kBaseSample) {
+        uint64_t tail = (std::min)(size - kBaseSample, (uint64_t)kBaseSample);
+        buf.resize((size_t)tail);
+#ifdef _WIN32
+        ok = _fseeki64(f, (int64_t)(size - tail), SEEK_SET) == 0;
+#else
+        ok = fseeko(f, (off_t)(size - tail), SEEK_SET) == 0;
+#endif
+        ok = ok && fread(buf.data(), buf.size(), 1, f) == 1;
+        sum = Checksum(buf.data(), buf.size(), sum);
+    }
+    fclose(f);
+    return ok;
+}
+
+} // namespace faintjnl
+
+class SceneJournal {
+public:
+    SceneJournal() {}
+    SceneJournal(const SceneJournal&) = delete;
+    SceneJournal& operator=(const SceneJournal&) = delete;
+    ~SceneJournal() { Close(); }
+
+    // Остался ли в dir журнал сеанса, который не завершился нормально
+    static bool Exists(const PathString& dir) {
+        faintjnl::Header h;
+        return faintjnl::ReadHeader(dir, h);
+    }
+
+    // Восстанавливает сцену из журнала в dir (сцена должна быть пуста).
+    // addImage — как у LoadDocument. Записи после первой повреждённой
+    // отбрасываются; false — не прочитана основа эпохи (error — описание).
+    template <class AddImage>
+    static bool Recover(const PathString& dir, SceneStore& scene, const AddImage& addImage, std::string& error) {
+        using namespace faintdoc;
+        using namespace faintjnl;
+
+        Header h;
+        if (!ReadHeader(dir, h)) {
+            error = "журнал не найден";
+            return false;
+        }
+        std::vector<BoundsF> bounds;
+        DocumentView view;
+        if (h.fixed.flags & kHasSnapshot) {
+            if (!LoadDocument(SnapshotName(dir, h.fixed.epoch).c_str(), scene, bounds, view, addImage, error)) return false;
+        }
+        else if (h.fixed.flags & kBaseDocument) {
+            uint64_t size, time;
+            uint32_t sum;
+            if (!Stat(h.document, size, time) || size != h.fixed.baseSize || time != h.fixed.baseTime ||
+                !BaseChecksum(h.document, size, sum) || sum != h.fixed.baseChecksum) {
+                error = "рисунок, с которого начат журнал, изменён или удалён";
+                return false;
+            }
+            SceneStore doc;
+            if (!LoadDocument(h.document.c_str(), doc, bounds, view, addImage, error)) return false;
+            // Стёртые места, которых нет в документе, — между его фигурами, как в живой сцене
+            std::vector<uint32_t> one(1, 0);
+            size_t g = 0;
+            for (uint32_t id = 0; id < (uint32_t)(doc.Size() + h.gaps.size()); id++) {
+                if (g < h.gaps.size() && h.gaps[g] == id) {
+                    scene.AddErased();
+                    g++;
+                }
+                else if (one[0] < doc.Size()) {
+                    scene.AppendFrom(doc, one);
+                    one[0]++;
+                }
+            }
+            if (g != h.gaps.size()) {
+                scene.Clear();
+                error = "журнал повреждён";
+                return false;
+            }
+        }
+
+        std::unordered_map<uint32_t, SceneStore> stashes;
+        for (uint32_t stash : h.stashes) {
+            if (!LoadDocument(StashName(dir, h.fixed.epoch, stash).c_str(), stashes[stash], bounds, view, addImage, error)) return false;
+        }
+
+        MappedFile file;
+        if (!file.Open(Name(dir, "journal.fjl").c_str()) || file.Size() < h.records) return true;
+        const uint8_t* p = file.Data() + h.records;
+        const uint8_t* end = file.Data() + file.Size();
+        std::vector<ScenePoint> pts;
+        while (end - p >= (ptrdiff_t)sizeof(RecordHeader)) {
+            RecordHeader rh;
+            memcpy(&rh, p, sizeof(rh));
+            p += sizeof(rh);
+            if ((uint64_t)(end - p) < rh.bytes || Checksum(p, rh.bytes) != rh.checksum) break;
+            const uint8_t* data = p;
+            p += (std::min)((uint64_t)(end - p), Pad8(rh.bytes));
+            if (!Apply(scene, rh.type, data, rh.bytes, addImage, pts, stashes)) break;
+        }
+        return true;
+    }
+
+    // Начинает новый журнал в dir (каталог должен существовать, путь — с
+    // разделителем на конце) со сцены scene; её снимок пишется сразу, если
+    // она не пуста. Журнал прошлого сеанса удаляется. image — как у
+    // SaveDocument.
+    template <class ImageSource>
+    bool Start(const PathString& dir, const SceneStore& scene, const DocumentView& view,
+        const ImageSource& image, std::string& error) {
+        Close();
+        directory = dir;
+        faintjnl::Header h;
+        if (!faintjnl::ReadHeader(dir, h)) h = faintjnl::Header();
+        epoch = h.fixed.epoch;
+        stashFiles = h.stashes;
+        Epoch e;
+        e.scene.AppendAll(scene);
+        e.view = view;
+        e.image = image;
+        if (!Rotate(e, error)) return false;
+        // Буферы меняются местами и не перевыделяются, пока поток записи успевает
+        pending.reserve(2 * kJournalFlushBytes);
+        writing.reserve(2 * kJournalFlushBytes);
+        stop = false;
+        open = true;
+        journalBytes = 0;
+        writer = std::thread([this] { WriterLoop(); });
+        return true;
+    }
+
+    bool IsOpen() const { return open; }
+
+    // Изменения сцены. Вызываются сразу после изменения, под тем же замком,
+    // что и само изменение: снимок не должен разойтись с журналом.
+
+    // Добавлена фигура id; imagePath(imageId) — путь картинки (UTF-8)
+    template <class ImagePath>
+    void Added(const SceneStore& scene, uint32_t id, const ImagePath& imagePath) {
+        if (open) AppendShape(scene, id, imagePath, nullptr);
+    }
+
+    // Фигура id заменена прежней версией или вернулась на своё место
+    // (отмена и повтор)
+    template <class ImagePath>
+    void Placed(const SceneStore& scene, uint32_t id, const ImagePath& imagePath) {
+        if (!open) return;
+        faintjnl::IdRecord ir{ id, 0 };
+        AppendShape(scene, id, imagePath, &ir);
+    }
+
+    // Точки штриха (или отрезка) id заменены
+    void Replaced(const SceneStore& scene, uint32_t id) {
+        if (!open) return;
+        size_t i = scene.order[id].slot;
+        faintjnl::IdRecord ir{ id, scene.strokes.count[i] };
+        Append(faintjnl::kReplace, { { &ir, sizeof(ir) }, { scene.strokes.Points(i), ir.count * sizeof(ScenePoint) } });
+    }
+
+    void Erased(uint32_t id) {
+        if (!open) return;
+        faintjnl::IdRecord ir{ id, 0 };
+        Append(faintjnl::kErase, { { &ir, sizeof(ir) } });
+    }
+
+    // Сцена поменялась местами с отложенной сценой stash (очистка, её
+    // отмена или повтор). Отложенные сцены, которые были до разреза, записаны
+    // с основой эпохи, новые восстановление заводит пустыми.
+    void Cleared(uint32_t stash) {
+        if (!open) return;
+        faintjnl::IdRecord ir{ stash, 0 };
+        Append(faintjnl::kClear, { { &ir, sizeof(ir) } });
+    }
+
+    // Сцена очищена без истории (открыт другой рисунок): журнал начинается
+    // заново с пустой сцены. Начатый снимок дожидается (Quiesce).
+    void Reset() {
+        if (!open) return;
+        Quiesce();
+        std::unique_ptr<Epoch> e(new Epoch());
+        e->replaced = true;
+        Request(std::move(e));
+    }
+
+    // Пора свернуть журнал в снимок: он больше kJournalSnapshotBytes и
+    // больше прошлого снимка, так что запись снимков в среднем не дороже
+    // самого журнала; прошлый снимок уже дописан
+    bool NeedsSnapshot() {
+        if (!open) return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        return !next && !rotating && journalBytes >= (std::max)(kJournalSnapshotBytes, snapshotBytes);
+    }
+
+    // Отложенные сцены истории (номер и копия) — для основы новой эпохи
+    typedef std::vector<std::pair<uint32_t, SceneStore>> Stashes;
+
+    // Сворачивает журнал: копия сцены (общие с ней точки из отображённого
+    // файла и графики не копируются) уходит потоку записи, он пишет снимок,
+    // отложенные сцены и начинает журнал новой эпохи. image(id) вызывается
+    // из потока записи и должен сам держать данные картинок до своего
+    // уничтожения. При ошибке журнал остаётся прежним.
+    template <class ImageSource>
+    void Snapshot(const SceneStore& scene, Stashes stashes, const DocumentView& view, const ImageSource& image) {
+        if (!open) return;
+        std::unique_ptr<Epoch> e(new Epoch());
+        e->scene.AppendAll(scene);
+        e->stashes = std::move(stashes);
+        e->view = view;
+        e->image = image;
+        Request(std::move(e));
+    }
+
+    // Сцена совпадает с документом path, только что открытым (opened) или
+    // сохранённым SaveDocument без стёртых мест: новая эпоха ссылается на
+    // него, снимок не пишется. У сохранённого стёртые места сцены
+    // запоминаются в заголовке, чтобы id в записях остались id сцены.
+    // stashes и image — как у Snapshot.
+    template <class ImageSource>
+    void Rebase(const PathString& path, const SceneStore& scene, bool opened, Stashes stashes, const ImageSource& image) {
+        if (!open) return;
+        std::unique_ptr<Epoch> e(new Epoch());
+        e->document = path;
+        e->stashes = std::move(stashes);
+        e->image = image;
+        for (uint32_t id = 0; !opened && id < (uint32_t)scene.Size(); id++)
+            if (scene.order[id].kind == ShapeKind::Erased) e->gaps.push_back(id);
+        e->replaced = opened;
+        Request(std::move(e));
+    }
+
+    // Дожидается, пока поток записи допишет начатые снимки: их копии сцены
+    // держат отображённый файл и читают картинки (image)
+    void Quiesce() {
+        if (!open) return;
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return !next && !rotating; });
+    }
+
+    // Сеанс завершён нормально: восстанавливать нечего
+    void Discard() {
+        if (!open) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            next.reset(); // снимок, который не начат, уже не нужен
+        }
+        Close();
+        RemoveEpoch(epoch, stashFiles);
+        faintjnl::Remove(faintjnl::Name(directory, "journal.fjl"));
+    }
+
+    // Останавливает поток записи; накопленное (и заказанный снимок) пишется на диск
+    void Close() {
+        if (writer.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            wake.notify_one();
+            writer.join();
+        }
+        open = false;
+        if (file) {
+            faintjnl::Sync(file);
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+private:
+    // Новая эпоха, заказанная потоком интерфейса
+    struct Epoch {
+        SceneStore scene; // её снимок; пустая сцена — без снимка
+        DocumentView view;
+        std::function<DocumentImage(uint32_t)> image;
+        PathString document;        // или документ-основа (Rebase)
+        std::vector<uint32_t> gaps; // и стёртые места сцены, которых в нём нет
+        Stashes stashes;
+        std::vector<uint8_t> before; // записи старой эпохи до разреза, ещё не на диске
+        bool replaced = false;       // сцена заменена целиком: записи после разреза к старой эпохе не подходят
+    };
+
+    PathString directory;
+    FILE* file = nullptr;   // только поток записи (и Start/Close, когда его нет)
+    uint64_t epoch = 0;     // то же
+    bool open = false;      // только поток интерфейса
+    uint64_t journalBytes = 0;  // записано в журнал этой эпохи (только поток интерфейса)
+    uint64_t snapshotBytes = 0; // размер последнего снимка (под mutex)
+    std::vector<uint32_t> stashFiles; // отложенные сцены, записанные с эпохой epoch (поток записи)
+
+    std::mutex mutex; // pending, next, rotating, stop
+    std::condition_variable wake, idle;
+    std::vector<uint8_t> pending;
+    std::vector<uint8_t> writing; // только поток записи
+    std::unique_ptr<Epoch> next;  // заказанная, ещё не начатая эпоха
+    bool rotating = false;        // поток записи пишет снимок
+    bool stop = false;
+    std::thread writer;
+
+    struct Part {
+        const void* data;
+        size_t size;
+    };
+
+    // Разрез: накопленные записи уходят с эпохой e. Ещё не начатую эпоху
+    // новая заменяет — её записи тоже относятся к старой эпохе.
+    void Request(std::unique_ptr<Epoch> e) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (next) {
+                e->before.swap(next->before);
+                e->replaced = e->replaced || next->replaced;
+            }
+            e->before.insert(e->before.end(), pending.begin(), pending.end());
+            pending.clear();
+            next = std::move(e);
+        }
+        journalBytes = 0;
+        wake.notify_one();
+    }
+
+    // Запись из нескольких частей подряд
+    void Append(uint32_t type, std::initializer_list<Part> parts) { Append(type, parts.begin(), parts.size()); }
+    void Append(uint32_t type, const Part* parts, size_t n) {
+        faintjnl::RecordHeader rh{ type, 0, 2166136261u, 0 };
+        for (size_t k = 0; k < n; k++) {
+            rh.bytes += (uint32_t)parts[k].size;
+            rh.checksum = faintjnl::Checksum(parts[k].data, parts[k].size, rh.checksum);
+        }
+        size_t total = sizeof(rh) + (size_t)faintdoc::Pad8(rh.bytes);
+        bool full;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            size_t at = pending.size();
+            pending.resize(at + total, 0);
+            memcpy(&pending[at], &rh, sizeof(rh));
+            at += sizeof(rh);
+            for (size_t k = 0; k < n; k++) {
+                const Part& part = parts[k];
+                if (part.size) memcpy(&pending[at], part.data, part.size);
+                at += part.size;
+            }
+            full = pending.size() >= kJournalFlushBytes;
+        }
+        journalBytes += total;
+        if (full) wake.notify_one();
+    }
+
+    // Запись добавления фигуры id; с place — запись возврата фигуры на место
+    template <class ImagePath>
+    void AppendShape(const SceneStore& scene, uint32_t id, const ImagePath& imagePath, faintjnl::IdRecord* place) {
+        using namespace faintdoc;
+        using namespace faintjnl;
+        const SceneStore::Ref& r = scene.order[id];
+        size_t i = r.slot;
+        // Возврат на место — та же запись добавления, перед ней id и её тип
+        auto put = [&](uint32_t type, std::initializer_list<Part> parts) {
+            if (!place) {
+                Append(type, parts);
+                return;
+            }
+            place->count = type;
+            Part all[3] = { { place, sizeof(*place) } };
+            std::copy(parts.begin(), parts.end(), all + 1);
+            Append(kPlace, all, parts.size() + 1);
+        };
+        switch (r.kind) {
+        case ShapeKind::Pen: {
+            const StrokeArray& a = scene.strokes;
+            StrokeRecord sr{ 0, a.count[i], a.color[i], a.stroke[i], 0 };
+            put(kAddStroke, { { &sr, sizeof(sr) }, { a.Points(i), a.count[i] * sizeof(ScenePoint) } });
+            break;
+        }
+        case ShapeKind::Line: {
+            const LineArray& a = scene.lines;
+            LineRecord lr{ a.x0[i], a.y0[i], a.x1[i], a.y1[i], a.stroke[i], a.color[i] };
+            put(kAddLine, { { &lr, sizeof(lr) } });
+            break;
+        }
+        case ShapeKind::Function: {
+            const FunctionPlot& f = *scene.functions[i];
+            FunctionRecord fr{ f.rangeStart, f.rangeEnd, f.originX, f.originY, f.width, f.color,
+                (f.drawAxes ? kFuncAxes : 0) | (f.clipToRange ? kFuncClip : 0), (uint32_t)f.expression.size() };
+            put(kAddFunction, { { &fr, sizeof(fr) }, { f.expression.data(), f.expression.size() } });
+            break;
+        }
+        case ShapeKind::Erased:
+            break;
+        default: {
+            const BoxArray& a = scene.Boxes(r.kind);
+            BoxRecord br{ (uint32_t)r.kind, a.x[i], a.y[i], a.w[i], a.h[i], a.stroke[i], a.color[i], kNoImage };
+            if (r.kind == ShapeKind::Image) {
+                std::string path = imagePath(scene.imageIds[i]);
+                put(kAddImage, { { &br, sizeof(br) }, { path.data(), path.size() } });
+            }
+            else {
+                put(kAddBox, { { &br, sizeof(br) } });
+            }
+            break;
+        }
+        }
+    }
+
+    void WriterLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait_for(lock, std::chrono::milliseconds(kJournalFlushMs),
+                [this] { return stop || next || pending.size() >= kJournalFlushBytes; });
+            std::unique_ptr<Epoch> e = std::move(next);
+            rotating = e != nullptr;
+            bool last = stop;
+            lock.unlock();
+            if (e) {
+                std::string error;
+                Rotate(*e, error);
+                e.reset(); // копия сцены и картинки отпускаются до idle
+            }
+            Flush();
+            lock.lock();
+            if (rotating) {
+                rotating = false;
+                idle.notify_all();
+            }
+            if (last) break;
+        }
+    }
+
+    // Переносит накопленные записи в файл. Пока заказана новая эпоха, в
+    // pending — записи после её разреза: они ждут её журнала.
+    void Flush() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (next) return;
+            writing.swap(pending);
+        }
+        if (writing.empty() || !file) {
+            writing.clear();
+            return;
+        }
+        if (fwrite(writing.data(), 1, writing.size(), file) == writing.size()) faintjnl::Sync(file);
+        writing.clear();
+    }
+
+    // Новая эпоха: записи старой до разреза дописываются в её журнал, затем
+    // пишется снимок (если сцена не пуста) и заголовок нового журнала на
+    // место старого. При ошибке продолжается старая эпоха; если же сцена
+    // заменена целиком, журнал удаляется — его записи к ней не подходят.
+    bool Rotate(Epoch& e, std::string& error) {
+        using namespace faintjnl;
+        if (file && !e.before.empty() && fwrite(e.before.data(), 1, e.before.size(), file) == e.before.size()) Sync(file);
+        uint64_t fresh = epoch + 1;
+        Header header;
+        JournalHeader& h = header.fixed;
+        memcpy(h.magic, kJournalMagic, 8);
+        h.version = kJournalVersion;
+        h.epoch = fresh;
+        PathString snap = SnapshotName(directory, fresh);
+        uint64_t bytes = 0;
+        bool ok = true;
+        if (!e.document.empty()) {
+            Remove(snap);
+            ok = Stat(e.document, h.baseSize, h.baseTime) && BaseChecksum(e.document, h.baseSize, h.baseChecksum);
+            if (!ok) error = "не удалось прочитать рисунок";
+            h.flags |= kBaseDocument;
+            h.pathBytes = (uint32_t)(e.document.size() * sizeof(PathChar));
+            h.gaps = (uint32_t)e.gaps.size();
+            header.document.swap(e.document);
+            header.gaps.swap(e.gaps);
+            bytes = h.baseSize; // следующий снимок перепишет рисунок целиком
+        }
+        else if (e.scene.Size() > 0) {
+            ok = Save(snap, e.scene, e.view, e.image, bytes, error);
+            h.flags |= kHasSnapshot;
+        }
+        else {
+            Remove(snap);
+        }
+        for (size_t k = 0; ok && k < e.stashes.size(); k++) {
+            ok = Save(StashName(directory, fresh, e.stashes[k].first), e.stashes[k].second, DocumentView(), e.image, bytes, error);
+            if (ok) header.stashes.push_back(e.stashes[k].first);
+        }
+        h.stashes = (uint32_t)header.stashes.size();
+
+        PathString path = Name(directory, "journal.fjl"), temp = Name(directory, "journal.fjl.tmp");
+        if (ok) {
+            FILE* f = Open(temp, "wb");
+            ok = f && WriteHeader(f, header) && Sync(f);
+            if (f) fclose(f);
+            if (!ok || !Replace(temp, path)) {
+                Remove(temp);
+                error = "не удалось создать журнал";
+                ok = false;
+            }
+        }
+        if (!ok) {
+            RemoveEpoch(fresh, header.stashes);
+            if (e.replaced && file) {
+                fclose(file);
+                file = nullptr;
+                Remove(path);
+                RemoveEpoch(epoch, stashFiles);
+            }
+            return false;
+        }
+        if (file) fclose(file);
+        file = Open(path, "ab");
+        RemoveEpoch(epoch, stashFiles);
+        epoch = fresh;
+        stashFiles.swap(header.stashes);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            snapshotBytes = bytes;
+        }
+        if (!file) {
+            error = "не удалось открыть журнал";
+            return false;
+        }
+        return true;
+    }
+
+    // Сцена в файл to через временный рядом; к bytes прибавляется его размер
+    static bool Save(const PathString& to, const SceneStore& scene, const DocumentView& view,
+        const std::function<DocumentImage(uint32_t)>& image, uint64_t& bytes, std::string& error) {
+        using namespace faintjnl;
+        PathString temp = Name(to, ".tmp");
+        bool ok = SaveDocument(temp.c_str(), scene, view, image, error, true);
+        if (ok && !Replace(temp, to)) {
+            error = "не удалось записать снимок";
+            ok = false;
+        }
+        if (!ok) {
+            Remove(temp);
+            return false;
+        }
+        uint64_t size, time;
+        if (Stat(to, size, time)) bytes += size;
+        return true;
+    }
+
+    // Снимок эпохи и её отложенные сцены
+    void RemoveEpoch(uint64_t e, const std::vector<uint32_t>& stashes) {
+        faintjnl::Remove(faintjnl::SnapshotName(directory, e));
+        for (uint32_t stash : stashes) faintjnl::Remove(faintjnl::StashName(directory, e, stash));
+    }
+
+    // Применяет запись журнала к сцене; false — запись не подходит к сцене
+    template <class AddImage>
+    static bool Apply(SceneStore& scene, uint32_t type, const uint8_t* p, uint32_t bytes,
+        const AddImage& addImage, std::vector<ScenePoint>& pts, std::unordered_map<uint32_t, SceneStore>& stashes) {
+        using namespace faintdoc;
+        using namespace faintjnl;
+        auto points = [&](const uint8_t* from, uint32_t count) {
+            if ((uint64_t)count * sizeof(ScenePoint) != (uint64_t)(p + bytes - from)) return false;
+            pts.resize(count);
+            if (count) memcpy(pts.data(), from, count * sizeof(ScenePoint));
+            return true;
+        };
+        switch (type) {
+        case kAddStroke: {
+            StrokeRecord sr;
+            if (bytes < sizeof(sr)) return false;
+            memcpy(&sr, p, sizeof(sr));
+            if (!points(p + sizeof(sr), sr.count)) return false;
+            scene.AddStroke(pts.data(), pts.size(), sr.color, sr.width);
+            return true;
+        }
+        case kAddLine: {
+            LineRecord lr;
+            if (bytes != sizeof(lr)) return false;
+            memcpy(&lr, p, sizeof(lr));
+            scene.AddLine(lr.x0, lr.y0, lr.x1, lr.y1, lr.color, lr.width);
+            return true;
+        }
+        case kAddBox:
+        case kAddImage: {
+            BoxRecord br;
+            if (bytes < sizeof(br)) return false;
+            memcpy(&br, p, sizeof(br));
+            ShapeKind kind = (ShapeKind)br.kind;
+            if (type == kAddImage) {
+                DocumentImage im;
+                im.path.assign((const char*)p + sizeof(br), bytes - sizeof(br));
+                scene.AddImage(br.x, br.y, br.w, br.h, addImage(im));
+                return true;
+            }
+            if (kind < ShapeKind::Rect || kind > ShapeKind::Star) return false;
+            scene.AddBox(kind, br.x, br.y, br.w, br.h, br.color, br.width);
+            return true;
+        }
+        case kAddFunction: {
+            FunctionRecord fr;
+            if (bytes < sizeof(fr)) return false;
+            memcpy(&fr, p, sizeof(fr));
+            if (bytes - sizeof(fr) != fr.exprBytes) return false;
+            std::string expr((const char*)p + sizeof(fr), fr.exprBytes);
+            scene.AddFunction(std::make_shared<FunctionPlot>(expr, fr.start, fr.end, fr.originX, fr.originY,
+                fr.color, fr.width, (fr.flags & kFuncAxes) != 0, (fr.flags & kFuncClip) != 0));
+            return true;
+        }
+        case kReplace:
+        case kErase: {
+            IdRecord ir;
+            if (bytes < sizeof(ir)) return false;
+            memcpy(&ir, p, sizeof(ir));
+            if (ir.id >= scene.Size()) return false;
+            ShapeKind kind = scene.order[ir.id].kind;
+            if (type == kErase) {
+                if (kind == ShapeKind::Erased) return false;
+                scene.Erase(ir.id);
+                return true;
+            }
+            if ((kind != ShapeKind::Pen && kind != ShapeKind::Line) || !points(p + sizeof(ir), ir.count)) return false;
+            scene.ReplaceStroke(ir.id, pts.data(), pts.size());
+            return true;
+        }
+        case kClear: {
+            IdRecord ir;
+            if (bytes != sizeof(ir)) return false;
+            memcpy(&ir, p, sizeof(ir));
+            std::swap(scene, stashes[ir.id]);
+            return true;
+        }
+        case kPlace: {
+            IdRecord ir;
+            if (bytes < sizeof(ir)) return false;
+            memcpy(&ir, p, sizeof(ir));
+            if (ir.id >= scene.Size() || ir.count < kAddStroke || ir.count > kAddFunction) return false;
+            size_t before = scene.Size();
+            if (!Apply(scene, ir.count, p + sizeof(ir), bytes - sizeof(ir), addImage, pts, stashes)) return false;
+            if (scene.Size() != before + 1) return false;
+            if (scene.order[ir.id].kind != ShapeKind::Erased) scene.Erase(ir.id);
+            scene.Place(ir.id);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+};
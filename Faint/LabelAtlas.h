@@ -0,0 +1,111 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Атлас подписей осей графиков. Подписи делений — короткие числа из
+// небольшого набора, и один и тот же текст выводится кадр за кадром, так
+// что каждая подпись (текст и цвет) растрируется один раз, а дальше её
+// растр только копируется в пиксели устройства — без разметки текста и без
+// шрифта на каждый кадр. Вид растра (Bitmap GDI+ в приложении) — параметр.
+// Записей не больше capacity, лишние уходят по давности вывода.
+// Потокобезопасен: подписи выводят и поток интерфейса, и потоки тайлов;
+// растр выводится под своим замком (Image GDI+ нельзя рисовать из двух
+// потоков сразу). Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+const size_t kLabelAtlasCapacity = 1024;
+
+template <class Image>
+class LabelAtlas {
+public:
+    struct Stats {
+        size_t labels = 0;
+        size_t made = 0; // подписей растрировано с начала работы
+        size_t drawn = 0;
+    };
+
+    explicit LabelAtlas(size_t capacity = kLabelAtlasCapacity) : capacity(capacity) {}
+
+    // Вывод подписи: нет в атласе — make() растрирует её (nullptr — вывести
+    // нельзя, пустая запись не заводится)
+    template <class Make, class Use>
+    bool Draw(const char* text, uint32_t argb, const Make& make, const Use& use) {
+        std::string key(text);
+        key.append((const char*)&argb, sizeof(argb));
+        std::shared_ptr<Entry> entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(key);
+            if (it != entries.end()) {
+                entry = it->second;
+                entry->lastUse = ++tick;
+            }
+            drawn++;
+        }
+        if (!entry) {
+            std::unique_ptr<Image> image = make();
+            if (!image) return false;
+            std::lock_guard<std::mutex> lock(mutex);
+            std::shared_ptr<Entry>& e = entries[key];
+            if (!e) { // другой поток мог успеть раньше
+                e = std::make_shared<Entry>();
+                e->image = std::move(image);
+                made++;
+            }
+            e->lastUse = ++tick;
+            entry = e;
+            Evict();
+        }
+        std::lock_guard<std::mutex> draw(entry->drawMutex);
+        use(*entry->image);
+        return true;
+    }
+
+    // Перед выключением библиотеки, которой принадлежат растры
+    void Clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        entries.clear();
+    }
+
+    Stats GetStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats s;
+        s.labels = entries.size();
+        s.made = made;
+        s.drawn = drawn;
+        return s;
+    }
+
+private:
+    struct Entry {
+        std::unique_ptr<Image> image;
+        uint64_t lastUse = 0;
+        std::mutex drawMutex;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+    size_t capacity, made = 0, drawn = 0;
+    uint64_t tick = 0;
+
+    // Под замком. Переполненный атлас теряет давнюю четверть сразу, чтобы
+    // не сортировать записи на каждой новой подписи.
+    void Evict() {
+        if (entries.size() <= capacity) return;
+        std::vector<std::pair<uint64_t, const std::string*>> order;
+        order.reserve(entries.size());
+        for (auto& e : entries) order.push_back(std::make_pair(e.second->lastUse, &e.first));
+        size_t drop = entries.size() - capacity * 3 / 4;
+        std::nth_element(order.begin(), order.begin() + (drop - 1), order.end(),
+            [](const std::pair<uint64_t, const std::string*>& a, const std::pair<uint64_t, const std::string*>& b) { return a.first < b.first; });
+        std::vector<std::string> keys;
+        for (size_t i = 0; i < drop; i++) keys.push_back(*order[i].second);
+        for (const std::string& k : keys) entries.erase(k);
+    }
+};
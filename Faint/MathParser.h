@@ -0,0 +1,374 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Математический парсер и компилятор выражений f(x).
+// Не зависит от Win32/GDI+, поэтому собирается и проверяется на любой платформе.
+// -------------------------------------------------------------------------
+#ifndef _USE_MATH_DEFINES
+#define _USE_MATH_DEFINES
+#endif
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+
+#include "SimdMath.h"
+
+// Операции байткода (обратная польская запись)
+enum class OpCode : unsigned char {
+    Const, X,
+    Add, Sub, Mul, Div, Pow,
+    Neg, Sin, Cos, Tan, Sqrt, Abs, Log
+};
+
+struct Instruction {
+    OpCode op;
+    double value; // только для Const
+};
+
+// Скомпилированное выражение: разбирается один раз, вычисляется много раз.
+// Семантика совпадает с MathParser::Evaluate (деление на 0 оставляет делимое,
+// sqrt берётся от модуля, неизвестные функции дают 0). Пустая программа
+// (CompiledExpression по умолчанию, а не результат Compile) даёт NaN.
+class CompiledExpression {
+public:
+    std::vector<Instruction> code;
+    int stackDepth = 1;
+
+    double Evaluate(double x) const {
+        double local[kInlineStack];
+        std::vector<double> heap;
+        double* st = local;
+        if (stackDepth > kInlineStack) { heap.resize(stackDepth); st = heap.data(); }
+
+        int sp = 0;
+        for (const Instruction& in : code) {
+            switch (in.op) {
+            case OpCode::Const: st[sp++] = in.value; break;
+            case OpCode::X: st[sp++] = x; break;
+            case OpCode::Neg: case OpCode::Sin: case OpCode::Cos: case OpCode::Tan:
+            case OpCode::Sqrt: case OpCode::Abs: case OpCode::Log:
+                st[sp - 1] = ApplyUnary(in.op, st[sp - 1]);
+                break;
+            default:
+                sp--;
+                st[sp - 1] = ApplyBinary(in.op, st[sp - 1], st[sp]);
+                break;
+            }
+        }
+        return sp > 0 ? st[sp - 1] : NAN;
+    }
+
+    // Пакетное вычисление ys[i] = f(xs[i]). Программа выполняется блоками по
+    // kBatchBlock значений: каждая инструкция — один проход SIMD по массиву.
+    // Хвост блока дополняется последним x, так что каждое значение проходит
+    // через одни и те же ядра независимо от длины массива и разбиения на куски.
+    void EvaluateBatch(const double* xs, double* ys, size_t n) const {
+        if (code.empty()) {
+            std::fill(ys, ys + n, (double)NAN);
+            return;
+        }
+        std::vector<double> stack((size_t)stackDepth * kBatchBlock);
+        double xbuf[kBatchBlock];
+
+        for (size_t base = 0; base < n; base += kBatchBlock) {
+            int count = (int)std::min<size_t>(kBatchBlock, n - base);
+            int padded = (count + simd::kMaxLanes - 1) / simd::kMaxLanes * simd::kMaxLanes;
+            memcpy(xbuf, xs + base, count * sizeof(double));
+            for (int i = count; i < padded; i++) xbuf[i] = xbuf[count - 1];
+
+            int sp = 0;
+            for (size_t k = 0; k < code.size(); k++) {
+                const Instruction& in = code[k];
+                double* slot = stack.data() + (size_t)sp * kBatchBlock;
+                switch (in.op) {
+                case OpCode::Const: simd::Fill(slot, in.value, padded); sp++; break;
+                case OpCode::X: memcpy(slot, xbuf, padded * sizeof(double)); sp++; break;
+                case OpCode::Neg: simd::Neg(slot - kBatchBlock, padded); break;
+                case OpCode::Sin: simd::Sin(slot - kBatchBlock, padded); break;
+                case OpCode::Cos: simd::Cos(slot - kBatchBlock, padded); break;
+                case OpCode::Tan: simd::Tan(slot - kBatchBlock, padded); break;
+                case OpCode::Sqrt: simd::SqrtAbs(slot - kBatchBlock, padded); break;
+                case OpCode::Abs: simd::Abs(slot - kBatchBlock, padded); break;
+                case OpCode::Log: simd::Log(slot - kBatchBlock, padded); break;
+                default: {
+                    double* right = slot - kBatchBlock;
+                    double* left = right - kBatchBlock;
+                    switch (in.op) {
+                    case OpCode::Add: simd::Add(left, right, padded); break;
+                    case OpCode::Sub: simd::Sub(left, right, padded); break;
+                    case OpCode::Mul: simd::Mul(left, right, padded); break;
+                    case OpCode::Div: simd::Div(left, right, padded); break;
+                    case OpCode::Pow: {
+                        // Константный целый показатель (x^2, x^-1): умножения вместо exp/log
+                        int e;
+                        if (IsSmallInteger(code[k - 1], e)) simd::PowInt(left, e, padded);
+                        else simd::Pow(left, right, padded);
+                        break;
+                    }
+                    default: break;
+                    }
+                    sp--;
+                    break;
+                }
+                }
+            }
+            if (sp > 0) memcpy(ys + base, stack.data() + (size_t)(sp - 1) * kBatchBlock, count * sizeof(double));
+            else std::fill(ys + base, ys + base + count, (double)NAN);
+        }
+    }
+
+    bool IsConstant() const { return code.size() == 1 && code[0].op == OpCode::Const; }
+
+    static double ApplyUnary(OpCode op, double v) {
+        switch (op) {
+        case OpCode::Neg: return -v;
+        case OpCode::Sin: return std::sin(v);
+        case OpCode::Cos: return std::cos(v);
+        case OpCode::Tan: return std::tan(v);
+        case OpCode::Sqrt: return std::sqrt(std::fabs(v));
+        case OpCode::Abs: return std::fabs(v);
+        case OpCode::Log: return std::log(v);
+        default: return v;
+        }
+    }
+
+    static double ApplyBinary(OpCode op, double l, double r) {
+        switch (op) {
+        case OpCode::Add: return l + r;
+        case OpCode::Sub: return l - r;
+        case OpCode::Mul: return l * r;
+        case OpCode::Div: return (r != 0) ? l / r : l;
+        case OpCode::Pow: return std::pow(l, r);
+        default: return l;
+        }
+    }
+
+    static const int kBatchBlock = 256;
+
+private:
+    static const int kInlineStack = 32;
+
+    static bool IsSmallInteger(const Instruction& in, int& e) {
+        if (in.op != OpCode::Const) return false;
+        double v = in.value;
+        if (!(std::fabs(v) <= simd::kMaxIntPow) || v != std::floor(v)) return false;
+        e = (int)v;
+        return true;
+    }
+};
+
+class MathParser {
+public:
+    static double Evaluate(std::string expr, double x) {
+        expr.erase(std::remove(expr.begin(), expr.end(), ' '), expr.end());
+        size_t pos = 0;
+        return ParseExpression(expr, pos, x);
+    }
+
+    // Однократный разбор в байткод со свёрткой констант.
+    // В отличие от Evaluate, некорректное число (например ".") даёт 0, а не исключение stod.
+    static CompiledExpression Compile(std::string expr) {
+        expr.erase(std::remove(expr.begin(), expr.end(), ' '), expr.end());
+        Compiler c(expr);
+        c.CompileExpression();
+        if (c.out.code.empty()) c.EmitConst(0);
+        return c.out;
+    }
+
+private:
+    static double ParseExpression(const std::string& expr, size_t& pos, double x) {
+        double left = ParseTerm(expr, pos, x);
+        while (pos < expr.length()) {
+            char op = expr[pos];
+            if (op != '+' && op != '-') break;
+            pos++;
+            double right = ParseTerm(expr, pos, x);
+            if (op == '+') left += right; else left -= right;
+        }
+        return left;
+    }
+    static double ParseTerm(const std::string& expr, size_t& pos, double x) {
+        double left = ParsePower(expr, pos, x);
+        while (pos < expr.length()) {
+            char op = expr[pos];
+            if (op != '*' && op != '/') break;
+            pos++;
+            double right = ParsePower(expr, pos, x);
+            if (op == '*') left *= right; else if (right != 0) left /= right;
+        }
+        return left;
+    }
+    static double ParsePower(const std::string& expr, size_t& pos, double x) {
+        double left = ParseFactor(expr, pos, x);
+        while (pos < expr.length()) {
+            if (expr[pos] == '^') {
+                pos++;
+                double right = ParseFactor(expr, pos, x);
+                left = std::pow(left, right);
+            }
+            else {
+                break;
+            }
+        }
+        return left;
+    }
+    static double ParseFactor(const std::string& expr, size_t& pos, double x) {
+        if (pos >= expr.length()) return 0;
+        if (expr[pos] == '-') { pos++; return -ParseFactor(expr, pos, x); }
+        if (expr[pos] == '(') {
+            pos++;
+            double val = ParseExpression(expr, pos, x);
+            if (pos < expr.length() && expr[pos] == ')') pos++;
+            return val;
+        }
+        if (isalpha(expr[pos])) {
+            std::string func;
+            while (pos < expr.length() && isalpha(expr[pos])) func += expr[pos++];
+            if (func == "x") return x;
+            if (func == "pi") return M_PI;
+            if (func == "e") return M_E;
+            if (pos < expr.length() && expr[pos] == '(') {
+                pos++;
+                double val = ParseExpression(expr, pos, x);
+                if (pos < expr.length() && expr[pos] == ')') pos++;
+                if (func == "sin") return std::sin(val);
+                if (func == "cos") return std::cos(val);
+                if (func == "tan") return std::tan(val);
+                if (func == "sqrt") return std::sqrt(std::fabs(val));
+                if (func == "abs") return std::fabs(val);
+                if (func == "log") return std::log(val);
+                if (func == "ln") return std::log(val);
+            }
+        }
+        if (isdigit(expr[pos]) || expr[pos] == '.') {
+            std::string numStr;
+            while (pos < expr.length() && (isdigit(expr[pos]) || expr[pos] == '.')) numStr += expr[pos++];
+            return std::stod(numStr);
+        }
+        return 0;
+    }
+
+    // Повторяет грамматику ParseExpression/ParseTerm/ParsePower/ParseFactor,
+    // но вместо значений порождает байткод.
+    struct Compiler {
+        const std::string& expr;
+        size_t pos = 0;
+        int depth = 0;
+        CompiledExpression out;
+
+        explicit Compiler(const std::string& e) : expr(e) {}
+
+        void CompileExpression() {
+            CompileTerm();
+            while (pos < expr.length()) {
+                char op = expr[pos];
+                if (op != '+' && op != '-') break;
+                pos++;
+                CompileTerm();
+                EmitBinary(op == '+' ? OpCode::Add : OpCode::Sub);
+            }
+        }
+        void CompileTerm() {
+            CompilePower();
+            while (pos < expr.length()) {
+                char op = expr[pos];
+                if (op != '*' && op != '/') break;
+                pos++;
+                CompilePower();
+                EmitBinary(op == '*' ? OpCode::Mul : OpCode::Div);
+            }
+        }
+        void CompilePower() {
+            CompileFactor();
+            while (pos < expr.length() && expr[pos] == '^') {
+                pos++;
+                CompileFactor();
+                EmitBinary(OpCode::Pow);
+            }
+        }
+        void CompileFactor() {
+            if (pos >= expr.length()) { EmitConst(0); return; }
+            if (expr[pos] == '-') { pos++; CompileFactor(); EmitUnary(OpCode::Neg); return; }
+            if (expr[pos] == '(') {
+                pos++;
+                CompileExpression();
+                if (pos < expr.length() && expr[pos] == ')') pos++;
+                return;
+            }
+            if (isalpha(expr[pos])) {
+                std::string func;
+                while (pos < expr.length() && isalpha(expr[pos])) func += expr[pos++];
+                if (func == "x") { Emit(OpCode::X, 0, 1); return; }
+                if (func == "pi") { EmitConst(M_PI); return; }
+                if (func == "e") { EmitConst(M_E); return; }
+                if (pos < expr.length() && expr[pos] == '(') {
+                    pos++;
+                    size_t mark = out.code.size();
+                    int markDepth = depth;
+                    CompileExpression();
+                    if (pos < expr.length() && expr[pos] == ')') pos++;
+                    OpCode op;
+                    if (LookupFunction(func, op)) { EmitUnary(op); return; }
+                    // Неизвестная функция: аргумент разобран, но не используется
+                    out.code.resize(mark);
+                    depth = markDepth;
+                }
+            }
+            if (isdigit(expr[pos]) || expr[pos] == '.') {
+                std::string numStr;
+                while (pos < expr.length() && (isdigit(expr[pos]) || expr[pos] == '.')) numStr += expr[pos++];
+                EmitConst(strtod(numStr.c_str(), nullptr));
+                return;
+            }
+            EmitConst(0);
+        }
+
+        static bool LookupFunction(const std::string& func, OpCode& op) {
+            if (func == "sin") op = OpCode::Sin;
+            else if (func == "cos") op = OpCode::Cos;
+            else if (func == "tan") op = OpCode::Tan;
+            else if (func == "sqrt") op = OpCode::Sqrt;
+            else if (func == "abs") op = OpCode::Abs;
+            else if (func == "log" || func == "ln") op = OpCode::Log;
+            else return false;
+            return true;
+        }
+
+        void Emit(OpCode op, double value, int stackDelta) {
+            out.code.push_back({ op, value });
+            depth += stackDelta;
+            if (depth > out.stackDepth) out.stackDepth = depth;
+        }
+        void EmitConst(double v) { Emit(OpCode::Const, v, 1); }
+
+        bool LastIsConst(size_t fromEnd) const {
+            size_t n = out.code.size();
+            return n >= fromEnd && out.code[n - fromEnd].op == OpCode::Const;
+        }
+
+        void EmitUnary(OpCode op) {
+            if (LastIsConst(1)) {
+                Instruction& a = out.code.back();
+                a.value = CompiledExpression::ApplyUnary(op, a.value);
+                return;
+            }
+            Emit(op, 0, 0);
+        }
+
+        void EmitBinary(OpCode op) {
+            if (LastIsConst(1) && LastIsConst(2)) {
+                double r = out.code.back().value;
+                out.code.pop_back();
+                depth--;
+                Instruction& l = out.code.back();
+                l.value = CompiledExpression::ApplyBinary(op, l.value, r);
+                return;
+            }
+            Emit(op, 0, -1);
+        }
+    };
+};
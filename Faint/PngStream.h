@@ -0,0 +1,642 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Потоковая запись PNG полосами строк — для вывода рисунка любого размера.
+// Полоса фильтруется и сжимается сама по себе: свой кусок потока deflate
+// без ссылок за начало полосы, выровненный пустым stored-блоком, и своя
+// Adler-32. Поэтому полосы сжимаются параллельно, а в файл идут по порядку;
+// сумма всего потока собирается из сумм полос. Изображение целиком в
+// памяти не бывает: StreamBands держит не больше window полос.
+// deflate свой (LZ77 с цепочками хэша, динамический Хаффман): приложение
+// не тянет zlib. Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+
+#include "ThreadPool.h"
+
+inline uint32_t Crc32(uint32_t crc, const uint8_t* p, size_t n) {
+    static const struct Table {
+        uint32_t v[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                v[i] = c;
+            }
+        }
+    } table;
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) crc = table.v[(crc ^ p[i]) & 255] ^ (crc >> 8);
+    return ~crc;
+}
+
+const uint32_t kAdlerBase = 65521;
+
+inline uint32_t Adler32(uint32_t adler, const uint8_t* p, size_t n) {
+    uint32_t a = adler & 0xFFFF, b = adler >> 16;
+    while (n > 0) {
+        size_t m = (std::min)(n, (size_t)5552); // без переполнения до взятия остатка
+        n -= m;
+        for (size_t i = 0; i < m; i++) {
+            a += p[i];
+            b += a;
+        }
+        p += m;
+        a %= kAdlerBase;
+        b %= kAdlerBase;
+    }
+    return a | b << 16;
+}
+
+// Adler-32 склейки: a1 — сумма первой части, a2 — второй длиной len2
+inline uint32_t AdlerCombine(uint32_t a1, uint32_t a2, uint64_t len2) {
+    uint32_t rem = (uint32_t)(len2 % kAdlerBase);
+    uint32_t sum1 = a1 & 0xFFFF;
+    uint32_t sum2 = (uint32_t)((uint64_t)rem * sum1 % kAdlerBase);
+    sum1 += (a2 & 0xFFFF) + kAdlerBase - 1;
+    sum2 += (a1 >> 16) + (a2 >> 16) + kAdlerBase - rem;
+    if (sum1 >= kAdlerBase) sum1 -= kAdlerBase;
+    if (sum1 >= kAdlerBase) sum1 -= kAdlerBase;
+    if (sum2 >= kAdlerBase * 2) sum2 -= kAdlerBase * 2;
+    if (sum2 >= kAdlerBase) sum2 -= kAdlerBase;
+    return sum1 | sum2 << 16;
+}
+
+// Сжатие deflate (RFC 1951) в независимые куски: Compress дописывает
+// нефинальные блоки и выравнивает поток пустым stored-блоком, так что
+// куски склеиваются подряд; Finish — пустой последний блок.
+class DeflateEncoder {
+public:
+    void Compress(const uint8_t* data, size_t n, std::vector<uint8_t>& out) {
+        BitWriter w{ &out };
+        head.assign(kHashSize, -1);
+        prev.resize(kWindow);
+        tokens.clear();
+        size_t blockStart = 0;
+        size_t pos = 0;
+        while (pos < n) {
+            int len = 0, dist = 0;
+            if (pos + kMinMatch <= n) {
+                int32_t cand = Insert(data, pos);
+                FindMatch(data, n, pos, cand, len, dist);
+            }
+            if (len >= kMinMatch) {
+                tokens.push_back(Token{ (uint16_t)len, (uint16_t)dist });
+                for (size_t k = pos + 1; k < pos + len && k + kMinMatch <= n; k++) Insert(data, k);
+                pos += len;
+            }
+            else {
+                tokens.push_back(Token{ data[pos], 0 });
+                pos++;
+            }
+            if (tokens.size() >= kBlockTokens) {
+                EmitBlock(w, data + blockStart, pos - blockStart);
+                blockStart = pos;
+            }
+        }
+        if (!tokens.empty()) EmitBlock(w, data + blockStart, pos - blockStart);
+        // Пустой stored-блок: выравнивание на байт
+        w.Put(0, 3);
+        w.Align();
+        const uint8_t sync[] = { 0, 0, 0xFF, 0xFF };
+        out.insert(out.end(), sync, sync + 4);
+    }
+
+    // Пустой последний блок с фиксированными кодами: BFINAL, BTYPE = 01, код 256
+    static void Finish(std::vector<uint8_t>& out) {
+        out.push_back(0x03);
+        out.push_back(0x00);
+    }
+
+private:
+    static const int kWindow = 32768;
+    static const int kHashBits = 15;
+    static const int kHashSize = 1 << kHashBits;
+    static const int kMinMatch = 3;
+    static const int kMaxMatch = 258;
+    static const int kMaxChain = 32;      // кандидатов на позицию
+    static const size_t kBlockTokens = 1 << 16;
+
+    struct Token {
+        uint16_t value; // литерал или длина совпадения
+        uint16_t dist;  // 0 — литерал
+    };
+
+    struct BitWriter {
+        std::vector<uint8_t>* out;
+        uint64_t bits = 0;
+        int count = 0;
+        void Put(uint32_t v, int n) {
+            bits |= (uint64_t)v << count;
+            count += n;
+            while (count >= 8) {
+                out->push_back((uint8_t)bits);
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+        void Align() {
+            if (count) Put(0, 8 - count);
+        }
+    };
+
+    std::vector<int32_t> head, prev;
+    std::vector<Token> tokens;
+
+    static uint32_t Hash(const uint8_t* p) {
+        uint32_t v = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+        return (v * 2654435761u) >> (32 - kHashBits);
+    }
+
+    // Позиция pos в цепочку своего хэша; возвращает прежнюю голову
+    int32_t Insert(const uint8_t* data, size_t pos) {
+        uint32_t h = Hash(data + pos);
+        int32_t cand = head[h];
+        prev[pos & (kWindow - 1)] = cand;
+        head[h] = (int32_t)pos;
+        return cand;
+    }
+
+    void FindMatch(const uint8_t* data, size_t n, size_t pos, int32_t cand, int& bestLen, int& bestDist) const {
+        int limit = (int)(std::min)((size_t)kMaxMatch, n - pos);
+        const uint8_t* p = data + pos;
+        for (int chain = kMaxChain; cand >= 0 && pos - (size_t)cand < (size_t)kWindow && chain > 0; chain--) {
+            const uint8_t* q = data + cand;
+            if (q[bestLen] == p[bestLen]) {
+                int len = 0;
+                while (len < limit && q[len] == p[len]) len++;
+                if (len > bestLen) {
+                    bestLen = len;
+                    bestDist = (int)(pos - (size_t)cand);
+                    if (len == limit) break;
+                }
+            }
+            cand = prev[cand & (kWindow - 1)];
+        }
+    }
+
+    static int LengthCode(int len, int& extra, int& extraBits) {
+        static const uint16_t base[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+            35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const uint8_t bits[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+            3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        int c = (int)(std::upper_bound(base, base + 29, (uint16_t)len) - base) - 1;
+        extra = len - base[c];
+        extraBits = bits[c];
+        return 257 + c;
+    }
+
+    static int DistCode(int dist, int& extra, int& extraBits) {
+        int x = dist - 1;
+        if (x < 4) {
+            extra = 0;
+            extraBits = 0;
+            return x;
+        }
+        int b = 31;
+        while (!(x >> b)) b--;
+        int code = 2 * b + ((x >> (b - 1)) & 1);
+        extraBits = b - 1;
+        extra = x - ((2 | (code & 1)) << (b - 1));
+        return code;
+    }
+
+    // Длины кодов Хаффмана не длиннее maxBits (алгоритм Моффата —
+    // Катаянена по частотам, затем выравнивание неравенства Крафта)
+    static void CodeLengths(const uint32_t* freq, int n, int maxBits, uint8_t* lengths) {
+        std::vector<int> syms;
+        for (int i = 0; i < n; i++) {
+            lengths[i] = 0;
+            if (freq[i]) syms.push_back(i);
+        }
+        // Не меньше двух кодов: одиночный код декодеры принимают не везде
+        for (int i = 0; syms.size() < 2; i++)
+            if (!freq[i]) syms.push_back(i);
+        std::sort(syms.begin(), syms.end(), [&](int a, int b) { return freq[a] < freq[b]; });
+        int m = (int)syms.size();
+        std::vector<uint32_t> A(m);
+        for (int i = 0; i < m; i++) A[i] = (std::max)(freq[syms[i]], 1u);
+
+        A[0] += A[1];
+        int root = 0, leaf = 2;
+        for (int next = 1; next < m - 1; next++) {
+            if (leaf >= m || A[root] < A[leaf]) { A[next] = A[root]; A[root++] = next; }
+            else A[next] = A[leaf++];
+            if (leaf >= m || (root < next && A[root] < A[leaf])) { A[next] += A[root]; A[root++] = next; }
+            else A[next] += A[leaf++];
+        }
+        A[m - 2] = 0;
+        for (int next = m - 3; next >= 0; next--) A[next] = A[A[next]] + 1;
+        int avail = 1, used = 0, depth = 0;
+        root = m - 2;
+        int next = m - 1;
+        while (avail > 0) {
+            while (root >= 0 && (int)A[root] == depth) { used++; root--; }
+            while (avail > used) { A[next--] = depth; avail--; }
+            avail = 2 * used;
+            depth++;
+            used = 0;
+        }
+
+        int counts[33] = { 0 };
+        for (int i = 0; i < m; i++) counts[(std::min)((int)A[i], 32)]++;
+        for (int i = maxBits + 1; i <= 32; i++) {
+            counts[maxBits] += counts[i];
+            counts[i] = 0;
+        }
+        uint32_t total = 0;
+        for (int i = 1; i <= maxBits; i++) total += (uint32_t)counts[i] << (maxBits - i);
+        while (total != 1u << maxBits) {
+            counts[maxBits]--;
+            for (int i = maxBits - 1; i > 0; i--)
+                if (counts[i]) {
+                    counts[i]--;
+                    counts[i + 1] += 2;
+                    break;
+                }
+            total--;
+        }
+        // Редкие символы (начало syms) получают длинные коды
+        int j = 0;
+        for (int len = maxBits; len >= 1; len--)
+            for (int k = counts[len]; k > 0; k--) lengths[syms[j++]] = (uint8_t)len;
+    }
+
+    // Канонические коды, биты развёрнуты под запись младшим битом вперёд
+    static void Codes(const uint8_t* lengths, int n, uint16_t* codes) {
+        int count[16] = { 0 }, next[16] = { 0 };
+        for (int i = 0; i < n; i++) count[lengths[i]]++;
+        count[0] = 0;
+        for (int len = 1, code = 0; len < 16; len++) {
+            code = (code + count[len - 1]) << 1;
+            next[len] = code;
+        }
+        for (int i = 0; i < n; i++) {
+            int len = lengths[i];
+            if (!len) continue;
+            uint32_t c = (uint32_t)next[len]++, r = 0;
+            for (int k = 0; k < len; k++) r |= ((c >> k) & 1) << (len - 1 - k);
+            codes[i] = (uint16_t)r;
+        }
+    }
+
+    // Блок из tokens (raw — исходные байты блока): динамический Хаффман
+    // или stored, если так короче
+    void EmitBlock(BitWriter& w, const uint8_t* raw, size_t rawSize) {
+        uint32_t litFreq[286] = { 0 }, distFreq[30] = { 0 };
+        int extra, extraBits;
+        for (const Token& t : tokens) {
+            if (t.dist) {
+                litFreq[LengthCode(t.value, extra, extraBits)]++;
+                distFreq[DistCode(t.dist, extra, extraBits)]++;
+            }
+            else litFreq[t.value]++;
+        }
+        litFreq[256] = 1;
+        uint8_t lens[286 + 30];
+        CodeLengths(litFreq, 286, 15, lens);
+        CodeLengths(distFreq, 30, 15, lens + 286);
+        int hlit = 286, hdist = 30;
+        while (hlit > 257 && !lens[hlit - 1]) hlit--;
+        while (hdist > 1 && !lens[286 + hdist - 1]) hdist--;
+
+        // Длины подряд (литералы, затем расстояния) с повторами 16, 17, 18
+        uint8_t all[286 + 30];
+        memcpy(all, lens, hlit);
+        memcpy(all + hlit, lens + 286, hdist);
+        int total = hlit + hdist;
+        std::vector<uint8_t> rle; // символ, затем значение доп. битов
+        for (int i = 0; i < total;) {
+            uint8_t len = all[i];
+            int run = 1;
+            while (i + run < total && all[i + run] == len) run++;
+            i += run;
+            if (len == 0) {
+                while (run >= 11) {
+                    int r = (std::min)(run, 138);
+                    rle.push_back(18); rle.push_back((uint8_t)(r - 11));
+                    run -= r;
+                }
+                if (run >= 3) {
+                    rle.push_back(17); rle.push_back((uint8_t)(run - 3));
+                    run = 0;
+                }
+            }
+            else {
+                rle.push_back(len); rle.push_back(0);
+                run--;
+                while (run >= 3) {
+                    int r = (std::min)(run, 6);
+                    rle.push_back(16); rle.push_back((uint8_t)(r - 3));
+                    run -= r;
+                }
+            }
+            for (; run > 0; run--) {
+                rle.push_back(len); rle.push_back(0);
+            }
+        }
+        uint32_t clFreq[19] = { 0 };
+        for (size_t i = 0; i < rle.size(); i += 2) clFreq[rle[i]]++;
+        uint8_t clLens[19];
+        CodeLengths(clFreq, 19, 7, clLens);
+        static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+        int hclen = 19;
+        while (hclen > 4 && !clLens[order[hclen - 1]]) hclen--;
+
+        // Размер в битах: динамический против stored
+        uint64_t bits = 3 + 5 + 5 + 4 + 3 * (uint64_t)hclen;
+        static const uint8_t clExtra[19] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7 };
+        for (size_t i = 0; i < rle.size(); i += 2) bits += clLens[rle[i]] + clExtra[rle[i]];
+        for (const Token& t : tokens) {
+            if (t.dist) {
+                int lc = LengthCode(t.value, extra, extraBits);
+                bits += lens[lc] + extraBits;
+                int dc = DistCode(t.dist, extra, extraBits);
+                bits += lens[286 + dc] + extraBits;
+            }
+            else bits += lens[t.value];
+        }
+        bits += lens[256];
+        uint64_t storedBits = (rawSize + 65534) / 65535 * 40 + rawSize * 8 + 7;
+        if (storedBits < bits) {
+            EmitStored(w, raw, rawSize);
+            tokens.clear();
+            return;
+        }
+
+        uint16_t litCodes[286], distCodes[30], clCodes[19];
+        Codes(lens, 286, litCodes);
+        Codes(lens + 286, 30, distCodes);
+        Codes(clLens, 19, clCodes);
+        w.Put(0, 1); // не последний
+        w.Put(2, 2); // динамический Хаффман
+        w.Put(hlit - 257, 5);
+        w.Put(hdist - 1, 5);
+        w.Put(hclen - 4, 4);
+        for (int i = 0; i < hclen; i++) w.Put(clLens[order[i]], 3);
+        for (size_t i = 0; i < rle.size(); i += 2) {
+            w.Put(clCodes[rle[i]], clLens[rle[i]]);
+            if (clExtra[rle[i]]) w.Put(rle[i + 1], clExtra[rle[i]]);
+        }
+        for (const Token& t : tokens) {
+            if (t.dist) {
+                int lc = LengthCode(t.value, extra, extraBits);
+                w.Put(litCodes[lc], lens[lc]);
+                if (extraBits) w.Put(extra, extraBits);
+                int dc = DistCode(t.dist, extra, extraBits);
+                w.Put(distCodes[dc], lens[286 + dc]);
+                if (extraBits) w.Put(extra, extraBits);
+            }
+            else w.Put(litCodes[t.value], lens[t.value]);
+        }
+        w.Put(litCodes[256], lens[256]);
+        tokens.clear();
+    }
+
+    static void EmitStored(BitWriter& w, const uint8_t* raw, size_t n) {
+        do {
+            size_t m = (std::min)(n, (size_t)65535);
+            w.Put(0, 3); // не последний, stored
+            w.Align();
+            w.Put((uint32_t)m, 16);
+            w.Put((uint32_t)m ^ 0xFFFF, 16);
+            w.out->insert(w.out->end(), raw, raw + m);
+            raw += m;
+            n -= m;
+        } while (n > 0);
+    }
+};
+
+// Сжатая полоса строк
+struct PngBand {
+    std::vector<uint8_t> filtered; // строки с байтом фильтра (рабочий буфер)
+    std::vector<uint8_t> data;     // кусок потока deflate
+    uint32_t adler = 1;            // Adler-32 строк с фильтрами
+    uint64_t size = 0;             // их длина
+    bool failed = false;           // полосу не удалось нарисовать: файл не дописывается
+};
+
+// rows строк непрозрачных пикселей ARGB (stride — пикселей в строке) ->
+// RGB с фильтром и сжатием. Фильтр строки — None, Sub, Up или Paeth с
+// наименьшей суммой модулей; первая строка полосы не ссылается на
+// предыдущую полосу (только None и Sub).
+inline void EncodePngBand(const uint32_t* pixels, size_t stride, int width, int rows, PngBand& out) {
+    size_t rowBytes = (size_t)width * 3;
+    out.filtered.resize((rowBytes + 1) * rows);
+    std::vector<uint8_t> cur(rowBytes), prev(rowBytes), trial[4];
+    for (auto& t : trial) t.resize(rowBytes);
+    for (int y = 0; y < rows; y++) {
+        const uint32_t* src = pixels + (size_t)y * stride;
+        for (int x = 0; x < width; x++) {
+            cur[x * 3] = (uint8_t)(src[x] >> 16);
+            cur[x * 3 + 1] = (uint8_t)(src[x] >> 8);
+            cur[x * 3 + 2] = (uint8_t)src[x];
+        }
+        const int filters[] = { 0, 1, 2, 4 };
+        int kinds = y > 0 ? 4 : 2;
+        int best = 0;
+        uint64_t bestSum = UINT64_MAX;
+        for (int k = 0; k < kinds; k++) {
+            uint8_t* t = trial[k].data();
+            uint64_t sum = 0;
+            for (size_t i = 0; i < rowBytes; i++) {
+                int a = i >= 3 ? cur[i - 3] : 0, b = prev[i], c = i >= 3 ? prev[i - 3] : 0;
+                int pred = 0;
+                switch (filters[k]) {
+                case 1: pred = a; break;
+                case 2: pred = b; break;
+                case 4: {
+                    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+                    pred = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+                    break;
+                }
+                }
+                t[i] = (uint8_t)(cur[i] - pred);
+                sum += (uint64_t)abs((int8_t)t[i]);
+            }
+            if (sum < bestSum) {
+                bestSum = sum;
+                best = k;
+            }
+        }
+        uint8_t* dst = &out.filtered[(rowBytes + 1) * y];
+        dst[0] = (uint8_t)filters[best];
+        memcpy(dst + 1, trial[best].data(), rowBytes);
+        std::swap(cur, prev);
+    }
+    out.size = out.filtered.size();
+    out.adler = Adler32(1, out.filtered.data(), out.filtered.size());
+    out.data.clear();
+    DeflateEncoder().Compress(out.filtered.data(), out.filtered.size(), out.data);
+}
+
+// Файл PNG (RGB, 8 бит на канал), данные которого приходят полосами
+class PngStream {
+public:
+    // Подпись, IHDR, pHYs при dpi > 0 и заголовок zlib. Файл открывает и
+    // закрывает вызывающий.
+    bool Begin(FILE* f, uint32_t width, uint32_t height, double dpi) {
+        file = f;
+        adler = 1;
+        ok = true;
+        const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        ok = fwrite(signature, 1, 8, file) == 8;
+        uint8_t ihdr[13];
+        Put32(ihdr, width);
+        Put32(ihdr + 4, height);
+        ihdr[8] = 8;  // бит на канал
+        ihdr[9] = 2;  // RGB
+        ihdr[10] = 0; // deflate
+        ihdr[11] = 0; // фильтры строк
+        ihdr[12] = 0; // без чередования
+        Chunk("IHDR", ihdr, 13);
+        if (dpi > 0) {
+            uint8_t phys[9];
+            uint32_t perMeter = (uint32_t)(dpi / 0.0254 + 0.5);
+            Put32(phys, perMeter);
+            Put32(phys + 4, perMeter);
+            phys[8] = 1; // метры
+            Chunk("pHYs", phys, 9);
+        }
+        const uint8_t zlib[] = { 0x78, 0x01 };
+        Chunk("IDAT", zlib, 2);
+        return ok;
+    }
+
+    // Следующая полоса
+    bool Append(const PngBand& band) {
+        for (size_t at = 0; at < band.data.size(); at += kMaxChunk)
+            Chunk("IDAT", band.data.data() + at, (std::min)(kMaxChunk, band.data.size() - at));
+        adler = AdlerCombine(adler, band.adler, band.size);
+        return ok;
+    }
+
+    // Конец потока zlib и IEND
+    bool End() {
+        std::vector<uint8_t> tail;
+        DeflateEncoder::Finish(tail);
+        uint8_t sum[4];
+        Put32(sum, adler);
+        tail.insert(tail.end(), sum, sum + 4);
+        Chunk("IDAT", tail.data(), tail.size());
+        Chunk("IEND", nullptr, 0);
+        return ok && fflush(file) == 0;
+    }
+
+private:
+    static const size_t kMaxChunk = 1 << 20;
+    FILE* file = nullptr;
+    uint32_t adler = 1;
+    bool ok = false;
+
+    static void Put32(uint8_t* p, uint32_t v) {
+        p[0] = (uint8_t)(v >> 24);
+        p[1] = (uint8_t)(v >> 16);
+        p[2] = (uint8_t)(v >> 8);
+        p[3] = (uint8_t)v;
+    }
+
+    void Chunk(const char* type, const uint8_t* data, size_t n) {
+        uint8_t head[8];
+        Put32(head, (uint32_t)n);
+        memcpy(head + 4, type, 4);
+        uint32_t crc = Crc32(Crc32(0, head + 4, 4), data, n);
+        uint8_t tail[4];
+        Put32(tail, crc);
+        ok = ok && fwrite(head, 1, 8, file) == 8 && (n == 0 || fwrite(data, 1, n, file) == n) && fwrite(tail, 1, 4, file) == 4;
+    }
+};
+
+// Полосы [0, bands): encode(b, band) рисует и сжимает полосу b (из любого
+// потока), вызывающий поток пишет их в png по порядку, как только готова
+// очередная. В работе не больше window полос. Вызывающий поток и сам
+// берёт полосы, пока ждёт, поэтому вызов из задачи того же пула не
+// блокируется. encode, которому не хватило памяти на полосу, ставит
+// band.failed; тогда, как и при ошибке записи, новые полосы не берутся.
+// false — не удалось нарисовать полосу или записать файл.
+template <class Encode>
+bool StreamBands(ThreadPool* pool, PngStream& png, size_t bands, size_t window, const Encode& encode) {
+    struct State {
+        std::mutex m;
+        std::condition_variable cv;
+        size_t next = 0, written = 0;
+        size_t helpers = 0;
+        bool failed = false;
+        std::vector<PngBand> slots;
+        std::vector<char> ready;
+    } st;
+    window = (std::max)((size_t)1, window);
+    st.slots.resize(window);
+    st.ready.assign(window, 0);
+
+    // Следующая полоса для кодирования, если окно позволяет; под замком
+    auto claim = [&](size_t& b) {
+        if (st.failed || st.next >= bands || st.next >= st.written + window) return false;
+        b = st.next++;
+        return true;
+    };
+    auto run = [&](size_t b) {
+        st.slots[b % window].failed = false;
+        encode(b, st.slots[b % window]);
+        std::lock_guard<std::mutex> lock(st.m);
+        st.ready[b % window] = 1;
+        st.cv.notify_all();
+    };
+    auto helper = [&]() {
+        for (;;) {
+            size_t b;
+            {
+                std::lock_guard<std::mutex> lock(st.m);
+                if (!claim(b)) {
+                    st.helpers--;
+                    st.cv.notify_all();
+                    return;
+                }
+            }
+            run(b);
+        }
+    };
+    auto spawn = [&]() { // под замком
+        size_t most = pool ? pool->WorkerCount() : 0;
+        size_t waiting = (std::min)(bands, st.written + window) - st.next;
+        while (st.helpers < most && waiting > st.helpers) {
+            st.helpers++;
+            pool->Submit(helper);
+        }
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(st.m);
+        spawn();
+    }
+    for (size_t w = 0; w < bands && !st.failed; w++) {
+        size_t slot = w % window;
+        for (;;) {
+            size_t b;
+            std::unique_lock<std::mutex> lock(st.m);
+            if (st.ready[slot]) break;
+            if (claim(b)) {
+                lock.unlock();
+                run(b);
+                continue;
+            }
+            st.cv.wait(lock);
+        }
+        bool ok = !st.slots[slot].failed && png.Append(st.slots[slot]);
+        std::lock_guard<std::mutex> lock(st.m);
+        st.ready[slot] = 0;
+        st.written++;
+        st.failed = !ok;
+        if (!st.failed) spawn();
+    }
+    std::unique_lock<std::mutex> lock(st.m);
+    st.cv.wait(lock, [&] { return st.helpers == 0; });
+    return !st.failed;
+}
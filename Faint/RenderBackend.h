@@ -0,0 +1,309 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Вывод сцены через интерфейс RenderBackend.
+// Всё, что знает, как выглядит фигура (вершины треугольника и звезды, оси
+// графика, выборка точек функции по пикселям устройства), живёт здесь;
+// backend умеет только примитивы в мировых координатах, а преобразование
+// мир -> устройство и отсечение держит у себя. В приложении backend —
+// GDI+ (Faint.cpp), без окна — программный растеризатор (SoftRaster.h).
+// Не зависит от Win32.
+// -------------------------------------------------------------------------
+#ifndef _USE_MATH_DEFINES
+#define _USE_MATH_DEFINES
+#endif
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+#include "SceneStore.h"
+
+class RenderBackend {
+public:
+    virtual ~RenderBackend() {}
+
+    // Пикселей устройства на единицу мира
+    virtual float PixelsPerUnit() const = 0;
+    // Видимая часть мира с учётом отсечения
+    virtual BoundsF VisibleBounds() const = 0;
+
+    // Кардинальный сплайн (натяжение 0.5, как DrawCurve) через n >= 2 узлов;
+    // круглые концы и стыки
+    virtual void Curve(const ScenePoint* pts, size_t n, uint32_t argb, float width) = 0;
+    // Ломаная из n >= 2 точек: плоские концы, стыки с митрой
+    virtual void Lines(const ScenePoint* pts, size_t n, uint32_t argb, float width) = 0;
+    // Замкнутый контур многоугольника, стыки с митрой
+    virtual void Polygon(const ScenePoint* pts, size_t n, uint32_t argb, float width) = 0;
+    // Контур эллипса, вписанного в прямоугольник
+    virtual void Ellipse(float x, float y, float w, float h, uint32_t argb, float width) = 0;
+    // Картинка из таблицы, растянутая на прямоугольник
+    virtual void Image(uint32_t image, float x, float y, float w, float h) = 0;
+    // Подпись оси шрифтом 8 пт (Arial в GDI+) в пикселях устройства, при
+    // любом масштабе; (x, y) — мировая точка левого верхнего угла
+    virtual void Label(const char* text, float x, float y, uint32_t argb) = 0;
+
+    // Отсечение мировым прямоугольником поверх текущего; PopClip возвращает прежнее
+    virtual void PushClip(const BoundsF& b) = 0;
+    virtual void PopClip() = 0;
+};
+
+// Штрих кисти; куски стёртого штриха — отдельными кривыми
+inline void DrawStroke(RenderBackend& out, const ScenePoint* pts, size_t n, uint32_t argb, float width) {
+    ForEachStrokePiece(pts, n, [&](const ScenePoint* p, size_t m) {
+        if (m >= 2) out.Curve(p, m, argb, width);
+    });
+}
+
+// Оси графика и сетка задаются в пикселях устройства: толщина линий,
+// длина делений, отступы и размер подписей от масштаба не зависят, а шаг
+// делений подбирается под масштаб. Выводится только видимое.
+const double kAxisExtent = 100000;      // длина полуоси, мировых единиц
+const double kAxisMinTickPixels = 60;   // соседние деления не ближе
+const uint32_t kAxisColor = 0xC8000000;
+const uint32_t kGridColor = 0x18000000;
+
+// Шаг делений 1, 2 или 5 * 10^k мировых единиц: наименьший, при котором
+// соседние деления на экране не ближе minPixels
+inline double AxisStep(double pxPerUnit, double minPixels) {
+    double raw = minPixels / pxPerUnit;
+    double decade = std::pow(10.0, std::floor(std::log10(raw)));
+    for (double m : { 1.0, 2.0, 5.0 })
+        if (m * decade >= raw * (1 - 1e-9)) return m * decade;
+    return 10 * decade;
+}
+
+// Подпись деления: знаков после запятой столько, сколько различает шаг
+inline std::string AxisLabel(double value, double step) {
+    int decimals = step >= 1 ? 0 : (int)std::ceil(-std::log10(step) - 1e-9);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+    return buf;
+}
+
+// Оси с делениями и подписями и сетка по делениям
+inline void DrawAxes(RenderBackend& out, float ox, float oy) {
+    double px = out.PixelsPerUnit() > 0 ? out.PixelsPerUnit() : 1.0;
+    float onePx = (float)(1 / px);
+    BoundsF vis = out.VisibleBounds();
+    double step = AxisStep(px, kAxisMinTickPixels);
+
+    // Номера делений [first, last] на отрезке [lo, hi] от начала координат
+    auto ticks = [&](double lo, double hi, long long& first, long long& last) {
+        lo = (std::max)(lo, -kAxisExtent);
+        hi = (std::min)(hi, kAxisExtent);
+        first = (long long)std::ceil(lo / step);
+        last = (long long)std::floor(hi / step);
+    };
+    long long first, last;
+
+    // Видимая часть квадрата осей
+    float x0 = (std::max)(vis.minX, ox - (float)kAxisExtent), x1 = (std::min)(vis.maxX, ox + (float)kAxisExtent);
+    float y0 = (std::max)(vis.minY, oy - (float)kAxisExtent), y1 = (std::min)(vis.maxY, oy + (float)kAxisExtent);
+    if (x0 > x1 || y0 > y1) return;
+
+    // Сетка: вертикальные линии по делениям x, горизонтальные — по делениям y
+    ticks(x0 - ox, x1 - ox, first, last);
+    for (long long i = first; i <= last; i++) {
+        if (i == 0) continue;
+        float x = ox + (float)(i * step);
+        ScenePoint line[] = { { x, y0 }, { x, y1 } };
+        out.Lines(line, 2, kGridColor, onePx);
+    }
+    ticks(oy - y1, oy - y0, first, last);
+    for (long long i = first; i <= last; i++) {
+        if (i == 0) continue;
+        float y = oy - (float)(i * step);
+        ScenePoint line[] = { { x0, y }, { x1, y } };
+        out.Lines(line, 2, kGridColor, onePx);
+    }
+
+    // Ось x с подписями под ней (до 20 пикселей вниз, до 50 вправо от деления)
+    if (oy >= vis.minY - 20 * onePx && oy <= vis.maxY + 3 * onePx) {
+        ScenePoint axis[] = { { x0, oy }, { x1, oy } };
+        out.Lines(axis, 2, kAxisColor, onePx);
+        ticks(vis.minX - ox - 50 * onePx, vis.maxX - ox + 10 * onePx, first, last);
+        for (long long i = first; i <= last; i++) {
+            if (i == 0) continue;
+            double value = i * step;
+            float x = ox + (float)value;
+            ScenePoint tick[] = { { x, oy - 3 * onePx }, { x, oy + 3 * onePx } };
+            out.Lines(tick, 2, kAxisColor, onePx);
+            out.Label(AxisLabel(value, step).c_str(), x - 10 * onePx, oy + 5 * onePx, kAxisColor);
+        }
+    }
+
+    // Ось y с подписями справа от неё
+    if (ox >= vis.minX - 60 * onePx && ox <= vis.maxX + 3 * onePx) {
+        ScenePoint axis[] = { { ox, y0 }, { ox, y1 } };
+        out.Lines(axis, 2, kAxisColor, onePx);
+        ticks(oy - vis.maxY - 14 * onePx, oy - vis.minY + 6 * onePx, first, last);
+        for (long long i = first; i <= last; i++) {
+            if (i == 0) continue;
+            double value = i * step;
+            float y = oy - (float)value;
+            ScenePoint tick[] = { { ox - 3 * onePx, y }, { ox + 3 * onePx, y } };
+            out.Lines(tick, 2, kAxisColor, onePx);
+            out.Label(AxisLabel(value, step).c_str(), ox + 5 * onePx, y - 6 * onePx, kAxisColor);
+        }
+    }
+}
+
+// Допустимый диапазон x графика в координатах функции
+inline void FunctionRange(const FunctionPlot& f, double& start, double& end) {
+    if (f.clipToRange) {
+        start = (std::min)(f.rangeStart, f.rangeEnd);
+        end = (std::max)(f.rangeStart, f.rangeEnd);
+    }
+    else {
+        start = -50000.0; end = 50000.0;
+    }
+}
+
+// Точки кривой для мировой области vis. Сетка дискретизации привязана к
+// пикселям устройства, диапазон x — к видимой области; точки берутся из
+// кэша уровня масштаба, досчитываются только новые края.
+inline void FunctionSamples(FunctionPlot& f, double pxPerUnit, const BoundsF& vis, std::vector<PlotSample>& samples) {
+    double start, end;
+    FunctionRange(f, start, end);
+    double from = (std::max)(start, (double)vis.minX - f.originX);
+    double to = (std::min)(end, (double)vis.maxX - f.originX);
+    samples.clear();
+    if (from <= to) f.cache.Query(f.program, pxPerUnit > 0 ? pxPerUnit : 1.0, from, to, start, end, samples);
+}
+
+// Мировые границы кривой в области vis (без осей и толщины линии)
+inline BoundsF FunctionCurveBounds(FunctionPlot& f, double pxPerUnit, const BoundsF& vis) {
+    std::vector<PlotSample> samples;
+    FunctionSamples(f, pxPerUnit, vis, samples);
+    BoundsF b = BoundsF::Empty();
+    for (const PlotSample& s : samples) {
+        float y = f.originY - (float)s.y;
+        if (std::isfinite(y)) b.Include(f.originX + (float)s.x, y);
+    }
+    return b;
+}
+
+// График функции: оси и кривая из кэша точек
+inline void DrawFunction(RenderBackend& out, FunctionPlot& f) {
+    float ox = f.originX, oy = f.originY;
+    if (f.drawAxes) DrawAxes(out, ox, oy);
+
+    if (f.clipToRange) {
+        double start, end;
+        FunctionRange(f, start, end);
+        out.PushClip(BoundsF{ (float)(ox + start), oy - 100000, (float)(ox + end), oy + 100000 });
+    }
+
+    std::vector<PlotSample> samples;
+    FunctionSamples(f, out.PixelsPerUnit(), out.VisibleBounds(), samples);
+
+    std::vector<ScenePoint> segment;
+    auto flush = [&]() {
+        if (segment.size() > 1) out.Lines(segment.data(), segment.size(), f.color, f.width);
+        segment.clear();
+    };
+    for (const PlotSample& s : samples) {
+        float screenY = oy - (float)s.y;
+        if (!std::isfinite(screenY)) { flush(); continue; }
+        segment.push_back(ScenePoint{ ox + (float)s.x, screenY });
+        if (s.breakAfter) flush();
+    }
+    flush();
+
+    if (f.clipToRange) out.PopClip();
+}
+
+// Фигура id сцены
+inline void DrawShape(RenderBackend& out, const SceneStore& s, uint32_t id) {
+    const SceneStore::Ref& r = s.order[id];
+    size_t i = r.slot;
+    switch (r.kind) {
+    case ShapeKind::Pen: {
+        const StrokeArray& a = s.strokes;
+        DrawStroke(out, a.Points(i), a.count[i], a.color[i], a.stroke[i]);
+        break;
+    }
+    case ShapeKind::Line: {
+        const LineArray& a = s.lines;
+        ScenePoint pts[] = { { a.x0[i], a.y0[i] }, { a.x1[i], a.y1[i] } };
+        out.Lines(pts, 2, a.color[i], a.stroke[i]);
+        break;
+    }
+    case ShapeKind::Rect: {
+        const BoxArray& a = s.rects;
+        ScenePoint pts[] = {
+            { a.x[i], a.y[i] }, { a.x[i] + a.w[i], a.y[i] },
+            { a.x[i] + a.w[i], a.y[i] + a.h[i] }, { a.x[i], a.y[i] + a.h[i] } };
+        out.Polygon(pts, 4, a.color[i], a.stroke[i]);
+        break;
+    }
+    case ShapeKind::Ellipse: {
+        const BoxArray& a = s.ellipses;
+        out.Ellipse(a.x[i], a.y[i], a.w[i], a.h[i], a.color[i], a.stroke[i]);
+        break;
+    }
+    case ShapeKind::Triangle: {
+        const BoxArray& a = s.triangles;
+        ScenePoint pts[] = {
+            { a.x[i] + a.w[i] / 2, a.y[i] },
+            { a.x[i], a.y[i] + a.h[i] },
+            { a.x[i] + a.w[i], a.y[i] + a.h[i] } };
+        out.Polygon(pts, 3, a.color[i], a.stroke[i]);
+        break;
+    }
+    case ShapeKind::Star: {
+        const BoxArray& a = s.stars;
+        float cx = a.x[i] + a.w[i] / 2;
+        float cy = a.y[i] + a.h[i] / 2;
+        float R = (std::min)(a.w[i], a.h[i]) / 2;
+        float rr = R * 0.4f;
+
+        ScenePoint pnts[10];
+        double angle = -M_PI / 2;
+        double step = M_PI / 5;
+        for (int k = 0; k < 10; k++) {
+            float currR = (k % 2 == 0) ? R : rr;
+            pnts[k] = ScenePoint{ cx + (float)(cos(angle) * currR), cy + (float)(sin(angle) * currR) };
+            angle += step;
+        }
+        out.Polygon(pnts, 10, a.color[i], a.stroke[i]);
+        break;
+    }
+    case ShapeKind::Image: {
+        const BoxArray& a = s.images;
+        out.Image(s.imageIds[i], a.x[i], a.y[i], a.w[i], a.h[i]);
+        break;
+    }
+    case ShapeKind::Function:
+        DrawFunction(out, *s.functions[i]);
+        break;
+    case ShapeKind::Erased:
+        break;
+    }
+}
+
+inline void DrawScene(RenderBackend& out, const SceneStore& s) {
+    for (uint32_t id = 0; id < (uint32_t)s.Size(); id++) DrawShape(out, s, id);
+}
+
+// Габарит рисунка для вывода целиком. У графика по y нет границ: берётся
+// квадрат над его диапазоном x вокруг начала координат.
+inline BoundsF DrawingExtent(const SceneStore& s) {
+    BoundsF all = BoundsF::Empty();
+    for (uint32_t id = 0; id < (uint32_t)s.Size(); id++) {
+        const SceneStore::Ref& r = s.order[id];
+        if (r.kind == ShapeKind::Erased) continue;
+        if (r.kind != ShapeKind::Function) {
+            all.Include(s.Bounds(id));
+            continue;
+        }
+        const FunctionPlot& f = *s.functions[r.slot];
+        float lo = (float)(std::min)(f.rangeStart, f.rangeEnd), hi = (float)(std::max)(f.rangeStart, f.rangeEnd);
+        float half = (hi - lo) / 2;
+        all.Include(BoundsF{ f.originX + lo, f.originY - half, f.originX + hi, f.originY + half });
+    }
+    return all;
+}
@@ -0,0 +1,475 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Хранилище сцены в виде массивов по типам фигур.
+// Фигуры одного типа лежат подряд (структура массивов): прямоугольные
+// примитивы — x/y/w/h/толщина/цвет, отрезки — концы, штрихи кисти —
+// указатель и длина куска в блоках точек (Arena.h). Порядок отрисовки задаёт
+// order: id фигуры — позиция в нём, элемент — (тип, номер в массиве типа).
+// Id не меняются до очистки: стёртая фигура остаётся в order как Erased,
+// её данные становятся мусором до Compact().
+// Цвет — ARGB в uint32_t (как Gdiplus::ARGB). Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+#include "Arena.h"
+#include "MathParser.h"
+#include "FunctionSampler.h"
+#include "SpatialIndex.h"
+
+enum class ShapeKind : uint8_t { Pen, Line, Rect, Ellipse, Triangle, Star, Image, Function, Erased };
+
+// Элемент массива типа, который больше не принадлежит ни одной фигуре
+const uint32_t kNoShape = UINT32_MAX;
+
+// Совместима по раскладке с Gdiplus::PointF
+struct ScenePoint {
+    float X, Y;
+};
+
+// Разрыв внутри штриха, частично стёртого ластиком: точка (NaN, NaN)
+// разделяет независимые куски, каждый рисуется своей кривой
+template <class P>
+inline bool IsStrokeBreak(const P& p) { return std::isnan(p.X); }
+
+// fn(first, count) для каждого непрерывного куска штриха
+template <class P, class F>
+void ForEachStrokePiece(const P* pts, size_t n, const F& fn) {
+    size_t start = 0;
+    for (size_t i = 0; i <= n; i++) {
+        if (i < n && !IsStrokeBreak(pts[i])) continue;
+        if (i > start) fn(pts + start, i - start);
+        start = i + 1;
+    }
+}
+
+// Габарит участка кривой DrawCurve у узлов [from, to) с пером width.
+// Кардинальный сплайн (натяжение 0.5) лежит в оболочке узлов и
+// контрольных точек p[i] ± (p[i+1] - p[i-1]) / 6.
+template <class P>
+BoundsF StrokeSpanBounds(const P* pts, size_t n, size_t from, size_t to, float width) {
+    BoundsF b = BoundsF::Empty();
+    for (size_t i = from; i < to && i < n; i++) {
+        const P& prev = pts[i > 0 ? i - 1 : i];
+        const P& next = pts[i + 1 < n ? i + 1 : i];
+        float tx = (next.X - prev.X) / 6, ty = (next.Y - prev.Y) / 6;
+        b.Include(pts[i].X - tx, pts[i].Y - ty);
+        b.Include(pts[i].X + tx, pts[i].Y + ty);
+    }
+    b.Inflate(width / 2);
+    return b;
+}
+
+// Прямоугольные примитивы одного типа
+struct BoxArray {
+    std::vector<float> x, y, w, h, stroke;
+    std::vector<uint32_t> color;
+    std::vector<uint32_t> id;   // позиция в порядке отрисовки
+
+    size_t Size() const { return x.size(); }
+    void Push(uint32_t shapeId, float bx, float by, float bw, float bh, uint32_t argb, float width) {
+        x.push_back(bx); y.push_back(by); w.push_back(bw); h.push_back(bh);
+        stroke.push_back(width); color.push_back(argb); id.push_back(shapeId);
+    }
+    void Clear() {
+        x.clear(); y.clear(); w.clear(); h.clear(); stroke.clear(); color.clear(); id.clear();
+    }
+    // pad = stroke * padPerWidth (половина пера, выступ острых углов)
+    BoundsF Bounds(size_t i, float padPerWidth) const {
+        BoundsF b{ x[i], y[i], x[i] + w[i], y[i] + h[i] };
+        b.Inflate(stroke[i] * padPerWidth);
+        return b;
+    }
+};
+
+struct LineArray {
+    std::vector<float> x0, y0, x1, y1, stroke;
+    std::vector<uint32_t> color;
+    std::vector<uint32_t> id;
+
+    size_t Size() const { return x0.size(); }
+    void Push(uint32_t shapeId, float ax, float ay, float bx, float by, uint32_t argb, float width) {
+        x0.push_back(ax); y0.push_back(ay); x1.push_back(bx); y1.push_back(by);
+        stroke.push_back(width); color.push_back(argb); id.push_back(shapeId);
+    }
+    void Clear() {
+        x0.clear(); y0.clear(); x1.clear(); y1.clear(); stroke.clear(); color.clear(); id.clear();
+    }
+    BoundsF Bounds(size_t i) const {
+        BoundsF b = BoundsF::Empty();
+        b.Include(x0[i], y0[i]);
+        b.Include(x1[i], y1[i]);
+        b.Inflate(stroke[i] / 2);
+        return b;
+    }
+};
+
+// Штрихи кисти. Точки каждого штриха лежат одним куском в блоках arena:
+// буфер не растёт удвоением с копированием, указатели на точки постоянны,
+// очистка освобождает все штрихи разом. Штрихи загруженного документа
+// указывают прямо в отображение файла (PushView) и не копируются.
+struct StrokeArray {
+    std::vector<const ScenePoint*> first;
+    std::vector<uint32_t> count;
+    std::vector<float> stroke;
+    std::vector<uint32_t> color;
+    std::vector<uint32_t> id;
+    Arena points;
+    size_t pointBytes = 0; // точки всех штрихов, и своих, и чужих
+
+    size_t Size() const { return first.size(); }
+    void Push(uint32_t shapeId, const ScenePoint* pts, size_t n, uint32_t argb, float width) {
+        ScenePoint* dst = points.Allocate<ScenePoint>(n);
+        std::copy(pts, pts + n, dst);
+        PushView(shapeId, dst, n, argb, width);
+    }
+    // Точки остаются там, где лежат; владелец памяти — SceneStore::Borrow
+    void PushView(uint32_t shapeId, const ScenePoint* pts, size_t n, uint32_t argb, float width) {
+        first.push_back(pts);
+        count.push_back((uint32_t)n);
+        stroke.push_back(width); color.push_back(argb); id.push_back(shapeId);
+        pointBytes += n * sizeof(ScenePoint);
+    }
+    void Clear() {
+        first.clear(); count.clear(); stroke.clear(); color.clear(); id.clear();
+        points.Reset();
+        pointBytes = 0;
+    }
+    const ScenePoint* Points(size_t i) const { return first[i]; }
+    BoundsF Bounds(size_t i) const {
+        BoundsF b = BoundsF::Empty();
+        ForEachStrokePiece(Points(i), count[i], [&](const ScenePoint* p, size_t n) {
+            b.Include(StrokeSpanBounds(p, n, 0, n, stroke[i]));
+        });
+        return b;
+    }
+};
+
+// График функции. Объект тяжёлый (программа, кэш точек) и не меняется после
+// создания, поэтому хранится по указателю и разделяется между копиями сцены.
+struct FunctionPlot {
+    std::string expression;
+    double rangeStart, rangeEnd;
+    float originX, originY;
+    bool drawAxes, clipToRange;
+    uint32_t color;
+    float width;
+    CompiledExpression program; // выражение разбирается один раз при создании
+    PlotCache cache;            // точки по уровням масштаба (выражение и диапазон не меняются)
+
+    FunctionPlot(const std::string& expr, double start, double end, float ox, float oy,
+        uint32_t argb, float w, bool axes, bool clip)
+        : expression(expr), rangeStart(start), rangeEnd(end), originX(ox), originY(oy),
+        drawAxes(axes), clipToRange(clip), color(argb), width(w), program(MathParser::Compile(expr)) {
+    }
+
+    BoundsF Bounds() const {
+        // По y график не ограничен; оси тянутся на ±100000 от начала координат
+        double lo = clipToRange ? (std::min)(rangeStart, rangeEnd) : -50000.0;
+        double hi = clipToRange ? (std::max)(rangeStart, rangeEnd) : 50000.0;
+        BoundsF b{ originX + (float)lo, -INFINITY, originX + (float)hi, INFINITY };
+        if (drawAxes) b.Include(BoundsF{ originX - 100000, originY - 100000, originX + 100000, originY + 100000 });
+        b.Inflate(width / 2);
+        return b;
+    }
+};
+
+class SceneStore {
+public:
+    struct Ref {
+        ShapeKind kind;
+        uint32_t slot; // номер в массиве своего типа
+    };
+
+    std::vector<Ref> order;   // порядок отрисовки, id = позиция
+    StrokeArray strokes;
+    LineArray lines;
+    BoxArray rects, ellipses, triangles, stars;
+    BoxArray images;          // цвет и толщина не используются
+    std::vector<uint32_t> imageIds; // по номеру картинки — id во внешней таблице изображений
+    std::vector<std::shared_ptr<FunctionPlot>> functions;
+    std::vector<uint32_t> functionIds; // позиции графиков в порядке отрисовки
+
+    size_t Size() const { return order.size(); }
+    size_t Erased() const { return erased; }
+
+    uint32_t AddStroke(const ScenePoint* pts, size_t n, uint32_t argb, float width) {
+        uint32_t id = Next(ShapeKind::Pen, strokes.Size());
+        strokes.Push(id, pts, n, argb, width);
+        return id;
+    }
+    // Штрих без копирования точек: pts внутри памяти, отданной Borrow
+    uint32_t AddStrokeView(const ScenePoint* pts, size_t n, uint32_t argb, float width) {
+        uint32_t id = Next(ShapeKind::Pen, strokes.Size());
+        strokes.PushView(id, pts, n, argb, width);
+        return id;
+    }
+
+    // Сцена ссылается на чужую память [data, data + size) (отображение файла);
+    // owner держит её, пока жива сцена или её копии для тайлов
+    void Borrow(std::shared_ptr<const void> owner, const void* data, size_t size) {
+        const char* b = static_cast<const char*>(data);
+        backing.push_back(Backing{ std::move(owner), b, b + size });
+    }
+    bool Borrowed(const void* p) const {
+        const char* c = static_cast<const char*>(p);
+        for (auto& b : backing)
+            if (c >= b.begin && c < b.end) return true;
+        return false;
+    }
+    // Копирует чужие точки к себе и отпускает чужую память
+    void Materialize() {
+        for (size_t i = 0; i < strokes.Size(); i++) {
+            if (!Borrowed(strokes.first[i])) continue;
+            ScenePoint* dst = strokes.points.Allocate<ScenePoint>(strokes.count[i]);
+            std::copy(strokes.first[i], strokes.first[i] + strokes.count[i], dst);
+            strokes.first[i] = dst;
+        }
+        backing.clear();
+    }
+    uint32_t AddLine(float ax, float ay, float bx, float by, uint32_t argb, float width) {
+        uint32_t id = Next(ShapeKind::Line, lines.Size());
+        lines.Push(id, ax, ay, bx, by, argb, width);
+        return id;
+    }
+    // Rect, Ellipse, Triangle или Star
+    uint32_t AddBox(ShapeKind kind, float x, float y, float w, float h, uint32_t argb, float width) {
+        BoxArray& a = Boxes(kind);
+        uint32_t id = Next(kind, a.Size());
+        a.Push(id, x, y, w, h, argb, width);
+        return id;
+    }
+    uint32_t AddImage(float x, float y, float w, float h, uint32_t imageId) {
+        uint32_t id = Next(ShapeKind::Image, images.Size());
+        images.Push(id, x, y, w, h, 0, 0);
+        imageIds.push_back(imageId);
+        return id;
+    }
+    uint32_t AddFunction(std::shared_ptr<FunctionPlot> f) {
+        uint32_t id = Next(ShapeKind::Function, functions.size());
+        functions.push_back(std::move(f));
+        functionIds.push_back(id);
+        return id;
+    }
+
+    // Новые точки штриха или отрезка id (куски через IsStrokeBreak).
+    // Отрезок при этом становится штрихом с тем же цветом и толщиной.
+    void ReplaceStroke(uint32_t id, const ScenePoint* pts, size_t n) {
+        Ref& r = order[id];
+        uint32_t argb;
+        float width;
+        if (r.kind == ShapeKind::Pen) {
+            argb = strokes.color[r.slot];
+            width = strokes.stroke[r.slot];
+        }
+        else {
+            argb = lines.color[r.slot];
+            width = lines.stroke[r.slot];
+        }
+        Detach(r);
+        r = Ref{ ShapeKind::Pen, (uint32_t)strokes.Size() };
+        strokes.Push(id, pts, n, argb, width);
+    }
+
+    // Место стёртой фигуры: id занят, фигуры нет (сцена, прочитанная из
+    // снимка журнала, сохраняет id живой сцены)
+    uint32_t AddErased() {
+        erased++;
+        return Next(ShapeKind::Erased, 0);
+    }
+
+    // Последняя добавленная фигура занимает место стёртой фигуры id — так
+    // отмена стирания возвращает фигуру под прежним id
+    void Place(uint32_t id) {
+        Ref r = order.back();
+        order.pop_back();
+        Owner(r) = id;
+        order[id] = r;
+        erased--;
+    }
+
+    // Фигура убирается из сцены; id остаётся занятым
+    void Erase(uint32_t id) {
+        Ref& r = order[id];
+        if (r.kind == ShapeKind::Erased) return;
+        Detach(r);
+        r = Ref{ ShapeKind::Erased, 0 };
+        erased++;
+    }
+
+    // Мусор (данные стёртых и заменённых фигур) занимает больше живых данных
+    bool NeedsCompact() const {
+        size_t total = strokes.pointBytes + order.size() * kSlotBytes;
+        return garbage > ((size_t)64 << 10) && garbage * 2 > total;
+    }
+
+    // Переупаковывает массивы без мусора; id и порядок не меняются
+    void Compact() {
+        SceneStore fresh;
+        fresh.backing = backing;
+        fresh.order.reserve(order.size());
+        for (uint32_t id = 0; id < (uint32_t)order.size(); id++) fresh.CopyShape(*this, id);
+        *this = std::move(fresh);
+    }
+
+    // Мировой габарит фигуры с учётом толщины линии
+    BoundsF Bounds(uint32_t id) const {
+        const Ref& r = order[id];
+        switch (r.kind) {
+        case ShapeKind::Pen: return strokes.Bounds(r.slot);
+        case ShapeKind::Line: return lines.Bounds(r.slot);
+        case ShapeKind::Function: return functions[r.slot]->Bounds();
+        case ShapeKind::Erased: return BoundsF::Empty();
+        default: return Boxes(r.kind).Bounds(r.slot, BoxPad(r.kind));
+        }
+    }
+
+    // Габариты всех фигур по id: отдельный проход по каждому массиву.
+    // У стёртых — пустой габарит.
+    void AllBounds(std::vector<BoundsF>& out) const {
+        out.assign(order.size(), BoundsF::Empty());
+        for (size_t i = 0; i < strokes.Size(); i++)
+            if (strokes.id[i] != kNoShape) out[strokes.id[i]] = strokes.Bounds(i);
+        for (size_t i = 0; i < lines.Size(); i++)
+            if (lines.id[i] != kNoShape) out[lines.id[i]] = lines.Bounds(i);
+        const ShapeKind boxKinds[] = { ShapeKind::Rect, ShapeKind::Ellipse, ShapeKind::Triangle, ShapeKind::Star, ShapeKind::Image };
+        for (ShapeKind k : boxKinds) {
+            const BoxArray& a = Boxes(k);
+            float pad = BoxPad(k);
+            for (size_t i = 0; i < a.Size(); i++)
+                if (a.id[i] != kNoShape) out[a.id[i]] = a.Bounds(i, pad);
+        }
+        for (size_t i = 0; i < functions.size(); i++)
+            if (functionIds[i] != kNoShape) out[functionIds[i]] = functions[i]->Bounds();
+    }
+
+    // Всё сразу: массивы простых типов освобождаются без обхода
+    void Clear() {
+        order.clear();
+        strokes.Clear();
+        lines.Clear();
+        rects.Clear(); ellipses.Clear(); triangles.Clear(); stars.Clear(); images.Clear();
+        imageIds.clear();
+        functions.clear();
+        functionIds.clear();
+        erased = 0;
+        garbage = 0;
+        backing.clear();
+    }
+
+    // Дописывает фигуры src с указанными id (в порядке ids) — снимок части
+    // сцены для фонового потока. Графики и точки из отображённого файла
+    // разделяются, а не копируются.
+    void AppendFrom(const SceneStore& src, const std::vector<uint32_t>& ids) {
+        for (auto& b : src.backing)
+            if (!Borrowed(b.begin)) backing.push_back(b);
+        for (uint32_t sid : ids) CopyShape(src, sid);
+    }
+    // Все фигуры src; в пустой сцене id те же (стёртые — пустыми местами)
+    void AppendAll(const SceneStore& src) {
+        for (auto& b : src.backing)
+            if (!Borrowed(b.begin)) backing.push_back(b);
+        order.reserve(order.size() + src.order.size());
+        for (uint32_t sid = 0; sid < (uint32_t)src.order.size(); sid++) CopyShape(src, sid);
+    }
+
+    BoxArray& Boxes(ShapeKind k) { return const_cast<BoxArray&>(static_cast<const SceneStore*>(this)->Boxes(k)); }
+    const BoxArray& Boxes(ShapeKind k) const {
+        switch (k) {
+        case ShapeKind::Ellipse: return ellipses;
+        case ShapeKind::Triangle: return triangles;
+        case ShapeKind::Star: return stars;
+        case ShapeKind::Image: return images;
+        default: return rects;
+        }
+    }
+
+    // Запас габарита на единицу толщины пера: прямой угол — 0.75,
+    // острые углы многоугольников — лимит митры GDI+ (10 полуширин)
+    static float BoxPad(ShapeKind k) {
+        switch (k) {
+        case ShapeKind::Rect: return 0.75f;
+        case ShapeKind::Ellipse: return 0.5f;
+        case ShapeKind::Triangle:
+        case ShapeKind::Star: return 5.0f;
+        default: return 0.0f;
+        }
+    }
+
+private:
+    struct Backing {
+        std::shared_ptr<const void> owner;
+        const char* begin;
+        const char* end;
+    };
+    std::vector<Backing> backing;
+
+    static const size_t kSlotBytes = 32; // примерно столько занимает запись фигуры в столбцах
+
+    size_t erased = 0;  // фигур Erased в order
+    size_t garbage = 0; // байт в массивах, которые больше не принадлежат фигурам
+
+    // Копия фигуры sid из src в конец; стёртая копируется как Erased
+    uint32_t CopyShape(const SceneStore& src, uint32_t sid) {
+        const Ref& r = src.order[sid];
+        size_t i = r.slot;
+        switch (r.kind) {
+        case ShapeKind::Pen:
+            // Чужие точки не копируются: копия разделяет владельца (backing)
+            if (src.Borrowed(src.strokes.Points(i)))
+                return AddStrokeView(src.strokes.Points(i), src.strokes.count[i], src.strokes.color[i], src.strokes.stroke[i]);
+            return AddStroke(src.strokes.Points(i), src.strokes.count[i], src.strokes.color[i], src.strokes.stroke[i]);
+        case ShapeKind::Line:
+            return AddLine(src.lines.x0[i], src.lines.y0[i], src.lines.x1[i], src.lines.y1[i], src.lines.color[i], src.lines.stroke[i]);
+        case ShapeKind::Image:
+            return AddImage(src.images.x[i], src.images.y[i], src.images.w[i], src.images.h[i], src.imageIds[i]);
+        case ShapeKind::Function:
+            return AddFunction(src.functions[i]);
+        case ShapeKind::Erased:
+            return AddErased();
+        default: {
+            const BoxArray& a = src.Boxes(r.kind);
+            return AddBox(r.kind, a.x[i], a.y[i], a.w[i], a.h[i], a.color[i], a.stroke[i]);
+        }
+        }
+    }
+
+    // Позиция в порядке отрисовки, записанная у элемента массива типа
+    uint32_t& Owner(const Ref& r) {
+        switch (r.kind) {
+        case ShapeKind::Pen: return strokes.id[r.slot];
+        case ShapeKind::Line: return lines.id[r.slot];
+        case ShapeKind::Function: return functionIds[r.slot];
+        default: return Boxes(r.kind).id[r.slot];
+        }
+    }
+
+    // Элемент массива типа больше не принадлежит фигуре
+    void Detach(const Ref& r) {
+        if (r.kind != ShapeKind::Erased) garbage += kSlotBytes;
+        switch (r.kind) {
+        case ShapeKind::Pen:
+            strokes.id[r.slot] = kNoShape;
+            garbage += strokes.count[r.slot] * sizeof(ScenePoint);
+            break;
+        case ShapeKind::Line: lines.id[r.slot] = kNoShape; break;
+        case ShapeKind::Function:
+            functionIds[r.slot] = kNoShape;
+            functions[r.slot].reset();
+            break;
+        case ShapeKind::Erased: break;
+        default: Boxes(r.kind).id[r.slot] = kNoShape; break;
+        }
+    }
+
+    uint32_t Next(ShapeKind kind, size_t slot) {
+        uint32_t id = (uint32_t)order.size();
+        order.push_back(Ref{ kind, (uint32_t)slot });
+        return id;
+    }
+};
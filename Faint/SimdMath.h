@@ -0,0 +1,350 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Векторные операции над массивами double для пакетного вычисления f(x).
+// AVX2 (4 полосы), SSE2 (2 полосы) или скалярный вариант (FAINT_NO_SIMD / другие CPU).
+// sin/cos/log/exp реализованы полиномами Cephes; значения вне рабочей области
+// (NaN, inf, отрицательный аргумент log, огромные аргументы sin) досчитываются
+// скалярными функциями CRT, поэтому результат для каждого x не зависит от его
+// положения в массиве.
+// -------------------------------------------------------------------------
+#include <cmath>
+#include <cfloat>
+#include <cstdint>
+
+#if !defined(FAINT_NO_SIMD)
+#if defined(__AVX2__)
+#define FAINT_SIMD_AVX2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FAINT_SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+#endif
+
+namespace simd {
+
+// Все массивы, передаваемые сюда, имеют длину, кратную kMaxLanes
+const int kMaxLanes = 4;
+
+// Граница, до которой редукция аргумента sin/cos по Коди-Уэйту точна
+const double kMaxTrigArg = 1.0e8;
+// exp(x) остаётся в нормализованных числах
+const double kMaxExpArg = 708.0;
+// Целые показатели степени, которые считаются умножениями
+const int kMaxIntPow = 64;
+
+inline double PowInt(double a, int n) {
+    unsigned int e = (unsigned int)(n < 0 ? -n : n);
+    double r = 1.0;
+    while (e) {
+        if (e & 1) r *= a;
+        a *= a;
+        e >>= 1;
+    }
+    return n < 0 ? 1.0 / r : r;
+}
+
+#if defined(FAINT_SIMD_AVX2) || defined(FAINT_SIMD_SSE2)
+
+#if defined(FAINT_SIMD_AVX2)
+typedef __m256d vd;
+typedef __m256i vi;
+const int kLanes = 4;
+const int kAllLanes = 0xF;
+inline vd VLoad(const double* p) { return _mm256_loadu_pd(p); }
+inline void VStore(double* p, vd v) { _mm256_storeu_pd(p, v); }
+inline vd VSet(double v) { return _mm256_set1_pd(v); }
+inline vd VAdd(vd a, vd b) { return _mm256_add_pd(a, b); }
+inline vd VSub(vd a, vd b) { return _mm256_sub_pd(a, b); }
+inline vd VMul(vd a, vd b) { return _mm256_mul_pd(a, b); }
+inline vd VDiv(vd a, vd b) { return _mm256_div_pd(a, b); }
+inline vd VSqrt(vd a) { return _mm256_sqrt_pd(a); }
+inline vd VAnd(vd a, vd b) { return _mm256_and_pd(a, b); }
+inline vd VAndNot(vd a, vd b) { return _mm256_andnot_pd(a, b); }
+inline vd VOr(vd a, vd b) { return _mm256_or_pd(a, b); }
+inline vd VXor(vd a, vd b) { return _mm256_xor_pd(a, b); }
+inline vd VLt(vd a, vd b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+inline vd VLe(vd a, vd b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+inline vd VGt(vd a, vd b) { return _mm256_cmp_pd(a, b, _CMP_GT_OQ); }
+inline vd VNe(vd a, vd b) { return _mm256_cmp_pd(a, b, _CMP_NEQ_UQ); }
+inline vd VSelect(vd mask, vd a, vd b) { return _mm256_blendv_pd(b, a, mask); }
+inline int VMask(vd m) { return _mm256_movemask_pd(m); }
+inline vi VBits(vd a) { return _mm256_castpd_si256(a); }
+inline vd VFromBits(vi a) { return _mm256_castsi256_pd(a); }
+inline vi IAdd(vi a, vi b) { return _mm256_add_epi64(a, b); }
+inline vi ISub(vi a, vi b) { return _mm256_sub_epi64(a, b); }
+inline vi IAnd(vi a, vi b) { return _mm256_and_si256(a, b); }
+inline vi IOr(vi a, vi b) { return _mm256_or_si256(a, b); }
+inline vi ISet(long long v) { return _mm256_set1_epi64x(v); }
+template <int N> inline vi IShl(vi a) { return _mm256_slli_epi64(a, N); }
+template <int N> inline vi IShr(vi a) { return _mm256_srli_epi64(a, N); }
+#else
+typedef __m128d vd;
+typedef __m128i vi;
+const int kLanes = 2;
+const int kAllLanes = 0x3;
+inline vd VLoad(const double* p) { return _mm_loadu_pd(p); }
+inline void VStore(double* p, vd v) { _mm_storeu_pd(p, v); }
+inline vd VSet(double v) { return _mm_set1_pd(v); }
+inline vd VAdd(vd a, vd b) { return _mm_add_pd(a, b); }
+inline vd VSub(vd a, vd b) { return _mm_sub_pd(a, b); }
+inline vd VMul(vd a, vd b) { return _mm_mul_pd(a, b); }
+inline vd VDiv(vd a, vd b) { return _mm_div_pd(a, b); }
+inline vd VSqrt(vd a) { return _mm_sqrt_pd(a); }
+inline vd VAnd(vd a, vd b) { return _mm_and_pd(a, b); }
+inline vd VAndNot(vd a, vd b) { return _mm_andnot_pd(a, b); }
+inline vd VOr(vd a, vd b) { return _mm_or_pd(a, b); }
+inline vd VXor(vd a, vd b) { return _mm_xor_pd(a, b); }
+inline vd VLt(vd a, vd b) { return _mm_cmplt_pd(a, b); }
+inline vd VLe(vd a, vd b) { return _mm_cmple_pd(a, b); }
+inline vd VGt(vd a, vd b) { return _mm_cmpgt_pd(a, b); }
+inline vd VNe(vd a, vd b) { return _mm_cmpneq_pd(a, b); }
+inline vd VSelect(vd mask, vd a, vd b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+inline int VMask(vd m) { return _mm_movemask_pd(m); }
+inline vi VBits(vd a) { return _mm_castpd_si128(a); }
+inline vd VFromBits(vi a) { return _mm_castsi128_pd(a); }
+inline vi IAdd(vi a, vi b) { return _mm_add_epi64(a, b); }
+inline vi ISub(vi a, vi b) { return _mm_sub_epi64(a, b); }
+inline vi IAnd(vi a, vi b) { return _mm_and_si128(a, b); }
+inline vi IOr(vi a, vi b) { return _mm_or_si128(a, b); }
+inline vi ISet(long long v) { return _mm_set1_epi64x(v); }
+template <int N> inline vi IShl(vi a) { return _mm_slli_epi64(a, N); }
+template <int N> inline vi IShr(vi a) { return _mm_srli_epi64(a, N); }
+#endif
+
+// 1.5 * 2^52: прибавление округляет до целого, а младшие биты мантиссы дают int64
+const double kRoundMagic = 6755399441055744.0;
+
+inline vd VSignMask() { return VFromBits(ISet((long long)0x8000000000000000ULL)); }
+inline vd VAbs(vd a) { return VAndNot(VSignMask(), a); }
+inline vd VRound(vd a) { return VSub(VAdd(a, VSet(kRoundMagic)), VSet(kRoundMagic)); }
+inline vd VFloor(vd a) {
+    vd r = VRound(a);
+    return VSub(r, VAnd(VGt(r, a), VSet(1.0)));
+}
+// Целое значение double (|v| < 2^51) -> int64 и обратно
+inline vi VToInt(vd a) { return ISub(VBits(VAdd(a, VSet(kRoundMagic))), VBits(VSet(kRoundMagic))); }
+inline vd VFromInt(vi a) { return VSub(VFromBits(IAdd(a, VBits(VSet(kRoundMagic)))), VSet(kRoundMagic)); }
+
+// Схема Горнера, коэффициенты от старшего к младшему (polevl/p1evl из Cephes)
+template <int N> inline vd VPoly(vd x, const double* c) {
+    vd r = VSet(c[0]);
+    for (int i = 1; i < N; i++) r = VAdd(VMul(r, x), VSet(c[i]));
+    return r;
+}
+template <int N> inline vd VPoly1(vd x, const double* c) {
+    vd r = VAdd(x, VSet(c[0]));
+    for (int i = 1; i < N; i++) r = VAdd(VMul(r, x), VSet(c[i]));
+    return r;
+}
+
+// sin и cos с общей редукцией аргумента. |x| <= kMaxTrigArg.
+inline void VSinCos(vd x, vd* s, vd* c) {
+    static const double sincof[] = {
+        1.58962301576546568060E-10, -2.50507477628578072866E-8, 2.75573136213857245213E-6,
+        -1.98412698295895385996E-4, 8.33333333332211858878E-3, -1.66666666666666307295E-1 };
+    static const double coscof[] = {
+        -1.13585365213876817300E-11, 2.08757008419747316778E-9, -2.75573141792967388112E-7,
+        2.48015872888517045348E-5, -1.38888888888730564116E-3, 4.16666666666665929218E-2 };
+    const double DP1 = 7.85398125648498535156E-1;
+    const double DP2 = 3.77489470793079817668E-8;
+    const double DP3 = 2.69515142907905952645E-15;
+    const double FOPI = 1.27323954473516268615; // 4/pi
+
+    vd ax = VAbs(x);
+    vi j = VToInt(VFloor(VMul(ax, VSet(FOPI))));
+    j = IAnd(IAdd(j, ISet(1)), ISet(~1LL));
+    vd y = VFromInt(j);
+
+    vd z = VSub(VSub(VSub(ax, VMul(y, VSet(DP1))), VMul(y, VSet(DP2))), VMul(y, VSet(DP3)));
+    vd zz = VMul(z, z);
+    vd ps = VAdd(z, VMul(VMul(z, zz), VPoly<6>(zz, sincof)));
+    vd pc = VAdd(VSub(VSet(1.0), VMul(zz, VSet(0.5))), VMul(VMul(zz, zz), VPoly<6>(zz, coscof)));
+
+    // j in {0,2,4,6}: бит 1 меняет местами sin/cos, бит 2 (и бит 1 для cos) меняет знак
+    vd swap = VGt(VFromInt(IAnd(j, ISet(3))), VSet(1.0));
+    vd sinSign = VAnd(VXor(x, VFromBits(IShl<61>(j))), VSignMask());
+    vd cosSign = VAnd(VXor(VFromBits(IShl<61>(j)), VFromBits(IShl<62>(j))), VSignMask());
+    *s = VXor(VSelect(swap, pc, ps), sinSign);
+    *c = VXor(VSelect(swap, ps, pc), cosSign);
+}
+
+// Натуральный логарифм для нормализованных x > 0
+inline vd VLog(vd x) {
+    static const double P[] = {
+        1.01875663804580931796E-4, 4.97494994976747001425E-1, 4.70579119878881725854E0,
+        1.44989225341610930846E1, 1.79368678507819816313E1, 7.70838733755885391666E0 };
+    static const double Q[] = {
+        1.12873587189167450590E1, 4.52279145837532221105E1, 8.29875266912776603211E1,
+        7.11544750618563894466E1, 2.31251620126765340583E1 };
+    const double SQRTH = 0.70710678118654752440;
+
+    vi bits = VBits(x);
+    vd e = VFromInt(ISub(IShr<52>(bits), ISet(1022)));
+    vd m = VFromBits(IOr(IAnd(bits, ISet(0x000FFFFFFFFFFFFFLL)), ISet(1022LL << 52)));
+
+    vd small = VLt(m, VSet(SQRTH));
+    e = VSub(e, VAnd(small, VSet(1.0)));
+    m = VSelect(small, VSub(VAdd(m, m), VSet(1.0)), VSub(m, VSet(1.0)));
+
+    vd z = VMul(m, m);
+    vd y = VMul(m, VDiv(VMul(z, VPoly<6>(m, P)), VPoly1<5>(m, Q)));
+    y = VSub(y, VMul(e, VSet(2.121944400546905827679e-4)));
+    y = VSub(y, VMul(z, VSet(0.5)));
+    vd r = VAdd(m, y);
+    return VAdd(r, VMul(e, VSet(0.693359375)));
+}
+
+// e^x для |x| <= kMaxExpArg
+inline vd VExp(vd x) {
+    static const double P[] = {
+        1.26177193074810590878E-4, 3.02994407707441961300E-2, 9.99999999999999999910E-1 };
+    static const double Q[] = {
+        3.00198505138664455042E-6, 2.52448340349684104192E-3, 2.27265548208155028766E-1,
+        2.00000000000000000009E0 };
+    const double C1 = 6.93145751953125E-1;
+    const double C2 = 1.42860682030941723212E-6;
+    const double LOG2E = 1.4426950408889634073599;
+
+    vd px = VFloor(VAdd(VMul(x, VSet(LOG2E)), VSet(0.5)));
+    vi n = VToInt(px);
+    x = VSub(VSub(x, VMul(px, VSet(C1))), VMul(px, VSet(C2)));
+    vd xx = VMul(x, x);
+    px = VMul(x, VPoly<3>(xx, P));
+    x = VDiv(px, VSub(VPoly<4>(xx, Q), px));
+    x = VAdd(VSet(1.0), VAdd(x, x));
+    vd scale = VFromBits(IShl<52>(IAdd(n, ISet(1023))));
+    return VMul(x, scale);
+}
+
+inline vd VPowInt(vd a, int n) {
+    unsigned int e = (unsigned int)(n < 0 ? -n : n);
+    vd r = VSet(1.0);
+    while (e) {
+        if (e & 1) r = VMul(r, a);
+        a = VMul(a, a);
+        e >>= 1;
+    }
+    return n < 0 ? VDiv(VSet(1.0), r) : r;
+}
+
+// Полосы, не прошедшие проверку области определения, пересчитываются скалярно
+template <class F>
+inline void FixupLanes(double* out, const double* in, vd valid, F scalarFn) {
+    int m = VMask(valid);
+    if (m == kAllLanes) return;
+    for (int l = 0; l < kLanes; l++) {
+        if (!(m & (1 << l))) out[l] = scalarFn(in[l]);
+    }
+}
+
+inline void Fill(double* a, double v, int n) {
+    vd vv = VSet(v);
+    for (int i = 0; i < n; i += kLanes) VStore(a + i, vv);
+}
+inline void Add(double* a, const double* b, int n) {
+    for (int i = 0; i < n; i += kLanes) VStore(a + i, VAdd(VLoad(a + i), VLoad(b + i)));
+}
+inline void Sub(double* a, const double* b, int n) {
+    for (int i = 0; i < n; i += kLanes) VStore(a + i, VSub(VLoad(a + i), VLoad(b + i)));
+}
+inline void Mul(double* a, const double* b, int n) {
+    for (int i = 0; i < n; i += kLanes) VStore(a + i, VMul(VLoad(a + i), VLoad(b + i)));
+}
+// a = (b != 0) ? a / b : a — как в MathParser
+inline void Div(double* a, const double* b, int n) {
+    for (int i = 0; i < n; i += kLanes) {
+        vd va = VLoad(a + i), vb = VLoad(b + i);
+        VStore(a + i, VSelect(VNe(vb, VSet(0.0)), VDiv(va, vb), va));
+    }
+}
+inline void Neg(double* a, int n) {
+    for (int i = 0; i < n; i += kLanes) VStore(a + i, VXor(VLoad(a + i), VSignMask()));
+}
+inline void Abs(double* a, int n) {
+    for (int i = 0; i < n; i += kLanes) VStore(a + i, VAbs(VLoad(a + i)));
+}
+inline void SqrtAbs(double* a, int n) {
+    for (int i = 0; i < n; i += kLanes) VStore(a + i, VSqrt(VAbs(VLoad(a + i))));
+}
+
+enum TrigKind { TrigSin, TrigCos, TrigTan };
+
+inline void Trig(double* a, int n, TrigKind kind) {
+    double in[kLanes];
+    for (int i = 0; i < n; i += kLanes) {
+        vd x = VLoad(a + i);
+        vd valid = VLe(VAbs(x), VSet(kMaxTrigArg));
+        VStore(in, x);
+        vd s, c;
+        VSinCos(VAnd(valid, x), &s, &c);
+        vd r = (kind == TrigSin) ? s : (kind == TrigCos) ? c : VDiv(s, c);
+        VStore(a + i, r);
+        if (kind == TrigSin) FixupLanes(a + i, in, valid, [](double v) { return std::sin(v); });
+        else if (kind == TrigCos) FixupLanes(a + i, in, valid, [](double v) { return std::cos(v); });
+        else FixupLanes(a + i, in, valid, [](double v) { return std::tan(v); });
+    }
+}
+inline void Sin(double* a, int n) { Trig(a, n, TrigSin); }
+inline void Cos(double* a, int n) { Trig(a, n, TrigCos); }
+inline void Tan(double* a, int n) { Trig(a, n, TrigTan); }
+
+inline void Log(double* a, int n) {
+    double in[kLanes];
+    for (int i = 0; i < n; i += kLanes) {
+        vd x = VLoad(a + i);
+        vd valid = VAnd(VLe(VSet(DBL_MIN), x), VLe(x, VSet(DBL_MAX)));
+        VStore(in, x);
+        VStore(a + i, VLog(VSelect(valid, x, VSet(1.0))));
+        FixupLanes(a + i, in, valid, [](double v) { return std::log(v); });
+    }
+}
+
+// a = a^b. Основание > 0: exp(b*log(a)), остальное — скалярный pow.
+inline void Pow(double* a, const double* b, int n) {
+    double in[kLanes], ex[kLanes];
+    for (int i = 0; i < n; i += kLanes) {
+        vd x = VLoad(a + i), y = VLoad(b + i);
+        vd valid = VAnd(VAnd(VLe(VSet(DBL_MIN), x), VLe(x, VSet(DBL_MAX))), VLe(VAbs(y), VSet(DBL_MAX)));
+        vd t = VMul(y, VLog(VSelect(valid, x, VSet(1.0))));
+        valid = VAnd(valid, VLe(VAbs(t), VSet(kMaxExpArg)));
+        VStore(in, x);
+        VStore(ex, y);
+        VStore(a + i, VExp(VAnd(valid, t)));
+        int m = VMask(valid);
+        if (m != kAllLanes) {
+            for (int l = 0; l < kLanes; l++) {
+                if (!(m & (1 << l))) a[i + l] = std::pow(in[l], ex[l]);
+            }
+        }
+    }
+}
+
+inline void PowInt(double* a, int e, int n) {
+    for (int i = 0; i < n; i += kLanes) VStore(a + i, VPowInt(VLoad(a + i), e));
+}
+
+#else
+
+// Скалярный вариант: те же операции поэлементно через CRT
+const int kLanes = 1;
+
+inline void Fill(double* a, double v, int n) { for (int i = 0; i < n; i++) a[i] = v; }
+inline void Add(double* a, const double* b, int n) { for (int i = 0; i < n; i++) a[i] += b[i]; }
+inline void Sub(double* a, const double* b, int n) { for (int i = 0; i < n; i++) a[i] -= b[i]; }
+inline void Mul(double* a, const double* b, int n) { for (int i = 0; i < n; i++) a[i] *= b[i]; }
+inline void Div(double* a, const double* b, int n) { for (int i = 0; i < n; i++) if (b[i] != 0) a[i] /= b[i]; }
+inline void Neg(double* a, int n) { for (int i = 0; i < n; i++) a[i] = -a[i]; }
+inline void Abs(double* a, int n) { for (int i = 0; i < n; i++) a[i] = std::fabs(a[i]); }
+inline void SqrtAbs(double* a, int n) { for (int i = 0; i < n; i++) a[i] = std::sqrt(std::fabs(a[i])); }
+inline void Sin(double* a, int n) { for (int i = 0; i < n; i++) a[i] = std::sin(a[i]); }
+inline void Cos(double* a, int n) { for (int i = 0; i < n; i++) a[i] = std::cos(a[i]); }
+inline void Tan(double* a, int n) { for (int i = 0; i < n; i++) a[i] = std::tan(a[i]); }
+inline void Log(double* a, int n) { for (int i = 0; i < n; i++) a[i] = std::log(a[i]); }
+inline void Pow(double* a, const double* b, int n) { for (int i = 0; i < n; i++) a[i] = std::pow(a[i], b[i]); }
+inline void PowInt(double* a, int e, int n) { for (int i = 0; i < n; i++) a[i] = PowInt(a[i], e); }
+
+#endif
+
+} // namespace simd
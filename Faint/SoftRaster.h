@@ -0,0 +1,636 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Программный растеризатор со сглаживанием: RenderBackend без GDI+ и без
+// окна (пакетный вывод, сервер сборки).
+// Контур накапливается как знаковая площадь под рёбрами в ячейках строки —
+// точное покрытие пикселя без подвыборок; проход по строке слева направо
+// суммирует ячейки и смешивает цвет с покрытием. Перо (толщина, концы,
+// стыки) превращается в контуры одной ориентации; сумма их покрытий
+// ограничивается единицей, так что перекрытия не темнеют.
+// Рисует в полосу строк большого изображения (RasterTarget::top), поэтому
+// полосы считаются независимо и параллельно (RenderBands).
+// Внутренние циклы — префиксная сумма покрытия, смешение, выборка картинки —
+// на SSE2 по 4 пикселя; FAINT_NO_SIMD оставляет скалярный вариант.
+// Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include "RenderBackend.h"
+#include "SimdMath.h"
+#include "ThreadPool.h"
+
+#if defined(FAINT_SIMD_AVX2) || defined(FAINT_SIMD_SSE2)
+#define FAINT_RASTER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Изображение в памяти: ARGB с умноженной альфой (как PixelFormat32bppPARGB)
+struct RasterImage {
+    int width = 0, height = 0;
+    std::vector<uint32_t> pixels;
+};
+
+// Полоса строк [top, top + height) изображения, куда рисует SoftwareBackend
+struct RasterTarget {
+    uint32_t* pixels = nullptr; // первая строка полосы, ARGB с умноженной альфой
+    int width = 0, height = 0;
+    int stride = 0;             // пикселей в строке
+    int top = 0;
+};
+
+const float kRasterTolerance = 0.1f; // допустимое отклонение ломаной от кривой, пикселей
+const float kMiterLimit = 10.0f;      // как у пера GDI+ по умолчанию
+
+// Смешение цвета argb (альфа не умножена) с покрытием
+inline void BlendPixel(uint32_t& dst, uint32_t argb, float coverage) {
+    float a = (float)(argb >> 24) * coverage * (1.0f / 255);
+    float inv = 1 - a;
+    uint32_t d = dst;
+    uint32_t out = (uint32_t)(255 * a + (float)(d >> 24) * inv + 0.5f) << 24;
+    for (int shift = 0; shift < 24; shift += 8) {
+        float v = (float)((argb >> shift) & 255) * a + (float)((d >> shift) & 255) * inv;
+        out |= (uint32_t)(v + 0.5f) << shift;
+    }
+    dst = out;
+}
+
+// Смешение цвета с умноженной альфой (пиксель картинки) с покрытием
+inline void BlendPremultiplied(uint32_t& dst, const float src[4], float coverage) {
+    float inv = 1 - src[3] * coverage * (1.0f / 255);
+    uint32_t d = dst;
+    uint32_t out = 0;
+    for (int c = 0; c < 4; c++) {
+        int shift = c * 8; // B, G, R, A
+        float v = src[c] * coverage + (float)((d >> shift) & 255) * inv;
+        out |= (uint32_t)(v + 0.5f) << shift;
+    }
+    dst = out;
+}
+
+// Префиксная сумма ячеек cells[0, n) -> покрытие min(1, |сумма|) в cov;
+// ячейки обнуляются
+inline void AccumulateCoverage(float* cells, int n, float* cov) {
+    int i = 0;
+    float acc = 0;
+#ifdef FAINT_RASTER_SSE2
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 carry = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(cells + i);
+        _mm_storeu_ps(cells + i, _mm_setzero_ps());
+        // Сумма внутри четвёрки за два сдвига, затем перенос от предыдущей
+        x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+        x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+        x = _mm_add_ps(x, carry);
+        carry = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+        _mm_storeu_ps(cov + i, _mm_min_ps(one, _mm_and_ps(x, absMask)));
+    }
+    acc = _mm_cvtss_f32(carry);
+#endif
+    for (; i < n; i++) {
+        acc += cells[i];
+        cells[i] = 0;
+        float c = fabsf(acc);
+        cov[i] = c > 1 ? 1.0f : c;
+    }
+}
+
+const float kMinCoverage = 1.0f / 512; // меньше — пиксель не меняется
+
+// Строка dst[0, n) смешивается с цветом argb по покрытию cov
+inline void BlendSpan(uint32_t* dst, const float* cov, int n, uint32_t argb) {
+    int i = 0;
+#ifdef FAINT_RASTER_SSE2
+    const __m128 alpha = _mm_set1_ps((float)(argb >> 24) * (1.0f / 255));
+    const __m128 sB = _mm_set1_ps((float)(argb & 255)), sG = _mm_set1_ps((float)((argb >> 8) & 255));
+    const __m128 sR = _mm_set1_ps((float)((argb >> 16) & 255)), s255 = _mm_set1_ps(255.0f);
+    const __m128 one = _mm_set1_ps(1.0f), eps = _mm_set1_ps(kMinCoverage);
+    const __m128i byte = _mm_set1_epi32(0xFF);
+    for (; i + 4 <= n; i += 4) {
+        __m128 c = _mm_loadu_ps(cov + i);
+        // Внутренность кольца, промежутки между кусками пера
+        if (_mm_movemask_ps(_mm_cmpgt_ps(c, eps)) == 0) continue;
+        c = _mm_and_ps(c, _mm_cmpgt_ps(c, eps));
+        __m128 a = _mm_mul_ps(c, alpha), inv = _mm_sub_ps(one, a);
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128 dB = _mm_cvtepi32_ps(_mm_and_si128(d, byte));
+        __m128 dG = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(d, 8), byte));
+        __m128 dR = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(d, 16), byte));
+        __m128 dA = _mm_cvtepi32_ps(_mm_srli_epi32(d, 24));
+        __m128i oB = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(sB, a), _mm_mul_ps(dB, inv)));
+        __m128i oG = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(sG, a), _mm_mul_ps(dG, inv)));
+        __m128i oR = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(sR, a), _mm_mul_ps(dR, inv)));
+        __m128i oA = _mm_cvtps_epi32(_mm_add_ps(_mm_mul_ps(s255, a), _mm_mul_ps(dA, inv)));
+        __m128i out = _mm_or_si128(_mm_or_si128(oB, _mm_slli_epi32(oG, 8)),
+            _mm_or_si128(_mm_slli_epi32(oR, 16), _mm_slli_epi32(oA, 24)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), out);
+    }
+#endif
+    for (; i < n; i++)
+        if (cov[i] > kMinCoverage) BlendPixel(dst[i], argb, cov[i]);
+}
+
+// Накопитель покрытия полосы width x height
+class CoverageRaster {
+public:
+    void Reset(int w, int h) {
+        width = w;
+        height = h;
+        stride = w + 2; // ребро у правого края пишет в ячейки w и w + 1
+        cells.assign((size_t)stride * h, 0.0f);
+        coverage.resize(stride);
+        rowMin.assign(h, INT_MAX);
+        rowMax.assign(h, -1);
+        top = h;
+        bottom = -1;
+    }
+
+    // Ребро контура в пикселях полосы. Часть левее 0 прижимается к нулю,
+    // правее width — к width: на покрытие внутри полосы это не влияет.
+    // Ребро, пересекающее край, сначала делится на нём, иначе прижатый
+    // кусок размазался бы по строке как наклонный.
+    void Edge(float x0, float y0, float x1, float y1) {
+        if (!(y0 != y1)) return; // горизонтальное или NaN
+        for (float side : { 0.0f, (float)width }) {
+            if ((x0 < side) != (x1 < side) && x0 != side && x1 != side) {
+                float yc = y0 + (side - x0) * (y1 - y0) / (x1 - x0);
+                Edge(x0, y0, side, yc);
+                Edge(side, yc, x1, y1);
+                return;
+            }
+        }
+        float dir = 1;
+        if (y0 > y1) {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+            dir = -1;
+        }
+        if (y1 <= 0 || y0 >= height) return;
+        float dxdy = (x1 - x0) / (y1 - y0);
+        float x = x0;
+        if (y0 < 0) {
+            x -= y0 * dxdy;
+            y0 = 0;
+        }
+        float yEnd = (std::min)(y1, (float)height);
+        int yi0 = (int)y0, yi1 = (int)ceilf(yEnd);
+        top = (std::min)(top, yi0);
+        bottom = (std::max)(bottom, yi1 - 1);
+        float fw = (float)width;
+        for (int y = yi0; y < yi1; y++) {
+            float dy = (std::min)((float)(y + 1), yEnd) - (std::max)((float)y, y0);
+            float xnext = x + dxdy * dy;
+            float d = dy * dir;
+            float xa = (std::max)(0.0f, (std::min)(fw, (std::min)(x, xnext)));
+            float xb = (std::max)(0.0f, (std::min)(fw, (std::max)(x, xnext)));
+            float* row = &cells[(size_t)y * stride];
+            int x0i = (int)xa;
+            int x1i = (int)ceilf(xb);
+            if (x1i <= x0i + 1) {
+                // Ребро в пределах одного пикселя: площадь по средней точке
+                float xmf = 0.5f * (xa + xb) - (float)x0i;
+                row[x0i] += d - d * xmf;
+                row[x0i + 1] += d * xmf;
+                Touch(y, x0i, x0i + 1);
+            }
+            else {
+                float s = 1.0f / (xb - xa);
+                float x0f = xa - (float)x0i;
+                float a0 = 0.5f * s * (1 - x0f) * (1 - x0f);
+                float x1f = xb - (float)x1i + 1;
+                float am = 0.5f * s * x1f * x1f;
+                row[x0i] += d * a0;
+                if (x1i == x0i + 2) {
+                    row[x0i + 1] += d * (1 - a0 - am);
+                }
+                else {
+                    float a1 = s * (1.5f - x0f);
+                    row[x0i + 1] += d * (a1 - a0);
+                    for (int xi = x0i + 2; xi < x1i - 1; xi++) row[xi] += d * s;
+                    float a2 = a1 + (float)(x1i - x0i - 3) * s;
+                    row[x1i - 1] += d * (1 - a2 - am);
+                }
+                row[x1i] += d * am;
+                Touch(y, x0i, x1i);
+            }
+            x = xnext;
+        }
+    }
+
+    // Замкнутый контур. orient > 0 — обход приводится к положительной
+    // площади, < 0 — к отрицательной (дырка), 0 — как задан
+    void Contour(const ScenePoint* p, size_t n, int orient) {
+        if (n < 3) return;
+        bool reverse = false;
+        if (orient != 0) {
+            double area = 0;
+            for (size_t i = 0, j = n - 1; i < n; j = i++) area += (double)p[j].X * p[i].Y - (double)p[i].X * p[j].Y;
+            reverse = (area < 0) != (orient < 0);
+        }
+        for (size_t i = 0; i < n; i++) {
+            const ScenePoint& a = p[i];
+            const ScenePoint& b = p[i + 1 < n ? i + 1 : 0];
+            if (reverse) Edge(b.X, b.Y, a.X, a.Y);
+            else Edge(a.X, a.Y, b.X, b.Y);
+        }
+    }
+
+    // blend(y, x, cov, n): покрытие пикселей [x, x + n) строки y в пределах
+    // [x0, x1) x [y0, y1). Все ячейки обнуляются.
+    template <class Blend>
+    void Sweep(int x0, int y0, int x1, int y1, const Blend& blend) {
+        for (int y = top; y <= bottom; y++) {
+            int from = rowMin[y], to = rowMax[y];
+            if (to < from) continue;
+            AccumulateCoverage(&cells[(size_t)y * stride + from], to - from + 1, coverage.data());
+            int s = (std::max)(from, x0), e = (std::min)(to + 1, x1);
+            if (y >= y0 && y < y1 && s < e) blend(y, s, coverage.data() + (s - from), e - s);
+            rowMin[y] = INT_MAX;
+            rowMax[y] = -1;
+        }
+        top = height;
+        bottom = -1;
+    }
+
+private:
+    int width = 0, height = 0, stride = 0;
+    std::vector<float> cells;
+    std::vector<float> coverage; // строка после префиксной суммы
+    std::vector<int> rowMin, rowMax; // затронутые ячейки строки
+    int top = 0, bottom = -1;        // затронутые строки
+
+    void Touch(int y, int from, int to) {
+        if (from < rowMin[y]) rowMin[y] = from;
+        if (to > rowMax[y]) rowMax[y] = to;
+    }
+};
+
+// Буквы подписей осей: цифры, минус и точка 5x7, строки сверху вниз
+inline const uint8_t* LabelGlyph(char c) {
+    static const uint8_t digits[10][7] = {
+        { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E },
+        { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E },
+        { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F },
+        { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E },
+        { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 },
+        { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E },
+        { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E },
+        { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+        { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E },
+        { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C },
+    };
+    static const uint8_t minus[7] = { 0, 0, 0, 0x0E, 0, 0, 0 };
+    static const uint8_t point[7] = { 0, 0, 0, 0, 0, 0x0C, 0x0C };
+    if (c >= '0' && c <= '9') return digits[c - '0'];
+    if (c == '-') return minus;
+    return c == '.' ? point : nullptr;
+}
+
+class SoftwareBackend : public RenderBackend {
+public:
+    // Мир -> изображение: x * scale + offsetX. images == nullptr или пустая
+    // запись — на месте картинки серый прямоугольник.
+    SoftwareBackend(const RasterTarget& target, float scale, float offsetX, float offsetY,
+        const std::vector<RasterImage>* images)
+        : t(target), scale(scale), ox(offsetX), oy(offsetY - (float)target.top), images(images) {
+        raster.Reset(t.width, t.height);
+        clips.push_back(Clip{ 0, 0, (float)t.width, (float)t.height });
+    }
+
+    float PixelsPerUnit() const override { return scale; }
+
+    BoundsF VisibleBounds() const override {
+        const Clip& c = clips.back();
+        return BoundsF{ (c.x0 - ox) / scale, (c.y0 - oy) / scale, (c.x1 - ox) / scale, (c.y1 - oy) / scale };
+    }
+
+    void Curve(const ScenePoint* pts, size_t n, uint32_t argb, float width) override {
+        float hw = width * scale / 2;
+        // Сплайн выходит за свои узлы, поэтому отсекается уже ломаная
+        Transform(pts, n, hw);
+        if (dev.empty()) return;
+        Flatten(dev, flat);
+        if (!Visible(flat, hw)) return;
+        RoundStroke(flat, hw);
+        Fill(argb);
+    }
+
+    void Lines(const ScenePoint* pts, size_t n, uint32_t argb, float width) override {
+        float hw = width * scale / 2;
+        if (!Transform(pts, n, hw * kMiterLimit)) return;
+        MiterStroke(dev, hw, false);
+        Fill(argb);
+    }
+
+    void Polygon(const ScenePoint* pts, size_t n, uint32_t argb, float width) override {
+        float hw = width * scale / 2;
+        if (!Transform(pts, n, hw * kMiterLimit)) return;
+        MiterStroke(dev, hw, true);
+        Fill(argb);
+    }
+
+    void Ellipse(float x, float y, float w, float h, uint32_t argb, float width) override {
+        float hw = width * scale / 2;
+        float cx = (x + w / 2) * scale + ox, cy = (y + h / 2) * scale + oy;
+        float rx = fabsf(w) * scale / 2, ry = fabsf(h) * scale / 2;
+        if (!Visible(cx - rx - hw, cy - ry - hw, cx + rx + hw, cy + ry + hw)) return;
+        EllipseContour(cx, cy, rx + hw, ry + hw, 1);
+        if (rx > hw && ry > hw) EllipseContour(cx, cy, rx - hw, ry - hw, -1);
+        Fill(argb);
+    }
+
+    void Image(uint32_t image, float x, float y, float w, float h) override {
+        float x0 = x * scale + ox, x1 = (x + w) * scale + ox;
+        float y0 = y * scale + oy, y1 = (y + h) * scale + oy;
+        if (x1 < x0) std::swap(x0, x1);
+        if (y1 < y0) std::swap(y0, y1);
+        if (!Visible(x0, y0, x1, y1) || x1 - x0 <= 0 || y1 - y0 <= 0) return;
+        const Clip& c = clips.back();
+        int px0 = (int)floorf((std::max)(x0, c.x0)), px1 = (int)ceilf((std::min)(x1, c.x1));
+        int py0 = (int)floorf((std::max)(y0, c.y0)), py1 = (int)ceilf((std::min)(y1, c.y1));
+        const RasterImage* im = images && image < images->size() && !(*images)[image].pixels.empty() ? &(*images)[image] : nullptr;
+        const float gray[4] = { 192, 192, 192, 255 };
+        for (int py = py0; py < py1; py++) {
+            float covY = (std::min)((float)py + 1, y1) - (std::max)((float)py, y0);
+            if (covY <= 0) continue;
+            uint32_t* row = t.pixels + (size_t)py * t.stride;
+            float v = im ? ((float)py + 0.5f - y0) / (y1 - y0) * im->height - 0.5f : 0;
+            for (int px = px0; px < px1; px++) {
+                float covX = (std::min)((float)px + 1, x1) - (std::max)((float)px, x0);
+                if (covX <= 0) continue;
+                if (im) {
+                    float u = ((float)px + 0.5f - x0) / (x1 - x0) * im->width - 0.5f;
+                    SampleBlend(row[px], *im, u, v, covX * covY);
+                }
+                else {
+                    BlendPremultiplied(row[px], gray, covX * covY);
+                }
+            }
+        }
+    }
+
+    void Label(const char* text, float x, float y, uint32_t argb) override {
+        // Метрики Arial 8 пт при 96 точках на дюйм, в пикселях устройства
+        const float cell = 1.1f, advance = 5.93f;
+        float penX = x * scale + ox + 1.8f, top = y * scale + oy + 2.0f;
+        size_t len = strlen(text);
+        if (!Visible(penX, top, penX + advance * len, top + 7 * cell)) return;
+        for (const char* c = text; *c; c++, penX += advance) {
+            const uint8_t* g = LabelGlyph(*c);
+            if (!g) continue;
+            for (int row = 0; row < 7; row++) {
+                // Подряд идущие точки строки — один прямоугольник
+                for (int col = 0; col < 5;) {
+                    if (!(g[row] & (0x10 >> col))) { col++; continue; }
+                    int end = col;
+                    while (end < 5 && (g[row] & (0x10 >> end))) end++;
+                    float rx0 = penX + col * cell, rx1 = penX + end * cell;
+                    float ry0 = top + row * cell, ry1 = top + (row + 1) * cell;
+                    ScenePoint r[] = { { rx0, ry0 }, { rx1, ry0 }, { rx1, ry1 }, { rx0, ry1 } };
+                    raster.Contour(r, 4, 1);
+                    col = end;
+                }
+            }
+        }
+        Fill(argb);
+    }
+
+    void PushClip(const BoundsF& b) override {
+        Clip c = clips.back();
+        c.x0 = (std::max)(c.x0, b.minX * scale + ox);
+        c.y0 = (std::max)(c.y0, b.minY * scale + oy);
+        c.x1 = (std::min)(c.x1, b.maxX * scale + ox);
+        c.y1 = (std::min)(c.y1, b.maxY * scale + oy);
+        if (c.x1 < c.x0) c.x1 = c.x0;
+        if (c.y1 < c.y0) c.y1 = c.y0;
+        clips.push_back(c);
+    }
+
+    void PopClip() override {
+        if (clips.size() > 1) clips.pop_back();
+    }
+
+private:
+    struct Clip { float x0, y0, x1, y1; }; // пиксели полосы
+
+    RasterTarget t;
+    float scale, ox, oy;
+    const std::vector<RasterImage>* images;
+    CoverageRaster raster;
+    std::vector<Clip> clips;
+    std::vector<ScenePoint> dev, flat, ring;
+    std::vector<ScenePoint> circle; // единичная окружность для кругов пера
+    float circleRadius = -1;
+
+    bool Visible(float x0, float y0, float x1, float y1) const {
+        const Clip& c = clips.back();
+        return x1 >= c.x0 && x0 <= c.x1 && y1 >= c.y0 && y0 <= c.y1;
+    }
+
+    // Ломаная с запасом pad хотя бы частью в отсечении
+    bool Visible(const std::vector<ScenePoint>& p, float pad) const {
+        float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+        for (const ScenePoint& q : p) {
+            x0 = (std::min)(x0, q.X); x1 = (std::max)(x1, q.X);
+            y0 = (std::min)(y0, q.Y); y1 = (std::max)(y1, q.Y);
+        }
+        return !p.empty() && Visible(x0 - pad, y0 - pad, x1 + pad, y1 + pad);
+    }
+
+    // Точки в пиксели полосы без повторов; false — фигура (с запасом pad)
+    // целиком вне отсечения
+    bool Transform(const ScenePoint* pts, size_t n, float pad) {
+        dev.clear();
+        for (size_t i = 0; i < n; i++) {
+            ScenePoint p{ pts[i].X * scale + ox, pts[i].Y * scale + oy };
+            if (!dev.empty() && p.X == dev.back().X && p.Y == dev.back().Y) continue;
+            dev.push_back(p);
+        }
+        return Visible(dev, pad);
+    }
+
+    void Fill(uint32_t argb) {
+        const Clip& c = clips.back();
+        raster.Sweep((int)floorf(c.x0), (int)floorf(c.y0), (int)ceilf(c.x1), (int)ceilf(c.y1),
+            [&](int y, int x, const float* cov, int n) { BlendSpan(t.pixels + (size_t)y * t.stride + x, cov, n, argb); });
+    }
+
+    // Кардинальный сплайн -> ломаная: каждый участок — кубическая Безье с
+    // контрольными точками p[i] ± (p[i+1] - p[i-1]) / 6
+    static void Flatten(const std::vector<ScenePoint>& p, std::vector<ScenePoint>& out) {
+        out.clear();
+        size_t n = p.size();
+        out.push_back(p[0]);
+        for (size_t i = 0; i + 1 < n; i++) {
+            const ScenePoint& prev = p[i > 0 ? i - 1 : 0];
+            const ScenePoint& next = p[i + 2 < n ? i + 2 : n - 1];
+            ScenePoint a = p[i], d = p[i + 1];
+            ScenePoint b{ a.X + (d.X - prev.X) / 6, a.Y + (d.Y - prev.Y) / 6 };
+            ScenePoint c{ d.X - (next.X - a.X) / 6, d.Y - (next.Y - a.Y) / 6 };
+            // Отклонение равномерного деления от кривой ~ 3/4 второй разности / k^2
+            float dd = (std::max)(hypotf(a.X - 2 * b.X + c.X, a.Y - 2 * b.Y + c.Y),
+                hypotf(b.X - 2 * c.X + d.X, b.Y - 2 * c.Y + d.Y));
+            int k = (int)ceilf(sqrtf(dd * 0.75f / kRasterTolerance));
+            k = (std::max)(1, (std::min)(k, 256));
+            for (int j = 1; j <= k; j++) {
+                float s = (float)j / k, r = 1 - s;
+                float w0 = r * r * r, w1 = 3 * r * r * s, w2 = 3 * r * s * s, w3 = s * s * s;
+                out.push_back(ScenePoint{ w0 * a.X + w1 * b.X + w2 * c.X + w3 * d.X, w0 * a.Y + w1 * b.Y + w2 * c.Y + w3 * d.Y });
+            }
+        }
+    }
+
+    // Число сторон многоугольника, приближающего окружность радиуса r
+    static int CircleSides(float r) {
+        if (r <= kRasterTolerance * 2) return 8;
+        int k = (int)ceilf((float)M_PI / acosf(1 - kRasterTolerance / r));
+        return (std::max)(8, (std::min)(k, 1024));
+    }
+
+    // Перо с круглыми концами и стыками: прямоугольник на каждый отрезок и
+    // круг в каждом узле
+    void RoundStroke(const std::vector<ScenePoint>& p, float hw) {
+        if (hw <= 0) return;
+        if (circleRadius != hw) {
+            int k = CircleSides(hw);
+            circle.resize(k);
+            for (int i = 0; i < k; i++) {
+                double a = 2 * M_PI * i / k;
+                circle[i] = ScenePoint{ (float)cos(a) * hw, (float)sin(a) * hw };
+            }
+            circleRadius = hw;
+        }
+        ring.resize(circle.size());
+        for (size_t i = 0; i < p.size(); i++) {
+            for (size_t k = 0; k < circle.size(); k++) ring[k] = ScenePoint{ p[i].X + circle[k].X, p[i].Y + circle[k].Y };
+            raster.Contour(ring.data(), ring.size(), 1);
+            if (i + 1 < p.size()) Segment(p[i], p[i + 1], hw);
+        }
+    }
+
+    // Перо с плоскими концами и стыками с митрой
+    void MiterStroke(const std::vector<ScenePoint>& p, float hw, bool closed) {
+        size_t n = p.size();
+        if (hw <= 0 || n < 2) return;
+        if (closed && n > 2 && p[0].X == p[n - 1].X && p[0].Y == p[n - 1].Y) n--;
+        for (size_t i = 0; i + 1 < n; i++) Segment(p[i], p[i + 1], hw);
+        if (closed && n > 2) Segment(p[n - 1], p[0], hw);
+        for (size_t i = 0; i < n; i++) {
+            bool inner = i > 0 && i + 1 < n;
+            if (!inner && !(closed && n > 2)) continue;
+            Join(p[i > 0 ? i - 1 : n - 1], p[i], p[i + 1 < n ? i + 1 : 0], hw);
+        }
+    }
+
+    void Segment(const ScenePoint& a, const ScenePoint& b, float hw) {
+        float dx = b.X - a.X, dy = b.Y - a.Y;
+        float len = hypotf(dx, dy);
+        if (len == 0) return;
+        float nx = -dy / len * hw, ny = dx / len * hw;
+        ScenePoint q[] = { { a.X + nx, a.Y + ny }, { b.X + nx, b.Y + ny }, { b.X - nx, b.Y - ny }, { a.X - nx, a.Y - ny } };
+        raster.Contour(q, 4, 1);
+    }
+
+    // Стык в узле v с внешней стороны поворота: митра или, если она длиннее
+    // kMiterLimit полутолщин, срез
+    void Join(const ScenePoint& a, const ScenePoint& v, const ScenePoint& b, float hw) {
+        float d0x = v.X - a.X, d0y = v.Y - a.Y, d1x = b.X - v.X, d1y = b.Y - v.Y;
+        float l0 = hypotf(d0x, d0y), l1 = hypotf(d1x, d1y);
+        if (l0 == 0 || l1 == 0) return;
+        d0x /= l0; d0y /= l0; d1x /= l1; d1y /= l1;
+        if (fabsf(d0x * d1y - d0y * d1x) < 1e-6f) return; // без поворота
+        float n0x = -d0y, n0y = d0x, n1x = -d1y, n1y = d1x;
+        float side = n0x * d1x + n0y * d1y > 0 ? -hw : hw;
+        ScenePoint o0{ v.X + n0x * side, v.Y + n0y * side };
+        ScenePoint o1{ v.X + n1x * side, v.Y + n1y * side };
+        float cosTurn = n0x * n1x + n0y * n1y;
+        if (1 + cosTurn > 2 / (kMiterLimit * kMiterLimit)) {
+            float k = side / (1 + cosTurn);
+            ScenePoint q[] = { v, o0, { v.X + (n0x + n1x) * k, v.Y + (n0y + n1y) * k }, o1 };
+            raster.Contour(q, 4, 1);
+        }
+        else {
+            ScenePoint q[] = { v, o0, o1 };
+            raster.Contour(q, 3, 1);
+        }
+    }
+
+    void EllipseContour(float cx, float cy, float rx, float ry, int orient) {
+        int k = CircleSides((std::max)(rx, ry));
+        ring.resize(k);
+        for (int i = 0; i < k; i++) {
+            double a = 2 * M_PI * i / k;
+            ring[i] = ScenePoint{ cx + (float)cos(a) * rx, cy + (float)sin(a) * ry };
+        }
+        raster.Contour(ring.data(), ring.size(), orient);
+    }
+
+    // Билинейная выборка картинки в (u, v), смешанная с dst по покрытию
+    static void SampleBlend(uint32_t& dst, const RasterImage& im, float u, float v, float coverage) {
+        u = (std::max)(0.0f, (std::min)(u, (float)im.width - 1));
+        v = (std::max)(0.0f, (std::min)(v, (float)im.height - 1));
+        int x0 = (int)u, y0 = (int)v;
+        int x1 = (std::min)(x0 + 1, im.width - 1), y1 = (std::min)(y0 + 1, im.height - 1);
+        float fx = u - x0, fy = v - y0;
+        const uint32_t* p = im.pixels.data();
+        uint32_t c00 = p[(size_t)y0 * im.width + x0], c10 = p[(size_t)y0 * im.width + x1];
+        uint32_t c01 = p[(size_t)y1 * im.width + x0], c11 = p[(size_t)y1 * im.width + x1];
+#ifdef FAINT_RASTER_SSE2
+        // Полосы вектора — каналы B, G, R, A
+        const __m128i z = _mm_setzero_si128();
+        auto texel = [&](uint32_t c) {
+            return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)c), z), z));
+        };
+        __m128 t00 = texel(c00), t10 = texel(c10), t01 = texel(c01), t11 = texel(c11);
+        __m128 vx = _mm_set1_ps(fx), vy = _mm_set1_ps(fy);
+        __m128 top = _mm_add_ps(t00, _mm_mul_ps(_mm_sub_ps(t10, t00), vx));
+        __m128 bottom = _mm_add_ps(t01, _mm_mul_ps(_mm_sub_ps(t11, t01), vx));
+        __m128 src = _mm_mul_ps(_mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), vy)), _mm_set1_ps(coverage));
+        __m128 inv = _mm_sub_ps(_mm_set1_ps(1.0f),
+            _mm_mul_ps(_mm_shuffle_ps(src, src, _MM_SHUFFLE(3, 3, 3, 3)), _mm_set1_ps(1.0f / 255)));
+        __m128i out = _mm_cvtps_epi32(_mm_add_ps(src, _mm_mul_ps(texel(dst), inv)));
+        out = _mm_packs_epi32(out, out);
+        dst = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(out, out));
+#else
+        float src[4];
+        for (int c = 0; c < 4; c++) {
+            int s = c * 8;
+            float top = ((c00 >> s) & 255) * (1 - fx) + ((c10 >> s) & 255) * fx;
+            float bottom = ((c01 >> s) & 255) * (1 - fx) + ((c11 >> s) & 255) * fx;
+            src[c] = top * (1 - fy) + bottom * fy;
+        }
+        BlendPremultiplied(dst, src, coverage);
+#endif
+    }
+};
+
+// Изображение image рисуется полосами по rows строк; draw(out) выводит
+// сцену в одну полосу. Полосы не пересекаются, поэтому идут параллельно на
+// pool (nullptr — по очереди), и draw может вызываться из нескольких потоков.
+template <class Draw>
+void RenderBands(ThreadPool* pool, const RasterTarget& image, int rows, float scale, float offsetX, float offsetY,
+    const std::vector<RasterImage>* images, const Draw& draw) {
+    size_t bands = (size_t)((image.height + rows - 1) / rows);
+    auto band = [&](size_t b) {
+        RasterTarget t = image;
+        int first = (int)b * rows;
+        t.pixels = image.pixels + (size_t)first * image.stride;
+        t.height = (std::min)(rows, image.height - first);
+        t.top = image.top + first;
+        SoftwareBackend out(t, scale, offsetX, offsetY, images);
+        draw(out);
+    };
+    if (pool) {
+        pool->ParallelFor(bands, band);
+    }
+    else {
+        for (size_t b = 0; b < bands; b++) band(b);
+    }
+}
@@ -0,0 +1,187 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Пространственный индекс фигур: иерархическая сетка.
+// Объект попадает на уровень, где ячейка не меньше его габарита, и
+// регистрируется в <= 4 ячейках. Слишком большие (оси, графики без
+// ограничения) лежат в отдельном списке и возвращаются всегда.
+// Идентификаторы — целые (индекс фигуры в сцене). Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Мировой прямоугольник, границы включительно
+struct BoundsF {
+    float minX, minY, maxX, maxY;
+
+    bool Intersects(const BoundsF& o) const {
+        return minX <= o.maxX && o.minX <= maxX && minY <= o.maxY && o.minY <= maxY;
+    }
+    void Inflate(float d) { minX -= d; minY -= d; maxX += d; maxY += d; }
+    void Include(float x, float y) {
+        minX = (std::min)(minX, x); maxX = (std::max)(maxX, x);
+        minY = (std::min)(minY, y); maxY = (std::max)(maxY, y);
+    }
+    void Include(const BoundsF& o) { Include(o.minX, o.minY); Include(o.maxX, o.maxY); }
+
+    static BoundsF Empty() { return BoundsF{ INFINITY, INFINITY, -INFINITY, -INFINITY }; }
+    static BoundsF Everything() { return BoundsF{ -INFINITY, -INFINITY, INFINITY, INFINITY }; }
+};
+
+const float kIndexBaseCell = 256.0f; // ячейка нижнего уровня, мировые единицы
+const int kIndexLevels = 8;           // каждый следующий уровень крупнее в 4 раза
+
+class SpatialIndex {
+public:
+    typedef uint32_t Id;
+
+    SpatialIndex() : levels(kIndexLevels) {
+        float cell = kIndexBaseCell;
+        for (auto& l : levels) { l.cell = cell; cell *= 4; }
+    }
+
+    size_t Size() const { return count; }
+
+    void Insert(Id id, const BoundsF& b) {
+        if (id >= items.size()) items.resize(id + 1);
+        Item& it = items[id];
+        if (it.present) Remove(id);
+        it.bounds = b;
+        it.present = true;
+        it.level = PickLevel(b);
+        count++;
+
+        if (it.level < 0) {
+            huge.push_back(id);
+            return;
+        }
+        Level& l = levels[it.level];
+        CellRange r = l.Cells(b);
+        for (int64_t cy = r.y0; cy <= r.y1; cy++)
+            for (int64_t cx = r.x0; cx <= r.x1; cx++)
+                l.cells[Key(cx, cy)].push_back(id);
+    }
+
+    void Remove(Id id) {
+        if (id >= items.size() || !items[id].present) return;
+        Item& it = items[id];
+        it.present = false;
+        count--;
+
+        if (it.level < 0) {
+            Erase(huge, id);
+            return;
+        }
+        Level& l = levels[it.level];
+        CellRange r = l.Cells(it.bounds);
+        for (int64_t cy = r.y0; cy <= r.y1; cy++)
+            for (int64_t cx = r.x0; cx <= r.x1; cx++) {
+                auto c = l.cells.find(Key(cx, cy));
+                if (c == l.cells.end()) continue;
+                Erase(c->second, id);
+                if (c->second.empty()) l.cells.erase(c);
+            }
+    }
+
+    void Clear() {
+        for (auto& l : levels) l.cells.clear();
+        huge.clear();
+        items.clear();
+        stamps.clear();
+        count = 0;
+    }
+
+    // Идентификаторы объектов, чьи габариты пересекают area, по возрастанию
+    // (то есть в порядке отрисовки). out перезаписывается.
+    void Query(const BoundsF& area, std::vector<Id>& out) {
+        out.clear();
+        if (stamps.size() < items.size()) stamps.resize(items.size(), 0);
+        if (++stamp == 0) {
+            std::fill(stamps.begin(), stamps.end(), 0);
+            stamp = 1;
+        }
+
+        for (Id id : huge)
+            if (items[id].bounds.Intersects(area)) Take(id, out);
+
+        for (auto& l : levels) {
+            if (l.cells.empty()) continue;
+            // Объект записан во все ячейки, которые задевает, поэтому
+            // достаточно ячеек, покрывающих сам area
+            CellRange r = l.Cells(area);
+            double span = (double)(r.x1 - r.x0 + 1) * (double)(r.y1 - r.y0 + 1);
+            if (span > (double)l.cells.size()) {
+                // Область больше занятых ячеек — дешевле перебрать сами ячейки
+                for (auto& c : l.cells) Collect(c.second, area, out);
+            }
+            else {
+                for (int64_t cy = r.y0; cy <= r.y1; cy++)
+                    for (int64_t cx = r.x0; cx <= r.x1; cx++) {
+                        auto c = l.cells.find(Key(cx, cy));
+                        if (c != l.cells.end()) Collect(c->second, area, out);
+                    }
+            }
+        }
+        std::sort(out.begin(), out.end());
+    }
+
+    bool Contains(Id id) const { return id < items.size() && items[id].present; }
+    const BoundsF& Bounds(Id id) const { return items[id].bounds; }
+
+private:
+    struct Item {
+        BoundsF bounds;
+        int level = -1;
+        bool present = false;
+    };
+    struct CellRange { int64_t x0, y0, x1, y1; };
+    struct Level {
+        float cell = 0;
+        std::unordered_map<uint64_t, std::vector<Id>> cells;
+
+        CellRange Cells(const BoundsF& b) const {
+            return CellRange{ Coord(b.minX), Coord(b.minY), Coord(b.maxX), Coord(b.maxY) };
+        }
+        int64_t Coord(float v) const {
+            // Бесконечные и огромные значения прижимаются к краю адресуемой сетки
+            double c = std::floor((double)v / cell);
+            const double lim = 1 << 30;
+            return (int64_t)(std::max)(-lim, (std::min)(lim, c));
+        }
+    };
+
+    std::vector<Level> levels;
+    std::vector<Id> huge;
+    std::vector<Item> items;
+    std::vector<uint32_t> stamps;
+    uint32_t stamp = 0;
+    size_t count = 0;
+
+    static uint64_t Key(int64_t cx, int64_t cy) {
+        return ((uint64_t)(uint32_t)(int32_t)cx << 32) | (uint32_t)(int32_t)cy;
+    }
+
+    int PickLevel(const BoundsF& b) const {
+        float extent = (std::max)(b.maxX - b.minX, b.maxY - b.minY);
+        if (!(extent >= 0) || !std::isfinite(extent)) return -1;
+        for (int i = 0; i < (int)levels.size(); i++)
+            if (extent <= levels[i].cell) return i;
+        return -1;
+    }
+
+    void Collect(const std::vector<Id>& ids, const BoundsF& area, std::vector<Id>& out) {
+        for (Id id : ids)
+            if (stamps[id] != stamp && items[id].bounds.Intersects(area)) Take(id, out);
+    }
+    void Take(Id id, std::vector<Id>& out) {
+        stamps[id] = stamp;
+        out.push_back(id);
+    }
+    static void Erase(std::vector<Id>& v, Id id) {
+        auto p = std::find(v.begin(), v.end(), id);
+        if (p != v.end()) { *p = v.back(); v.pop_back(); }
+    }
+};
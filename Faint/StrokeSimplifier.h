@@ -0,0 +1,130 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Упрощение штриха кисти.
+// Во время рисования — потоковый фильтр «скользящего окна»: точки после
+// последнего опорного узла копятся в окне, пока все они лежат не дальше
+// допуска от хорды «опорный узел — текущая точка»; как только это нарушено,
+// предыдущая точка становится опорной. Последний элемент ломаной всегда
+// текущая точка, поэтому штрих не отстаёт от курсора.
+// При отпускании кнопки — проход Рамера–Дугласа–Пекера по опорным узлам.
+// Половина допуска уходит на каждый этап, так что итоговая ломаная
+// отклоняется от исходной не больше чем на tolerance.
+// Тип точки — любой с полями X, Y (PointF). Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+// Допуск упрощения в пикселях устройства при масштабе на момент рисования
+const double kStrokeTolerancePx = 0.5;
+// Окно потокового фильтра: ограничивает работу на одну точку
+const size_t kStrokeWindow = 128;
+
+// Расстояние от p до отрезка ab
+template <class P>
+double SegmentDistance(const P& p, const P& a, const P& b) {
+    double dx = (double)b.X - a.X, dy = (double)b.Y - a.Y;
+    double px = (double)p.X - a.X, py = (double)p.Y - a.Y;
+    double len2 = dx * dx + dy * dy;
+    double t = len2 > 0 ? (px * dx + py * dy) / len2 : 0;
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    double ex = px - t * dx, ey = py - t * dy;
+    return std::sqrt(ex * ex + ey * ey);
+}
+
+// Рамер–Дуглас–Пекер на месте (без рекурсии); концы сохраняются
+template <class P>
+void SimplifyPolyline(std::vector<P>& pts, double tolerance) {
+    size_t n = pts.size();
+    if (n < 3) return;
+    std::vector<char> keep(n, 0);
+    keep[0] = keep[n - 1] = 1;
+    std::vector<std::pair<size_t, size_t>> stack;
+    stack.push_back(std::make_pair((size_t)0, n - 1));
+    while (!stack.empty()) {
+        size_t a = stack.back().first, b = stack.back().second;
+        stack.pop_back();
+        double worst = 0;
+        size_t at = a;
+        for (size_t i = a + 1; i < b; i++) {
+            double d = SegmentDistance(pts[i], pts[a], pts[b]);
+            if (d > worst) { worst = d; at = i; }
+        }
+        if (worst > tolerance) {
+            keep[at] = 1;
+            stack.push_back(std::make_pair(a, at));
+            stack.push_back(std::make_pair(at, b));
+        }
+    }
+    size_t w = 0;
+    for (size_t i = 0; i < n; i++)
+        if (keep[i]) pts[w++] = pts[i];
+    pts.resize(w);
+}
+
+class StrokeSimplifier {
+public:
+    // Начало штриха: out = { p }
+    template <class P>
+    void Begin(std::vector<P>& out, const P& p, double tolerance) {
+        tol = tolerance;
+        raw = 1;
+        out.clear();
+        out.push_back(p);
+        window.clear();
+    }
+
+    template <class P>
+    void Add(std::vector<P>& out, const P& p) {
+        raw++;
+        const P& last = out.back();
+        // Точка ближе допуска к текущему концу не двигает его, но остаётся
+        // в окне, чтобы следующая хорда её тоже покрывала
+        if (std::hypot((double)p.X - last.X, (double)p.Y - last.Y) <= StreamTolerance()) {
+            if (!window.empty()) window.push_back(Pt{ p.X, p.Y });
+            return;
+        }
+
+        if (window.empty()) {
+            // Опорный узел — последний в out, новая точка становится «плавающим» концом
+            out.push_back(p);
+            window.push_back(Pt{ p.X, p.Y });
+            return;
+        }
+
+        const P& anchor = out[out.size() - 2];
+        Pt a{ anchor.X, anchor.Y }, b{ p.X, p.Y };
+        bool fits = window.size() < kStrokeWindow;
+        for (size_t i = 0; fits && i < window.size(); i++)
+            fits = SegmentDistance(window[i], a, b) <= StreamTolerance();
+
+        if (fits) {
+            out.back() = p;
+        }
+        else {
+            // Прежний конец закрепляется, окно начинается заново от него
+            out.push_back(p);
+            window.clear();
+        }
+        window.push_back(b);
+    }
+
+    // Конец штриха: окончательное упрощение опорных узлов
+    template <class P>
+    void Finish(std::vector<P>& out) {
+        SimplifyPolyline(out, tol / 2);
+        window.clear();
+    }
+
+    size_t RawCount() const { return raw; }
+
+private:
+    struct Pt { double X, Y; };
+    std::vector<Pt> window; // исходные точки после последнего опорного узла
+    double tol = 0;
+    size_t raw = 0;
+
+    double StreamTolerance() const { return tol / 2; }
+};
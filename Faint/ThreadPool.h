@@ -0,0 +1,114 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Постоянный пул рабочих потоков.
+// Submit — фоновая задача, ParallelFor — разбиение работы на индексы с
+// ожиданием завершения (вызывающий поток тоже работает, поэтому вложенные
+// вызовы из задач пула не блокируются). Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+class ThreadPool {
+public:
+    // threads == 0: по числу ядер минус поток интерфейса
+    explicit ThreadPool(unsigned threads = 0) {
+        if (threads == 0) {
+            unsigned hw = std::thread::hardware_concurrency();
+            threads = hw > 1 ? hw - 1 : 1;
+        }
+        for (unsigned i = 0; i < threads; i++) workers.emplace_back([this] { WorkerLoop(); });
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& t : workers) t.join();
+    }
+
+    size_t WorkerCount() const { return workers.size(); }
+
+    void Submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // fn(i) для i из [0, count); возвращается, когда все вызовы завершены
+    template <class F>
+    void ParallelFor(size_t count, const F& fn) {
+        if (count == 0) return;
+        if (count == 1 || workers.empty()) {
+            for (size_t i = 0; i < count; i++) fn(i);
+            return;
+        }
+
+        struct State {
+            std::atomic<size_t> next{ 0 };
+            std::atomic<size_t> done{ 0 };
+            std::mutex m;
+            std::condition_variable cv;
+        };
+        auto st = std::make_shared<State>();
+        // Опоздавший помощник получит индекс >= count и к fn не обратится
+        const F* pfn = &fn;
+        auto run = [st, count, pfn]() {
+            for (;;) {
+                size_t i = st->next++;
+                if (i >= count) break;
+                (*pfn)(i);
+                if (++st->done == count) {
+                    std::lock_guard<std::mutex> lock(st->m);
+                    st->cv.notify_all();
+                }
+            }
+        };
+
+        size_t helpers = workers.size() < count - 1 ? workers.size() : count - 1;
+        for (size_t h = 0; h < helpers; h++) Submit(run);
+        run();
+
+        std::unique_lock<std::mutex> lock(st->m);
+        st->cv.wait(lock, [&] { return st->done.load() == count; });
+    }
+
+    // Общий пул приложения
+    static ThreadPool& Shared() {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    void WorkerLoop() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty()) return;
+                task = std::move(tasks.front());
+                tasks.pop_front();
+            }
+            task();
+        }
+    }
+};
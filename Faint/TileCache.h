@@ -0,0 +1,164 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Кэш растровых тайлов бесконечного холста.
+// Тайл — квадрат kTileSize x kTileSize пикселей на уровне масштаба
+// (четверть октавы, как у PlotCache), ключ (level, tx, ty). Хранит
+// содержимое сцены на момент рендера: фигуры [0, count). Фигуры новее
+// count дорисовываются поверх векторно, пока тайл не перерендерен;
+// изменённые и стёртые фигуры выбрасывают задетые тайлы (Invalidate).
+// Кэш однопоточный (живёт в потоке интерфейса), вытеснение — LRU по
+// бюджету в байтах. Вид изображения — параметр шаблона, Win32 не нужен.
+// -------------------------------------------------------------------------
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+
+#include "SpatialIndex.h"
+
+const int kTileSize = 256;
+
+struct TileKey {
+    int level;
+    int32_t tx, ty;
+    bool operator==(const TileKey& o) const { return level == o.level && tx == o.tx && ty == o.ty; }
+};
+
+struct TileKeyHash {
+    size_t operator()(const TileKey& k) const {
+        uint64_t h = (uint64_t)(uint32_t)k.tx * 0x9E3779B97F4A7C15ull;
+        h ^= (uint64_t)(uint32_t)k.ty + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2);
+        h ^= (uint64_t)(uint32_t)k.level * 0xC2B2AE3D27D4EB4Full;
+        return (size_t)h;
+    }
+};
+
+// Уровень, чей масштаб не меньше zoom: тайл при выводе только уменьшается
+inline int TileLevelFor(double zoom) { return (int)std::ceil(std::log2(zoom) * 4 - 1e-9); }
+inline double TileLevelScale(int level) { return std::pow(2.0, level / 4.0); }
+
+// Мировой прямоугольник тайла
+inline BoundsF TileWorldBounds(const TileKey& k) {
+    double span = kTileSize / TileLevelScale(k.level);
+    return BoundsF{ (float)(k.tx * span), (float)(k.ty * span), (float)((k.tx + 1) * span), (float)((k.ty + 1) * span) };
+}
+
+// Диапазон тайлов уровня, покрывающих мировой прямоугольник (включительно)
+struct TileRange {
+    int level;
+    int32_t tx0, ty0, tx1, ty1;
+
+    bool Contains(const TileKey& k) const {
+        return k.level == level && k.tx >= tx0 && k.tx <= tx1 && k.ty >= ty0 && k.ty <= ty1;
+    }
+    static TileRange Covering(int level, const BoundsF& b) {
+        double span = kTileSize / TileLevelScale(level);
+        auto idx = [span](float v) {
+            double t = std::floor(v / span);
+            const double lim = 1 << 30;
+            return (int32_t)(t < -lim ? -lim : t > lim ? lim : t);
+        };
+        return TileRange{ level, idx(b.minX), idx(b.minY), idx(b.maxX), idx(b.maxY) };
+    }
+};
+
+template <class Image>
+class TileCache {
+public:
+    struct Entry {
+        std::shared_ptr<Image> image;
+        size_t count = 0;       // сколько первых фигур сцены в тайле
+        size_t bytes = 0;
+        uint64_t lastUse = 0;
+    };
+
+    explicit TileCache(size_t budgetBytes = (size_t)128 << 20) : budget(budgetBytes) {}
+
+    void SetBudget(size_t bytes) { budget = bytes; Evict(); }
+    size_t Budget() const { return budget; }
+    size_t MemoryUsed() const { return used; }
+    size_t Size() const { return entries.size(); }
+
+    // nullptr, если тайла нет; найденный тайл отмечается как использованный
+    const Entry* Find(const TileKey& k) {
+        auto it = entries.find(k);
+        if (it == entries.end()) return nullptr;
+        it->second.lastUse = ++tick;
+        return &it->second;
+    }
+
+    void Store(const TileKey& k, std::shared_ptr<Image> image, size_t bytes, size_t count) {
+        Entry& e = entries[k];
+        used += bytes - e.bytes;
+        e.image = std::move(image);
+        e.bytes = bytes;
+        e.count = count;
+        e.lastUse = ++tick;
+        Evict();
+    }
+
+    // fn(key, entry) для каждого тайла, который задевает прямоугольник
+    template <class F>
+    void ForEachIntersecting(const BoundsF& b, const F& fn) {
+        for (auto& e : entries)
+            if (TileWorldBounds(e.first).Intersects(b)) fn(e.first, e.second);
+    }
+
+    void Clear() {
+        entries.clear();
+        used = 0;
+    }
+
+    // Фигуры в b изменились: тайлы с ними выбрасываются, а заказанные,
+    // возможно, снятые со старой сцены, помечаются устаревшими
+    void Invalidate(const BoundsF& b) {
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (TileWorldBounds(it->first).Intersects(b)) {
+                used -= it->second.bytes;
+                it = entries.erase(it);
+            }
+            else {
+                ++it;
+            }
+        }
+        for (auto& k : pending)
+            if (TileWorldBounds(k).Intersects(b)) stale.insert(k);
+    }
+
+    // Запрос на рендер уже отправлен (отметки ведёт вызывающий)
+    bool IsPending(const TileKey& k) const { return pending.count(k) != 0; }
+    void SetPending(const TileKey& k, bool on) {
+        if (on) pending.insert(k);
+        else {
+            pending.erase(k);
+            stale.erase(k);
+        }
+    }
+    void ClearPending() {
+        pending.clear();
+        stale.clear();
+    }
+    // Результат заказа не годится: сцена менялась после него (Invalidate)
+    bool IsStale(const TileKey& k) const { return stale.count(k) != 0; }
+
+private:
+    std::unordered_map<TileKey, Entry, TileKeyHash> entries;
+    std::unordered_set<TileKey, TileKeyHash> pending;
+    std::unordered_set<TileKey, TileKeyHash> stale;
+    size_t budget;
+    size_t used = 0;
+    uint64_t tick = 0;
+
+    void Evict() {
+        while (used > budget && !entries.empty()) {
+            auto victim = entries.begin();
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+                if (it->second.lastUse < victim->second.lastUse) victim = it;
+            used -= victim->second.bytes;
+            entries.erase(victim);
+        }
+    }
+};
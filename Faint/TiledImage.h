@@ -0,0 +1,409 @@
+﻿#pragma once
+
+// -------------------------------------------------------------------------
+// Огромные картинки (спутниковые снимки, сканы на десятки тысяч пикселей)
+// хранятся на диске тайлами и выводятся по частям.
+// Хранилище (*.ftiles) пишется один раз при вставке (TiledImageWriter):
+// картинка подаётся строками сверху вниз, пирамида уровней (каждый вдвое
+// меньше, пока картинка не уместится в один тайл) строится на ходу, так что
+// в памяти только полоса в тайл высотой на каждом уровне. Файл:
+//   заголовок, записи уровней, затем с границы страницы тайлы уровня 0,
+//   уровня 1, ... построчно; тайл — kImageTileSize^2 пикселей ARGB с
+//   умноженной альфой, крайние тайлы дополнены прозрачным.
+// При выводе файл отображается в память (TiledImage), а в памяти процесса
+// держатся только тайлы, которые недавно выводились: TiledTileCache —
+// LRU по бюджету в байтах, общий для всех таких картинок. Не зависит от Win32.
+// -------------------------------------------------------------------------
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include "Document.h" // MappedFile, PathChar
+
+const int kImageTileSize = 256;
+const size_t kImageTileBytes = (size_t)kImageTileSize * kImageTileSize * 4;
+
+namespace tiledimg {
+
+const char kMagic[8] = { 'F', 'A', 'I', 'N', 'T', 'T', 'I', 'L' };
+const uint32_t kVersion = 1;
+const uint64_t kDataAlign = 4096; // тайлы с границы страницы
+
+struct Header {
+    char magic[8];
+    uint32_t version, tileSize;
+    uint32_t width, height;
+    uint32_t levels, reserved;
+};
+struct Level {
+    uint32_t width, height;
+    uint32_t tilesX, tilesY;
+    uint64_t offset; // первый тайл уровня
+};
+static_assert(sizeof(Header) == 32 && sizeof(Level) == 24, "записи хранилища тайлов");
+
+// Уровни картинки w x h: от полного размера до помещающегося в один тайл
+inline std::vector<Level> Layout(uint32_t w, uint32_t h) {
+    std::vector<Level> levels;
+    uint64_t at = (sizeof(Header) + 64 * sizeof(Level) + kDataAlign - 1) / kDataAlign * kDataAlign;
+    for (;;) {
+        Level l;
+        l.width = w;
+        l.height = h;
+        l.tilesX = (w + kImageTileSize - 1) / kImageTileSize;
+        l.tilesY = (h + kImageTileSize - 1) / kImageTileSize;
+        l.offset = at;
+        levels.push_back(l);
+        at += (uint64_t)l.tilesX * l.tilesY * kImageTileBytes;
+        if (w <= (uint32_t)kImageTileSize && h <= (uint32_t)kImageTileSize) break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+    return levels;
+}
+
+inline bool Seek(FILE* f, uint64_t at) {
+#ifdef _WIN32
+    return _fseeki64(f, (__int64)at, SEEK_SET) == 0;
+#else
+    return fseeko(f, (off_t)at, SEEK_SET) == 0;
+#endif
+}
+
+inline bool Rename(const PathChar* from, const PathChar* to) {
+#ifdef _WIN32
+    return MoveFileExW(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+inline void Remove(const PathChar* path) {
+#ifdef _WIN32
+    DeleteFileW(path);
+#else
+    remove(path);
+#endif
+}
+
+} // namespace tiledimg
+
+// Запись хранилища: Begin, затем все строки картинки по порядку (Rows
+// любыми порциями), затем Finish. Пишется во временный файл рядом и
+// переименовывается в конце, так что недописанное хранилище не найдётся.
+class TiledImageWriter {
+public:
+    TiledImageWriter() {}
+    TiledImageWriter(const TiledImageWriter&) = delete;
+    TiledImageWriter& operator=(const TiledImageWriter&) = delete;
+    ~TiledImageWriter() { Abort(); }
+
+    bool Begin(const PathChar* path, uint32_t width, uint32_t height) {
+        Abort();
+        if (width == 0 || height == 0) return false;
+        target = path;
+        partial = target + PathSuffix();
+        f = OpenForWrite(partial.c_str());
+        if (!f) return false;
+        std::vector<tiledimg::Level> layout = tiledimg::Layout(width, height);
+        levels.resize(layout.size());
+        for (size_t i = 0; i < layout.size(); i++) {
+            levels[i].info = layout[i];
+            levels[i].band.assign((size_t)layout[i].tilesX * kImageTileSize * kImageTileSize, 0);
+        }
+        tiledimg::Header h = {};
+        memcpy(h.magic, tiledimg::kMagic, 8);
+        h.version = tiledimg::kVersion;
+        h.tileSize = kImageTileSize;
+        h.width = width;
+        h.height = height;
+        h.levels = (uint32_t)layout.size();
+        ok = fwrite(&h, sizeof(h), 1, f) == 1 && fwrite(layout.data(), sizeof(tiledimg::Level), layout.size(), f) == layout.size();
+        return ok;
+    }
+
+    // rows строк уровня 0 (пиксели ARGB с умноженной альфой, stride — пикселей в строке)
+    bool Rows(const uint32_t* pixels, size_t stride, uint32_t rows) {
+        for (uint32_t r = 0; r < rows && ok; r++) Push(0, pixels + r * stride);
+        return ok;
+    }
+
+    // Дописывает неполные полосы всех уровней и публикует файл
+    bool Finish() {
+        if (!f) return false;
+        for (size_t l = 0; l < levels.size() && ok; l++) {
+            LevelState& s = levels[l];
+            if (s.rowsSeen != s.info.height) ok = false;
+            // Нечётная последняя строка даёт строку следующего уровня сама с собой
+            if (ok && s.hasCarry && l + 1 < levels.size()) HalveInto(l, s.carry.data(), s.carry.data());
+            if (ok && s.rowsInBand > 0) FlushBand(l);
+        }
+        ok = fclose(f) == 0 && ok;
+        f = nullptr;
+        if (ok) ok = tiledimg::Rename(partial.c_str(), target.c_str());
+        if (!ok) tiledimg::Remove(partial.c_str());
+        levels.clear();
+        return ok;
+    }
+
+    void Abort() {
+        if (!f) return;
+        fclose(f);
+        f = nullptr;
+        tiledimg::Remove(partial.c_str());
+        levels.clear();
+    }
+
+private:
+    struct LevelState {
+        tiledimg::Level info;
+        std::vector<uint32_t> band;   // tilesX * kImageTileSize столбцов, kImageTileSize строк
+        uint32_t rowsInBand = 0;
+        uint32_t bandIndex = 0;       // номер строки тайлов
+        uint32_t rowsSeen = 0;
+        std::vector<uint32_t> carry;  // чётная строка ждёт пары для следующего уровня
+        bool hasCarry = false;
+        std::vector<uint32_t> down;   // строка следующего уровня из пары строк этого
+    };
+
+    FILE* f = nullptr;
+    bool ok = false;
+    std::basic_string<PathChar> target, partial;
+    std::vector<LevelState> levels;
+    std::vector<uint32_t> tile;
+
+    static const PathChar* PathSuffix() {
+#ifdef _WIN32
+        return L".part";
+#else
+        return ".part";
+#endif
+    }
+
+    void Push(size_t l, const uint32_t* row) {
+        LevelState& s = levels[l];
+        if (s.rowsSeen >= s.info.height) {
+            ok = false;
+            return;
+        }
+        s.rowsSeen++;
+        uint32_t w = s.info.width;
+        memcpy(&s.band[(size_t)s.rowsInBand * s.info.tilesX * kImageTileSize], row, (size_t)w * 4);
+        if (++s.rowsInBand == (uint32_t)kImageTileSize) FlushBand(l);
+        if (l + 1 == levels.size()) return;
+        if (s.hasCarry) {
+            s.hasCarry = false;
+            HalveInto(l, s.carry.data(), row);
+        }
+        else {
+            s.carry.assign(row, row + w);
+            s.hasCarry = true;
+        }
+    }
+
+    // Строка уровня l + 1 — среднее 2x2 из строк a, b уровня l (нечётный край повторяется)
+    void HalveInto(size_t l, const uint32_t* a, const uint32_t* b) {
+        uint32_t w = levels[l].info.width, hw = levels[l + 1].info.width;
+        std::vector<uint32_t>& half = levels[l].down;
+        half.resize(hw);
+        for (uint32_t x = 0; x < hw; x++) {
+            uint32_t x0 = 2 * x, x1 = (std::min)(2 * x + 1, w - 1);
+            uint32_t q[4] = { a[x0], a[x1], b[x0], b[x1] };
+            uint32_t out = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                uint32_t sum = 2;
+                for (uint32_t v : q) sum += (v >> shift) & 255;
+                out |= (sum >> 2) << shift;
+            }
+            half[x] = out;
+        }
+        Push(l + 1, half.data());
+    }
+
+    // Полоса уровня l — строка тайлов в файл. Полоса обнуляется после
+    // каждой записи, поэтому недописанные строки и хвост правее картинки прозрачные.
+    void FlushBand(size_t l) {
+        LevelState& s = levels[l];
+        size_t bandStride = (size_t)s.info.tilesX * kImageTileSize;
+        tile.resize((size_t)kImageTileSize * kImageTileSize);
+        ok = ok && tiledimg::Seek(f, s.info.offset + (uint64_t)s.bandIndex * s.info.tilesX * kImageTileBytes);
+        for (uint32_t tx = 0; tx < s.info.tilesX && ok; tx++) {
+            for (int y = 0; y < kImageTileSize; y++)
+                memcpy(&tile[(size_t)y * kImageTileSize], &s.band[y * bandStride + (size_t)tx * kImageTileSize], kImageTileSize * 4);
+            ok = fwrite(tile.data(), 4, tile.size(), f) == tile.size();
+        }
+        std::fill(s.band.begin(), s.band.end(), 0);
+        s.rowsInBand = 0;
+        s.bandIndex++;
+    }
+};
+
+// Хранилище, открытое для вывода; тайлы читаются прямо из отображения
+class TiledImage {
+public:
+    bool Open(const PathChar* path) {
+        levels.clear();
+        if (!file.Open(path) || file.Size() < sizeof(tiledimg::Header)) return false;
+        tiledimg::Header h;
+        memcpy(&h, file.Data(), sizeof(h));
+        if (memcmp(h.magic, tiledimg::kMagic, 8) != 0 || h.version != tiledimg::kVersion || h.tileSize != (uint32_t)kImageTileSize) return Fail();
+        std::vector<tiledimg::Level> expect = tiledimg::Layout(h.width, h.height);
+        if (h.width == 0 || h.height == 0 || h.levels != expect.size() ||
+            file.Size() < sizeof(h) + expect.size() * sizeof(tiledimg::Level)) return Fail();
+        levels.resize(expect.size());
+        memcpy(levels.data(), file.Data() + sizeof(h), levels.size() * sizeof(tiledimg::Level));
+        for (size_t i = 0; i < levels.size(); i++)
+            if (memcmp(&levels[i], &expect[i], sizeof(tiledimg::Level)) != 0) return Fail();
+        const tiledimg::Level& last = levels.back();
+        if (file.Size() < last.offset + (uint64_t)last.tilesX * last.tilesY * kImageTileBytes) return Fail();
+        return true;
+    }
+
+    bool IsOpen() const { return !levels.empty(); }
+    uint32_t Width() const { return levels[0].width; }
+    uint32_t Height() const { return levels[0].height; }
+    int Levels() const { return (int)levels.size(); }
+    const tiledimg::Level& Level(int l) const { return levels[l]; }
+
+    // Тайл целиком (kImageTileSize строк по kImageTileSize пикселей)
+    const uint32_t* Tile(int level, uint32_t tx, uint32_t ty) const {
+        const tiledimg::Level& l = levels[level];
+        return (const uint32_t*)(file.Data() + l.offset + ((uint64_t)ty * l.tilesX + tx) * kImageTileBytes);
+    }
+
+    // Наименьший уровень не меньше width x height пикселей устройства
+    int PickLevel(float width, float height) const {
+        int k = 0;
+        while (k + 1 < Levels() && levels[k + 1].width >= width && levels[k + 1].height >= height) k++;
+        return k;
+    }
+
+private:
+    MappedFile file;
+    std::vector<tiledimg::Level> levels;
+
+    bool Fail() {
+        levels.clear();
+        file.Close();
+        return false;
+    }
+};
+
+struct TiledTileKey {
+    uint32_t image; // номер картинки у владельца кэша
+    int level;
+    uint32_t tx, ty;
+    bool operator==(const TiledTileKey& o) const { return image == o.image && level == o.level && tx == o.tx && ty == o.ty; }
+};
+
+struct TiledTileKeyHash {
+    size_t operator()(const TiledTileKey& k) const {
+        uint64_t h = (uint64_t)k.tx * 0x9E3779B97F4A7C15ull ^ (uint64_t)k.ty * 0xC2B2AE3D27D4EB4Full;
+        h ^= ((uint64_t)k.image << 8 | (uint32_t)k.level) * 0x165667B19E3779F9ull;
+        return (size_t)(h ^ h >> 29);
+    }
+};
+
+// Тайлы огромных картинок в памяти процесса: LRU по бюджету. Вид тайла
+// (Bitmap GDI+ в приложении) — параметр. Потокобезопасен; тайл выводится
+// под своим замком (Image GDI+ нельзя рисовать из двух потоков сразу),
+// вытесненный во время вывода тайл живёт до конца вывода.
+template <class Tile>
+class TiledTileCache {
+public:
+    struct Stats {
+        size_t tiles = 0, bytes = 0, budget = 0;
+        size_t loads = 0; // тайлов прочитано из хранилищ с начала работы
+    };
+
+    void SetBudget(size_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = bytes;
+        Evict();
+    }
+
+    // Вывод тайла k: нет в памяти — load() даёт его (nullptr — вывести нельзя)
+    template <class Load, class Use>
+    bool Draw(const TiledTileKey& k, const Load& load, const Use& use) {
+        std::shared_ptr<Slot> slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = slots.find(k);
+            if (it != slots.end()) {
+                slot = it->second;
+                slot->lastUse = ++tick;
+            }
+        }
+        if (!slot) {
+            std::unique_ptr<Tile> tile = load();
+            if (!tile) return false;
+            std::lock_guard<std::mutex> lock(mutex);
+            std::shared_ptr<Slot>& s = slots[k];
+            if (!s) { // другой поток мог успеть раньше
+                s = std::make_shared<Slot>();
+                s->tile = std::move(tile);
+                bytes += kImageTileBytes;
+                loads++;
+            }
+            s->lastUse = ++tick;
+            slot = s;
+            Evict();
+        }
+        std::lock_guard<std::mutex> draw(slot->drawMutex);
+        use(*slot->tile);
+        return true;
+    }
+
+    // Картинка удалена: её тайлы больше не нужны
+    void Forget(uint32_t image) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = slots.begin(); it != slots.end();) {
+            if (it->first.image == image) {
+                bytes -= kImageTileBytes;
+                it = slots.erase(it);
+            }
+            else ++it;
+        }
+    }
+
+    Stats GetStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+        Stats s;
+        s.tiles = slots.size();
+        s.bytes = bytes;
+        s.budget = budget;
+        s.loads = loads;
+        return s;
+    }
+
+private:
+    struct Slot {
+        std::unique_ptr<Tile> tile;
+        uint64_t lastUse = 0;
+        std::mutex drawMutex;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<TiledTileKey, std::shared_ptr<Slot>, TiledTileKeyHash> slots;
+    size_t bytes = 0, budget = (size_t)128 << 20, loads = 0;
+    uint64_t tick = 0;
+
+    // Под замком. Самые давние тайлы уходят, пока не уложимся в бюджет.
+    void Evict() {
+        if (bytes <= budget) return;
+        std::vector<std::pair<uint64_t, TiledTileKey>> order;
+        order.reserve(slots.size());
+        for (auto& s : slots) order.push_back(std::make_pair(s.second->lastUse, s.first));
+        std::sort(order.begin(), order.end(), [](const std::pair<uint64_t, TiledTileKey>& a, const std::pair<uint64_t, TiledTileKey>& b) { return a.first < b.first; });
+        for (auto& o : order) {
+            if (bytes <= budget) break;
+            slots.erase(o.second);
+            bytes -= kImageTileBytes;
+        }
+    }
+};
@@ -0,0 +1,162 @@
+﻿// -------------------------------------------------------------------------
+// Число выделений памяти и пик занятой памяти на синтетическом сеансе из
+// 50 000 штрихов (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -I.. ArenaBench.cpp -o arena_bench
+// Три раскладки точек штрихов:
+//   shapes — как было до SceneStore: объект на штрих, свой vector<PointF>,
+//            точки добавляются по одной (AddPoint), очистка — delete по всем;
+//   vector — общий буфер точек, растущий удвоением с копированием;
+//   arena  — текущий StrokeArray (блоки Arena.h).
+// Точки штрихов одинаковы во всех трёх.
+// -------------------------------------------------------------------------
+#include "SceneStore.h"
+#include "StrokeSimplifier.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+// Учёт через глобальные operator new/delete: размер хранится перед блоком
+// (GCC при встраивании принимает это за выход за границы — ложная тревога)
+#if defined(__GNUC__)
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+static size_t g_Allocs = 0, g_Frees = 0, g_Live = 0, g_Peak = 0;
+
+void* operator new(size_t n) {
+    void* p = std::malloc(n + 16);
+    if (!p) throw std::bad_alloc();
+    *(size_t*)p = n;
+    g_Allocs++;
+    g_Live += n;
+    if (g_Live > g_Peak) g_Peak = g_Live;
+    return (char*)p + 16;
+}
+void operator delete(void* p) noexcept {
+    if (!p) return;
+    char* b = (char*)p - 16;
+    g_Frees++;
+    g_Live -= *(size_t*)b;
+    std::free(b);
+}
+void* operator new[](size_t n) { return operator new(n); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+const size_t kStrokes = 50000;
+
+namespace legacy {
+struct PenShape {
+    uint32_t color = 0xFF000000;
+    float width = 2;
+    std::vector<ScenePoint> points;
+    virtual ~PenShape() {}
+    void AddPoint(const ScenePoint& p) { points.push_back(p); }
+};
+}
+
+struct SharedBuffer {
+    std::vector<uint32_t> offset, count;
+    std::vector<ScenePoint> points;
+    void Push(const ScenePoint* p, size_t n) {
+        offset.push_back((uint32_t)points.size());
+        count.push_back((uint32_t)n);
+        points.insert(points.end(), p, p + n);
+    }
+    void Clear() { offset.clear(); count.clear(); points.clear(); }
+};
+
+// Сеанс рисования: все штрихи заранее (случайное блуждание мыши,
+// прореженное StrokeSimplifier), подряд в одном буфере
+struct Session {
+    std::vector<ScenePoint> points;
+    std::vector<uint32_t> lengths;
+
+    Session() {
+        std::mt19937 rng(11);
+        std::uniform_int_distribution<int> len(40, 600);
+        std::uniform_real_distribution<float> pos(-20000, 20000), step(-1.5f, 1.5f);
+        StrokeSimplifier filter;
+        std::vector<ScenePoint> pts;
+        for (size_t s = 0; s < kStrokes; s++) {
+            ScenePoint p{ pos(rng), pos(rng) };
+            float dx = step(rng), dy = step(rng);
+            filter.Begin(pts, p, 0.5);
+            for (int k = len(rng); k > 0; k--) {
+                dx = dx * 0.9f + step(rng) * 0.4f; dy = dy * 0.9f + step(rng) * 0.4f;
+                p.X += dx + 1; p.Y += dy;
+                filter.Add(pts, p);
+            }
+            filter.Finish(pts);
+            points.insert(points.end(), pts.begin(), pts.end());
+            lengths.push_back((uint32_t)pts.size());
+        }
+    }
+};
+
+struct Result { size_t allocs, peak, frees; double store, clear; };
+
+// add(points, n) на каждый штрих сеанса, затем clear()
+template <class Add, class Clear>
+static Result Run(const Session& session, const Add& add, const Clear& clear) {
+    Result r;
+    size_t a0 = g_Allocs, live0 = g_Live;
+    g_Peak = g_Live;
+    double t0 = Now();
+    const ScenePoint* p = session.points.data();
+    for (uint32_t n : session.lengths) {
+        add(p, n);
+        p += n;
+    }
+    r.store = Now() - t0;
+    r.allocs = g_Allocs - a0;
+    r.peak = g_Peak - live0;
+    size_t f0 = g_Frees;
+    t0 = Now();
+    clear();
+    r.clear = Now() - t0;
+    r.frees = g_Frees - f0;
+    return r;
+}
+
+static void Print(const char* name, const Result& r) {
+    printf("%-7s %10zu %10.1f %11.1f %10.1f %10zu\n", name, r.allocs, r.peak / 1048576.0,
+        r.store * 1e3, r.clear * 1e3, r.frees);
+}
+
+int main() {
+    Session session;
+
+    std::vector<legacy::PenShape*> shapes;
+    Result rs = Run(session, [&](const ScenePoint* p, size_t n) {
+        auto* s = new legacy::PenShape();
+        for (size_t i = 0; i < n; i++) s->AddPoint(p[i]);
+        shapes.push_back(s);
+    }, [&] {
+        for (auto* s : shapes) delete s;
+        shapes.clear();
+    });
+
+    SharedBuffer buffer;
+    Result rv = Run(session, [&](const ScenePoint* p, size_t n) { buffer.Push(p, n); }, [&] { buffer.Clear(); });
+
+    SceneStore store;
+    Result ra = Run(session, [&](const ScenePoint* p, size_t n) { store.AddStroke(p, n, 0xFF000000, 2); }, [&] { store.Clear(); });
+
+    printf("%zu strokes, %zu points after simplification (%.1f MB)\n", kStrokes, session.points.size(),
+        session.points.size() * sizeof(ScenePoint) / 1048576.0);
+    printf("layout      allocs    peak MB    store ms   clear ms      frees\n");
+    Print("shapes", rs);
+    Print("vector", rv);
+    Print("arena", ra);
+    return 0;
+}
@@ -0,0 +1,114 @@
+﻿// -------------------------------------------------------------------------
+// Оси графика (DrawAxes в RenderBackend.h, LabelAtlas.h):
+//  - шаг делений 1-2-5 на масштабах 0.001..1000: соседние деления на
+//    экране от kAxisMinTickPixels до 2.5 * kAxisMinTickPixels пикселей;
+//  - вызовов backend на кадр окна 1920x1080 против прежних осей (±3000
+//    с шагом 50 на любом масштабе);
+//  - атлас подписей при панорамировании и смене масштаба: сколько подписей
+//    растрировано против выведенных;
+//  - время кадра осей программным растеризатором (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -pthread -I.. AxesBench.cpp -o axes_bench
+// -------------------------------------------------------------------------
+#include "SoftRaster.h"
+#include "LabelAtlas.h"
+
+#include <chrono>
+#include <cstdio>
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Растр подписи в атласе: здесь только ширина
+struct LabelImage { int width; };
+
+// Backend, который только считает вызовы; подписи идут через атлас
+class CountingBackend : public RenderBackend {
+public:
+    size_t lines = 0, labels = 0;
+    LabelAtlas<LabelImage>* atlas = nullptr;
+
+    CountingBackend(float scale, BoundsF view) : scale(scale), view(view) {}
+
+    float PixelsPerUnit() const override { return scale; }
+    BoundsF VisibleBounds() const override { return view; }
+    void Curve(const ScenePoint*, size_t, uint32_t, float) override {}
+    void Lines(const ScenePoint*, size_t, uint32_t, float) override { lines++; }
+    void Polygon(const ScenePoint*, size_t, uint32_t, float) override {}
+    void Ellipse(float, float, float, float, uint32_t, float) override {}
+    void Image(uint32_t, float, float, float, float) override {}
+    void Label(const char* text, float, float, uint32_t argb) override {
+        labels++;
+        if (atlas) atlas->Draw(text, argb, [&] { return std::unique_ptr<LabelImage>(new LabelImage{ (int)strlen(text) * 6 }); }, [](LabelImage&) {});
+    }
+    void PushClip(const BoundsF&) override {}
+    void PopClip() override {}
+
+private:
+    float scale;
+    BoundsF view;
+};
+
+// Окно w x h пикселей с центром в мировой точке (cx, cy)
+static BoundsF View(float scale, float cx, float cy, float w = 1920, float h = 1080) {
+    return BoundsF{ cx - w / 2 / scale, cy - h / 2 / scale, cx + w / 2 / scale, cy + h / 2 / scale };
+}
+
+int main() {
+    bool ok = true;
+
+    // Шаг делений
+    double worstLo = 1e9, worstHi = 0;
+    for (double z = 0.001; z <= 1000; z *= 1.037) {
+        double px = AxisStep(z, kAxisMinTickPixels) * z;
+        worstLo = (std::min)(worstLo, px);
+        worstHi = (std::max)(worstHi, px);
+    }
+    printf("шаг делений на экране: от %.1f до %.1f пикселей\n", worstLo, worstHi);
+    ok = ok && worstLo >= kAxisMinTickPixels - 1e-6 && worstHi <= 2.5 * kAxisMinTickPixels + 1e-6;
+    printf("подписи: %s %s %s %s\n", AxisLabel(150, 50).c_str(), AxisLabel(-0.4, 0.2).c_str(),
+        AxisLabel(0.05, 0.05).c_str(), AxisLabel(200000, 100000).c_str());
+    ok = ok && AxisLabel(-0.4, 0.2) == "-0.4" && AxisLabel(0.05, 0.05) == "0.05" && AxisLabel(150, 50) == "150";
+
+    // Вызовов на кадр: начало координат в центре окна
+    const float zooms[] = { 0.01f, 0.1f, 1.0f, 10.0f, 50.0f, 1000.0f };
+    for (float z : zooms) {
+        CountingBackend out(z, View(z, 0, 0));
+        DrawAxes(out, 0, 0);
+        printf("масштаб %7.2f: шаг %-8s линий %3zu, подписей %3zu (прежде 2 + 240 линий и 240 подписей)\n",
+            z, AxisLabel(AxisStep(z, kAxisMinTickPixels), AxisStep(z, kAxisMinTickPixels)).c_str(), out.lines, out.labels);
+        ok = ok && out.labels <= 80;
+    }
+
+    // Атлас: 200 кадров панорамирования на каждом масштабе
+    LabelAtlas<LabelImage> atlas;
+    size_t labels = 0;
+    for (float z : zooms)
+        for (int frame = 0; frame < 200; frame++) {
+            CountingBackend out(z, View(z, frame * 7 / z, frame * 3 / z));
+            out.atlas = &atlas;
+            DrawAxes(out, 0, 0);
+            labels += out.labels;
+        }
+    LabelAtlas<LabelImage>::Stats s = atlas.GetStats();
+    printf("атлас: выведено подписей %zu, растрировано %zu (%.1f%%), в атласе %zu из %zu\n",
+        s.drawn, s.made, 100.0 * s.made / s.drawn, s.labels, kLabelAtlasCapacity);
+    ok = ok && s.drawn == labels && s.labels <= kLabelAtlasCapacity;
+
+    // Время кадра осей программным растеризатором
+    std::vector<uint32_t> pixels((size_t)1920 * 1080);
+    RasterTarget t{ pixels.data(), 1920, 1080, 1920, 0 };
+    for (float z : { 0.1f, 1.0f, 50.0f }) {
+        const int kFrames = 50;
+        double t0 = Now();
+        for (int i = 0; i < kFrames; i++) {
+            SoftwareBackend out(t, z, 960, 540, nullptr);
+            DrawAxes(out, 0, 0);
+        }
+        printf("растеризатор, масштаб %5.1f: кадр осей %.2f мс\n", z, (Now() - t0) * 1000 / kFrames);
+    }
+
+    printf("%s\n", ok ? "ok" : "ОШИБКА");
+    return ok ? 0 : 1;
+}
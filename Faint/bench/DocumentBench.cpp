@@ -0,0 +1,118 @@
+﻿// -------------------------------------------------------------------------
+// Запись и открытие документа *.faint на 1 000 000 фигур (половина —
+// штрихи по 64 точки) с проверкой, что прочитанная сцена совпадает с
+// записанной (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -I.. DocumentBench.cpp -o document_bench
+//   ./document_bench [путь к файлу]
+// «open» — LoadDocument: заголовки, таблицы и габариты, без чтения точек;
+// «first walk» — первый обход всех точек, когда страницы отображения
+// подгружаются с диска (из кэша ОС, если файл только что записан).
+// -------------------------------------------------------------------------
+#include "Document.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Сумма по геометрии в порядке слоёв — отпечаток сцены
+static double Walk(const SceneStore& s) {
+    const BoxArray* boxes[] = { nullptr, nullptr, &s.rects, &s.ellipses, &s.triangles, &s.stars, &s.images };
+    double sum = 0;
+    for (const SceneStore::Ref& r : s.order) {
+        size_t i = r.slot;
+        if (r.kind == ShapeKind::Pen) {
+            const ScenePoint* p = s.strokes.Points(i);
+            double t = 0;
+            for (uint32_t k = 0, n = s.strokes.count[i]; k < n; k++) t += p[k].X + p[k].Y;
+            sum += t + s.strokes.color[i] + s.strokes.stroke[i];
+        }
+        else if (r.kind == ShapeKind::Line) {
+            sum += s.lines.x0[i] + s.lines.y0[i] + s.lines.x1[i] + s.lines.y1[i] + s.lines.color[i];
+        }
+        else if (r.kind != ShapeKind::Function && r.kind != ShapeKind::Erased) {
+            const BoxArray& a = *boxes[(int)r.kind];
+            sum += a.x[i] + a.y[i] + a.w[i] + a.h[i] + a.color[i] + a.stroke[i];
+        }
+    }
+    return sum;
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : "document_bench.faint";
+    const size_t kShapes = 1000000;
+    const int kStrokePoints = 64;
+
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> pos(-50000, 50000), size(1, 200);
+    SceneStore scene;
+    std::vector<ScenePoint> pts(kStrokePoints);
+    for (size_t n = 0; n < kShapes; n++) {
+        float x = pos(rng), y = pos(rng);
+        switch (rng() % 4) {
+        case 0:
+        case 1:
+            for (int k = 0; k < kStrokePoints; k++) pts[k] = ScenePoint{ x + k, y + k * 0.5f };
+            scene.AddStroke(pts.data(), pts.size(), 0xFF000000 | (uint32_t)n, 2);
+            break;
+        case 2:
+            scene.AddLine(x, y, x + size(rng), y + size(rng), 0xFF0000FF, 1);
+            break;
+        default:
+            scene.AddBox(ShapeKind::Ellipse, x, y, size(rng), size(rng), 0xFFFF0000, 3);
+            break;
+        }
+    }
+    double expected = Walk(scene);
+    std::vector<BoundsF> expectedBounds;
+    scene.AllBounds(expectedBounds);
+
+    std::string error;
+    double t0 = Now();
+    bool saved = SaveDocument(path, scene, DocumentView{ 1.5f, 10, 20 }, [](uint32_t) { return DocumentImage(); }, error);
+    double tSave = Now() - t0;
+    if (!saved) {
+        printf("save failed: %s\n", error.c_str());
+        return 1;
+    }
+
+    SceneStore loaded;
+    std::vector<BoundsF> bounds;
+    DocumentView view;
+    t0 = Now();
+    bool opened = LoadDocument(path, loaded, bounds, view, [](const DocumentImage&) { return 0u; }, error);
+    double tOpen = Now() - t0;
+    if (!opened) {
+        printf("open failed: %s\n", error.c_str());
+        return 1;
+    }
+
+    t0 = Now();
+    double got = Walk(loaded);
+    double tWalk = Now() - t0;
+
+    bool same = got == expected && bounds.size() == expectedBounds.size() && view.zoom == 1.5f;
+    for (size_t i = 0; same && i < bounds.size(); i++)
+        same = bounds[i].minX == expectedBounds[i].minX && bounds[i].maxY == expectedBounds[i].maxY;
+
+    FILE* f = fopen(path, "rb");
+    long bytes = 0;
+    if (f) {
+        fseek(f, 0, SEEK_END);
+        bytes = ftell(f);
+        fclose(f);
+    }
+
+    printf("%zu shapes, %.1f MB file\n", kShapes, bytes / 1048576.0);
+    printf("save        %9.1f ms\n", tSave * 1e3);
+    printf("open        %9.1f ms\n", tOpen * 1e3);
+    printf("first walk  %9.1f ms\n", tWalk * 1e3);
+    printf("results %s\n", same ? "match" : "MISMATCH");
+    loaded.Clear();
+    remove(path);
+    return same ? 0 : 1;
+}
@@ -0,0 +1,365 @@
+﻿// -------------------------------------------------------------------------
+// Сводный набор замеров горячих путей для сравнения между коммитами
+// (Linux/MSVC, без Win32 и без окна):
+//  - parse.*   — MathParser::Evaluate (разбор на каждое значение),
+//                Compile, CompiledExpression::Evaluate и EvaluateBatch на
+//                наборе выражений, значений в секунду;
+//  - sample.*  — выборка графика: FunctionSampler::SampleRange по сетке
+//                пикселей и холодный PlotCache::Query окна 1920 пикселей;
+//  - stroke.*  — приём точек кисти: StrokeSimplifier Begin/Add/Finish и
+//                AddStroke, как в WM_MOUSEMOVE/WM_LBUTTONUP;
+//  - render.*  — кадр 1920x1080 сцены из 1k/10k/100k смешанных фигур на
+//                нескольких масштабах: запрос к SpatialIndex и вывод
+//                видимых фигур программным растеризатором одной полосой,
+//                как цикл WM_PAINT.
+// Итог пишется в JSON (--json файл, иначе в stdout): плоский список
+// { name, value, unit }, где unit "1/s" — больше лучше, "ms" — меньше лучше.
+// --compare прежний.json печатает отношение к прежнему прогону.
+//   g++ -O2 -std=c++14 -pthread -I.. FaintBench.cpp -o faint_bench
+//   ./faint_bench [--quick] [--only префикс] [--json файл] [--compare файл]
+// -------------------------------------------------------------------------
+#include "MathParser.h"
+#include "FunctionSampler.h"
+#include "StrokeSimplifier.h"
+#include "SpatialIndex.h"
+#include "SoftRaster.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+struct Result {
+    std::string name;
+    double value;
+    const char* unit;
+};
+
+static std::vector<Result> g_Results;
+static bool g_Quick = false;
+static const char* g_Only = nullptr;
+
+static bool Enabled(const char* name) { return !g_Only || !strncmp(name, g_Only, strlen(g_Only)); }
+
+static void Report(const std::string& name, double value, const char* unit) {
+    g_Results.push_back(Result{ name, value, unit });
+    fprintf(stderr, "%-34s %14.3f %s\n", name.c_str(), value, unit);
+}
+
+// Лучшее время одного прогона body(): повторы, пока не наберётся minTime
+template <class Body>
+static double Best(const Body& body, double minTime = 0.3) {
+    double best = 1e30, total = 0;
+    int reps = 0;
+    while (total < (g_Quick ? minTime / 5 : minTime) || reps < 3) {
+        double t0 = Now();
+        body();
+        double t = Now() - t0;
+        best = (std::min)(best, t);
+        total += t;
+        reps++;
+    }
+    return best;
+}
+
+static volatile double g_Sink;
+
+// Выражения, какие вводят в диалоге графика
+static const char* const kCorpus[] = {
+    "x", "x^2/100", "sin(x/20)*50", "cos(x/30)*40+sin(x/7)*10", "x^3/10000-x",
+    "sqrt(abs(x))*10", "tan(x/50)*20", "log(abs(x)+1)*30", "1/(x/100)", "abs(sin(x/10))*(x/5)",
+    "(x-10)*(x+20)/(x^2+1)*100", "sin(x/40)^2*60-cos(x/15)*sqrt(abs(x))",
+};
+static const size_t kCorpusSize = sizeof(kCorpus) / sizeof(kCorpus[0]);
+
+static void Parse() {
+    const int n = g_Quick ? 2000 : 20000;
+    std::vector<double> xs(n), ys(n);
+    for (int i = 0; i < n; i++) xs[i] = -500 + 1000.0 * i / n;
+    std::vector<CompiledExpression> programs;
+    for (const char* e : kCorpus) programs.push_back(MathParser::Compile(e));
+
+    double t = Best([&] {
+        double s = 0;
+        for (const char* e : kCorpus)
+            for (int i = 0; i < n; i += 16) s += MathParser::Evaluate(e, xs[i]);
+        g_Sink = s;
+    });
+    Report("parse.evaluate_text", kCorpusSize * ((n + 15) / 16) / t, "1/s");
+
+    t = Best([&] {
+        size_t s = 0;
+        for (int r = 0; r < 100; r++)
+            for (const char* e : kCorpus) s += MathParser::Compile(e).code.size();
+        g_Sink = (double)s;
+    });
+    Report("parse.compile", 100 * kCorpusSize / t, "1/s");
+
+    t = Best([&] {
+        double s = 0;
+        for (const CompiledExpression& p : programs)
+            for (int i = 0; i < n; i++) s += p.Evaluate(xs[i]);
+        g_Sink = s;
+    });
+    Report("parse.evaluate_compiled", kCorpusSize * n / t, "1/s");
+
+    t = Best([&] {
+        for (const CompiledExpression& p : programs) p.EvaluateBatch(xs.data(), ys.data(), n);
+        g_Sink = ys[n / 2];
+    });
+    Report("parse.evaluate_batch", kCorpusSize * n / t, "1/s");
+}
+
+static void Sample() {
+    std::vector<CompiledExpression> programs;
+    for (const char* e : kCorpus) programs.push_back(MathParser::Compile(e));
+    const long long nodes = g_Quick ? 20000 : 200000;
+    const double ppus[] = { 0.25, 1.0, 8.0 };
+    for (double ppu : ppus) {
+        size_t samples = 0;
+        std::vector<PlotSample> out;
+        double t = Best([&] {
+            samples = 0;
+            for (const CompiledExpression& p : programs) {
+                out.clear();
+                FunctionSampler::SampleRange(p, ppu, -nodes / 2, nodes / 2, true, out);
+                samples += out.size();
+            }
+        });
+        char name[64];
+        snprintf(name, sizeof(name), "sample.range.ppu%g", ppu);
+        Report(name, samples / t, "1/s");
+    }
+
+    // Холодный кэш: первый кадр графика после вставки или смены масштаба
+    size_t samples = 0;
+    double t = Best([&] {
+        samples = 0;
+        for (const CompiledExpression& p : programs) {
+            PlotCache cache;
+            std::vector<PlotSample> out;
+            cache.Query(p, 1.0, -960, 960, -50000, 50000, out);
+            samples += out.size();
+        }
+    });
+    Report("sample.cache_cold_frame", kCorpusSize / t, "1/s");
+    Report("sample.cache_cold_samples", samples / t, "1/s");
+}
+
+// Путь мыши: шаг около пикселя с дрожанием руки, плавные повороты
+static std::vector<ScenePoint> MouseTrace(size_t n, std::mt19937& rng) {
+    std::uniform_real_distribution<float> jitter(-0.7f, 0.7f), turn(-0.08f, 0.08f);
+    std::vector<ScenePoint> p(n);
+    float x = 0, y = 0, a = 0;
+    for (size_t i = 0; i < n; i++) {
+        a += turn(rng);
+        x += cosf(a) * 1.5f + jitter(rng);
+        y += sinf(a) * 1.5f + jitter(rng);
+        p[i] = ScenePoint{ x, y };
+    }
+    return p;
+}
+
+static void Stroke() {
+    std::mt19937 rng(11);
+    const size_t kStrokePoints = 600, strokes = g_Quick ? 100 : 1000;
+    std::vector<std::vector<ScenePoint>> traces;
+    for (size_t s = 0; s < strokes; s++) traces.push_back(MouseTrace(kStrokePoints, rng));
+
+    StrokeSimplifier filter;
+    std::vector<ScenePoint> pts;
+    size_t kept = 0;
+    double t = Best([&] {
+        kept = 0;
+        for (const std::vector<ScenePoint>& tr : traces) {
+            filter.Begin(pts, tr[0], kStrokeTolerancePx);
+            for (size_t i = 1; i < tr.size(); i++) filter.Add(pts, tr[i]);
+            filter.Finish(pts);
+            kept += pts.size();
+        }
+    });
+    Report("stroke.simplify_points", strokes * kStrokePoints / t, "1/s");
+
+    t = Best([&] {
+        SceneStore scene;
+        for (const std::vector<ScenePoint>& tr : traces) {
+            filter.Begin(pts, tr[0], kStrokeTolerancePx);
+            for (size_t i = 1; i < tr.size(); i++) filter.Add(pts, tr[i]);
+            filter.Finish(pts);
+            scene.AddStroke(pts.data(), pts.size(), 0xFF000000u, 2.0f);
+        }
+        g_Sink = (double)scene.Size();
+    });
+    Report("stroke.ingest_points", strokes * kStrokePoints / t, "1/s");
+    Report("stroke.kept_ratio", (double)kept / (strokes * kStrokePoints), "ratio");
+}
+
+// Смешанная сцена из n фигур на квадрате мира со стороной 40 * sqrt(n):
+// штрихи, отрезки, фигуры в рамке, картинки и графики (каждый второй с осями)
+static float BuildScene(SceneStore& scene, SpatialIndex& index, size_t n) {
+    float side = 40 * sqrtf((float)n);
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> pos(0, side), unit(0, 1);
+    auto color = [&]() { return 0xFF000000u | (rng() & 0xFFFFFF); };
+    const ShapeKind boxes[] = { ShapeKind::Rect, ShapeKind::Ellipse, ShapeKind::Triangle, ShapeKind::Star };
+    for (size_t k = 0; k < n; k++) {
+        uint32_t kind = rng() % 100;
+        float x = pos(rng), y = pos(rng);
+        if (k % 1000 == 999) {
+            std::shared_ptr<FunctionPlot> f = std::make_shared<FunctionPlot>(kCorpus[k / 1000 % kCorpusSize],
+                -300.0, 300.0, x, y, color(), 2.0f, (k / 1000) % 2 == 0, true);
+            scene.AddFunction(f);
+        }
+        else if (kind < 60) {
+            ScenePoint pts[48];
+            int m = 16 + (int)(rng() % 33);
+            for (int i = 0; i < m; i++) {
+                x += unit(rng) * 12 - 6;
+                y += unit(rng) * 12 - 6;
+                pts[i] = ScenePoint{ x, y };
+            }
+            scene.AddStroke(pts, m, color(), 1 + unit(rng) * 6);
+        }
+        else if (kind < 70) {
+            scene.AddLine(x, y, x + unit(rng) * 200 - 100, y + unit(rng) * 200 - 100, color(), 1 + unit(rng) * 4);
+        }
+        else if (kind < 98) {
+            scene.AddBox(boxes[kind % 4], x, y, 10 + unit(rng) * 120, 10 + unit(rng) * 120, color(), 1 + unit(rng) * 4);
+        }
+        else {
+            scene.AddImage(x, y, 40 + unit(rng) * 160, 30 + unit(rng) * 120, 0);
+        }
+    }
+    for (uint32_t id = 0; id < (uint32_t)scene.Size(); id++) index.Insert(id, scene.Bounds(id));
+    return side;
+}
+
+static void Render() {
+    const int kWidth = 1920, kHeight = 1080;
+    std::vector<uint32_t> pixels((size_t)kWidth * kHeight);
+    RasterTarget image;
+    image.pixels = pixels.data();
+    image.width = kWidth;
+    image.height = kHeight;
+    image.stride = kWidth;
+    const size_t sizes[] = { 1000, 10000, 100000 };
+    const float zooms[] = { 0.1f, 0.5f, 1.0f, 4.0f };
+    for (size_t n : sizes) {
+        if (g_Quick && n > 10000) continue;
+        SceneStore scene;
+        SpatialIndex index;
+        double t0 = Now();
+        float side = BuildScene(scene, index, n);
+        char name[64];
+        snprintf(name, sizeof(name), "render.n%zu.build", n);
+        Report(name, (Now() - t0) * 1000, "ms");
+        for (float zoom : zooms) {
+            // Окно с центром в середине сцены
+            float ox = kWidth / 2 - side / 2 * zoom, oy = kHeight / 2 - side / 2 * zoom;
+            BoundsF view{ -ox / zoom, -oy / zoom, (kWidth - ox) / zoom, (kHeight - oy) / zoom };
+            std::vector<SpatialIndex::Id> ids;
+            double t = Best([&] {
+                std::fill(pixels.begin(), pixels.end(), 0xFFFFFFFFu);
+                ids.clear();
+                index.Query(view, ids);
+                SoftwareBackend out(image, zoom, ox, oy, nullptr);
+                for (auto id : ids) DrawShape(out, scene, id);
+            }, 1.0);
+            snprintf(name, sizeof(name), "render.n%zu.zoom%g", n, zoom);
+            Report(name, t * 1000, "ms");
+            snprintf(name, sizeof(name), "render.n%zu.zoom%g.visible", n, zoom);
+            Report(name, (double)ids.size(), "count");
+        }
+    }
+}
+
+static void WriteJson(FILE* f) {
+    fprintf(f, "{\n  \"quick\": %s,\n  \"results\": [\n", g_Quick ? "true" : "false");
+    for (size_t i = 0; i < g_Results.size(); i++) {
+        const Result& r = g_Results[i];
+        fprintf(f, "    { \"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\" }%s\n",
+            r.name.c_str(), r.value, r.unit, i + 1 < g_Results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+// Значения прежнего прогона: пары name/value из файла, записанного WriteJson
+static std::map<std::string, double> ReadJson(const char* path) {
+    std::map<std::string, double> out;
+    FILE* f = fopen(path, "rb");
+    if (!f) return out;
+    std::string text;
+    char buf[4096];
+    size_t got;
+    while ((got = fread(buf, 1, sizeof(buf), f)) > 0) text.append(buf, got);
+    fclose(f);
+    const char* key = "\"name\": \"";
+    for (size_t p = text.find(key); p != std::string::npos; p = text.find(key, p)) {
+        p += strlen(key);
+        size_t end = text.find('"', p);
+        size_t v = text.find("\"value\":", end);
+        if (end == std::string::npos || v == std::string::npos) break;
+        out[text.substr(p, end - p)] = atof(text.c_str() + v + 8);
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    const char* json = nullptr;
+    const char* compare = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--quick")) g_Quick = true;
+        else if (!strcmp(argv[i], "--only") && i + 1 < argc) g_Only = argv[++i];
+        else if (!strcmp(argv[i], "--json") && i + 1 < argc) json = argv[++i];
+        else if (!strcmp(argv[i], "--compare") && i + 1 < argc) compare = argv[++i];
+        else {
+            fprintf(stderr, "использование: %s [--quick] [--only префикс] [--json файл] [--compare файл]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    if (Enabled("parse")) Parse();
+    if (Enabled("sample")) Sample();
+    if (Enabled("stroke")) Stroke();
+    if (Enabled("render")) Render();
+
+    if (json) {
+        FILE* f = fopen(json, "w");
+        if (!f) {
+            fprintf(stderr, "не записать %s\n", json);
+            return 1;
+        }
+        WriteJson(f);
+        fclose(f);
+    }
+    else {
+        WriteJson(stdout);
+    }
+
+    if (compare) {
+        std::map<std::string, double> base = ReadJson(compare);
+        if (base.empty()) {
+            fprintf(stderr, "не прочитать %s\n", compare);
+            return 1;
+        }
+        // Отношение больше 1 — улучшение, для времени берётся обратное
+        fprintf(stderr, "\nпротив %s:\n", compare);
+        for (const Result& r : g_Results) {
+            auto it = base.find(r.name);
+            if (it == base.end() || it->second <= 0 || r.value <= 0) continue;
+            bool time = !strcmp(r.unit, "ms"), rate = !strcmp(r.unit, "1/s");
+            if (!time && !rate) continue;
+            double gain = time ? it->second / r.value : r.value / it->second;
+            fprintf(stderr, "%-34s x%.2f%s\n", r.name.c_str(), gain, gain < 0.9 ? "  хуже" : "");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+﻿// -------------------------------------------------------------------------
+// Замеры кадров (FrameStats.h):
+//  - процентили скользящего окна против сортировки на известных данных;
+//  - цена замеров: вывод 2000 мелких фигур программным растеризатором
+//    без замеров, с выключенными (проверка nullptr, как в SceneRenderer)
+//    и с включёнными — на фигуру;
+//  - EndFrame с процентилями для оверлея и выгрузка трассы 100 000 кадров
+//    в CSV и JSON (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -pthread -I.. FrameStatsBench.cpp -o frame_stats_bench
+// -------------------------------------------------------------------------
+#include "FrameStats.h"
+#include "SoftRaster.h"
+
+#include <cstdio>
+#include <random>
+
+// Вывод фигуры, как SceneRenderer::Draw в приложении
+static void Draw(RenderBackend& out, const SceneStore& s, uint32_t id, ShapeTimes* times) {
+    if (!times) {
+        DrawShape(out, s, id);
+        return;
+    }
+    double t0 = FrameClock();
+    DrawShape(out, s, id);
+    times->Add(s.order[id].kind, FrameClock() - t0);
+}
+
+int main() {
+    bool ok = true;
+
+    // Процентили: окно держит последние kFrameWindow значений
+    RollingWindow w;
+    std::mt19937 rng(9);
+    for (int i = 0; i < 10000; i++) w.Push((float)(rng() % 100000));
+    for (size_t i = 0; i < kFrameWindow; i++) w.Push((float)(i + 1));
+    float p50 = w.Percentile(0.5), p99 = w.Percentile(0.99);
+    printf("окно %zu: p50 %.0f, p99 %.0f (ожидается %zu и %zu)\n", w.Size(), p50, p99, kFrameWindow / 2 + 1, kFrameWindow * 99 / 100 + 1);
+    ok = ok && w.Size() == kFrameWindow && p50 == kFrameWindow / 2 + 1 && p99 == kFrameWindow * 99 / 100 + 1;
+
+    // Цена замеров на фигуру
+    SceneStore scene;
+    std::uniform_real_distribution<float> pos(0, 600), unit(0, 1);
+    for (int k = 0; k < 2000; k++) {
+        float x = pos(rng), y = pos(rng);
+        if (k % 2) scene.AddBox(ShapeKind::Rect, x, y, 4 + unit(rng) * 8, 4 + unit(rng) * 8, 0xFF000000u, 1);
+        else scene.AddLine(x, y, x + 6, y + 3, 0xFF000000u, 1);
+    }
+    std::vector<uint32_t> pixels(640 * 640);
+    RasterTarget t{ pixels.data(), 640, 640, 640, 0 };
+    FrameStats stats;
+    const int kFrames = 40;
+    double cost[3];
+    for (int mode = 0; mode < 3; mode++) {
+        stats.Enable(mode == 2);
+        double best = 1e9;
+        for (int f = 0; f < kFrames; f++) {
+            SoftwareBackend out(t, 1, 0, 0, nullptr);
+            double t0 = FrameClock();
+            if (mode == 0) DrawScene(out, scene);
+            else for (uint32_t id = 0; id < (uint32_t)scene.Size(); id++) Draw(out, scene, id, stats.Shapes());
+            best = (std::min)(best, FrameClock() - t0);
+            if (stats.Enabled()) {
+                stats.BeginFrame();
+                stats.EndFrame();
+            }
+        }
+        cost[mode] = best / scene.Size() * 1e9;
+    }
+    printf("на фигуру: без замеров %.0f нс, выключены %.0f нс (%+.1f%%), включены %.0f нс (%+.1f%%)\n",
+        cost[0], cost[1], 100 * (cost[1] / cost[0] - 1), cost[2], 100 * (cost[2] / cost[0] - 1));
+
+    // EndFrame и выгрузка трассы
+    stats.Enable(false);
+    stats.Enable(true);
+    double t0 = FrameClock();
+    for (size_t f = 0; f < kFrameTraceMax + 10; f++) {
+        stats.BeginFrame();
+        ShapeTimes* s = stats.Shapes();
+        s->Add(ShapeKind::Pen, 0.0004 + (f % 7) * 1e-5);
+        s->Add(ShapeKind::Function, 0.002);
+        s->culled += 3;
+        stats.EndFrame();
+    }
+    double endFrame = (FrameClock() - t0) / (kFrameTraceMax + 10) * 1e6;
+    t0 = FrameClock();
+    for (int i = 0; i < 100; i++) {
+        FrameStats::Percentiles p = stats.Metric(FrameMetric::Total);
+        p = stats.Shape((int)ShapeKind::Pen);
+        (void)p;
+    }
+    double hud = (FrameClock() - t0) / 100 * 1e6;
+    printf("EndFrame %.2f мкс, процентили для оверлея %.0f мкс, в трассе %zu кадров, не попало %zu\n",
+        endFrame, hud, stats.TraceFrames(), stats.Dropped());
+    ok = ok && stats.TraceFrames() == kFrameTraceMax && stats.Dropped() == 10;
+    FrameStats::Percentiles pen = stats.Shape((int)ShapeKind::Pen);
+    ok = ok && pen.p50 > 0.39f && pen.p99 < 0.47f;
+
+    const char* files[] = { "frames_bench.csv", "frames_bench.json" };
+    for (int i = 0; i < 2; i++) {
+        FILE* f = fopen(files[i], "wb");
+        t0 = FrameClock();
+        bool written = f && (i ? stats.WriteJson(f) : stats.WriteCsv(f));
+        long size = f ? ftell(f) : 0;
+        if (f) fclose(f);
+        printf("%s: %.0f мс, %.1f МБ\n", files[i], (FrameClock() - t0) * 1000, size / 1048576.0);
+        ok = ok && written;
+        remove(files[i]);
+    }
+
+    printf("%s\n", ok ? "ok" : "ОШИБКА");
+    return ok ? 0 : 1;
+}
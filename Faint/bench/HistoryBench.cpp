@@ -0,0 +1,185 @@
+﻿// -------------------------------------------------------------------------
+// Отмена и повтор (History.h) на сценах из 10 000, 100 000 и 1 000 000
+// фигур: время отмены и повтора добавления, прохода ластика (100 фигур) и
+// очистки не должно зависеть от размера сцены. На 100 000 фигур — память
+// истории после 1000 правок. Отпечаток сцены сверяется после отмены всего
+// и повтора всего (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -I.. HistoryBench.cpp -o history_bench
+// -------------------------------------------------------------------------
+#include "History.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+
+// Счётчик живой памяти: размер хранится перед блоком. Все формы new и
+// delete (обычные, массивы, с размером) идут через одну пару malloc/free.
+static size_t g_liveBytes = 0;
+
+static void* CountedAlloc(size_t n) {
+    size_t* p = static_cast<size_t*>(malloc(n + sizeof(size_t) * 2));
+    if (!p) throw std::bad_alloc();
+    p[0] = n;
+    g_liveBytes += n;
+    return p + 2;
+}
+
+static void CountedFree(void* q) noexcept {
+    if (!q) return;
+    size_t* p = static_cast<size_t*>(q) - 2;
+    g_liveBytes -= p[0];
+    free(p);
+}
+
+void* operator new(size_t n) { return CountedAlloc(n); }
+void* operator new[](size_t n) { return CountedAlloc(n); }
+void operator delete(void* q) noexcept { CountedFree(q); }
+void operator delete[](void* q) noexcept { CountedFree(q); }
+void operator delete(void* q, size_t) noexcept { CountedFree(q); }
+void operator delete[](void* q, size_t) noexcept { CountedFree(q); }
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Отпечаток сцены: виды, точки штрихов, габариты остальных фигур по id;
+// стёртые не считаются
+static double Fingerprint(const SceneStore& s) {
+    double sum = 0;
+    for (uint32_t id = 0; id < s.Size(); id++) {
+        const SceneStore::Ref& r = s.order[id];
+        if (r.kind == ShapeKind::Erased) continue;
+        double t = (double)r.kind;
+        if (r.kind == ShapeKind::Pen) {
+            const ScenePoint* p = s.strokes.Points(r.slot);
+            for (uint32_t k = 0, n = s.strokes.count[r.slot]; k < n; k++) t += p[k].X + 0.5 * p[k].Y;
+        }
+        else {
+            BoundsF b = s.Bounds(id);
+            t += b.minX + b.maxY;
+        }
+        sum += t * (id % 7 + 1);
+    }
+    return sum;
+}
+
+// Мир растёт со сценой: плотность фигур (и заполненность ячеек индекса)
+// одна и та же при любом их числе
+static float g_worldHalf = 0;
+
+static uint32_t AddStroke(SceneStore& s, SpatialIndex& index, std::mt19937& rng) {
+    std::uniform_real_distribution<float> pos(-g_worldHalf, g_worldHalf);
+    ScenePoint pts[16];
+    float x = pos(rng), y = pos(rng);
+    for (int k = 0; k < 16; k++) pts[k] = ScenePoint{ x + k, y + k * 0.5f };
+    uint32_t id = s.AddStroke(pts, 16, 0xFF000000, 2);
+    index.Insert(id, s.Bounds(id));
+    return id;
+}
+
+// Проход ластика: count живых фигур стираются или укорачиваются
+static void EraseStep(SceneStore& s, SpatialIndex& index, SceneHistory& h, std::mt19937& rng, int count) {
+    h.Begin();
+    for (int done = 0; done < count;) {
+        uint32_t id = rng() % (uint32_t)s.Size();
+        ShapeKind kind = s.order[id].kind;
+        if (kind == ShapeKind::Erased) continue;
+        h.Changing(s, id);
+        if (kind == ShapeKind::Pen && rng() % 2) {
+            std::vector<ScenePoint> cut(s.strokes.Points(s.order[id].slot), s.strokes.Points(s.order[id].slot) + 8);
+            s.ReplaceStroke(id, cut.data(), cut.size());
+            index.Insert(id, s.Bounds(id));
+        }
+        else {
+            s.Erase(id);
+            index.Remove(id);
+        }
+        done++;
+    }
+    h.Commit();
+}
+
+// Среднее время пары отмена + повтор, мкс
+static double UndoRedoUs(SceneStore& s, SpatialIndex& index, SceneHistory& h, int reps) {
+    SceneHistory::Effect fx;
+    double t0 = Now();
+    for (int k = 0; k < reps; k++) {
+        h.Undo(s, index, fx);
+        h.Redo(s, index, fx);
+    }
+    return (Now() - t0) / reps * 1e6;
+}
+
+int main() {
+    bool ok = true;
+    printf("%10s %12s %12s %12s\n", "shapes", "add us", "erase100 us", "clear us");
+    for (size_t n : { (size_t)10000, (size_t)100000, (size_t)1000000 }) {
+        std::mt19937 rng(7);
+        SceneStore scene;
+        SpatialIndex index;
+        SceneHistory history;
+        g_worldHalf = 5 * sqrtf((float)n);
+        std::uniform_real_distribution<float> pos(-g_worldHalf, g_worldHalf);
+        for (size_t k = 0; k < n; k++) {
+            if (k % 2) AddStroke(scene, index, rng);
+            else {
+                uint32_t id = scene.AddBox(ShapeKind::Rect, pos(rng), pos(rng), 10, 10, 0xFFFF0000, 1);
+                index.Insert(id, scene.Bounds(id));
+            }
+        }
+        double initial = Fingerprint(scene);
+
+        history.Begin();
+        history.Added(AddStroke(scene, index, rng));
+        history.Commit();
+        double tAdd = UndoRedoUs(scene, index, history, 1000);
+
+        EraseStep(scene, index, history, rng, 100);
+        double tErase = UndoRedoUs(scene, index, history, 1000);
+
+        history.Clear(scene, index);
+        double tClear = UndoRedoUs(scene, index, history, 1000);
+        printf("%10zu %12.2f %12.2f %12.2f\n", n, tAdd, tErase, tClear);
+
+        double edited = Fingerprint(scene);
+        SceneHistory::Effect fx;
+        while (history.Undo(scene, index, fx)) {}
+        ok = ok && Fingerprint(scene) == initial && scene.Size() == n + 1;
+        while (history.Redo(scene, index, fx)) {}
+        ok = ok && Fingerprint(scene) == edited;
+    }
+
+    // Память истории: те же 1000 правок на 100 000 штрихах с историей и без
+    size_t grown[2];
+    size_t sceneBytes = 0;
+    for (int record = 0; record < 2; record++) {
+        std::mt19937 rng(11);
+        g_worldHalf = 5 * sqrtf(100000.0f);
+        size_t base = g_liveBytes;
+        SceneStore scene;
+        SpatialIndex index;
+        for (size_t k = 0; k < 100000; k++) AddStroke(scene, index, rng);
+        sceneBytes = g_liveBytes - base;
+        SceneHistory history;
+        for (int step = 0; step < 1000; step++) {
+            if (step % 2) {
+                EraseStep(scene, index, history, rng, 5);
+            }
+            else {
+                history.Begin();
+                history.Added(AddStroke(scene, index, rng));
+                history.Commit();
+            }
+            if (!record) history.Reset();
+        }
+        grown[record] = g_liveBytes - base - sceneBytes;
+    }
+    printf("100000 strokes: scene %.1f MB, history of 1000 edits %.1f KB\n",
+        sceneBytes / 1048576.0, ((double)grown[1] - (double)grown[0]) / 1024.0);
+    printf("results %s\n", ok ? "match" : "MISMATCH");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,333 @@
+﻿// -------------------------------------------------------------------------
+// Кэш картинок (ImageCache.h):
+//  - одна картинка, вставленная много раз: записей и раскодирований;
+//  - вывод большой картинки в маленький прямоугольник программным
+//    растеризатором полным размером и уровнем пирамиды: время и
+//    отклонение от честного усреднения по площади пикселя;
+//  - вытеснение пирамид бюджетом при выводе множества картинок, в том
+//    числе из нескольких потоков сразу;
+//  - заказы в фоне: заглушка до готовности, уведомления, отмена ещё не
+//    начатых заказов, Draw забирает себе заказ из очереди; время
+//    раскодирования пачки картинок по очереди и пулом (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -pthread -I.. ImageCacheBench.cpp -o image_cache_bench
+// -------------------------------------------------------------------------
+#include "ImageCache.h"
+#include "SoftRaster.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+typedef ImageCache<RasterImage> Cache;
+
+// «Файл» картинки: ширина, высота и пиксели ARGB как есть
+static std::vector<uint8_t> Encode(int w, int h, uint32_t seed) {
+    std::vector<uint8_t> bytes(8 + (size_t)w * h * 4);
+    memcpy(&bytes[0], &w, 4);
+    memcpy(&bytes[4], &h, 4);
+    std::mt19937 rng(seed);
+    uint32_t* p = (uint32_t*)&bytes[8];
+    // Мелкие полосы и шум: то, что даёт муар при уменьшении без фильтра
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            uint32_t v = ((x / 2 + y / 3) & 1) ? 230 : 25;
+            v = (std::min)(255u, v + (uint32_t)(rng() & 15));
+            p[(size_t)y * w + x] = 0xFF000000u | v << 16 | v << 8 | v;
+        }
+    return bytes;
+}
+
+// Уменьшение вдвое усреднением 2x2 (нечётный край повторяется)
+static void Halve(const RasterImage& src, RasterImage& dst) {
+    dst.width = (std::max)(1, (src.width + 1) / 2);
+    dst.height = (std::max)(1, (src.height + 1) / 2);
+    dst.pixels.resize((size_t)dst.width * dst.height);
+    for (int y = 0; y < dst.height; y++) {
+        int y0 = (std::min)(2 * y, src.height - 1), y1 = (std::min)(2 * y + 1, src.height - 1);
+        for (int x = 0; x < dst.width; x++) {
+            int x0 = (std::min)(2 * x, src.width - 1), x1 = (std::min)(2 * x + 1, src.width - 1);
+            uint32_t q[4] = { src.pixels[(size_t)y0 * src.width + x0], src.pixels[(size_t)y0 * src.width + x1],
+                src.pixels[(size_t)y1 * src.width + x0], src.pixels[(size_t)y1 * src.width + x1] };
+            uint32_t out = 0;
+            for (int shift = 0; shift < 32; shift += 8) {
+                uint32_t s = 2;
+                for (uint32_t v : q) s += (v >> shift) & 255;
+                out |= (s / 4) << shift;
+            }
+            dst.pixels[(size_t)y * dst.width + x] = out;
+        }
+    }
+}
+
+static std::atomic<int> g_Builds(0);
+
+static bool Build(const std::vector<uint8_t>& bytes, std::vector<Cache::Level>& levels) {
+    if (bytes.size() < 8) return false;
+    int w, h;
+    memcpy(&w, &bytes[0], 4);
+    memcpy(&h, &bytes[4], 4);
+    if (w <= 0 || h <= 0 || bytes.size() != 8 + (size_t)w * h * 4) return false;
+    g_Builds++;
+    levels.emplace_back();
+    levels.back().image.reset(new RasterImage());
+    RasterImage& base = *levels.back().image;
+    base.width = w;
+    base.height = h;
+    base.pixels.resize((size_t)w * h);
+    memcpy(base.pixels.data(), &bytes[8], base.pixels.size() * 4);
+    levels.back().width = w;
+    levels.back().height = h;
+    while ((std::max)(levels.back().width, levels.back().height) / 2 >= kMipMinSide) {
+        std::unique_ptr<RasterImage> half(new RasterImage());
+        Halve(*levels.back().image, *half);
+        levels.emplace_back();
+        levels.back().width = half->width;
+        levels.back().height = half->height;
+        levels.back().image = std::move(half);
+    }
+    return true;
+}
+
+static bool Dedupe() {
+    Cache cache;
+    std::vector<uint8_t> bytes = Encode(1024, 768, 1);
+    std::vector<uint32_t> ids;
+    for (int i = 0; i < 10; i++) ids.push_back(cache.Acquire("photo.png", std::vector<uint8_t>(bytes)));
+    // Тот же путь с другим содержимым и то же содержимое с другим путём — другие записи
+    uint32_t other = cache.Acquire("photo.png", Encode(1024, 768, 2));
+    uint32_t moved = cache.Acquire("copy/photo.png", std::vector<uint8_t>(bytes));
+    int before = g_Builds;
+    for (uint32_t id : ids) cache.Draw(id, 200, 150, Build, [](RasterImage&) {});
+    Cache::Stats s = cache.GetStats();
+    printf("вставок 10 + 2: записей %zu, ссылок %zu, раскодировано %d, файлы %.1f МБ, пирамиды %.1f МБ\n",
+        s.entries, s.references, g_Builds - before, s.encodedBytes / 1048576.0, s.decodedBytes / 1048576.0);
+    bool ok = s.entries == 3 && s.references == 12 && g_Builds - before == 1;
+    bool broken = !cache.Draw(cache.Acquire("bad.png", std::vector<uint8_t>(5)), 10, 10, Build, [](RasterImage&) {});
+    for (uint32_t id : ids) cache.Release(id);
+    cache.Release(other);
+    cache.Release(moved);
+    s = cache.GetStats();
+    ok = ok && broken && s.entries == 1 && s.encodedBytes == 5;
+    printf("  нечитаемая картинка не выводится, после освобождения записей %zu: %s\n", s.entries, ok ? "ok" : "ОШИБКА");
+    return ok;
+}
+
+// Средний цвет источника под каждым пикселем w x h — опорное уменьшение
+static std::vector<float> AreaAverage(const RasterImage& src, int w, int h) {
+    std::vector<float> out((size_t)w * h);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            int sx0 = x * src.width / w, sx1 = (x + 1) * src.width / w;
+            int sy0 = y * src.height / h, sy1 = (y + 1) * src.height / h;
+            double s = 0;
+            for (int sy = sy0; sy < sy1; sy++)
+                for (int sx = sx0; sx < sx1; sx++) s += src.pixels[(size_t)sy * src.width + sx] & 255;
+            out[(size_t)y * w + x] = (float)(s / ((sx1 - sx0) * (sy1 - sy0)));
+        }
+    return out;
+}
+
+static bool Downscale() {
+    const int kSide = 4096, kTarget = 256, kRuns = 20;
+    std::vector<Cache::Level> levels;
+    Build(Encode(kSide, kSide, 3), levels);
+    std::vector<float> ref = AreaAverage(*levels[0].image, kTarget, kTarget);
+    size_t picked = Cache::PickLevel(levels, kTarget, kTarget);
+    printf("картинка %dx%d в %dx%d, уровней %zu, выбран %zu (%dx%d)\n", kSide, kSide, kTarget, kTarget,
+        levels.size(), picked, levels[picked].width, levels[picked].height);
+    double errors[2];
+    size_t use[2] = { 0, picked };
+    for (int k = 0; k < 2; k++) {
+        std::vector<RasterImage> images(1);
+        std::swap(images[0], *levels[use[k]].image);
+        RasterImage frame;
+        frame.width = frame.height = kTarget;
+        frame.pixels.assign((size_t)kTarget * kTarget, 0xFFFFFFFFu);
+        RasterTarget t{ frame.pixels.data(), kTarget, kTarget, kTarget, 0 };
+        double t0 = Now();
+        for (int r = 0; r < kRuns; r++) {
+            SoftwareBackend backend(t, 1.0f, 0, 0, &images);
+            backend.Image(0, 0, 0, (float)kTarget, (float)kTarget);
+        }
+        double ms = (Now() - t0) * 1000 / kRuns;
+        double err = 0;
+        for (size_t i = 0; i < ref.size(); i++) err += fabs((double)(frame.pixels[i] & 255) - ref[i]);
+        errors[k] = err / ref.size();
+        printf("  %-14s %7.3f мс, среднее отклонение от усреднения %.1f уровня\n",
+            k ? "уровень пирамиды" : "полный размер", ms, errors[k]);
+        std::swap(images[0], *levels[use[k]].image);
+    }
+    bool ok = errors[1] < 8 && errors[1] < errors[0];
+    printf("  %s\n", ok ? "ok" : "ОШИБКА");
+    return ok;
+}
+
+static bool Evict() {
+    const int kImages = 24, kSide = 1024;
+    const size_t kBudget = (size_t)32 << 20;
+    Cache cache;
+    cache.SetBudget(kBudget);
+    std::vector<uint32_t> ids;
+    for (int i = 0; i < kImages; i++) ids.push_back(cache.Acquire("img" + std::to_string(i), Encode(kSide, kSide, 10 + i)));
+    int before = g_Builds;
+    size_t peak = 0;
+    bool ok = true;
+    // Вывод по кругу: рабочий набор больше бюджета, каждый круг строит заново
+    for (int round = 0; round < 2; round++)
+        for (uint32_t id : ids) {
+            ok = cache.Draw(id, kSide, kSide, Build, [](RasterImage&) {}) && ok;
+            peak = (std::max)(peak, cache.GetStats().decodedBytes);
+        }
+    // Малый рабочий набор укладывается в бюджет и больше не строится
+    int hot = g_Builds;
+    for (int round = 0; round < 10; round++)
+        for (int i = 0; i < 4; i++) cache.Draw(ids[i], 64, 64, Build, [](RasterImage&) {});
+    int hotBuilds = g_Builds - hot;
+    Cache::Stats s = cache.GetStats();
+    size_t one = (size_t)kSide * kSide * 4 * 4 / 3 + (size_t)kSide * 8;
+    printf("%d картинок %dx%d, бюджет %zu МБ: пик пирамид %.1f МБ, построено %d за 2 круга, "
+        "4 горячих за 10 кругов — %d\n", kImages, kSide, kSide, kBudget >> 20, peak / 1048576.0,
+        hot - before, hotBuilds);
+    ok = ok && peak <= kBudget + one && hotBuilds <= 4 && s.decodedBytes <= kBudget;
+
+    // Несколько потоков выводят вперемешку: без взаимных блокировок, бюджет соблюдается
+    std::vector<std::thread> threads;
+    std::atomic<size_t> drawn(0);
+    double t0 = Now();
+    for (int k = 0; k < 4; k++)
+        threads.emplace_back([&, k] {
+            std::mt19937 rng(k);
+            for (int i = 0; i < 200; i++) {
+                uint32_t id = ids[rng() % kImages];
+                float side = (float)(16 << (rng() % 7));
+                if (cache.Draw(id, side, side, Build, [](RasterImage& im) { volatile uint32_t p = im.pixels[0]; (void)p; })) drawn++;
+            }
+        });
+    for (auto& th : threads) th.join();
+    s = cache.GetStats();
+    printf("  4 потока, %zu выводов за %.0f мс, пирамиды %.1f МБ\n", drawn.load(), (Now() - t0) * 1000,
+        s.decodedBytes / 1048576.0);
+    ok = ok && drawn == 800 && s.decodedBytes <= kBudget + 4 * one;
+    for (uint32_t id : ids) cache.Release(id);
+    ok = ok && cache.GetStats().decodedBytes == 0;
+    printf("  %s\n", ok ? "ok" : "ОШИБКА");
+    return ok;
+}
+
+// Очередь пула стоит, пока не открыт шлюз: заказы гарантированно ещё не начаты
+struct Gate {
+    std::mutex m;
+    std::condition_variable cv;
+    bool open = false;
+    void Block(ThreadPool& pool) {
+        for (size_t i = 0; i < pool.WorkerCount(); i++)
+            pool.Submit([this] {
+                std::unique_lock<std::mutex> lock(m);
+                cv.wait(lock, [this] { return open; });
+            });
+    }
+    void Open() {
+        std::lock_guard<std::mutex> lock(m);
+        open = true;
+        cv.notify_all();
+    }
+};
+
+static bool Async() {
+    const int kImages = 8, kSide = 2048;
+    ThreadPool pool;
+    auto submit = [&pool](std::function<void()> job) { pool.Submit(std::move(job)); };
+    std::vector<std::vector<uint8_t>> files;
+    for (int i = 0; i < kImages; i++) files.push_back(Encode(kSide, kSide, 100 + i));
+    bool ok = true;
+
+    // По очереди в одном потоке
+    double serial;
+    {
+        Cache cache;
+        std::vector<uint32_t> ids;
+        for (int i = 0; i < kImages; i++) ids.push_back(cache.Acquire("a" + std::to_string(i), std::vector<uint8_t>(files[i])));
+        double t0 = Now();
+        for (uint32_t id : ids) cache.Draw(id, 100, 100, Build, [](RasterImage&) {});
+        serial = Now() - t0;
+    }
+
+    // Заказами: сразу заглушки, затем всё готово, о каждой пирамиде сообщено
+    Cache cache;
+    std::atomic<int> notified(0);
+    cache.SetOnDecoded([&](uint32_t) { notified++; });
+    std::vector<uint32_t> ids;
+    for (int i = 0; i < kImages; i++) ids.push_back(cache.Acquire("a" + std::to_string(i), std::vector<uint8_t>(files[i])));
+    Gate gate;
+    gate.Block(pool);
+    int pending = 0;
+    double t0 = Now();
+    for (uint32_t id : ids) {
+        cache.Request(id, submit, Build);
+        cache.Request(id, submit, Build); // повторный заказ ничего не добавляет
+        if (cache.TryDraw(id, 100, 100, [](RasterImage&) {}) == ImageStatus::Pending) pending++;
+    }
+    double queued = Now() - t0;
+    gate.Open();
+    cache.WaitForJobs();
+    double parallel = Now() - t0;
+    int drawn = 0;
+    for (uint32_t id : ids)
+        if (cache.TryDraw(id, 100, 100, [](RasterImage&) {}) == ImageStatus::Drawn) drawn++;
+    printf("%d картинок %dx%d: по очереди %.0f мс, заказами в пул из %zu потоков %.0f мс "
+        "(заказ всех — %.3f мс), заглушек %d, готово %d, уведомлений %d\n", kImages, kSide, kSide,
+        serial * 1000, pool.WorkerCount(), parallel * 1000, queued * 1000, pending, drawn, notified.load());
+    ok = pending == kImages && drawn == kImages && notified == kImages;
+
+    // Отмена: из четырёх заказов два отменены до начала, одна запись освобождена
+    Cache fresh;
+    std::vector<uint32_t> four;
+    for (int i = 0; i < 4; i++) four.push_back(fresh.Acquire("c" + std::to_string(i), std::vector<uint8_t>(files[i])));
+    Gate gate2;
+    gate2.Block(pool);
+    int before = g_Builds;
+    for (uint32_t id : four) fresh.Request(id, submit, Build);
+    fresh.Cancel(four[0]);
+    fresh.Cancel(four[1]);
+    fresh.Release(four[3]);
+    gate2.Open();
+    fresh.WaitForJobs();
+    int built = g_Builds - before;
+    ImageStatus s0 = fresh.TryDraw(four[0], 10, 10, [](RasterImage&) {});
+    ImageStatus s2 = fresh.TryDraw(four[2], 10, 10, [](RasterImage&) {});
+    bool cancelOk = built == 1 && s0 == ImageStatus::Pending && s2 == ImageStatus::Drawn && fresh.GetStats().entries == 3;
+
+    // Draw не ждёт очереди: заказ, который ещё не начался, строится на месте
+    Gate gate3;
+    gate3.Block(pool);
+    before = g_Builds;
+    fresh.Request(four[1], submit, Build);
+    bool drew = fresh.Draw(four[1], 10, 10, Build, [](RasterImage&) {});
+    gate3.Open();
+    fresh.WaitForJobs();
+    bool takeOver = drew && g_Builds - before == 1;
+    printf("  отмена: раскодировано %d из 4 заказов, Draw забирает заказ из очереди: %s\n", built, takeOver ? "да" : "нет");
+    ok = ok && cancelOk && takeOver;
+    for (size_t i = 0; i < 3; i++) fresh.Release(four[i]);
+    for (uint32_t id : ids) cache.Release(id);
+    printf("  %s\n", ok ? "ok" : "ОШИБКА");
+    return ok;
+}
+
+int main() {
+    bool ok = Dedupe();
+    ok = Downscale() && ok;
+    ok = Evict() && ok;
+    ok = Async() && ok;
+    return ok ? 0 : 1;
+}
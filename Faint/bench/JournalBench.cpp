@@ -0,0 +1,122 @@
+﻿// -------------------------------------------------------------------------
+// Цена журнала (Journal.h) для потока интерфейса и восстановление после
+// «сбоя» на сеансе из 50 000 штрихов со стиранием (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -pthread -I.. JournalBench.cpp -o journal_bench
+//   ./journal_bench [каталог журнала, с разделителем на конце]
+// append — время вызова Added/Replaced/Erased (то, что добавляется к
+// отпусканию кнопки мыши); запись на диск идёт в фоновом потоке. snapshot —
+// доля снимка на потоке интерфейса (копия сцены), сам снимок пишет поток
+// записи. Сбой — Close без Discard; восстановленная сцена сравнивается с живой.
+// -------------------------------------------------------------------------
+#include "Journal.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Живые фигуры в порядке отрисовки: тип и точки штрихов
+static std::vector<float> Fingerprint(const SceneStore& s) {
+    std::vector<float> out;
+    for (const SceneStore::Ref& r : s.order) {
+        if (r.kind == ShapeKind::Erased) continue;
+        out.push_back((float)r.kind);
+        if (r.kind != ShapeKind::Pen) continue;
+        const ScenePoint* p = s.strokes.Points(r.slot);
+        for (uint32_t k = 0; k < s.strokes.count[r.slot]; k++) {
+            out.push_back(p[k].X);
+            out.push_back(p[k].Y);
+        }
+    }
+    return out;
+}
+
+int main(int argc, char** argv) {
+    PathString dir = argc > 1 ? argv[1] : "./";
+    const size_t kStrokes = 50000;
+
+    auto noImages = [](uint32_t) { return DocumentImage(); };
+    auto noPath = [](uint32_t) { return std::string(); };
+    std::string error;
+    SceneStore scene;
+    SceneJournal journal;
+    if (!journal.Start(dir, scene, DocumentView(), noImages, error)) {
+        printf("start failed: %s\n", error.c_str());
+        return 1;
+    }
+
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> len(40, 400);
+    std::uniform_real_distribution<float> pos(-20000, 20000), step(-1.5f, 1.5f);
+    std::vector<ScenePoint> pts;
+    std::vector<double> times;
+    size_t snapshots = 0;
+    double snapshotTime = 0;
+    for (size_t s = 0; s < kStrokes; s++) {
+        pts.clear();
+        ScenePoint p{ pos(rng), pos(rng) };
+        for (int k = len(rng); k > 0; k--) {
+            p.X += 1 + step(rng);
+            p.Y += step(rng);
+            pts.push_back(p);
+        }
+        uint32_t id = scene.AddStroke(pts.data(), pts.size(), 0xFF000000, 2);
+        double t0 = Now();
+        journal.Added(scene, id, noPath);
+        times.push_back(Now() - t0);
+
+        // Каждый десятый штрих ластик режет или стирает одну из прежних фигур
+        if (s % 10 == 9) {
+            uint32_t victim = (uint32_t)(rng() % scene.Size());
+            if (scene.order[victim].kind == ShapeKind::Pen) {
+                t0 = Now();
+                if (rng() % 2) {
+                    size_t n = scene.strokes.count[scene.order[victim].slot] / 2;
+                    std::vector<ScenePoint> half(scene.strokes.Points(scene.order[victim].slot), scene.strokes.Points(scene.order[victim].slot) + n);
+                    scene.ReplaceStroke(victim, half.data(), half.size());
+                    journal.Replaced(scene, victim);
+                }
+                else {
+                    scene.Erase(victim);
+                    journal.Erased(victim);
+                }
+                times.push_back(Now() - t0);
+            }
+        }
+        if (journal.NeedsSnapshot()) {
+            t0 = Now();
+            journal.Snapshot(scene, SceneJournal::Stashes(), DocumentView(), noImages);
+            snapshotTime += Now() - t0;
+            snapshots++;
+        }
+        if (scene.NeedsCompact()) scene.Compact();
+    }
+    journal.Close(); // сбой: журнал и снимок остаются
+
+    SceneStore recovered;
+    double t0 = Now();
+    bool ok = SceneJournal::Recover(dir, recovered, [](const DocumentImage&) { return 0u; }, error);
+    double tRecover = Now() - t0;
+    bool same = ok && Fingerprint(recovered) == Fingerprint(scene);
+
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (double t : times) sum += t;
+    printf("%zu strokes, %zu changes journaled, %zu snapshots (%.1f ms each on the caller)\n", kStrokes, times.size(),
+        snapshots, snapshots ? snapshotTime / snapshots * 1e3 : 0.0);
+    printf("append   avg %.2f us, p99 %.2f us, max %.0f us\n", sum / times.size() * 1e6,
+        times[times.size() * 99 / 100] * 1e6, times.back() * 1e6);
+    printf("recover  %.0f ms, %zu shapes\n", tRecover * 1e3, recovered.Size() - recovered.Erased());
+    printf("results %s\n", same ? "match" : "MISMATCH");
+
+    recovered.Clear();
+    SceneJournal cleanup;
+    cleanup.Start(dir, SceneStore(), DocumentView(), noImages, error);
+    cleanup.Discard();
+    return same ? 0 : 1;
+}
@@ -0,0 +1,128 @@
+﻿// -------------------------------------------------------------------------
+// Три пути вычисления f(x) дают одно и то же (MathParser.h):
+//  - MathParser::Evaluate (разбор строки на каждое значение) — эталон;
+//  - MathParser::Compile + CompiledExpression::Evaluate — совпадение точное;
+//  - CompiledExpression::EvaluateBatch (полиномы SIMD) — с допуском
+//    kBatchTolerance относительно max(1, |y|).
+// Набор выражений: свёртка констант, унарный минус, степени с целым и
+// дробным показателем, края области: sqrt отрицательного (берётся модуль),
+// log от нуля и отрицательных, деление на 0 (остаётся делимое), полюса tan,
+// неизвестные функции (0). NaN совпадает только с NaN, бесконечности — с
+// такими же. Значения x — сетка с хвостом, не кратным блоку и полосам, и
+// особые точки (0, ±π/2, крошечные, огромные, inf, NaN). В конце — время
+// трёх путей (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -I.. ParserBench.cpp -o parser_bench
+// -------------------------------------------------------------------------
+#include "MathParser.h"
+
+#include <chrono>
+#include <cstdio>
+#include <limits>
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static const char* const kCorpus[] = {
+    // Свёртка констант
+    "2*3+4", "2^10", "(1+2)*(3+4)/7", "pi*2+e", "sin(pi/6)*2", "2*3*x", "x*2*3", "1/3*x+2^-1",
+    // Унарный минус
+    "-x", "--x", "-x^2", "-(x+1)*-2", "2*-x", "-sin(-x)", "-(-3)",
+    // Целый показатель: умножения; вне kMaxIntPow и дробный — pow
+    "x^2", "x^3", "x^-2", "x^0", "(x/100)^10", "(x/500)^64", "(x/500)^65", "2^(x/100)",
+    "x^0.5", "abs(x)^1.5", "x^(1/3)", "(x/100)^2.5", "(x/300)^(x/300)", "x^-0.5",
+    // Края области
+    "sqrt(x)", "sqrt(-x-1)", "log(x)", "ln(x-1)", "log(0)", "log(-x*x)", "log(x-x)",
+    "x/0", "1/(x-x)", "x/(x-1)", "(x+1)/(x*0)",
+    "tan(x)", "tan(pi/2)", "tan(x*pi/2)", "1/tan(x)",
+    "foo(x)", "foo(x)+x", "bar(x*2)*2+1", "sinh(x)-x",
+    // Смешанные и несбалансированные скобки
+    "sin(x/10)*50+x^2/100", "cos(x)*cos(x)+sin(x)*sin(x)", "log(abs(x)+1)*sin(x)", "(x+1", "x)*2",
+    "sqrt(x*x+1)-abs(x)", "cos(x/7)^3-sin(x/3)^2", "e^(-(x/200)^2)*100",
+};
+
+// Совпадение с учётом NaN и бесконечностей; tolerance — доля max(1, |y|)
+static bool Same(double a, double b, double tolerance) {
+    if (std::isnan(a) || std::isnan(b)) return std::isnan(a) && std::isnan(b);
+    if (std::isinf(a) || std::isinf(b)) return a == b;
+    return std::fabs(a - b) <= tolerance * (std::max)({ 1.0, std::fabs(a), std::fabs(b) });
+}
+
+const double kBatchTolerance = 1e-9;
+
+static volatile double g_Sink;
+
+int main() {
+    bool ok = true;
+
+    std::vector<double> xs;
+    for (int i = 0; i < 2741; i++) xs.push_back(-1000 + i * 0.7331);
+    const double specials[] = { 0.0, -0.0, 1, -1, 0.5, M_PI / 2, -M_PI / 2, 3 * M_PI / 2, M_PI, 1e-300, -1e-300,
+        1e6, -1e6, 1e10, 1e300, -1e300, std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(), std::numeric_limits<double>::quiet_NaN() };
+    for (double x : specials) xs.push_back(x);
+    size_t n = xs.size();
+
+    std::vector<double> tree(n), compiled(n), batch(n);
+    size_t values = 0, worstAt = 0;
+    double worst = 0;
+    const char* worstExpr = "";
+    for (const char* e : kCorpus) {
+        CompiledExpression p = MathParser::Compile(e);
+        for (size_t i = 0; i < n; i++) {
+            tree[i] = MathParser::Evaluate(e, xs[i]);
+            compiled[i] = p.Evaluate(xs[i]);
+        }
+        p.EvaluateBatch(xs.data(), batch.data(), n);
+
+        int bad = 0;
+        for (size_t i = 0; i < n; i++) {
+            bool exact = Same(tree[i], compiled[i], 0);
+            bool close = Same(compiled[i], batch[i], kBatchTolerance);
+            if ((!exact || !close) && bad++ < 3)
+                printf("  %-28s x = %-12g Evaluate %-14.17g Compile %-14.17g Batch %.17g\n", e, xs[i], tree[i], compiled[i], batch[i]);
+            if (std::isfinite(compiled[i]) && std::isfinite(batch[i])) {
+                double d = std::fabs(compiled[i] - batch[i]) / (std::max)({ 1.0, std::fabs(compiled[i]), std::fabs(batch[i]) });
+                if (d > worst) { worst = d; worstExpr = e; worstAt = i; }
+            }
+        }
+        if (bad) printf("%-28s расхождений: %d\n", e, bad);
+        ok = ok && bad == 0;
+        values += n;
+    }
+    printf("выражений %zu, значений %zu; худшее отклонение Batch %.2e (%s, x = %g)\n",
+        sizeof(kCorpus) / sizeof(kCorpus[0]), values, worst, worstExpr, xs[worstAt]);
+
+    // Пустая программа (не результат Compile): NaN обоими путями
+    CompiledExpression empty;
+    empty.EvaluateBatch(xs.data(), batch.data(), n);
+    bool emptyNan = std::isnan(empty.Evaluate(1));
+    for (size_t i = 0; i < n; i++) emptyNan = emptyNan && std::isnan(batch[i]);
+    printf("пустая программа: %s\n", emptyNan ? "NaN" : "не NaN");
+    ok = ok && emptyNan;
+
+    // Время трёх путей на всём наборе
+    double sink = 0, t0 = Now();
+    for (const char* e : kCorpus)
+        for (size_t i = 0; i < n; i++) sink += MathParser::Evaluate(e, xs[i]);
+    double tTree = Now() - t0;
+    std::vector<CompiledExpression> programs;
+    for (const char* e : kCorpus) programs.push_back(MathParser::Compile(e));
+    t0 = Now();
+    for (const CompiledExpression& p : programs)
+        for (size_t i = 0; i < n; i++) sink += p.Evaluate(xs[i]);
+    double tCompiled = Now() - t0;
+    t0 = Now();
+    for (const CompiledExpression& p : programs) {
+        p.EvaluateBatch(xs.data(), batch.data(), n);
+        sink += batch[n / 2];
+    }
+    double tBatch = Now() - t0;
+    g_Sink = sink;
+    printf("на значение: Evaluate %.1f нс, Compile %.1f нс, Batch %.1f нс\n",
+        tTree / values * 1e9, tCompiled / values * 1e9, tBatch / values * 1e9);
+
+    printf("%s\n", ok ? "ok" : "ОШИБКА");
+    return ok ? 0 : 1;
+}
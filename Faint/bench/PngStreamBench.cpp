@@ -0,0 +1,202 @@
+﻿// -------------------------------------------------------------------------
+// Потоковая запись PNG (PngStream.h):
+//  - deflate: куски DeflateEncoder, склеенные в один поток, разжимаются
+//    zlib байт в байт; размер против zlib уровня 6 на тех же данных;
+//  - вывод рисунка полосами в файл: время, размер, пик памяти процесса
+//    против полного изображения; файл читается libpng построчно и
+//    сверяется по Adler-32 строк с тем, что было нарисовано (Linux):
+//   g++ -O2 -std=c++14 -pthread -I.. PngStreamBench.cpp -o png_stream_bench -lpng -lz
+// -------------------------------------------------------------------------
+#include "PngStream.h"
+#include "SoftRaster.h"
+
+#include <png.h>
+#include <zlib.h>
+#include <sys/resource.h>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static double PeakMB() {
+    rusage u;
+    getrusage(RUSAGE_SELF, &u);
+    return u.ru_maxrss / 1024.0;
+}
+
+// data кусками по chunk байт -> один поток deflate; разжатие zlib
+static bool RoundTrip(const char* name, const std::vector<uint8_t>& data, size_t chunk) {
+    std::vector<uint8_t> packed;
+    double t0 = Now();
+    for (size_t at = 0; at < data.size(); at += chunk)
+        DeflateEncoder().Compress(data.data() + at, (std::min)(chunk, data.size() - at), packed);
+    DeflateEncoder::Finish(packed);
+    double t = Now() - t0;
+
+    std::vector<uint8_t> back(data.size() + 1);
+    z_stream z = {};
+    inflateInit2(&z, -15);
+    z.next_in = packed.data();
+    z.avail_in = (uInt)packed.size();
+    z.next_out = back.data();
+    z.avail_out = (uInt)back.size();
+    int rc = inflate(&z, Z_FINISH);
+    size_t got = z.total_out;
+    inflateEnd(&z);
+    bool ok = rc == Z_STREAM_END && got == data.size() && memcmp(back.data(), data.data(), got) == 0;
+
+    uLongf zlibSize = compressBound((uLong)data.size());
+    std::vector<uint8_t> ref(zlibSize);
+    double t1 = Now();
+    compress2(ref.data(), &zlibSize, data.data(), (uLong)data.size(), 6);
+    double tz = Now() - t1;
+    printf("%-10s %8.1f KB -> %8.1f KB (zlib 6: %8.1f KB), %6.1f MB/s (zlib %6.1f) %s\n", name,
+        data.size() / 1024.0, packed.size() / 1024.0, zlibSize / 1024.0,
+        data.size() / t / 1e6, data.size() / tz / 1e6, ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+static bool DeflateCases() {
+    std::mt19937 rng(1);
+    bool ok = true;
+    std::vector<uint8_t> zeros(3 << 20, 0);
+    ok = RoundTrip("zeros", zeros, 1 << 20) && ok;
+    std::vector<uint8_t> noise(1 << 20);
+    for (auto& b : noise) b = (uint8_t)rng();
+    ok = RoundTrip("noise", noise, 300000) && ok;
+    std::string text;
+    const char* words[] = { "точка ", "x ", "sin(x) ", "0.25 ", "рисунок ", "\n" };
+    while (text.size() < (2 << 20)) text += words[rng() % 6];
+    ok = RoundTrip("text", std::vector<uint8_t>(text.begin(), text.end()), 1 << 19) && ok;
+    // Отфильтрованные строки нарисованной сцены
+    SceneStore scene;
+    std::uniform_real_distribution<float> pos(0, 1000), unit(0, 1);
+    for (int k = 0; k < 300; k++)
+        scene.AddBox(k % 2 ? ShapeKind::Ellipse : ShapeKind::Star, pos(rng), pos(rng) * 0.6f, 20 + unit(rng) * 200, 20 + unit(rng) * 200,
+            0xFF000000u | (rng() & 0xFFFFFF), 1 + unit(rng) * 6);
+    std::vector<uint32_t> px((size_t)1000 * 600, 0xFFFFFFFFu);
+    RasterTarget t;
+    t.pixels = px.data();
+    t.width = 1000;
+    t.height = 600;
+    t.stride = 1000;
+    SoftwareBackend out(t, 1, 0, 0, nullptr);
+    DrawScene(out, scene);
+    PngBand band;
+    EncodePngBand(px.data(), 1000, 1000, 600, band);
+    ok = RoundTrip("drawing", band.filtered, band.filtered.size()) && ok;
+    return ok;
+}
+
+// Построчное чтение libpng, Adler-32 строк RGB в adler. Через setjmp здесь
+// не живёт ни одной локальной переменной: строка и сумма — у вызывающего.
+static bool ReadRows(png_structp rd, png_infop info, FILE* in, int height, std::vector<uint8_t>& row, uint32_t& adler) {
+    if (setjmp(png_jmpbuf(rd))) return false;
+    png_init_io(rd, in);
+    png_read_info(rd, info);
+    if (png_get_rowbytes(rd, info) != row.size()) return false;
+    for (int y = 0; y < height; y++) {
+        png_read_row(rd, row.data(), nullptr);
+        adler = Adler32(adler, row.data(), row.size());
+    }
+    png_read_end(rd, nullptr);
+    return true;
+}
+
+// Рисунок шириной 2000 x 1200 мира в файл с масштабом scale
+static bool Export(const SceneStore& scene, ThreadPool& pool, float scale, const char* path) {
+    const int rows = 128;
+    int width = (int)(2000 * scale), height = (int)(1200 * scale);
+    size_t bands = (size_t)((height + rows - 1) / rows);
+    std::vector<uint32_t> adlers(bands);
+    std::vector<uint64_t> sizes(bands);
+    FILE* f = fopen(path, "wb");
+    if (!f) return false;
+    double t0 = Now();
+    PngStream png;
+    bool ok = png.Begin(f, (uint32_t)width, (uint32_t)height, 96 * scale);
+    ok = ok && StreamBands(&pool, png, bands, 2 * (pool.WorkerCount() + 1), [&](size_t b, PngBand& band) {
+        RasterTarget t;
+        t.width = width;
+        t.top = (int)b * rows;
+        t.height = (std::min)(rows, height - t.top);
+        t.stride = width;
+        std::vector<uint32_t> px((size_t)width * t.height, 0xFFFFFFFFu);
+        t.pixels = px.data();
+        SoftwareBackend out(t, scale, 0, 0, nullptr);
+        DrawScene(out, scene);
+        EncodePngBand(px.data(), width, width, t.height, band);
+        // Сумма строк RGB без байта фильтра — для сверки с прочитанным
+        std::vector<uint8_t> rgb((size_t)width * 3);
+        uint32_t a = 1;
+        for (int y = 0; y < t.height; y++) {
+            for (int x = 0; x < width; x++) {
+                uint32_t p = px[(size_t)y * width + x];
+                rgb[x * 3] = (uint8_t)(p >> 16);
+                rgb[x * 3 + 1] = (uint8_t)(p >> 8);
+                rgb[x * 3 + 2] = (uint8_t)p;
+            }
+            a = Adler32(a, rgb.data(), rgb.size());
+        }
+        adlers[b] = a;
+        sizes[b] = (uint64_t)rgb.size() * t.height;
+    });
+    ok = png.End() && ok;
+    fclose(f);
+    double t = Now() - t0;
+    uint32_t drawn = 1;
+    for (size_t b = 0; b < bands; b++) drawn = AdlerCombine(drawn, adlers[b], sizes[b]);
+
+    // Чтение libpng построчно
+    FILE* in = fopen(path, "rb");
+    png_structp rd = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png_create_info_struct(rd);
+    std::vector<uint8_t> row((size_t)width * 3);
+    uint32_t read = 1;
+    bool decoded = ReadRows(rd, info, in, height, row, read) &&
+        png_get_image_width(rd, info) == (png_uint_32)width && png_get_image_height(rd, info) == (png_uint_32)height;
+    png_destroy_read_struct(&rd, &info, nullptr);
+    fclose(in);
+    ok = ok && decoded && read == drawn;
+
+    FILE* sz = fopen(path, "rb");
+    fseek(sz, 0, SEEK_END);
+    long bytes = ftell(sz);
+    fclose(sz);
+    printf("%6dx%-6d %7.2f s  %8.1f MB file  peak RSS %7.1f MB (full ARGB image %7.1f MB)  %s\n",
+        width, height, t, bytes / 1048576.0, PeakMB(), (double)width * height * 4 / 1048576.0, ok ? "ok" : "MISMATCH");
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : "png_stream_bench.png";
+    bool ok = DeflateCases();
+
+    SceneStore scene;
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> x(0, 2000), y(0, 1200), unit(0, 1);
+    for (int k = 0; k < 3000; k++) {
+        ScenePoint pts[24];
+        float px = x(rng), py = y(rng);
+        for (int i = 0; i < 24; i++) {
+            px += unit(rng) * 12 - 6;
+            py += unit(rng) * 12 - 6;
+            pts[i] = ScenePoint{ px, py };
+        }
+        scene.AddStroke(pts, 24, 0xFF000000u | (rng() & 0xFFFFFF), 1 + unit(rng) * 4);
+    }
+    for (int k = 0; k < 1000; k++)
+        scene.AddBox(k % 2 ? ShapeKind::Rect : ShapeKind::Ellipse, x(rng), y(rng), 10 + unit(rng) * 100, 10 + unit(rng) * 100,
+            0xFF000000u | (rng() & 0xFFFFFF), 1 + unit(rng) * 3);
+
+    ThreadPool pool;
+    for (float scale : { 1.0f, 4.0f, 10.0f }) ok = Export(scene, pool, scale, path) && ok;
+    remove(path);
+    printf("results %s\n", ok ? "match" : "MISMATCH");
+    return ok ? 0 : 1;
+}
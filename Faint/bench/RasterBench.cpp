@@ -0,0 +1,200 @@
+﻿// -------------------------------------------------------------------------
+// Программный растеризатор (SoftRaster.h):
+//  - точность покрытия CoverageRaster против опорного 16x16 сэмплирования на
+//    случайных многоугольниках, допуск по пикселю kCoverageTolerance;
+//  - время кадра 1920x1080 синтетической сцены одной полосой и полосами
+//    на всех ядрах (RenderBands);
+//  - --save файл / --compare файл: кадр сохраняется сырыми пикселями или
+//    сверяется с сохранённым — так векторная сборка сравнивается со
+//    скалярной (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -pthread -I.. RasterBench.cpp -o raster_bench
+//   g++ -O2 -std=c++14 -pthread -I.. -DFAINT_NO_SIMD RasterBench.cpp -o raster_bench_scalar
+//   ./raster_bench_scalar --save base.raw && ./raster_bench --compare base.raw
+// -------------------------------------------------------------------------
+#include "SoftRaster.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+
+// Наибольшее отклонение покрытия пикселя; опорное сэмплирование само
+// ошибается до 1/16 на ребре вдоль его сетки
+const float kCoverageTolerance = 1.0f / 16;
+// Наибольшая разница канала между кадрами: округление float зависит от
+// начала полосы и от порядка сложения в SSE
+const int kCompareTolerance = 8;
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Звёздчатый многоугольник без самопересечений вокруг (cx, cy)
+static std::vector<ScenePoint> RandomPolygon(std::mt19937& rng, float cx, float cy, float r) {
+    std::uniform_real_distribution<float> unit(0, 1);
+    int n = 3 + (int)(rng() % 12);
+    std::vector<ScenePoint> p;
+    double a = unit(rng) * 2 * M_PI;
+    for (int k = 0; k < n; k++) {
+        a += 2 * M_PI / n * (0.5 + unit(rng) * 0.5);
+        float rr = r * (0.2f + 0.8f * unit(rng));
+        p.push_back(ScenePoint{ cx + (float)cos(a) * rr, cy + (float)sin(a) * rr });
+    }
+    return p;
+}
+
+// Опорное покрытие пикселя (x, y): доля из 16x16 точек с ненулевым числом оборотов
+static float ReferenceCoverage(const std::vector<ScenePoint>& p, int x, int y) {
+    int inside = 0;
+    for (int sy = 0; sy < 16; sy++)
+        for (int sx = 0; sx < 16; sx++) {
+            float px = x + (sx + 0.5f) / 16, py = y + (sy + 0.5f) / 16;
+            int winding = 0;
+            for (size_t i = 0, j = p.size() - 1; i < p.size(); j = i++) {
+                const ScenePoint& a = p[j];
+                const ScenePoint& b = p[i];
+                if ((a.Y <= py) == (b.Y <= py)) continue;
+                float t = (py - a.Y) / (b.Y - a.Y);
+                if (a.X + t * (b.X - a.X) > px) winding += b.Y > a.Y ? 1 : -1;
+            }
+            if (winding) inside++;
+        }
+    return inside / 256.0f;
+}
+
+static bool CoverageAccuracy() {
+    const int size = 64;
+    std::mt19937 rng(3);
+    CoverageRaster raster;
+    raster.Reset(size, size);
+    std::vector<float> cov((size_t)size * size);
+    double maxErr = 0, sumErr = 0;
+    size_t pixels = 0;
+    for (int shape = 0; shape < 200; shape++) {
+        // Часть многоугольников выходит за края полосы
+        std::uniform_real_distribution<float> pos(-8, size + 8);
+        std::vector<ScenePoint> p = RandomPolygon(rng, pos(rng), pos(rng), 4 + (float)(rng() % 40));
+        raster.Contour(p.data(), p.size(), 0);
+        std::fill(cov.begin(), cov.end(), 0.0f);
+        raster.Sweep(0, 0, size, size, [&](int y, int x, const float* c, int n) {
+            memcpy(&cov[(size_t)y * size + x], c, n * sizeof(float));
+        });
+        for (int y = 0; y < size; y++)
+            for (int x = 0; x < size; x++) {
+                double err = fabs(cov[(size_t)y * size + x] - ReferenceCoverage(p, x, y));
+                maxErr = (std::max)(maxErr, err);
+                sumErr += err;
+                pixels++;
+            }
+    }
+    bool ok = maxErr <= kCoverageTolerance;
+    printf("coverage vs 16x16 reference: max error %.4f, mean %.5f (%s)\n",
+        maxErr, sumErr / pixels, ok ? "ok" : "OVER TOLERANCE");
+    return ok;
+}
+
+// Сцена всех видов фигур на 2000 x 1200 мира
+static void BuildScene(SceneStore& scene) {
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> x(0, 2000), y(0, 1200), unit(0, 1);
+    auto color = [&]() { return 0xFF000000u | (rng() & 0xFFFFFF); };
+    for (int k = 0; k < 4000; k++) {
+        ScenePoint pts[32];
+        float px = x(rng), py = y(rng);
+        for (int i = 0; i < 32; i++) {
+            px += unit(rng) * 12 - 6;
+            py += unit(rng) * 12 - 6;
+            pts[i] = ScenePoint{ px, py };
+        }
+        scene.AddStroke(pts, 32, color(), 1 + unit(rng) * 6);
+    }
+    const ShapeKind boxes[] = { ShapeKind::Rect, ShapeKind::Ellipse, ShapeKind::Triangle, ShapeKind::Star };
+    for (int k = 0; k < 2000; k++)
+        scene.AddBox(boxes[k % 4], x(rng), y(rng), 10 + unit(rng) * 120, 10 + unit(rng) * 120, color(), 1 + unit(rng) * 4);
+}
+
+// Кадр 1920 x 1080: весь мир с масштабом 0.9; pool == nullptr — одной полосой
+static double RenderFrame(const SceneStore& scene, ThreadPool* pool, std::vector<uint32_t>& pixels) {
+    const int width = 1920, height = 1080;
+    pixels.assign((size_t)width * height, 0xFFFFFFFFu);
+    RasterTarget image;
+    image.pixels = pixels.data();
+    image.width = width;
+    image.height = height;
+    image.stride = width;
+    double t0 = Now();
+    RenderBands(pool, image, pool ? 128 : height, 0.9f, 20, 0, nullptr, [&](SoftwareBackend& out) {
+        DrawScene(out, scene);
+    });
+    return Now() - t0;
+}
+
+// Наибольшая разница канала и доля отличающихся пикселей
+static bool Compare(const char* what, const std::vector<uint32_t>& base, const std::vector<uint32_t>& frame) {
+    int maxDiff = 0;
+    size_t differ = 0;
+    for (size_t i = 0; i < base.size(); i++) {
+        int d = 0;
+        for (int s = 0; s < 32; s += 8) d = (std::max)(d, abs((int)((base[i] >> s) & 255) - (int)((frame[i] >> s) & 255)));
+        maxDiff = (std::max)(maxDiff, d);
+        if (d) differ++;
+    }
+    bool ok = maxDiff <= kCompareTolerance;
+    printf("vs %s: max channel difference %d, %.3f%% pixels differ (%s)\n",
+        what, maxDiff, 100.0 * differ / base.size(), ok ? "ok" : "OVER TOLERANCE");
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    const char* save = nullptr;
+    const char* compare = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!strcmp(argv[i], "--save")) save = argv[i + 1];
+        else if (!strcmp(argv[i], "--compare")) compare = argv[i + 1];
+    }
+#ifdef FAINT_RASTER_SSE2
+    printf("build: SSE2\n");
+#else
+    printf("build: scalar\n");
+#endif
+    bool ok = CoverageAccuracy();
+
+    SceneStore scene;
+    BuildScene(scene);
+    unsigned threads = (std::max)(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(threads > 1 ? threads - 1 : 1);
+    std::vector<uint32_t> single, banded;
+    double best1 = 1e9, bestN = 1e9;
+    for (int rep = 0; rep < 5; rep++) {
+        best1 = (std::min)(best1, RenderFrame(scene, nullptr, single));
+        bestN = (std::min)(bestN, RenderFrame(scene, &pool, banded));
+    }
+    printf("1920x1080, %u shapes: one band %.1f ms, bands on %u threads %.1f ms\n",
+        (unsigned)scene.Size(), best1 * 1e3, threads, bestN * 1e3);
+    ok = Compare("one band", single, banded) && ok;
+
+    if (save) {
+        FILE* f = fopen(save, "wb");
+        ok = f && fwrite(single.data(), sizeof(uint32_t), single.size(), f) == single.size() && ok;
+        if (f) fclose(f);
+        printf("saved %s\n", save);
+    }
+    if (compare) {
+        std::vector<uint32_t> base(single.size());
+        FILE* f = fopen(compare, "rb");
+        if (!f || fread(base.data(), sizeof(uint32_t), base.size(), f) != base.size()) {
+            printf("cannot read %s\n", compare);
+            ok = false;
+        }
+        else {
+            ok = Compare(compare, base, single) && ok;
+        }
+        if (f) fclose(f);
+    }
+    printf("results %s\n", ok ? "match" : "MISMATCH");
+    return ok ? 0 : 1;
+}
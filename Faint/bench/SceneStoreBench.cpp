@@ -0,0 +1,151 @@
+﻿// -------------------------------------------------------------------------
+// Сравнение SceneStore с прежним устройством сцены (vector<Shape*>,
+// виртуальные Draw/GetBounds, точки штриха в собственном векторе) на
+// 1 000 000 примитивов (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -pthread -I.. SceneStoreBench.cpp -o scene_bench
+// «Отрисовка» здесь — обход геометрии в порядке слоёв с накоплением суммы,
+// то есть та же работа с памятью, что у SceneRenderer, без GDI+.
+// -------------------------------------------------------------------------
+#include "SceneStore.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Прежняя раскладка: отдельное выделение на фигуру, данные за указателем
+namespace legacy {
+struct Shape {
+    uint32_t color;
+    float width;
+    Shape(uint32_t c, float w) : color(c), width(w) {}
+    virtual ~Shape() {}
+    virtual double Draw() const = 0;
+    virtual BoundsF GetBounds() const = 0;
+};
+struct PenShape : Shape {
+    std::vector<ScenePoint> points;
+    PenShape(uint32_t c, float w) : Shape(c, w) {}
+    double Draw() const override {
+        double s = 0;
+        for (auto& p : points) s += p.X + p.Y;
+        return s + color + width;
+    }
+    BoundsF GetBounds() const override { return StrokeSpanBounds(points.data(), points.size(), 0, points.size(), width); }
+};
+struct BoxShape : Shape {
+    float x, y, w, h;
+    BoxShape(float bx, float by, float bw, float bh, uint32_t c, float sw) : Shape(c, sw), x(bx), y(by), w(bw), h(bh) {}
+    double Draw() const override { return x + y + w + h + color + width; }
+    BoundsF GetBounds() const override {
+        BoundsF b{ x, y, x + w, y + h };
+        b.Inflate(width * 0.75f);
+        return b;
+    }
+};
+}
+
+static double DrawStore(const SceneStore& s) {
+    const BoxArray* boxes[] = { nullptr, nullptr, &s.rects, &s.ellipses, &s.triangles, &s.stars, &s.images };
+    double sum = 0;
+    for (const SceneStore::Ref& r : s.order) {
+        size_t i = r.slot;
+        if (r.kind == ShapeKind::Pen) {
+            const ScenePoint* p = s.strokes.Points(i);
+            double t = 0;
+            for (uint32_t k = 0, n = s.strokes.count[i]; k < n; k++) t += p[k].X + p[k].Y;
+            sum += t + s.strokes.color[i] + s.strokes.stroke[i];
+        }
+        else {
+            const BoxArray& a = *boxes[(int)r.kind];
+            sum += a.x[i] + a.y[i] + a.w[i] + a.h[i] + a.color[i] + a.stroke[i];
+        }
+    }
+    return sum;
+}
+
+int main() {
+    const size_t kShapes = 1000000;
+    const int kStrokePoints = 16; // короткие штрихи после упрощения
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> pos(-50000, 50000), size(1, 200);
+    struct Spec { bool pen; float x, y, w, h; };
+    std::vector<Spec> specs(kShapes);
+    for (auto& sp : specs) sp = Spec{ rng() % 2 == 0, pos(rng), pos(rng), size(rng), size(rng) };
+
+    // --- Прежняя раскладка
+    double t0 = Now();
+    std::vector<legacy::Shape*> shapes;
+    for (auto& sp : specs) {
+        if (sp.pen) {
+            auto* p = new legacy::PenShape(0xFF000000, 2);
+            for (int k = 0; k < kStrokePoints; k++) p->points.push_back(ScenePoint{ sp.x + k, sp.y + k * 0.5f });
+            shapes.push_back(p);
+        }
+        else {
+            shapes.push_back(new legacy::BoxShape(sp.x, sp.y, sp.w, sp.h, 0xFF000000, 2));
+        }
+    }
+    double lBuild = Now() - t0;
+
+    t0 = Now();
+    double lSum = 0;
+    for (auto* s : shapes) lSum += s->Draw();
+    double lDraw = Now() - t0;
+
+    t0 = Now();
+    std::vector<BoundsF> lBounds(shapes.size());
+    for (size_t i = 0; i < shapes.size(); i++) lBounds[i] = shapes[i]->GetBounds();
+    double lBoundsT = Now() - t0;
+
+    t0 = Now();
+    for (auto* s : shapes) delete s;
+    shapes.clear();
+    double lClear = Now() - t0;
+
+    // --- SceneStore
+    t0 = Now();
+    SceneStore store;
+    std::vector<ScenePoint> pts(kStrokePoints);
+    for (auto& sp : specs) {
+        if (sp.pen) {
+            for (int k = 0; k < kStrokePoints; k++) pts[k] = ScenePoint{ sp.x + k, sp.y + k * 0.5f };
+            store.AddStroke(pts.data(), pts.size(), 0xFF000000, 2);
+        }
+        else {
+            store.AddBox(ShapeKind::Rect, sp.x, sp.y, sp.w, sp.h, 0xFF000000, 2);
+        }
+    }
+    double sBuild = Now() - t0;
+
+    t0 = Now();
+    double sSum = DrawStore(store);
+    double sDraw = Now() - t0;
+
+    t0 = Now();
+    std::vector<BoundsF> sBounds;
+    store.AllBounds(sBounds);
+    double sBoundsT = Now() - t0;
+
+    bool same = lSum == sSum && sBounds.size() == lBounds.size();
+    for (size_t i = 0; same && i < sBounds.size(); i++)
+        same = sBounds[i].minX == lBounds[i].minX && sBounds[i].maxY == lBounds[i].maxY;
+
+    t0 = Now();
+    store.Clear();
+    double sClear = Now() - t0;
+
+    printf("%zu shapes (half strokes of %d points)\n", kShapes, kStrokePoints);
+    printf("            legacy     SceneStore\n");
+    printf("build   %9.1f ms %9.1f ms\n", lBuild * 1e3, sBuild * 1e3);
+    printf("draw    %9.1f ms %9.1f ms\n", lDraw * 1e3, sDraw * 1e3);
+    printf("bounds  %9.1f ms %9.1f ms\n", lBoundsT * 1e3, sBoundsT * 1e3);
+    printf("clear   %9.1f ms %9.1f ms\n", lClear * 1e3, sClear * 1e3);
+    printf("results %s\n", same ? "match" : "MISMATCH");
+    return same ? 0 : 1;
+}
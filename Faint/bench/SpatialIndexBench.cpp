@@ -0,0 +1,88 @@
+﻿// -------------------------------------------------------------------------
+// Замер SpatialIndex на 100 000 фигур (Linux/MSVC, без Win32):
+//   g++ -O2 -std=c++14 -I.. SpatialIndexBench.cpp -o spatial_bench
+// Проверяет, что запрос совпадает с полным перебором, и печатает время
+// вставки и запросов для окна при разных масштабах.
+// -------------------------------------------------------------------------
+#include "SpatialIndex.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+int main() {
+    const size_t kShapes = 100000;
+    const float kWorld = 200000.0f;
+
+    std::mt19937 rng(12345);
+    std::uniform_real_distribution<float> pos(-kWorld / 2, kWorld / 2);
+    std::exponential_distribution<float> size(1.0f / 60.0f);
+
+    std::vector<BoundsF> boxes(kShapes);
+    for (auto& b : boxes) {
+        float x = pos(rng), y = pos(rng);
+        float w = size(rng), h = size(rng);
+        b = BoundsF{ x, y, x + w, y + h };
+    }
+    // Пара «бесконечных» фигур, как графики функций без ограничения
+    boxes[10] = BoundsF{ -50000, -INFINITY, 50000, INFINITY };
+    boxes[20] = BoundsF::Everything();
+
+    SpatialIndex index;
+    double t0 = Now();
+    for (size_t i = 0; i < kShapes; i++) index.Insert((SpatialIndex::Id)i, boxes[i]);
+    double tInsert = Now() - t0;
+    printf("insert %zu: %.2f ms\n", kShapes, tInsert * 1e3);
+
+    // Окно 1920x1080 при масштабах 0.1 .. 50
+    const float zooms[] = { 0.1f, 1.0f, 10.0f, 50.0f };
+    std::vector<SpatialIndex::Id> hits, naive;
+    for (float z : zooms) {
+        const int kQueries = 1000;
+        size_t total = 0;
+        bool ok = true;
+        std::uniform_real_distribution<float> center(-kWorld / 2, kWorld / 2);
+        std::vector<BoundsF> views(kQueries);
+        for (auto& v : views) {
+            float cx = center(rng), cy = center(rng);
+            float hw = 960 / z, hh = 540 / z;
+            v = BoundsF{ cx - hw, cy - hh, cx + hw, cy + hh };
+        }
+
+        t0 = Now();
+        for (auto& v : views) {
+            index.Query(v, hits);
+            total += hits.size();
+        }
+        double tQuery = (Now() - t0) / kQueries;
+
+        // Сверка с полным перебором на части запросов
+        for (int q = 0; q < kQueries; q += 50) {
+            index.Query(views[q], hits);
+            naive.clear();
+            for (size_t i = 0; i < kShapes; i++)
+                if (boxes[i].Intersects(views[q])) naive.push_back((SpatialIndex::Id)i);
+            if (hits != naive) ok = false;
+        }
+
+        t0 = Now();
+        size_t scanned = 0;
+        for (int q = 0; q < 100; q++)
+            for (size_t i = 0; i < kShapes; i++) scanned += boxes[i].Intersects(views[q]);
+        double tScan = (Now() - t0) / 100;
+
+        printf("zoom %5.1f: query %8.1f us, full scan %8.1f us (%zu), avg hits %.1f, %s\n",
+            z, tQuery * 1e6, tScan * 1e6, scanned, (double)total / kQueries, ok ? "ok" : "MISMATCH");
+        if (!ok) return 1;
+    }
+
+    t0 = Now();
+    for (size_t i = 0; i < kShapes; i += 2) index.Remove((SpatialIndex::Id)i);
+    printf("remove %zu: %.2f ms, left %zu\n", kShapes / 2, (Now() - t0) * 1e3, index.Size());
+    return 0;
+}
@@ -0,0 +1,177 @@
+﻿// -------------------------------------------------------------------------
+// Огромные картинки тайлами (TiledImage.h):
+//  - запись хранилища картинки 24000x16000, поданной полосами по 64
+//    строки: время, размер файла, пик памяти процесса против полной
+//    картинки в памяти;
+//  - сверка: тайлы уровня 0 с исходными пикселями, каждый уровень с
+//    усреднением 2x2 предыдущего (выборочно);
+//  - просмотр окном 1920x1080 с панорамированием и масштабом: тайлов на
+//    кадр, тайлов в памяти при бюджете, время кадра, память процесса:
+//    своя (тайлы) и страницы отображённого файла (Linux, без Win32):
+//   g++ -O2 -std=c++14 -pthread -I.. TiledImageBench.cpp -o tiled_image_bench
+//   ./tiled_image_bench [каталог для хранилища]
+// -------------------------------------------------------------------------
+#include "TiledImage.h"
+
+#include <sys/resource.h>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+
+static double Now() {
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static double PeakMB() {
+    rusage u;
+    getrusage(RUSAGE_SELF, &u);
+    return u.ru_maxrss / 1024.0;
+}
+
+// Пиксель «снимка»: плавный рельеф и мелкая сетка, непрозрачный
+static uint32_t Pixel(uint32_t x, uint32_t y) {
+    uint32_t r = (x * 255 / 24000) & 255, g = (y * 255 / 16000) & 255;
+    uint32_t b = ((x / 7) ^ (y / 5)) & 255;
+    return 0xFF000000u | r << 16 | g << 8 | b;
+}
+
+// Текущая память процесса, МБ: своя и страницы файлов (/proc/self/status)
+static void Rss(double& anon, double& file) {
+    anon = file = 0;
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f) return;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        long kb;
+        if (sscanf(line, "RssAnon: %ld", &kb) == 1) anon = kb / 1024.0;
+        if (sscanf(line, "RssFile: %ld", &kb) == 1) file = kb / 1024.0;
+    }
+    fclose(f);
+}
+
+static uint32_t Average4(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+        out |= ((((a >> shift) & 255) + ((b >> shift) & 255) + ((c >> shift) & 255) + ((d >> shift) & 255) + 2) >> 2) << shift;
+    return out;
+}
+
+// Пиксель (x, y) уровня level из хранилища
+static uint32_t At(const TiledImage& im, int level, uint32_t x, uint32_t y) {
+    return im.Tile(level, x / kImageTileSize, y / kImageTileSize)[(y % kImageTileSize) * kImageTileSize + x % kImageTileSize];
+}
+
+int main(int argc, char** argv) {
+    const uint32_t kW = 24000, kH = 16000, kBand = 64;
+    std::string dir = argc > 1 ? argv[1] : ".";
+    std::string path = dir + "/bench.ftiles";
+    bool ok = true;
+
+    // Запись
+    double t0 = Now();
+    {
+        TiledImageWriter w;
+        ok = w.Begin(path.c_str(), kW, kH);
+        std::vector<uint32_t> rows((size_t)kW * kBand);
+        for (uint32_t y = 0; y < kH && ok; y += kBand) {
+            uint32_t n = (std::min)(kBand, kH - y);
+            for (uint32_t r = 0; r < n; r++)
+                for (uint32_t x = 0; x < kW; x++) rows[(size_t)r * kW + x] = Pixel(x, y + r);
+            ok = w.Rows(rows.data(), kW, n);
+        }
+        ok = w.Finish() && ok;
+    }
+    double written = Now() - t0;
+    TiledImage im;
+    ok = ok && im.Open(path.c_str());
+    if (!ok) {
+        printf("хранилище не записано: %s\n", path.c_str());
+        return 1;
+    }
+    FILE* f = fopen(path.c_str(), "rb");
+    fseeko(f, 0, SEEK_END);
+    double fileMB = ftello(f) / 1048576.0;
+    fclose(f);
+    printf("запись %ux%u: %.1f с, файл %.0f МБ, уровней %d, пик памяти %.0f МБ (картинка целиком — %.0f МБ)\n",
+        kW, kH, written, fileMB, im.Levels(), PeakMB(), (double)kW * kH * 4 / 1048576.0);
+
+    // Сверка
+    std::mt19937 rng(7);
+    size_t bad = 0;
+    for (int i = 0; i < 200000; i++) {
+        uint32_t x = rng() % kW, y = rng() % kH;
+        if (At(im, 0, x, y) != Pixel(x, y)) bad++;
+    }
+    for (int l = 1; l < im.Levels(); l++) {
+        const tiledimg::Level& up = im.Level(l - 1);
+        const tiledimg::Level& lv = im.Level(l);
+        for (int i = 0; i < 20000; i++) {
+            uint32_t x = rng() % lv.width, y = rng() % lv.height;
+            uint32_t x1 = (std::min)(2 * x + 1, up.width - 1), y1 = (std::min)(2 * y + 1, up.height - 1);
+            uint32_t want = Average4(At(im, l - 1, 2 * x, 2 * y), At(im, l - 1, x1, 2 * y), At(im, l - 1, 2 * x, y1), At(im, l - 1, x1, y1));
+            if (At(im, l, x, y) != want) bad++;
+        }
+        // Прозрачное дополнение крайних тайлов
+        if (lv.width % kImageTileSize && At(im, l, lv.width, 0) != 0) bad++;
+    }
+    printf("сверка пикселей: расхождений %zu\n", bad);
+    ok = bad == 0;
+
+    // Просмотр: окно 1920x1080 проходит по картинке на трёх масштабах.
+    // Хранилище открывается заново: сверка затронула все страницы отображения.
+    ok = im.Open(path.c_str()) && ok;
+    double anon0, file0;
+    Rss(anon0, file0);
+    typedef std::vector<uint32_t> Tile;
+    TiledTileCache<Tile> cache;
+    const size_t kBudget = (size_t)64 << 20;
+    cache.SetBudget(kBudget);
+    const float kViewW = 1920, kViewH = 1080;
+    const float zooms[] = { 1.0f, 0.25f, 0.05f };
+    volatile uint32_t sink = 0;
+    for (float zoom : zooms) {
+        int level = im.PickLevel(kW * zoom, kH * zoom);
+        const tiledimg::Level& lv = im.Level(level);
+        double scale = (double)lv.width / kW; // пикселей уровня на пиксель картинки
+        size_t frames = 0, tiles = 0, peakTiles = 0, loadsBefore = cache.GetStats().loads;
+        double t = Now();
+        // Окно идёт по диагонали картинки из угла в угол, 51 кадр
+        for (float p = 0; p <= 1.0f; p += 0.02f) {
+            double cx = p * kW, cy = p * kH;
+            double vw = kViewW / zoom, vh = kViewH / zoom; // окно в пикселях картинки
+            double x0 = (std::max)(0.0, cx - vw / 2), y0 = (std::max)(0.0, cy - vh / 2);
+            double x1 = (std::min)((double)kW, cx + vw / 2), y1 = (std::min)((double)kH, cy + vh / 2);
+            uint32_t tx0 = (uint32_t)(x0 * scale) / kImageTileSize, ty0 = (uint32_t)(y0 * scale) / kImageTileSize;
+            uint32_t tx1 = (std::min)(lv.tilesX - 1, (uint32_t)(x1 * scale) / kImageTileSize);
+            uint32_t ty1 = (std::min)(lv.tilesY - 1, (uint32_t)(y1 * scale) / kImageTileSize);
+            for (uint32_t ty = ty0; ty <= ty1; ty++)
+                for (uint32_t tx = tx0; tx <= tx1; tx++) {
+                    cache.Draw(TiledTileKey{ 0, level, tx, ty },
+                        [&] {
+                            const uint32_t* src = im.Tile(level, tx, ty);
+                            return std::unique_ptr<Tile>(new Tile(src, src + kImageTileSize * kImageTileSize));
+                        },
+                        [&](Tile& tile) { sink = sink + tile[(size_t)(tx + ty) % tile.size()]; });
+                    tiles++;
+                }
+            frames++;
+            peakTiles = (std::max)(peakTiles, cache.GetStats().tiles);
+        }
+        double ms = (Now() - t) * 1000 / frames;
+        TiledTileCache<Tile>::Stats s = cache.GetStats();
+        printf("масштаб %.2f: уровень %d (%ux%u), кадров %zu, тайлов на кадр %.1f, прочитано %zu, "
+            "в памяти до %zu тайлов (%.0f МБ из %zu), кадр %.2f мс\n", zoom, level, lv.width, lv.height, frames,
+            (double)tiles / frames, s.loads - loadsBefore, peakTiles, s.bytes / 1048576.0, kBudget >> 20, ms);
+        ok = ok && s.bytes <= kBudget;
+    }
+    double anon, file;
+    Rss(anon, file);
+    printf("память процесса после просмотра: своя %.0f МБ (до просмотра %.0f), страницы хранилища %.0f МБ (до %.0f)\n",
+        anon, anon0, file, file0);
+    remove(path.c_str());
+    printf("%s\n", ok ? "ok" : "ОШИБКА");
+    return ok ? 0 : 1;
+}
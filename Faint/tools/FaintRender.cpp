@@ -0,0 +1,298 @@
+﻿// -------------------------------------------------------------------------
+// Пакетный вывод документов *.faint в PNG без окна и без GDI+ (Linux):
+//   g++ -O2 -std=c++14 -pthread -I.. FaintRender.cpp -o faint_render -lpng -ljpeg
+//   ./faint_render [параметры] рисунок.faint...
+// Параметры:
+//   -s ШxВ              размер изображения, по умолчанию 1920x1080
+//   --fit               вписать весь рисунок (по умолчанию)
+//   --view              вид, сохранённый в документе (масштаб и сдвиг окна)
+//   --transform М X Y   мир -> изображение: (x, y) * М + (X, Y)
+//   --dpi N             весь рисунок в натуральную величину при N точек на
+//                       дюйм (единица мира — пиксель при 96); размер по рисунку
+//   -o каталог          куда писать <имя>.png, по умолчанию рядом с документом
+//   -j N                потоков, по умолчанию по числу ядер: документы и
+//                       полосы строк одного документа рисуются параллельно
+// Картинки берутся из копий внутри документа, иначе по сохранённому пути.
+// PNG пишется полосами (PngStream.h): целиком изображение в памяти не держится.
+// -------------------------------------------------------------------------
+#include "Document.h"
+#include "SoftRaster.h"
+#include "PngStream.h"
+#include "ThreadPool.h"
+
+#include <png.h>
+#include <jpeglib.h>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+const int kBandRows = 128;         // полоса строк, которую рисует один проход по сцене
+const int kMaxSide = 1 << 20;      // больше — вероятно, ошибка в --dpi
+const float kDpiMargin = 2;        // поле вокруг рисунка при --dpi, пикселей
+
+enum class Fit { Scene, View, Transform, Dpi };
+
+struct Options {
+    int width = 1920, height = 1080;
+    Fit fit = Fit::Scene;
+    float zoom = 1, offsetX = 0, offsetY = 0;
+    double dpi = 0;
+    std::string outDir;
+    unsigned jobs = 0;
+    std::vector<std::string> files;
+};
+
+static void Premultiply(RasterImage& im) {
+    for (uint32_t& p : im.pixels) {
+        uint32_t a = p >> 24;
+        if (a == 255) continue;
+        uint32_t out = a << 24;
+        for (int s = 0; s < 24; s += 8) out |= (((p >> s) & 255) * a + 127) / 255 << s;
+        p = out;
+    }
+}
+
+static bool DecodePng(const uint8_t* data, size_t size, RasterImage& out) {
+    png_image im;
+    memset(&im, 0, sizeof(im));
+    im.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&im, data, size)) return false;
+    im.format = PNG_FORMAT_BGRA; // в памяти B, G, R, A — это uint32_t ARGB
+    out.width = (int)im.width;
+    out.height = (int)im.height;
+    out.pixels.resize((size_t)im.width * im.height);
+    if (!png_image_finish_read(&im, nullptr, out.pixels.data(), 0, nullptr)) {
+        png_image_free(&im);
+        return false;
+    }
+    Premultiply(out);
+    return true;
+}
+
+struct JpegError {
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+};
+
+static bool DecodeJpeg(const uint8_t* data, size_t size, RasterImage& out) {
+    jpeg_decompress_struct info;
+    JpegError err;
+    std::vector<uint8_t> row;
+    info.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = [](j_common_ptr c) { longjmp(reinterpret_cast<JpegError*>(c->err)->jump, 1); };
+    if (setjmp(err.jump)) {
+        jpeg_destroy_decompress(&info);
+        return false;
+    }
+    jpeg_create_decompress(&info);
+    jpeg_mem_src(&info, const_cast<uint8_t*>(data), (unsigned long)size);
+    jpeg_read_header(&info, TRUE);
+    info.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&info);
+    out.width = (int)info.output_width;
+    out.height = (int)info.output_height;
+    out.pixels.resize((size_t)out.width * out.height);
+    row.resize((size_t)out.width * 3);
+    while (info.output_scanline < info.output_height) {
+        uint8_t* rows[] = { row.data() };
+        uint32_t* dst = &out.pixels[(size_t)info.output_scanline * out.width];
+        jpeg_read_scanlines(&info, rows, 1);
+        for (int x = 0; x < out.width; x++)
+            dst[x] = 0xFF000000u | (uint32_t)row[x * 3] << 16 | (uint32_t)row[x * 3 + 1] << 8 | row[x * 3 + 2];
+    }
+    jpeg_finish_decompress(&info);
+    jpeg_destroy_decompress(&info);
+    return true;
+}
+
+static bool ReadFile(const std::string& path, std::vector<uint8_t>& bytes) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    uint8_t buf[65536];
+    size_t n;
+    bytes.clear();
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) bytes.insert(bytes.end(), buf, buf + n);
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+// Картинка документа; не удалось прочитать — пустая запись (серый прямоугольник)
+static uint32_t AddImage(std::vector<RasterImage>& table, const DocumentImage& src) {
+    std::vector<uint8_t> file;
+    const uint8_t* data = src.data;
+    size_t size = src.size;
+    if (!data && ReadFile(src.path, file)) {
+        data = file.data();
+        size = file.size();
+    }
+    table.emplace_back();
+    RasterImage& im = table.back();
+    bool ok = false;
+    if (data && size >= 8 && memcmp(data, "\x89PNG", 4) == 0) ok = DecodePng(data, size, im);
+    else if (data && size >= 2 && data[0] == 0xFF && data[1] == 0xD8) ok = DecodeJpeg(data, size, im);
+    if (!ok) im = RasterImage();
+    return (uint32_t)(table.size() - 1);
+}
+
+static std::string OutputPath(const Options& opt, const std::string& file) {
+    size_t slash = file.find_last_of('/');
+    std::string dir = slash == std::string::npos ? std::string() : file.substr(0, slash + 1);
+    std::string name = slash == std::string::npos ? file : file.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != std::string::npos && dot > 0) name.resize(dot);
+    if (!opt.outDir.empty()) dir = opt.outDir + "/";
+    return dir + name + ".png";
+}
+
+static bool RenderFile(const Options& opt, const std::string& file, ThreadPool* pool, std::string& error) {
+    SceneStore scene;
+    std::vector<BoundsF> bounds;
+    DocumentView view;
+    std::vector<RasterImage> images;
+    if (!LoadDocument(file.c_str(), scene, bounds, view,
+        [&](const DocumentImage& im) { return AddImage(images, im); }, error)) return false;
+
+    SpatialIndex index;
+    for (uint32_t id = 0; id < (uint32_t)bounds.size(); id++)
+        if (scene.order[id].kind != ShapeKind::Erased) index.Insert(id, bounds[id]);
+
+    int width = opt.width, height = opt.height;
+    float zoom = opt.zoom, ox = opt.offsetX, oy = opt.offsetY;
+    if (opt.fit == Fit::Dpi) {
+        BoundsF b = DrawingExtent(scene);
+        if (!(b.minX <= b.maxX)) b = BoundsF{ 0, 0, 0, 0 };
+        zoom = (float)(opt.dpi / 96);
+        double w = ceil((b.maxX - b.minX) * (double)zoom + 2 * kDpiMargin);
+        double h = ceil((b.maxY - b.minY) * (double)zoom + 2 * kDpiMargin);
+        if (w > kMaxSide || h > kMaxSide) {
+            error = "слишком большое изображение: " + std::to_string((long long)w) + "x" + std::to_string((long long)h);
+            return false;
+        }
+        width = (int)w;
+        height = (int)h;
+        ox = kDpiMargin - b.minX * zoom;
+        oy = kDpiMargin - b.minY * zoom;
+    }
+    else if (opt.fit == Fit::View) {
+        zoom = view.zoom;
+        ox = view.offsetX;
+        oy = view.offsetY;
+    }
+    else if (opt.fit == Fit::Scene) {
+        BoundsF b = DrawingExtent(scene);
+        zoom = 1;
+        float cx = 0, cy = 0;
+        if (b.minX <= b.maxX) {
+            float w = (std::max)(b.maxX - b.minX, 1.0f), h = (std::max)(b.maxY - b.minY, 1.0f);
+            zoom = 0.95f * (std::min)(opt.width / w, opt.height / h);
+            cx = (b.minX + b.maxX) / 2;
+            cy = (b.minY + b.maxY) / 2;
+        }
+        ox = opt.width / 2.0f - cx * zoom;
+        oy = opt.height / 2.0f - cy * zoom;
+    }
+
+    std::string path = OutputPath(opt, file);
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) {
+        error = "не удалось создать " + path;
+        return false;
+    }
+    PngStream png;
+    bool ok = png.Begin(f, (uint32_t)width, (uint32_t)height, opt.dpi);
+    std::mutex indexMutex; // Query пишет метки посещения
+    size_t bands = (size_t)((height + kBandRows - 1) / kBandRows);
+    size_t window = 2 * ((pool ? pool->WorkerCount() : 0) + 1);
+    ok = ok && StreamBands(pool, png, bands, window, [&](size_t b, PngBand& band) {
+        int top = (int)b * kBandRows;
+        RasterTarget t;
+        t.width = width;
+        t.height = (std::min)(kBandRows, height - top);
+        t.stride = width;
+        t.top = top;
+        std::vector<uint32_t> pixels((size_t)t.width * t.height, 0xFFFFFFFFu);
+        t.pixels = pixels.data();
+        SoftwareBackend out(t, zoom, ox, oy, &images);
+        std::vector<SpatialIndex::Id> ids;
+        {
+            std::lock_guard<std::mutex> lock(indexMutex);
+            index.Query(out.VisibleBounds(), ids);
+        }
+        for (SpatialIndex::Id id : ids) DrawShape(out, scene, id);
+        EncodePngBand(pixels.data(), t.stride, t.width, t.height, band);
+    });
+    ok = ok && png.End();
+    ok = fclose(f) == 0 && ok;
+    if (!ok) {
+        error = "не удалось записать " + path;
+        return false;
+    }
+    return true;
+}
+
+static bool ParseArgs(int argc, char** argv, Options& opt) {
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        bool more = i + 1 < argc;
+        if (a == "-s" && more) {
+            if (sscanf(argv[++i], "%dx%d", &opt.width, &opt.height) != 2 || opt.width <= 0 || opt.height <= 0) return false;
+        }
+        else if (a == "--fit") opt.fit = Fit::Scene;
+        else if (a == "--view") opt.fit = Fit::View;
+        else if (a == "--transform" && i + 3 < argc) {
+            opt.fit = Fit::Transform;
+            opt.zoom = (float)atof(argv[++i]);
+            opt.offsetX = (float)atof(argv[++i]);
+            opt.offsetY = (float)atof(argv[++i]);
+            if (!(opt.zoom > 0)) return false;
+        }
+        else if (a == "--dpi" && more) {
+            opt.fit = Fit::Dpi;
+            opt.dpi = atof(argv[++i]);
+            if (!(opt.dpi > 0)) return false;
+        }
+        else if (a == "-o" && more) opt.outDir = argv[++i];
+        else if (a == "-j" && more) opt.jobs = (unsigned)atoi(argv[++i]);
+        else if (!a.empty() && a[0] == '-') return false;
+        else opt.files.push_back(a);
+    }
+    return !opt.files.empty();
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!ParseArgs(argc, argv, opt)) {
+        fprintf(stderr, "использование: %s [-s ШxВ] [--fit | --view | --transform М X Y | --dpi N] [-o каталог] [-j N] рисунок.faint...\n", argv[0]);
+        return 2;
+    }
+    unsigned jobs = opt.jobs ? opt.jobs : (std::max)(1u, std::thread::hardware_concurrency());
+    // Вызывающий поток работает наравне с пулом
+    std::unique_ptr<ThreadPool> pool;
+    if (jobs > 1) pool.reset(new ThreadPool(jobs - 1));
+
+    std::mutex report;
+    int failed = 0;
+    auto render = [&](size_t i) {
+        std::string error;
+        bool ok = RenderFile(opt, opt.files[i], pool.get(), error);
+        std::lock_guard<std::mutex> lock(report);
+        if (ok) printf("%s -> %s\n", opt.files[i].c_str(), OutputPath(opt, opt.files[i]).c_str());
+        else {
+            fprintf(stderr, "%s: %s\n", opt.files[i].c_str(), error.c_str());
+            failed++;
+        }
+    };
+    if (pool) {
+        pool->ParallelFor(opt.files.size(), render);
+    }
+    else {
+        for (size_t i = 0; i < opt.files.size(); i++) render(i);
+    }
+    return failed ? 1 : 0;
+}